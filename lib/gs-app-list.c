@@ -20,6 +20,7 @@
 #include "config.h"
 
 #include <glib.h>
+#include <string.h>
 
 #include "gs-app-private.h"
 #include "gs-app-list-private.h"
@@ -31,6 +32,17 @@ struct _GsAppList
 	GObject			 parent_instance;
 	GPtrArray		*array;
 	GMutex			 mutex;
+
+	/* number of times each app is in @array */
+	GHashTable		*apps_set;		/* (owned) GsApp : guint */
+
+	/* index of @array by unique ID, rebuilt on demand when it is %NULL or
+	 * the unique ID of an app in @array has changed since it was built */
+	GHashTable		*id_index;		/* (owned) (nullable) hash of ID part : GPtrArray of GsApp, in list order */
+	GPtrArray		*id_index_wildcards;	/* (owned) (nullable) apps with %GS_APP_QUIRK_IS_WILDCARD, in list order */
+	gboolean		 id_index_incomplete;	/* an app has a wildcard ID part, so lookups have to scan */
+	gint			 id_index_stale;	/* (atomic) set by the apps in @array, see gs_app_watch_unique_id() */
+
 	guint			 size_peak;
 	GsAppListFlags		 flags;
 	GsAppState		 state;
@@ -299,9 +311,121 @@ gs_app_list_set_size_peak (GsAppList *list,
 	list->size_peak = size_peak;
 }
 
+/* Hashes the ID part of @unique_id, which is the only part that
+ * as_utils_data_id_equal() can’t match against a wildcard in another unique
+ * ID, unless it is a wildcard itself. Unique IDs which aren’t data IDs are
+ * compared as plain strings, so those are hashed whole. */
+static guint
+gs_app_list_hash_unique_id (const gchar *unique_id, gboolean *is_wildcard)
+{
+	const gchar *start = unique_id;
+	const gchar *end = NULL;
+	guint sections = 0;
+	guint hash = 5381;
+
+	for (const gchar *p = unique_id; *p != '\0'; p++) {
+		if (*p != '/')
+			continue;
+		sections++;
+		if (sections == 3)
+			start = p + 1;
+		else if (sections == 4)
+			end = p;
+	}
+	if (sections != 4) {
+		start = unique_id;
+		end = unique_id + strlen (unique_id);
+	}
+
+	*is_wildcard = (sections == 4 && end - start == 1 && *start == '*');
+	for (const gchar *p = start; p < end; p++)
+		hash = (hash << 5) + hash + (guint) *p;
+	return hash;
+}
+
+static void
+gs_app_list_clear_id_index (GsAppList *list)
+{
+	g_clear_pointer (&list->id_index, g_hash_table_unref);
+	g_clear_pointer (&list->id_index_wildcards, g_ptr_array_unref);
+	list->id_index_incomplete = FALSE;
+}
+
+static void
+gs_app_list_id_index_add (GsAppList *list, GsApp *app)
+{
+	const gchar *unique_id = gs_app_get_unique_id (app);
+	GPtrArray *bucket;
+	gboolean is_wildcard;
+	guint hash;
+
+	if (gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD))
+		g_ptr_array_add (list->id_index_wildcards, app);
+	if (unique_id == NULL)
+		return;
+
+	hash = gs_app_list_hash_unique_id (unique_id, &is_wildcard);
+	if (is_wildcard) {
+		list->id_index_incomplete = TRUE;
+		return;
+	}
+	bucket = g_hash_table_lookup (list->id_index, GUINT_TO_POINTER (hash));
+	if (bucket == NULL) {
+		bucket = g_ptr_array_new ();
+		g_hash_table_insert (list->id_index, GUINT_TO_POINTER (hash), bucket);
+	}
+	g_ptr_array_add (bucket, app);
+}
+
+/* mutex must be held; returns %FALSE if the index is there but stale */
+static gboolean
+gs_app_list_id_index_is_valid (GsAppList *list)
+{
+	return list->id_index == NULL ||
+	       !g_atomic_int_get (&list->id_index_stale);
+}
+
+static void
+gs_app_list_ensure_id_index (GsAppList *list)
+{
+	if (!gs_app_list_id_index_is_valid (list))
+		gs_app_list_clear_id_index (list);
+	if (list->id_index != NULL)
+		return;
+
+	g_atomic_int_set (&list->id_index_stale, FALSE);
+	list->id_index = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						NULL, (GDestroyNotify) g_ptr_array_unref);
+	list->id_index_wildcards = g_ptr_array_new ();
+	for (guint i = 0; i < list->array->len; i++)
+		gs_app_list_id_index_add (list, g_ptr_array_index (list->array, i));
+}
+
 static GsApp *
 gs_app_list_lookup_safe (GsAppList *list, const gchar *unique_id)
 {
+	GPtrArray *bucket;
+	gboolean is_wildcard;
+	guint hash;
+
+	if (unique_id == NULL)
+		return NULL;
+
+	hash = gs_app_list_hash_unique_id (unique_id, &is_wildcard);
+	if (!is_wildcard) {
+		gs_app_list_ensure_id_index (list);
+		if (!list->id_index_incomplete) {
+			bucket = g_hash_table_lookup (list->id_index, GUINT_TO_POINTER (hash));
+			for (guint i = 0; bucket != NULL && i < bucket->len; i++) {
+				GsApp *app = g_ptr_array_index (bucket, i);
+				if (as_utils_data_id_equal (gs_app_get_unique_id (app), unique_id))
+					return app;
+			}
+			return NULL;
+		}
+	}
+
+	/* a wildcard ID part may match any app */
 	for (guint i = 0; i < list->array->len; i++) {
 		GsApp *app = g_ptr_array_index (list->array, i);
 		if (as_utils_data_id_equal (gs_app_get_unique_id (app), unique_id))
@@ -371,6 +495,39 @@ gs_app_list_add_flag (GsAppList *list, GsAppListFlags flag)
 	}
 }
 
+static void
+gs_app_list_index_add_app (GsAppList *list, GsApp *app)
+{
+	guint n = GPOINTER_TO_UINT (g_hash_table_lookup (list->apps_set, app));
+
+	g_hash_table_insert (list->apps_set, app, GUINT_TO_POINTER (n + 1));
+	gs_app_watch_unique_id (app, &list->id_index_stale);
+
+	/* keep a valid index up to date, as appending keeps it in list order */
+	if (list->id_index != NULL) {
+		if (gs_app_list_id_index_is_valid (list))
+			gs_app_list_id_index_add (list, app);
+		else
+			gs_app_list_clear_id_index (list);
+	}
+}
+
+/* must be called before @app is removed from the array */
+static void
+gs_app_list_index_remove_app (GsAppList *list, GsApp *app)
+{
+	guint n = GPOINTER_TO_UINT (g_hash_table_lookup (list->apps_set, app));
+
+	if (n <= 1)
+		g_hash_table_remove (list->apps_set, app);
+	else
+		g_hash_table_insert (list->apps_set, app, GUINT_TO_POINTER (n - 1));
+	gs_app_unwatch_unique_id (app, &list->id_index_stale);
+
+	/* removals can happen anywhere in the list, so rebuild when needed */
+	gs_app_list_clear_id_index (list);
+}
+
 static gboolean
 gs_app_list_check_for_duplicate (GsAppList *list, GsApp *app)
 {
@@ -379,10 +536,9 @@ gs_app_list_check_for_duplicate (GsAppList *list, GsApp *app)
 
 	/* adding a wildcard */
 	if (gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD)) {
-		for (guint i = 0; i < list->array->len; i++) {
-			GsApp *app_tmp = g_ptr_array_index (list->array, i);
-			if (!gs_app_has_quirk (app_tmp, GS_APP_QUIRK_IS_WILDCARD))
-				continue;
+		gs_app_list_ensure_id_index (list);
+		for (guint i = 0; i < list->id_index_wildcards->len; i++) {
+			GsApp *app_tmp = g_ptr_array_index (list->id_index_wildcards, i);
 			/* not adding exactly the same wildcard */
 			if (g_strcmp0 (gs_app_get_unique_id (app_tmp),
 				       gs_app_get_unique_id (app)) == 0)
@@ -391,11 +547,8 @@ gs_app_list_check_for_duplicate (GsAppList *list, GsApp *app)
 		return TRUE;
 	}
 
-	for (guint i = 0; i < list->array->len; i++) {
-		GsApp *app_tmp = g_ptr_array_index (list->array, i);
-		if (app_tmp == app)
-			return FALSE;
-	}
+	if (g_hash_table_contains (list->apps_set, app))
+		return FALSE;
 
 	/* does not exist */
 	id = gs_app_get_unique_id (app);
@@ -432,6 +585,7 @@ gs_app_list_add_safe (GsAppList *list, GsApp *app, GsAppListAddFlag flag)
 	/* just use the ref */
 	gs_app_list_maybe_watch_app (list, app);
 	g_ptr_array_add (list->array, g_object_ref (app));
+	gs_app_list_index_add_app (list, app);
 
 	/* update the historical max */
 	if (list->array->len > list->size_peak)
@@ -488,6 +642,8 @@ gs_app_list_remove (GsAppList *list, GsApp *app)
 	g_return_val_if_fail (GS_IS_APP (app), FALSE);
 
 	locker = g_mutex_locker_new (&list->mutex);
+	if (g_hash_table_contains (list->apps_set, app))
+		gs_app_list_index_remove_app (list, app);
 	removed = g_ptr_array_remove (list->array, app);
 	if (removed) {
 		gs_app_list_maybe_unwatch_app (list, app);
@@ -572,7 +728,10 @@ gs_app_list_remove_all_safe (GsAppList *list)
 	for (guint i = 0; i < list->array->len; i++) {
 		GsApp *app = g_ptr_array_index (list->array, i);
 		gs_app_list_maybe_unwatch_app (list, app);
+		gs_app_unwatch_unique_id (app, &list->id_index_stale);
 	}
+	g_hash_table_remove_all (list->apps_set);
+	gs_app_list_clear_id_index (list);
 	g_ptr_array_set_size (list->array, 0);
 	gs_app_list_invalidate_state (list);
 	gs_app_list_invalidate_progress (list);
@@ -664,6 +823,9 @@ gs_app_list_sort (GsAppList *list, GsAppListSortFunc func, gpointer user_data)
 	helper.func = func;
 	helper.user_data = user_data;
 	g_ptr_array_sort_with_data (list->array, gs_app_list_sort_cb, &helper);
+
+	/* the index buckets are in list order */
+	gs_app_list_clear_id_index (list);
 }
 
 /**
@@ -695,9 +857,150 @@ gs_app_list_truncate (GsAppList *list, guint length)
 
 	/* remove the apps in the positions larger than the length */
 	locker = g_mutex_locker_new (&list->mutex);
+	for (guint i = length; i < list->array->len; i++)
+		gs_app_list_index_remove_app (list, g_ptr_array_index (list->array, i));
 	g_ptr_array_set_size (list->array, length);
 }
 
+typedef struct {
+	GsApp			**apps;
+	GsAppListSortFunc	 func;
+	gpointer		 user_data;
+} GsAppListTopHelper;
+
+/* Compare the apps at indices @a and @b, falling back to their positions so
+ * that equal apps keep their relative order, as with gs_app_list_sort(). */
+static gint
+gs_app_list_top_cmp (const GsAppListTopHelper *helper,
+		     guint                     a,
+		     guint                     b)
+{
+	gint rc = helper->func (helper->apps[a], helper->apps[b], helper->user_data);
+	if (rc != 0)
+		return rc;
+	return (a < b) ? -1 : (a > b) ? 1 : 0;
+}
+
+/* Restore the heap property of @heap below @i, where the root is the index
+ * of the app which sorts last. */
+static void
+gs_app_list_top_sift_down (const GsAppListTopHelper *helper,
+			   guint                    *heap,
+			   guint                     heap_len,
+			   guint                     i)
+{
+	for (;;) {
+		guint largest = i;
+		guint left = 2 * i + 1;
+		guint right = 2 * i + 2;
+		guint tmp;
+
+		if (left < heap_len && gs_app_list_top_cmp (helper, heap[left], heap[largest]) > 0)
+			largest = left;
+		if (right < heap_len && gs_app_list_top_cmp (helper, heap[right], heap[largest]) > 0)
+			largest = right;
+		if (largest == i)
+			return;
+
+		tmp = heap[i];
+		heap[i] = heap[largest];
+		heap[largest] = tmp;
+		i = largest;
+	}
+}
+
+/**
+ * gs_app_list_sort_top:
+ * @list: A #GsAppList
+ * @func: A #GsAppListSortFunc
+ * @user_data: user data to pass to @func
+ * @length: the maximum number of apps to keep
+ *
+ * Sorts the application list and truncates it to at most @length apps. The
+ * result is the same as calling gs_app_list_sort() and then
+ * gs_app_list_truncate(), but only the best @length apps are kept in a bounded
+ * heap while scanning the list, which is a lot cheaper when @length is much
+ * smaller than the list.
+ *
+ * Since: 46
+ **/
+void
+gs_app_list_sort_top (GsAppList *list, GsAppListSortFunc func, gpointer user_data, guint length)
+{
+	g_autoptr(GMutexLocker) locker = NULL;
+	g_autofree guint *heap = NULL;
+	g_autofree GsApp **apps = NULL;
+	g_autofree gboolean *kept = NULL;
+	GsAppListTopHelper helper;
+	guint n_apps;
+	guint heap_len = 0;
+
+	g_return_if_fail (GS_IS_APP_LIST (list));
+	g_return_if_fail (func != NULL);
+
+	if (length == 0) {
+		gs_app_list_truncate (list, 0);
+		return;
+	}
+
+	/* nothing to throw away */
+	if (length >= gs_app_list_length (list)) {
+		gs_app_list_sort (list, func, user_data);
+		return;
+	}
+
+	locker = g_mutex_locker_new (&list->mutex);
+
+	n_apps = list->array->len;
+	apps = g_memdup2 (list->array->pdata, n_apps * sizeof (GsApp *));
+	helper.apps = apps;
+	helper.func = func;
+	helper.user_data = user_data;
+
+	/* keep the indices of the best @length apps seen so far, with the
+	 * worst of them at the root so it can be replaced */
+	heap = g_new (guint, length);
+	for (guint i = 0; i < n_apps; i++) {
+		if (heap_len < length) {
+			heap[heap_len++] = i;
+			if (heap_len == length) {
+				for (guint j = heap_len / 2; j > 0; j--)
+					gs_app_list_top_sift_down (&helper, heap, heap_len, j - 1);
+			}
+		} else if (gs_app_list_top_cmp (&helper, i, heap[0]) < 0) {
+			heap[0] = i;
+			gs_app_list_top_sift_down (&helper, heap, heap_len, 0);
+		}
+	}
+
+	/* heapsort the kept apps into order */
+	for (guint end = heap_len - 1; end > 0; end--) {
+		guint tmp = heap[0];
+		heap[0] = heap[end];
+		heap[end] = tmp;
+		gs_app_list_top_sift_down (&helper, heap, end, 0);
+	}
+
+	/* put the kept apps first, then drop the rest */
+	kept = g_new0 (gboolean, n_apps);
+	for (guint i = 0; i < heap_len; i++) {
+		list->array->pdata[i] = apps[heap[i]];
+		kept[heap[i]] = TRUE;
+	}
+	for (guint i = 0, j = heap_len; i < n_apps; i++) {
+		if (!kept[i])
+			list->array->pdata[j++] = apps[i];
+	}
+
+	list->flags |= GS_APP_LIST_FLAG_IS_TRUNCATED;
+	for (guint i = heap_len; i < list->array->len; i++)
+		gs_app_list_index_remove_app (list, g_ptr_array_index (list->array, i));
+	g_ptr_array_set_size (list->array, heap_len);
+
+	/* the index buckets are in list order */
+	gs_app_list_clear_id_index (list);
+}
+
 /**
  * gs_app_list_randomize:
  * @list: A #GsAppList
@@ -736,6 +1039,9 @@ gs_app_list_randomize (GsAppList *list)
 		list->array->pdata[j] = tmp;
 	}
 
+	/* the index buckets are in list order */
+	gs_app_list_clear_id_index (list);
+
 	g_rand_free (rand);
 }
 
@@ -758,56 +1064,98 @@ gs_app_list_filter_app_is_better (GsApp *app, GsApp *found, GsAppListFilterFlags
 	return FALSE;
 }
 
-static GPtrArray *
-gs_app_list_filter_app_get_keys (GsApp *app, GsAppListFilterFlags flags)
-{
-	GPtrArray *keys = g_ptr_array_new_with_free_func (g_free);
-	g_autoptr(GString) key = NULL;
-
-	/* just use the unique ID */
-	if (flags == GS_APP_LIST_FILTER_FLAG_NONE) {
-		if (gs_app_get_unique_id (app) != NULL)
-			g_ptr_array_add (keys, g_strdup (gs_app_get_unique_id (app)));
-		return keys;
-	}
-
-	/* use the ID and any provided items */
-	if (flags & GS_APP_LIST_FILTER_FLAG_KEY_ID_PROVIDES) {
-		GPtrArray *provided = gs_app_get_provided (app);
-		g_ptr_array_add (keys, g_strdup (gs_app_get_id (app)));
-		for (guint i = 0; i < provided->len; i++) {
-			AsProvided *prov = g_ptr_array_index (provided, i);
-			GPtrArray *items;
-			if (as_provided_get_kind (prov) != AS_PROVIDED_KIND_ID)
-				continue;
-			items = as_provided_get_items (prov);
-			for (guint j = 0; j < items->len; j++)
-				g_ptr_array_add (keys, g_strdup (g_ptr_array_index (items, j)));
-		}
-		return keys;
-	}
+/* The fields used to identify an app when filtering duplicates. The strings
+ * are borrowed from the #GsApp, so no copies are made. */
+typedef struct {
+	const gchar	*id;
+	const gchar	*source;
+	const gchar	*version;
+} GsAppListFilterKey;
 
-	/* specific compound type */
-	key = g_string_new (NULL);
-	if (flags & GS_APP_LIST_FILTER_FLAG_KEY_ID) {
-		const gchar *tmp = gs_app_get_id (app);
-		if (tmp != NULL)
-			g_string_append (key, gs_app_get_id (app));
-	}
-	if (flags & GS_APP_LIST_FILTER_FLAG_KEY_SOURCE) {
-		const gchar *tmp = gs_app_get_source_default (app);
-		if (tmp != NULL)
-			g_string_append_printf (key, ":%s", tmp);
+static guint
+gs_app_list_filter_key_hash (gconstpointer data)
+{
+	const GsAppListFilterKey *key = data;
+	guint hash = 0;
+
+	if (key->id != NULL)
+		hash = g_str_hash (key->id);
+	if (key->source != NULL)
+		hash = hash * 31 + g_str_hash (key->source);
+	if (key->version != NULL)
+		hash = hash * 37 + g_str_hash (key->version);
+	return hash;
+}
+
+static gboolean
+gs_app_list_filter_key_equal (gconstpointer a, gconstpointer b)
+{
+	const GsAppListFilterKey *key1 = a;
+	const GsAppListFilterKey *key2 = b;
+
+	return g_strcmp0 (key1->id, key2->id) == 0 &&
+	       g_strcmp0 (key1->source, key2->source) == 0 &&
+	       g_strcmp0 (key1->version, key2->version) == 0;
+}
+
+/* Fills @key with the compound key for @app, returning %FALSE if there is
+ * nothing to identify it by. */
+static gboolean
+gs_app_list_filter_app_get_key (GsApp *app,
+				GsAppListFilterFlags flags,
+				GsAppListFilterKey *key)
+{
+	key->id = NULL;
+	key->source = NULL;
+	key->version = NULL;
+
+	if (flags & GS_APP_LIST_FILTER_FLAG_KEY_ID)
+		key->id = gs_app_get_id (app);
+	if (flags & GS_APP_LIST_FILTER_FLAG_KEY_SOURCE)
+		key->source = gs_app_get_source_default (app);
+	if (flags & GS_APP_LIST_FILTER_FLAG_KEY_VERSION)
+		key->version = gs_app_get_version (app);
+
+	return key->id != NULL || key->source != NULL || key->version != NULL;
+}
+
+/* Looks up @app by every ID it provides, returning the first app found. If
+ * @replace is set, all of those keys are pointed at @app instead. */
+static GsApp *
+gs_app_list_filter_lookup_provides (GHashTable *hash,
+				    GsApp *app,
+				    gboolean replace)
+{
+	GPtrArray *provided = gs_app_get_provided (app);
+	const gchar *id = gs_app_get_id (app);
+
+	if (!replace) {
+		GsApp *found = (id != NULL) ? g_hash_table_lookup (hash, id) : NULL;
+		if (found != NULL)
+			return found;
+	} else if (id != NULL) {
+		g_hash_table_insert (hash, (gpointer) id, app);
 	}
-	if (flags & GS_APP_LIST_FILTER_FLAG_KEY_VERSION) {
-		const gchar *tmp = gs_app_get_version (app);
-		if (tmp != NULL)
-			g_string_append_printf (key, ":%s", tmp);
+
+	for (guint i = 0; i < provided->len; i++) {
+		AsProvided *prov = g_ptr_array_index (provided, i);
+		GPtrArray *items;
+		if (as_provided_get_kind (prov) != AS_PROVIDED_KIND_ID)
+			continue;
+		items = as_provided_get_items (prov);
+		for (guint j = 0; j < items->len; j++) {
+			const gchar *item = g_ptr_array_index (items, j);
+			if (replace) {
+				g_hash_table_insert (hash, (gpointer) item, app);
+			} else {
+				GsApp *found = g_hash_table_lookup (hash, item);
+				if (found != NULL)
+					return found;
+			}
+		}
 	}
-	if (key->len == 0)
-		return keys;
-	g_ptr_array_add (keys, g_string_free (g_steal_pointer (&key), FALSE));
-	return keys;
+
+	return NULL;
 }
 
 /**
@@ -824,66 +1172,93 @@ gs_app_list_filter_duplicates (GsAppList *list, GsAppListFilterFlags flags)
 {
 	g_autoptr(GHashTable) hash = NULL;
 	g_autoptr(GHashTable) kept_apps = NULL;
-	g_autoptr(GsAppList) old = NULL;
+	g_autofree GsAppListFilterKey *keys = NULL;
 	g_autoptr(GMutexLocker) locker = NULL;
+	gboolean by_provides;
+	gboolean by_compound_key;
+	guint len;
+	guint n_kept = 0;
 
 	g_return_if_fail (GS_IS_APP_LIST (list));
 
 	locker = g_mutex_locker_new (&list->mutex);
 
-	/* a hash table to hold apps with unique app ids */
-	hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	/* the keys are all borrowed from the apps, which the list keeps alive */
+	by_provides = (flags & GS_APP_LIST_FILTER_FLAG_KEY_ID_PROVIDES) > 0;
+	by_compound_key = (flags != GS_APP_LIST_FILTER_FLAG_NONE && !by_provides);
+	if (by_compound_key) {
+		keys = g_new (GsAppListFilterKey, list->array->len);
+		hash = g_hash_table_new (gs_app_list_filter_key_hash, gs_app_list_filter_key_equal);
+	} else {
+		hash = g_hash_table_new (g_str_hash, g_str_equal);
+	}
 	/* a hash table containing apps we want to keep */
 	kept_apps = g_hash_table_new (g_direct_hash, g_direct_equal);
 
 	for (guint i = 0; i < list->array->len; i++) {
-		GsApp *app = gs_app_list_index (list, i);
+		GsApp *app = g_ptr_array_index (list->array, i);
 		GsApp *found = NULL;
-		g_autoptr(GPtrArray) keys = NULL;
-
-		/* get all the keys used to identify this app */
-		keys = gs_app_list_filter_app_get_keys (app, flags);
-		for (guint j = 0; j < keys->len; j++) {
-			const gchar *key = g_ptr_array_index (keys, j);
+		gpointer key = NULL;
+
+		/* find any app already seen with the same keys */
+		if (by_provides) {
+			found = gs_app_list_filter_lookup_provides (hash, app, FALSE);
+		} else if (by_compound_key) {
+			if (!gs_app_list_filter_app_get_key (app, flags, &keys[i])) {
+				g_hash_table_add (kept_apps, app);
+				continue;
+			}
+			key = &keys[i];
 			found = g_hash_table_lookup (hash, key);
-			if (found != NULL)
-				break;
-		}
-
-		/* new app */
-		if (found == NULL) {
-			for (guint j = 0; j < keys->len; j++) {
-				const gchar *key = g_ptr_array_index (keys, j);
-				g_hash_table_insert (hash, g_strdup (key), app);
+		} else {
+			key = (gpointer) gs_app_get_unique_id (app);
+			if (key == NULL) {
+				g_hash_table_add (kept_apps, app);
+				continue;
 			}
-			g_hash_table_add (kept_apps, app);
-			continue;
+			found = g_hash_table_lookup (hash, key);
 		}
 
-		/* better? */
-		if (flags != GS_APP_LIST_FILTER_FLAG_NONE &&
-		    gs_app_list_filter_app_is_better (app, found, flags)) {
-			for (guint j = 0; j < keys->len; j++) {
-				const gchar *key = g_ptr_array_index (keys, j);
-				g_hash_table_insert (hash, g_strdup (key), app);
-			}
-			g_hash_table_remove (kept_apps, found);
+		/* new app, or better than the one seen before? */
+		if (found == NULL ||
+		    (flags != GS_APP_LIST_FILTER_FLAG_NONE &&
+		     gs_app_list_filter_app_is_better (app, found, flags))) {
+			if (by_provides)
+				gs_app_list_filter_lookup_provides (hash, app, TRUE);
+			else
+				g_hash_table_insert (hash, key, app);
+			if (found != NULL)
+				g_hash_table_remove (kept_apps, found);
 			g_hash_table_add (kept_apps, app);
 		}
 	}
 
-	/* deep copy to a temp list and clear the current one */
-	old = gs_app_list_copy (list);
-	gs_app_list_remove_all_safe (list);
+	/* compact the apps we want to keep to the front of the array, in
+	 * their existing order, dropping the others */
+	len = list->array->len;
+	for (guint i = 0; i < len; i++) {
+		GsApp *app = g_ptr_array_index (list->array, i);
 
-	/* add back the apps we want to keep */
-	for (guint i = 0; i < old->array->len; i++) {
-		GsApp *app = gs_app_list_index (old, i);
-		if (g_hash_table_contains (kept_apps, app)) {
-			gs_app_list_add_safe (list, app, GS_APP_LIST_ADD_FLAG_NONE);
-			/* In case the same instance is in the 'list' multiple times */
-			g_hash_table_remove (kept_apps, app);
+		/* In case the same instance is in the 'list' multiple times,
+		 * only keep the first */
+		if (g_hash_table_remove (kept_apps, app)) {
+			list->array->pdata[n_kept++] = app;
+			continue;
 		}
+
+		gs_app_list_index_remove_app (list, app);
+		if (!g_hash_table_contains (list->apps_set, app))
+			gs_app_list_maybe_unwatch_app (list, app);
+		g_object_unref (app);
+	}
+	g_ptr_array_set_free_func (list->array, NULL);
+	g_ptr_array_set_size (list->array, n_kept);
+	g_ptr_array_set_free_func (list->array, (GDestroyNotify) g_object_unref);
+
+	/* recalculate global state */
+	if (n_kept != len) {
+		gs_app_list_invalidate_state (list);
+		gs_app_list_invalidate_progress (list);
 	}
 }
 
@@ -944,7 +1319,11 @@ static void
 gs_app_list_finalize (GObject *object)
 {
 	GsAppList *list = GS_APP_LIST (object);
+	for (guint i = 0; i < list->array->len; i++)
+		gs_app_unwatch_unique_id (g_ptr_array_index (list->array, i), &list->id_index_stale);
 	g_ptr_array_unref (list->array);
+	g_hash_table_unref (list->apps_set);
+	gs_app_list_clear_id_index (list);
 	g_mutex_clear (&list->mutex);
 	G_OBJECT_CLASS (gs_app_list_parent_class)->finalize (object);
 }
@@ -1000,6 +1379,7 @@ gs_app_list_init (GsAppList *list)
 {
 	g_mutex_init (&list->mutex);
 	list->array = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	list->apps_set = g_hash_table_new (g_direct_hash, g_direct_equal);
 	list->custom_progress = GS_APP_PROGRESS_UNKNOWN;
 }
 
@@ -18,6 +18,19 @@ void		 gs_app_set_priority		(GsApp		*app,
 guint		 gs_app_get_priority		(GsApp		*app);
 void		 gs_app_set_unique_id		(GsApp		*app,
 						 const gchar	*unique_id);
+void		 gs_app_watch_unique_id		(GsApp		*app,
+						 gint		*stale_flag);
+void		 gs_app_unwatch_unique_id	(GsApp		*app,
+						 gint		*stale_flag);
+guint		 gs_app_get_refine_generation	(void);
+void		 gs_app_invalidate_all_refined_flags
+						(void);
+gboolean	 gs_app_get_refined_flags	(GsApp		*app,
+						 GsPluginRefineFlags *out_flags);
+void		 gs_app_add_refined_flags	(GsApp		*app,
+						 GsPluginRefineFlags flags,
+						 GsPluginRefineFlags mode_flags,
+						 guint		 generation);
 void		 gs_app_remove_addon		(GsApp		*app,
 						 GsApp		*addon);
 GCancellable	*gs_app_get_cancellable		(GsApp		*app);
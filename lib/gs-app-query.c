@@ -65,6 +65,7 @@ struct _GsAppQuery
 	GsAppListSortFunc sort_func;
 	gpointer sort_user_data;
 	GDestroyNotify sort_user_data_notify;
+	GsPluginRefineFlags sort_refine_flags;
 
 	GsAppListFilterFunc filter_func;
 	gpointer filter_user_data;
@@ -99,6 +100,7 @@ typedef enum {
 	PROP_SORT_FUNC,
 	PROP_SORT_USER_DATA,
 	PROP_SORT_USER_DATA_NOTIFY,
+	PROP_SORT_REFINE_FLAGS,
 	PROP_FILTER_FUNC,
 	PROP_FILTER_USER_DATA,
 	PROP_FILTER_USER_DATA_NOTIFY,
@@ -156,6 +158,9 @@ gs_app_query_get_property (GObject    *object,
 	case PROP_SORT_USER_DATA_NOTIFY:
 		g_value_set_pointer (value, self->sort_user_data_notify);
 		break;
+	case PROP_SORT_REFINE_FLAGS:
+		g_value_set_flags (value, self->sort_refine_flags);
+		break;
 	case PROP_FILTER_FUNC:
 		g_value_set_pointer (value, self->filter_func);
 		break;
@@ -249,6 +254,11 @@ gs_app_query_set_property (GObject      *object,
 		g_assert (self->sort_user_data_notify == NULL);
 		self->sort_user_data_notify = g_value_get_pointer (value);
 		break;
+	case PROP_SORT_REFINE_FLAGS:
+		/* Construct only. */
+		g_assert (self->sort_refine_flags == 0);
+		self->sort_refine_flags = g_value_get_flags (value);
+		break;
 	case PROP_FILTER_FUNC:
 		/* Construct only. */
 		g_assert (self->filter_func == NULL);
@@ -491,6 +501,29 @@ gs_app_query_class_init (GsAppQueryClass *klass)
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
 				      G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
 
+	/**
+	 * GsAppQuery:sort-refine-flags:
+	 *
+	 * Flags to specify how the returned apps must be refined before
+	 * #GsAppQuery:sort-func can compare them, or
+	 * %GS_PLUGIN_REFINE_FLAGS_NONE if this is not known.
+	 *
+	 * If this is set along with #GsAppQuery:max-results, the query executor
+	 * may refine all the results with these flags first, sort and truncate
+	 * them, and then only refine the kept results with
+	 * #GsAppQuery:refine-flags. Use %GS_PLUGIN_REFINE_FLAGS_REQUIRE_ID if
+	 * the sort function only needs the basic app data which every refine
+	 * provides, such as the state and kind.
+	 *
+	 * Since: 46
+	 */
+	props[PROP_SORT_REFINE_FLAGS] =
+		g_param_spec_flags ("sort-refine-flags", "Sort Refine Flags",
+				    "Flags to specify how the returned apps must be refined before sorting them.",
+				    GS_TYPE_PLUGIN_REFINE_FLAGS, GS_PLUGIN_REFINE_FLAGS_NONE,
+				    G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+				    G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
 	/**
 	 * GsAppQuery:filter-func: (nullable)
 	 *
@@ -911,6 +944,23 @@ gs_app_query_get_sort_func (GsAppQuery *self,
 	return self->sort_func;
 }
 
+/**
+ * gs_app_query_get_sort_refine_flags:
+ * @self: a #GsAppQuery
+ *
+ * Get the value of #GsAppQuery:sort-refine-flags.
+ *
+ * Returns: the refine flags needed to sort the query results
+ * Since: 46
+ */
+GsPluginRefineFlags
+gs_app_query_get_sort_refine_flags (GsAppQuery *self)
+{
+	g_return_val_if_fail (GS_IS_APP_QUERY (self), GS_PLUGIN_REFINE_FLAGS_NONE);
+
+	return self->sort_refine_flags;
+}
+
 /**
  * gs_app_query_get_filter_func:
  * @self: a #GsAppQuery
@@ -943,7 +993,7 @@ gs_app_query_get_filter_func (GsAppQuery *self,
  * These are the properties which determine the query results, rather than ones
  * which control refining the results (#GsAppQuery:refine-flags,
  * #GsAppQuery:max-results, #GsAppQuery:dedupe-flags, #GsAppQuery:sort-func and
- * its user data, #GsAppQuery:filter-func and its user data,
+ * its user data and refine flags, #GsAppQuery:filter-func and its user data,
  * #GsAppQuery:license-type).
  *
  * Returns: number of properties set so they will affect query results
@@ -101,6 +101,7 @@ guint			 gs_app_query_get_max_results	(GsAppQuery *self);
 GsAppListFilterFlags	 gs_app_query_get_dedupe_flags	(GsAppQuery *self);
 GsAppListSortFunc	 gs_app_query_get_sort_func	(GsAppQuery *self,
 							 gpointer   *user_data_out);
+GsPluginRefineFlags	 gs_app_query_get_sort_refine_flags (GsAppQuery *self);
 GsAppListFilterFunc	 gs_app_query_get_filter_func	(GsAppQuery *self,
 							 gpointer   *user_data_out);
 
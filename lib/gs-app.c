@@ -58,6 +58,9 @@ typedef struct
 	gchar			*id;
 	gchar			*unique_id;
 	gboolean		 unique_id_valid;
+	GPtrArray		*unique_id_watchers;  /* (owned) (nullable) (element-type gint) (lock unique_id_watchers) */
+	GsPluginRefineFlags	 refined_flags;
+	guint			 refined_generation;
 	gchar			*branch;
 	gchar			*name;
 	gchar			*renamed_from;
@@ -362,6 +365,35 @@ _as_component_quirk_flag_to_string (GsAppQuirk quirk)
 	}
 }
 
+/* protects the unique_id_watchers of all apps; never held while taking
+ * another lock */
+G_LOCK_DEFINE_STATIC (unique_id_watchers);
+
+static gboolean
+gs_app_has_unique_id_watchers (GsApp *app)
+{
+	GsAppPrivate *priv = gs_app_get_instance_private (app);
+	gboolean watched;
+
+	G_LOCK (unique_id_watchers);
+	watched = (priv->unique_id_watchers != NULL && priv->unique_id_watchers->len > 0);
+	G_UNLOCK (unique_id_watchers);
+
+	return watched;
+}
+
+/* marks the indexes which contain @app as stale, see gs_app_watch_unique_id() */
+static void
+gs_app_unique_id_changed (GsApp *app)
+{
+	GsAppPrivate *priv = gs_app_get_instance_private (app);
+
+	G_LOCK (unique_id_watchers);
+	for (guint i = 0; priv->unique_id_watchers != NULL && i < priv->unique_id_watchers->len; i++)
+		g_atomic_int_set ((gint *) g_ptr_array_index (priv->unique_id_watchers, i), TRUE);
+	G_UNLOCK (unique_id_watchers);
+}
+
 /* mutex must be held */
 static const gchar *
 gs_app_get_unique_id_unlocked (GsApp *app)
@@ -385,6 +417,25 @@ gs_app_get_unique_id_unlocked (GsApp *app)
 	return priv->unique_id;
 }
 
+/* mutex must be held */
+static void
+gs_app_invalidate_unique_id (GsApp *app)
+{
+	GsAppPrivate *priv = gs_app_get_instance_private (app);
+	g_autofree gchar *old_unique_id = NULL;
+	gboolean was_valid = priv->unique_id_valid;
+
+	priv->unique_id_valid = FALSE;
+	if (!gs_app_has_unique_id_watchers (app))
+		return;
+
+	/* Rebuild it straight away, so the indexes are only invalidated if
+	 * it has actually changed. For example, the kind isn’t part of it. */
+	old_unique_id = g_steal_pointer (&priv->unique_id);
+	if (!was_valid || g_strcmp0 (old_unique_id, gs_app_get_unique_id_unlocked (app)) != 0)
+		gs_app_unique_id_changed (app);
+}
+
 /**
  * gs_app_compare_priority:
  * @app1: a #GsApp
@@ -858,7 +909,7 @@ gs_app_set_id (GsApp *app, const gchar *id)
 	g_return_if_fail (GS_IS_APP (app));
 	locker = g_mutex_locker_new (&priv->mutex);
 	if (_g_set_str (&priv->id, id))
-		priv->unique_id_valid = FALSE;
+		gs_app_invalidate_unique_id (app);
 }
 
 /**
@@ -892,9 +943,12 @@ void
 gs_app_set_scope (GsApp *app, AsComponentScope scope)
 {
 	GsAppPrivate *priv = gs_app_get_instance_private (app);
+	g_autoptr(GMutexLocker) locker = NULL;
 
 	g_return_if_fail (GS_IS_APP (app));
 
+	locker = g_mutex_locker_new (&priv->mutex);
+
 	/* same */
 	if (scope == priv->scope)
 		return;
@@ -902,7 +956,7 @@ gs_app_set_scope (GsApp *app, AsComponentScope scope)
 	priv->scope = scope;
 
 	/* no longer valid */
-	priv->unique_id_valid = FALSE;
+	gs_app_invalidate_unique_id (app);
 }
 
 /**
@@ -936,9 +990,12 @@ void
 gs_app_set_bundle_kind (GsApp *app, AsBundleKind bundle_kind)
 {
 	GsAppPrivate *priv = gs_app_get_instance_private (app);
+	g_autoptr(GMutexLocker) locker = NULL;
 
 	g_return_if_fail (GS_IS_APP (app));
 
+	locker = g_mutex_locker_new (&priv->mutex);
+
 	/* same */
 	if (bundle_kind == priv->bundle_kind)
 		return;
@@ -946,7 +1003,7 @@ gs_app_set_bundle_kind (GsApp *app, AsBundleKind bundle_kind)
 	priv->bundle_kind = bundle_kind;
 
 	/* no longer valid */
-	priv->unique_id_valid = FALSE;
+	gs_app_invalidate_unique_id (app);
 }
 
 /**
@@ -1076,6 +1133,7 @@ gs_app_set_state_recover (GsApp *app)
 	gs_app_set_progress (app, GS_APP_PROGRESS_UNKNOWN);
 
 	priv->state = priv->state_recover;
+	priv->refined_generation = 0;
 	gs_app_queue_notify (app, obj_props[PROP_STATE]);
 }
 
@@ -1195,6 +1253,9 @@ gs_app_set_state_internal (GsApp *app, GsAppState state)
 
 	priv->state = state;
 
+	/* what plugins return for an app typically depends on its state */
+	priv->refined_generation = 0;
+
 	if (state == GS_APP_STATE_UNKNOWN ||
 	    state == GS_APP_STATE_AVAILABLE_LOCAL ||
 	    state == GS_APP_STATE_AVAILABLE)
@@ -1425,7 +1486,7 @@ gs_app_set_kind (GsApp *app, AsComponentKind kind)
 	gs_app_queue_notify (app, obj_props[PROP_KIND]);
 
 	/* no longer valid */
-	priv->unique_id_valid = FALSE;
+	gs_app_invalidate_unique_id (app);
 }
 
 /**
@@ -1476,11 +1537,163 @@ gs_app_set_unique_id (GsApp *app, const gchar *unique_id)
 	if (!as_utils_data_id_valid (unique_id))
 		g_warning ("unique_id %s not valid", unique_id);
 
+	if (!priv->unique_id_valid || g_strcmp0 (priv->unique_id, unique_id) != 0)
+		gs_app_unique_id_changed (app);
+
 	g_free (priv->unique_id);
 	priv->unique_id = g_strdup (unique_id);
 	priv->unique_id_valid = TRUE;
 }
 
+/**
+ * gs_app_watch_unique_id:
+ * @app: a #GsApp
+ * @stale_flag: (not nullable): flag of an index keyed by the unique ID
+ *
+ * Marks @app as being in an index keyed by its unique ID, such as the one in
+ * #GsAppList. When the unique ID or %GS_APP_QUIRK_IS_WILDCARD of @app
+ * changes, @stale_flag is atomically set to %TRUE, so the index knows it has
+ * to be rebuilt.
+ *
+ * Each call must be balanced by a call to gs_app_unwatch_unique_id() before
+ * @stale_flag is freed.
+ */
+void
+gs_app_watch_unique_id (GsApp *app,
+                        gint  *stale_flag)
+{
+	GsAppPrivate *priv = gs_app_get_instance_private (app);
+
+	G_LOCK (unique_id_watchers);
+	if (priv->unique_id_watchers == NULL)
+		priv->unique_id_watchers = g_ptr_array_new ();
+	g_ptr_array_add (priv->unique_id_watchers, stale_flag);
+	G_UNLOCK (unique_id_watchers);
+}
+
+/**
+ * gs_app_unwatch_unique_id:
+ * @app: a #GsApp
+ * @stale_flag: (not nullable): flag passed to gs_app_watch_unique_id()
+ *
+ * Reverses a call to gs_app_watch_unique_id().
+ */
+void
+gs_app_unwatch_unique_id (GsApp *app,
+                          gint  *stale_flag)
+{
+	GsAppPrivate *priv = gs_app_get_instance_private (app);
+
+	G_LOCK (unique_id_watchers);
+	if (priv->unique_id_watchers != NULL)
+		g_ptr_array_remove_fast (priv->unique_id_watchers, stale_flag);
+	G_UNLOCK (unique_id_watchers);
+}
+
+/* incremented whenever previously refined data may be out of date for all apps,
+ * see gs_app_invalidate_all_refined_flags(); starts at 1 so that new apps,
+ * with a generation of 0, have nothing refined */
+static guint refine_generation = 1;  /* (atomic) */
+
+/**
+ * gs_app_get_refine_generation:
+ *
+ * Gets the current refine generation. This should be sampled before starting
+ * a refine and passed to gs_app_add_refined_flags() once the refine has
+ * finished, so that invalidations which happen during the refine are not
+ * lost.
+ *
+ * Returns: the refine generation
+ */
+guint
+gs_app_get_refine_generation (void)
+{
+	return g_atomic_int_get (&refine_generation);
+}
+
+/**
+ * gs_app_invalidate_all_refined_flags:
+ *
+ * Marks the data refined for all apps as out of date, for example because the
+ * metadata the plugins refine from has been reloaded.
+ */
+void
+gs_app_invalidate_all_refined_flags (void)
+{
+	g_atomic_int_inc (&refine_generation);
+}
+
+/**
+ * gs_app_get_refined_flags:
+ * @app: a #GsApp
+ * @out_flags: (out caller-allocates): return location for the refined flags
+ *
+ * Gets the refine flags which all plugins have already refined @app for, and
+ * which have not been invalidated since.
+ *
+ * Returns: %TRUE if @app has been completely refined since it was last
+ *   invalidated, %FALSE if it has never been refined (in which case @out_flags
+ *   is set to %GS_PLUGIN_REFINE_FLAGS_NONE)
+ */
+gboolean
+gs_app_get_refined_flags (GsApp               *app,
+                          GsPluginRefineFlags *out_flags)
+{
+	GsAppPrivate *priv = gs_app_get_instance_private (app);
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	g_return_val_if_fail (GS_IS_APP (app), FALSE);
+	g_return_val_if_fail (out_flags != NULL, FALSE);
+
+	locker = g_mutex_locker_new (&priv->mutex);
+	if (priv->refined_generation != gs_app_get_refine_generation ()) {
+		*out_flags = GS_PLUGIN_REFINE_FLAGS_NONE;
+		return FALSE;
+	}
+	*out_flags = priv->refined_flags;
+	return TRUE;
+}
+
+/**
+ * gs_app_add_refined_flags:
+ * @app: a #GsApp
+ * @flags: the refine flags which @app has been refined for
+ * @mode_flags: the flags, out of @flags, which say how @app was refined rather
+ *   than what was refined for it
+ * @generation: the value of gs_app_get_refine_generation() from before the
+ *   refine started
+ *
+ * Records that all plugins have completely refined @app for @flags, so
+ * future refines can skip them. @flags may be %GS_PLUGIN_REFINE_FLAGS_NONE to
+ * record that @app has been refined at all. If the data was invalidated since
+ * @generation, this does nothing.
+ *
+ * Flags previously recorded for @app are only kept if they were refined with
+ * the same @mode_flags bits set as @flags; otherwise they are replaced.
+ */
+void
+gs_app_add_refined_flags (GsApp               *app,
+                          GsPluginRefineFlags  flags,
+                          GsPluginRefineFlags  mode_flags,
+                          guint                generation)
+{
+	GsAppPrivate *priv = gs_app_get_instance_private (app);
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	g_return_if_fail (GS_IS_APP (app));
+
+	if (generation != gs_app_get_refine_generation ())
+		return;
+
+	locker = g_mutex_locker_new (&priv->mutex);
+	if (priv->refined_generation != generation ||
+	    (priv->refined_flags & mode_flags) != (flags & mode_flags)) {
+		priv->refined_generation = generation;
+		priv->refined_flags = GS_PLUGIN_REFINE_FLAGS_NONE;
+	}
+	priv->refined_flags |= flags;
+}
+
 /**
  * gs_app_get_name:
  * @app: a #GsApp
@@ -1599,7 +1812,7 @@ gs_app_set_branch (GsApp *app, const gchar *branch)
 	g_return_if_fail (GS_IS_APP (app));
 	locker = g_mutex_locker_new (&priv->mutex);
 	if (_g_set_str (&priv->branch, branch))
-		priv->unique_id_valid = FALSE;
+		gs_app_invalidate_unique_id (app);
 }
 
 /**
@@ -1923,6 +2136,9 @@ get_icon_theme (void)
  * call gs_remote_icon_ensure_cached() on icons of type #GsRemoteIcon to
  * download them; this function will not do that for you.
  *
+ * Cached remote icons which are larger than needed are returned as the scaled
+ * copy made when they were cached; see gs_remote_icon_dup_icon_for_size().
+ *
  * This function may do disk I/O or image resizing, but it will not do network
  * I/O to load a pixbuf. It should be acceptable to call this from a UI thread.
  *
@@ -1977,8 +2193,18 @@ gs_app_get_icon_for_size (GsApp       *app,
 		if (icon_width == 0 || icon_width * icon_scale < size * scale)
 			continue;
 
-		if (icon_width * icon_scale >= size * scale)
-			return g_object_ref (icon);
+		if (icon_width * icon_scale >= size * scale) {
+			g_autoptr(GIcon) found_icon = g_object_ref (icon);
+
+			/* Remote icons are cached as downloaded, so may be
+			 * much bigger than needed; use a scaled copy. */
+			if (GS_IS_REMOTE_ICON (found_icon)) {
+				g_clear_pointer (&locker, g_mutex_locker_free);
+				return gs_remote_icon_dup_icon_for_size (GS_REMOTE_ICON (found_icon), size, scale);
+			}
+
+			return g_steal_pointer (&found_icon);
+		}
 	}
 
 	/* Fallback to themed icons with no width set. Typically
@@ -3036,7 +3262,7 @@ gs_app_set_origin (GsApp *app, const gchar *origin)
 	priv->origin = g_strdup (origin);
 
 	/* no longer valid */
-	priv->unique_id_valid = FALSE;
+	gs_app_invalidate_unique_id (app);
 }
 
 /**
@@ -4732,6 +4958,8 @@ calculate_key_colors (GsApp *app)
 	GsAppPrivate *priv = gs_app_get_instance_private (app);
 	g_autoptr(GIcon) icon_small = NULL;
 	g_autoptr(GdkPixbuf) pb_small = NULL;
+	g_autoptr(GArray) key_colors = NULL;
+	g_autofree gchar *icon_path = NULL;
 	const gchar *overrides_str;
 
 	/* Lazily create the array */
@@ -4790,6 +5018,18 @@ calculate_key_colors (GsApp *app)
 	if (icon_small == NULL) {
 		g_debug ("no pixbuf, so no key colors");
 		return;
+	} else if (G_IS_FILE_ICON (icon_small) &&
+		   (icon_path = g_file_get_path (g_file_icon_get_file (G_FILE_ICON (icon_small)))) != NULL) {
+		/* Use the cached key colors if the file hasn’t changed */
+		key_colors = gs_calculate_key_colors_for_file (icon_path);
+		if (key_colors == NULL) {
+			g_debug ("pixbuf couldn’t be loaded, so no key colors");
+			return;
+		}
+
+		g_clear_pointer (&priv->key_colors, g_array_unref);
+		priv->key_colors = g_steal_pointer (&key_colors);
+		return;
 	} else if (G_IS_LOADABLE_ICON (icon_small)) {
 		g_autoptr(GInputStream) icon_stream = g_loadable_icon_load (G_LOADABLE_ICON (icon_small), 32, NULL, NULL, NULL);
 		if (icon_stream)
@@ -4811,7 +5051,15 @@ calculate_key_colors (GsApp *app)
 				path = g_file_get_path (file);
 
 			if (path != NULL) {
-				pb_small = gdk_pixbuf_new_from_file_at_size (path, 32, 32, NULL);
+				key_colors = gs_calculate_key_colors_for_file (path);
+				if (key_colors == NULL) {
+					g_debug ("pixbuf couldn’t be loaded, so no key colors");
+					return;
+				}
+
+				g_clear_pointer (&priv->key_colors, g_array_unref);
+				priv->key_colors = g_steal_pointer (&key_colors);
+				return;
 			} else {
 				g_autoptr(GskRenderNode) render_node = NULL;
 				g_autoptr(GtkSnapshot) snapshot = NULL;
@@ -5138,6 +5386,8 @@ gs_app_add_quirk (GsApp *app, GsAppQuirk quirk)
 
 	locker = g_mutex_locker_new (&priv->mutex);
 	priv->quirk |= quirk;
+	if (quirk & GS_APP_QUIRK_IS_WILDCARD)
+		gs_app_unique_id_changed (app);
 	gs_app_queue_notify (app, obj_props[PROP_QUIRK]);
 }
 
@@ -5163,6 +5413,8 @@ gs_app_remove_quirk (GsApp *app, GsAppQuirk quirk)
 
 	locker = g_mutex_locker_new (&priv->mutex);
 	priv->quirk &= ~quirk;
+	if (quirk & GS_APP_QUIRK_IS_WILDCARD)
+		gs_app_unique_id_changed (app);
 	gs_app_queue_notify (app, obj_props[PROP_QUIRK]);
 }
 
@@ -5544,9 +5796,13 @@ gs_app_set_property (GObject *object, guint prop_id, const GValue *value, GParam
 	case PROP_RELEASE_DATE:
 		gs_app_set_release_date (app, g_value_get_uint64 (value));
 		break;
-	case PROP_QUIRK:
-		priv->quirk = g_value_get_flags (value);
+	case PROP_QUIRK: {
+		GsAppQuirk quirk = g_value_get_flags (value);
+		if ((quirk ^ priv->quirk) & GS_APP_QUIRK_IS_WILDCARD)
+			gs_app_unique_id_changed (app);
+		priv->quirk = quirk;
 		break;
+	}
 	case PROP_PENDING_ACTION:
 		/* Read only */
 		g_assert_not_reached ();
@@ -5658,6 +5914,7 @@ gs_app_finalize (GObject *object)
 	g_mutex_clear (&priv->mutex);
 	g_free (priv->id);
 	g_free (priv->unique_id);
+	g_clear_pointer (&priv->unique_id_watchers, g_ptr_array_unref);
 	g_free (priv->branch);
 	g_free (priv->name);
 	g_free (priv->renamed_from);
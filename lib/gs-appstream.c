@@ -11,8 +11,14 @@
 
 #include <gnome-software.h>
 #include <locale.h>
+#include <string.h>
+
+#ifdef HAVE_LIBSTEMMER
+#include <libstemmer.h>
+#endif
 
 #include "gs-appstream.h"
+#include "gs-key-colors.h"
 
 #define	GS_APPSTREAM_MAX_SCREENSHOTS	5
 
@@ -1475,6 +1481,422 @@ gs_appstream_refine_app (GsPlugin *plugin,
 	return TRUE;
 }
 
+/* Fields of a component which are tokenised into the search index. Each
+ * posting in the index records which fields matched the token, so the same
+ * index can serve searches which weight the fields differently. */
+typedef enum {
+	SEARCH_FIELD_NONE		= 0,
+	SEARCH_FIELD_ID			= 1 << 0,
+	SEARCH_FIELD_LAUNCHABLE		= 1 << 1,
+	SEARCH_FIELD_PKGNAME		= 1 << 2,
+	SEARCH_FIELD_NAME		= 1 << 3,
+	SEARCH_FIELD_SUMMARY		= 1 << 4,
+	SEARCH_FIELD_KEYWORD		= 1 << 5,
+	SEARCH_FIELD_MIMETYPE		= 1 << 6,
+	SEARCH_FIELD_ORIGIN		= 1 << 7,
+	SEARCH_FIELD_DEVELOPER_NAME	= 1 << 8,
+	SEARCH_FIELD_PROJECT_GROUP	= 1 << 9,
+} SearchField;
+
+typedef struct {
+	guint32			 component;  /* offset into `components/component` */
+	guint16			 fields;  /* bitfield of SearchField */
+} SearchPosting;
+
+typedef struct {
+	gchar			*token;  /* (owned) */
+	GArray			*postings;  /* (owned) (element-type SearchPosting), sorted by component */
+} SearchTerm;
+
+/* An inverted index from folded token to the components containing it,
+ * built once per silo so that searching does not need to run XPath queries
+ * against every component for every search term. */
+typedef struct {
+	guint			 n_components;
+	GPtrArray		*terms;  /* (owned) (element-type SearchTerm), sorted by token */
+	GPtrArray		*names;  /* (owned) (element-type utf8), casefolded, indexed by component, elements nullable */
+	GPtrArray		*pkgnames;  /* (owned) (element-type utf8), casefolded, indexed by component, elements nullable */
+} GsAppstreamSearchIndex;
+
+#define GS_APPSTREAM_SEARCH_INDEX_KEY	"GnomeSoftware::SearchIndex"
+
+static void
+search_term_free (SearchTerm *term)
+{
+	g_free (term->token);
+	g_array_unref (term->postings);
+	g_free (term);
+}
+
+static void
+gs_appstream_search_index_free (GsAppstreamSearchIndex *search_index)
+{
+	g_ptr_array_unref (search_index->terms);
+	g_ptr_array_unref (search_index->names);
+	g_ptr_array_unref (search_index->pkgnames);
+	g_free (search_index);
+}
+
+static gint
+search_term_cmp (gconstpointer a, gconstpointer b)
+{
+	const SearchTerm *term_a = *((const SearchTerm **) a);
+	const SearchTerm *term_b = *((const SearchTerm **) b);
+	return strcmp (term_a->token, term_b->token);
+}
+
+static void
+search_index_add_tokens (GHashTable  *terms_by_token,
+			 GPtrArray   *terms,
+			 guint        component,
+			 SearchField  field,
+			 gchar      **tokens)
+{
+	for (guint i = 0; tokens != NULL && tokens[i] != NULL; i++) {
+		SearchTerm *term = g_hash_table_lookup (terms_by_token, tokens[i]);
+		SearchPosting posting = { component, field };
+
+		if (term == NULL) {
+			term = g_new0 (SearchTerm, 1);
+			term->token = g_strdup (tokens[i]);
+			term->postings = g_array_new (FALSE, FALSE, sizeof (SearchPosting));
+			g_hash_table_insert (terms_by_token, term->token, term);
+			g_ptr_array_add (terms, term);
+		}
+
+		/* components are added in order, so only the last posting can
+		 * be for this component */
+		if (term->postings->len > 0) {
+			SearchPosting *last = &g_array_index (term->postings, SearchPosting,
+							      term->postings->len - 1);
+			if (last->component == component) {
+				last->fields |= field;
+				continue;
+			}
+		}
+		g_array_append_val (term->postings, posting);
+	}
+}
+
+static void
+search_index_add_text (GHashTable  *terms_by_token,
+		       GPtrArray   *terms,
+		       guint        component,
+		       SearchField  field,
+		       const gchar *text)
+{
+	g_auto(GStrv) tokens = NULL;
+	g_auto(GStrv) ascii_alternates = NULL;
+
+	if (text == NULL || *text == '\0')
+		return;
+
+	tokens = g_str_tokenize_and_fold (text, NULL, &ascii_alternates);
+	search_index_add_tokens (terms_by_token, terms, component, field, tokens);
+	search_index_add_tokens (terms_by_token, terms, component, field, ascii_alternates);
+}
+
+static SearchField
+search_field_for_element (const gchar *element)
+{
+	if (g_strcmp0 (element, "id") == 0)
+		return SEARCH_FIELD_ID;
+	if (g_strcmp0 (element, "launchable") == 0)
+		return SEARCH_FIELD_LAUNCHABLE;
+	if (g_strcmp0 (element, "pkgname") == 0)
+		return SEARCH_FIELD_PKGNAME;
+	if (g_strcmp0 (element, "name") == 0)
+		return SEARCH_FIELD_NAME;
+	if (g_strcmp0 (element, "summary") == 0)
+		return SEARCH_FIELD_SUMMARY;
+	if (g_strcmp0 (element, "developer_name") == 0)
+		return SEARCH_FIELD_DEVELOPER_NAME;
+	if (g_strcmp0 (element, "project_group") == 0)
+		return SEARCH_FIELD_PROJECT_GROUP;
+	return SEARCH_FIELD_NONE;
+}
+
+/* Appends @text, casefolded, to the newline-separated list in @str, for
+ * substring matching */
+static void
+search_index_append_raw (GString **str, const gchar *text)
+{
+	g_autofree gchar *folded = NULL;
+
+	if (text == NULL)
+		return;
+	if (*str == NULL)
+		*str = g_string_new (NULL);
+	else
+		g_string_append_c (*str, '\n');
+	folded = g_utf8_casefold (text, -1);
+	g_string_append (*str, folded);
+}
+
+/* Whether the `stem()` XPath function in libxmlb actually stems, which depends
+ * on whether libxmlb was built with libstemmer. This is checked by querying a
+ * tiny silo, so the search index always stems tokens if and only if the
+ * `~=stem(?)` queries do. */
+static gboolean
+search_index_libxmlb_stems (void)
+{
+	static gsize stems = 0;
+
+	if (g_once_init_enter (&stems)) {
+		g_autoptr(XbBuilder) builder = xb_builder_new ();
+		g_autoptr(XbBuilderSource) source = xb_builder_source_new ();
+		g_autoptr(XbSilo) silo = NULL;
+		g_autoptr(XbNode) node = NULL;
+
+		/* ‘editing’ only matches ‘edit’ once it’s been stemmed */
+		if (xb_builder_source_load_xml (source, "<t>edit</t>", XB_BUILDER_SOURCE_FLAG_NONE, NULL)) {
+			xb_builder_import_source (builder, source);
+			silo = xb_builder_compile (builder, XB_BUILDER_COMPILE_FLAG_NONE, NULL, NULL);
+		}
+		if (silo != NULL)
+			node = xb_silo_query_first (silo, "t[text()~=stem('editing')]", NULL);
+
+		g_debug ("libxmlb %s search terms", (node != NULL) ? "stems" : "does not stem");
+		g_once_init_leave (&stems, (node != NULL) ? 2 : 1);
+	}
+
+	return (stems == 2);
+}
+
+/* Stems @token in the same way as the `stem()` XPath function in libxmlb, so
+ * that the index matches the same components as the `~=stem(?)` queries. This
+ * must only be called if search_index_can_stem() returns %TRUE. */
+static gchar *
+search_index_stem (const gchar *token)
+{
+#ifdef HAVE_LIBSTEMMER
+	static GMutex stemmer_mutex;
+	static struct sb_stemmer *stemmer = NULL;
+
+	if (search_index_libxmlb_stems ()) {
+		g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&stemmer_mutex);
+
+		if (stemmer == NULL)
+			stemmer = sb_stemmer_new ("en", NULL);
+		if (stemmer != NULL) {
+			const sb_symbol *stemmed = sb_stemmer_stem (stemmer, (const sb_symbol *) token, strlen (token));
+			if (stemmed != NULL && sb_stemmer_length (stemmer) > 0)
+				return g_utf8_strdown ((const gchar *) stemmed, sb_stemmer_length (stemmer));
+		}
+	}
+#endif
+	return g_utf8_strdown (token, -1);
+}
+
+/* Whether search_index_stem() stems tokens in the same way as libxmlb. If
+ * libxmlb stems but libstemmer wasn’t available when building this, it can’t,
+ * and the index mustn’t be used. */
+static gboolean
+search_index_can_stem (void)
+{
+#ifdef HAVE_LIBSTEMMER
+	return TRUE;
+#else
+	return !search_index_libxmlb_stems ();
+#endif
+}
+
+/* This indexes the same elements which are queried by gs_appstream_search()
+ * and gs_appstream_search_developer_apps(). The index is attached to @silo and
+ * lives as long as it does, so it only needs building when the silo has been
+ * (re)loaded; searches fall back to per-component XPath queries without it. */
+gboolean
+gs_appstream_silo_build_search_index (XbSilo        *silo,
+				      GCancellable  *cancellable,
+				      GError       **error)
+{
+	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GPtrArray) components = NULL;
+	g_autoptr(GHashTable) terms_by_token = NULL;
+	g_autoptr(GTimer) timer = g_timer_new ();
+	GsAppstreamSearchIndex *search_index;
+
+	g_return_val_if_fail (XB_IS_SILO (silo), FALSE);
+
+	/* an index which stems differently from libxmlb would match different
+	 * components from the `~=stem(?)` queries */
+	if (!search_index_can_stem ()) {
+		g_debug ("not building search index as libxmlb stems search terms but libstemmer is not available");
+		return TRUE;
+	}
+
+	components = xb_silo_query (silo, "components/component", 0, &error_local);
+	if (components == NULL) {
+		if (!g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+			g_propagate_error (error, g_steal_pointer (&error_local));
+			return FALSE;
+		}
+		components = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	}
+
+	search_index = g_new0 (GsAppstreamSearchIndex, 1);
+	search_index->n_components = components->len;
+	search_index->terms = g_ptr_array_new_with_free_func ((GDestroyNotify) search_term_free);
+	search_index->names = g_ptr_array_new_full (components->len, g_free);
+	search_index->pkgnames = g_ptr_array_new_full (components->len, g_free);
+	terms_by_token = g_hash_table_new (g_str_hash, g_str_equal);
+
+	for (guint i = 0; i < components->len; i++) {
+		XbNode *component = g_ptr_array_index (components, i);
+		g_autoptr(XbNode) parent = xb_node_get_parent (component);
+		GString *names = NULL;
+		GString *pkgnames = NULL;
+
+		if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+			gs_appstream_search_index_free (search_index);
+			return FALSE;
+		}
+
+		if (parent != NULL) {
+			search_index_add_text (terms_by_token, search_index->terms, i, SEARCH_FIELD_ORIGIN,
+					       xb_node_get_attr (parent, "origin"));
+		}
+
+		for (g_autoptr(XbNode) child = xb_node_get_child (component); child != NULL; node_set_to_next (&child)) {
+			const gchar *element = xb_node_get_element (child);
+			SearchField field;
+
+			if (g_strcmp0 (element, "keywords") == 0 ||
+			    g_strcmp0 (element, "mimetypes") == 0) {
+				field = g_strcmp0 (element, "keywords") == 0 ? SEARCH_FIELD_KEYWORD : SEARCH_FIELD_MIMETYPE;
+				for (g_autoptr(XbNode) n = xb_node_get_child (child); n != NULL; node_set_to_next (&n)) {
+					search_index_add_text (terms_by_token, search_index->terms, i, field,
+							       xb_node_get_text (n));
+				}
+				continue;
+			}
+
+			field = search_field_for_element (element);
+			if (field == SEARCH_FIELD_NONE)
+				continue;
+			search_index_add_text (terms_by_token, search_index->terms, i, field,
+					       xb_node_get_text (child));
+			if (field == SEARCH_FIELD_NAME)
+				search_index_append_raw (&names, xb_node_get_text (child));
+			else if (field == SEARCH_FIELD_PKGNAME)
+				search_index_append_raw (&pkgnames, xb_node_get_text (child));
+		}
+
+		g_ptr_array_add (search_index->names, names != NULL ? g_string_free (names, FALSE) : NULL);
+		g_ptr_array_add (search_index->pkgnames, pkgnames != NULL ? g_string_free (pkgnames, FALSE) : NULL);
+	}
+
+	g_ptr_array_sort (search_index->terms, search_term_cmp);
+
+	g_debug ("built search index of %u tokens for %u components in %fms",
+		 search_index->terms->len, search_index->n_components,
+		 g_timer_elapsed (timer, NULL) * 1000);
+
+	g_object_set_data_full (G_OBJECT (silo), GS_APPSTREAM_SEARCH_INDEX_KEY, search_index,
+				(GDestroyNotify) gs_appstream_search_index_free);
+
+	return TRUE;
+}
+
+typedef struct {
+	AsSearchTokenMatch	match_value;
+	const gchar		*xpath;
+	SearchField		 field;  /* for the search index */
+	gboolean		 substring;  /* whether @xpath matches with contains() */
+} Query;
+
+/* Returns the offset of the first term in @terms which is not less than @prefix */
+static guint
+search_index_lower_bound (GPtrArray   *terms,
+			  const gchar *prefix)
+{
+	guint lo = 0, hi = terms->len;
+
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+		const SearchTerm *term = g_ptr_array_index (terms, mid);
+		if (strcmp (term->token, prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Sets @term_matches[i] to the match value of @value for component i. Like
+ * the `~=stem(?)` XPath queries, a stemmed token in the search value matches
+ * any indexed token which it is a prefix of, and the `contains()` queries
+ * match the stemmed value as a substring. Both sides are casefolded. If
+ * @candidates is non-%NULL, substring matching is only done for components
+ * with a non-zero candidate value. */
+static void
+search_index_match_value (GsAppstreamSearchIndex *search_index,
+			  const Query             queries[],
+			  const gchar            *value,
+			  const guint16          *candidates,
+			  guint16                *term_matches)
+{
+	g_auto(GStrv) tokens = g_str_tokenize_and_fold (value, NULL, NULL);
+	g_autofree gchar *value_folded = NULL;
+	g_autofree gchar *needle = NULL;
+
+	memset (term_matches, 0, search_index->n_components * sizeof (guint16));
+
+	for (guint i = 0; tokens[i] != NULL; i++) {
+		g_autofree gchar *stem = search_index_stem (tokens[i]);
+
+		for (guint j = search_index_lower_bound (search_index->terms, stem); j < search_index->terms->len; j++) {
+			const SearchTerm *term = g_ptr_array_index (search_index->terms, j);
+
+			if (!g_str_has_prefix (term->token, stem))
+				break;
+
+			for (guint k = 0; k < term->postings->len; k++) {
+				const SearchPosting *posting = &g_array_index (term->postings, SearchPosting, k);
+				for (guint q = 0; queries[q].xpath != NULL; q++) {
+					if (!queries[q].substring && (posting->fields & queries[q].field) != 0)
+						term_matches[posting->component] |= queries[q].match_value;
+				}
+			}
+		}
+	}
+
+	/* substring matches against the casefolded raw text */
+	value_folded = g_utf8_casefold (value, -1);
+	needle = search_index_stem (value_folded);
+	for (guint q = 0; queries[q].xpath != NULL; q++) {
+		GPtrArray *texts;
+
+		if (!queries[q].substring)
+			continue;
+		if (queries[q].field == SEARCH_FIELD_NAME)
+			texts = search_index->names;
+		else if (queries[q].field == SEARCH_FIELD_PKGNAME)
+			texts = search_index->pkgnames;
+		else
+			continue;
+
+		for (guint i = 0; i < search_index->n_components; i++) {
+			const gchar *text = g_ptr_array_index (texts, i);
+			if (candidates != NULL && candidates[i] == 0)
+				continue;
+			if (text != NULL && strstr (text, needle) != NULL)
+				term_matches[i] |= queries[q].match_value;
+		}
+	}
+}
+
+static gboolean
+search_index_supports_queries (const Query queries[])
+{
+	for (guint i = 0; queries[i].xpath != NULL; i++) {
+		if (queries[i].field == SEARCH_FIELD_NONE)
+			return FALSE;
+	}
+	return TRUE;
+}
+
 typedef struct {
 	AsSearchTokenMatch	 match_value;
 	XbQuery			*query;
@@ -1525,10 +1947,135 @@ gs_appstream_silo_search_component (GPtrArray *array, XbNode *component, const g
 	return matches_sum;
 }
 
-typedef struct {
-	AsSearchTokenMatch	match_value;
-	const gchar		*xpath;
-} Query;
+static gboolean
+gs_appstream_search_add_component (GsPlugin   *plugin,
+				   XbSilo     *silo,
+				   XbNode     *component,
+				   guint16     match_value,
+				   GsAppList  *list,
+				   GError    **error)
+{
+	g_autoptr(GsApp) app = gs_appstream_create_app (plugin, silo, component, error);
+	if (app == NULL)
+		return FALSE;
+	if (gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD)) {
+		g_debug ("not returning wildcard %s",
+			 gs_app_get_unique_id (app));
+		return TRUE;
+	}
+	g_debug ("add %s", gs_app_get_unique_id (app));
+
+	/* The match value is used for prioritising results.
+	 * Drop the ID token from it as it’s the highest
+	 * numeric value but isn’t visible to the user in the
+	 * UI, which leads to confusing results ordering. */
+	gs_app_set_match_value (app, match_value & (~AS_SEARCH_TOKEN_MATCH_ID));
+	gs_app_list_add (list, app);
+
+	if (gs_app_get_kind (app) == AS_COMPONENT_KIND_ADDON) {
+		g_autoptr(GPtrArray) extends = NULL;
+
+		/* add the parent app as a wildcard, to be refined later */
+		extends = xb_node_query (component, "extends", 0, NULL);
+		for (guint jj = 0; extends && jj < extends->len; jj++) {
+			XbNode *extend = g_ptr_array_index (extends, jj);
+			g_autoptr(GsApp) app2 = NULL;
+			const gchar *tmp;
+			app2 = gs_app_new (xb_node_get_text (extend));
+			gs_app_add_quirk (app2, GS_APP_QUIRK_IS_WILDCARD);
+			tmp = xb_node_query_attr (extend, "../..", "origin", NULL);
+			if (gs_appstream_origin_valid (tmp))
+				gs_app_set_origin_appstream (app2, tmp);
+			gs_app_list_add (list, app2);
+		}
+	}
+
+	return TRUE;
+}
+
+/* Search using the index attached to @silo by
+ * gs_appstream_silo_build_search_index(). Sets @out_used_index to %FALSE if
+ * there is no usable index, in which case nothing is added to @list. */
+static gboolean
+gs_appstream_do_search_index (GsPlugin            *plugin,
+			      XbSilo              *silo,
+			      const gchar * const *values,
+			      const Query          queries[],
+			      GsAppList           *list,
+			      gboolean            *out_used_index,
+			      GCancellable        *cancellable,
+			      GError             **error)
+{
+	GsAppstreamSearchIndex *search_index;
+	g_autofree guint16 *matches = NULL;
+	g_autofree guint16 *term_matches = NULL;
+	g_autoptr(GPtrArray) components = NULL;
+	g_autoptr(GError) error_local = NULL;
+
+	*out_used_index = FALSE;
+
+	search_index = g_object_get_data (G_OBJECT (silo), GS_APPSTREAM_SEARCH_INDEX_KEY);
+	if (search_index == NULL || !search_index_supports_queries (queries))
+		return TRUE;
+
+	*out_used_index = TRUE;
+	if (search_index->n_components == 0)
+		return TRUE;
+
+	/* do *all* search keywords match */
+	matches = g_new0 (guint16, search_index->n_components);
+	term_matches = g_new0 (guint16, search_index->n_components);
+	for (guint i = 0; values[i] != NULL; i++) {
+		gboolean any_match = FALSE;
+
+		search_index_match_value (search_index, queries, values[i],
+					  (i > 0) ? matches : NULL,
+					  term_matches);
+
+		for (guint j = 0; j < search_index->n_components; j++) {
+			if (i == 0)
+				matches[j] = term_matches[j];
+			else if (term_matches[j] == 0)
+				matches[j] = 0;
+			else
+				matches[j] |= term_matches[j];
+			any_match |= (matches[j] != 0);
+		}
+
+		if (!any_match)
+			return TRUE;
+		if (g_cancellable_set_error_if_cancelled (cancellable, error))
+			return FALSE;
+	}
+
+	/* map the matching offsets back to nodes */
+	components = xb_silo_query (silo, "components/component", 0, &error_local);
+	if (components == NULL) {
+		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+			return TRUE;
+		g_propagate_error (error, g_steal_pointer (&error_local));
+		return FALSE;
+	}
+	if (components->len != search_index->n_components) {
+		g_warning ("search index has %u components but silo has %u; ignoring index",
+			   search_index->n_components, components->len);
+		*out_used_index = FALSE;
+		return TRUE;
+	}
+
+	for (guint i = 0; i < components->len; i++) {
+		if (matches[i] == 0)
+			continue;
+		if (!gs_appstream_search_add_component (plugin, silo,
+							g_ptr_array_index (components, i),
+							matches[i], list, error))
+			return FALSE;
+		if (g_cancellable_set_error_if_cancelled (cancellable, error))
+			return FALSE;
+	}
+
+	return TRUE;
+}
 
 static gboolean
 gs_appstream_do_search (GsPlugin *plugin,
@@ -1543,12 +2090,22 @@ gs_appstream_do_search (GsPlugin *plugin,
 	g_autoptr(GPtrArray) array = g_ptr_array_new_with_free_func ((GDestroyNotify) gs_appstream_search_helper_free);
 	g_autoptr(GPtrArray) components = NULL;
 	g_autoptr(GTimer) timer = g_timer_new ();
+	gboolean used_index = FALSE;
 
 	g_return_val_if_fail (GS_IS_PLUGIN (plugin), FALSE);
 	g_return_val_if_fail (XB_IS_SILO (silo), FALSE);
 	g_return_val_if_fail (values != NULL, FALSE);
 	g_return_val_if_fail (GS_IS_APP_LIST (list), FALSE);
 
+	/* use the precompiled index if there is one */
+	if (!gs_appstream_do_search_index (plugin, silo, values, queries, list,
+					   &used_index, cancellable, error))
+		return FALSE;
+	if (used_index) {
+		g_debug ("indexed search took %fms", g_timer_elapsed (timer, NULL) * 1000);
+		return TRUE;
+	}
+
 	/* add some weighted queries */
 	for (guint i = 0; queries[i].xpath != NULL; i++) {
 		g_autoptr(GError) error_query = NULL;
@@ -1574,42 +2131,9 @@ gs_appstream_do_search (GsPlugin *plugin,
 	for (guint i = 0; i < components->len; i++) {
 		XbNode *component = g_ptr_array_index (components, i);
 		guint16 match_value = gs_appstream_silo_search_component (array, component, values);
-		if (match_value != 0) {
-			g_autoptr(GsApp) app = gs_appstream_create_app (plugin, silo, component, error);
-			if (app == NULL)
-				return FALSE;
-			if (gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD)) {
-				g_debug ("not returning wildcard %s",
-					 gs_app_get_unique_id (app));
-				continue;
-			}
-			g_debug ("add %s", gs_app_get_unique_id (app));
-
-			/* The match value is used for prioritising results.
-			 * Drop the ID token from it as it’s the highest
-			 * numeric value but isn’t visible to the user in the
-			 * UI, which leads to confusing results ordering. */
-			gs_app_set_match_value (app, match_value & (~AS_SEARCH_TOKEN_MATCH_ID));
-			gs_app_list_add (list, app);
-
-			if (gs_app_get_kind (app) == AS_COMPONENT_KIND_ADDON) {
-				g_autoptr(GPtrArray) extends = NULL;
-
-				/* add the parent app as a wildcard, to be refined later */
-				extends = xb_node_query (component, "extends", 0, NULL);
-				for (guint jj = 0; extends && jj < extends->len; jj++) {
-					XbNode *extend = g_ptr_array_index (extends, jj);
-					g_autoptr(GsApp) app2 = NULL;
-					const gchar *tmp;
-					app2 = gs_app_new (xb_node_get_text (extend));
-					gs_app_add_quirk (app2, GS_APP_QUIRK_IS_WILDCARD);
-					tmp = xb_node_query_attr (extend, "../..", "origin", NULL);
-					if (gs_appstream_origin_valid (tmp))
-						gs_app_set_origin_appstream (app2, tmp);
-					gs_app_list_add (list, app2);
-				}
-			}
-		}
+		if (match_value != 0 &&
+		    !gs_appstream_search_add_component (plugin, silo, component, match_value, list, error))
+			return FALSE;
 
 		if (g_cancellable_set_error_if_cancelled (cancellable, error))
 			return FALSE;
@@ -1630,9 +2154,9 @@ gs_appstream_search (GsPlugin *plugin,
 {
 	const Query queries[] = {
 		#ifdef HAVE_AS_SEARCH_TOKEN_MATCH_MEDIATYPE
-		{ AS_SEARCH_TOKEN_MATCH_MEDIATYPE,	"mimetypes/mimetype[text()~=stem(?)]" },
+		{ AS_SEARCH_TOKEN_MATCH_MEDIATYPE,	"mimetypes/mimetype[text()~=stem(?)]", SEARCH_FIELD_MIMETYPE, FALSE },
 		#else
-		{ AS_SEARCH_TOKEN_MATCH_MIMETYPE,	"mimetypes/mimetype[text()~=stem(?)]" },
+		{ AS_SEARCH_TOKEN_MATCH_MIMETYPE,	"mimetypes/mimetype[text()~=stem(?)]", SEARCH_FIELD_MIMETYPE, FALSE },
 		#endif
 		/* Search once with a tokenize-and-casefold operator (`~=`) to support casefolded
 		 * full-text search, then again using substring matching (`contains()`), to
@@ -1640,16 +2164,16 @@ gs_appstream_search (GsPlugin *plugin,
 		 * lower priority, otherwise things will get confusing.
 		 * 
 		 * See https://gitlab.gnome.org/GNOME/gnome-software/-/issues/2277 */
-		{ AS_SEARCH_TOKEN_MATCH_PKGNAME,	"pkgname[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_PKGNAME / 2,	"pkgname[contains(text(),stem(?))]" },
-		{ AS_SEARCH_TOKEN_MATCH_SUMMARY,	"summary[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_NAME,		"name[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_NAME / 2,	"name[contains(text(),stem(?))]" },
-		{ AS_SEARCH_TOKEN_MATCH_KEYWORD,	"keywords/keyword[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_ID,		"id[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_ID,		"launchable[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_ORIGIN,		"../components[@origin~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_NONE,		NULL }
+		{ AS_SEARCH_TOKEN_MATCH_PKGNAME,	"pkgname[text()~=stem(?)]", SEARCH_FIELD_PKGNAME, FALSE },
+		{ AS_SEARCH_TOKEN_MATCH_PKGNAME / 2,	"pkgname[contains(text(),stem(?))]", SEARCH_FIELD_PKGNAME, TRUE },
+		{ AS_SEARCH_TOKEN_MATCH_SUMMARY,	"summary[text()~=stem(?)]", SEARCH_FIELD_SUMMARY, FALSE },
+		{ AS_SEARCH_TOKEN_MATCH_NAME,		"name[text()~=stem(?)]", SEARCH_FIELD_NAME, FALSE },
+		{ AS_SEARCH_TOKEN_MATCH_NAME / 2,	"name[contains(text(),stem(?))]", SEARCH_FIELD_NAME, TRUE },
+		{ AS_SEARCH_TOKEN_MATCH_KEYWORD,	"keywords/keyword[text()~=stem(?)]", SEARCH_FIELD_KEYWORD, FALSE },
+		{ AS_SEARCH_TOKEN_MATCH_ID,		"id[text()~=stem(?)]", SEARCH_FIELD_ID, FALSE },
+		{ AS_SEARCH_TOKEN_MATCH_ID,		"launchable[text()~=stem(?)]", SEARCH_FIELD_LAUNCHABLE, FALSE },
+		{ AS_SEARCH_TOKEN_MATCH_ORIGIN,		"../components[@origin~=stem(?)]", SEARCH_FIELD_ORIGIN, FALSE },
+		{ AS_SEARCH_TOKEN_MATCH_NONE,		NULL, SEARCH_FIELD_NONE, FALSE }
 	};
 
 	return gs_appstream_do_search (plugin, silo, values, queries, list, cancellable, error);
@@ -1664,9 +2188,9 @@ gs_appstream_search_developer_apps (GsPlugin *plugin,
 				    GError **error)
 {
 	const Query queries[] = {
-		{ AS_SEARCH_TOKEN_MATCH_PKGNAME,	"developer_name[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_SUMMARY,	"project_group[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_NONE,		NULL }
+		{ AS_SEARCH_TOKEN_MATCH_PKGNAME,	"developer_name[text()~=stem(?)]", SEARCH_FIELD_DEVELOPER_NAME, FALSE },
+		{ AS_SEARCH_TOKEN_MATCH_SUMMARY,	"project_group[text()~=stem(?)]", SEARCH_FIELD_PROJECT_GROUP, FALSE },
+		{ AS_SEARCH_TOKEN_MATCH_NONE,		NULL, SEARCH_FIELD_NONE, FALSE }
 	};
 
 	return gs_appstream_do_search (plugin, silo, values, queries, list, cancellable, error);
@@ -1736,37 +2260,113 @@ gs_appstream_add_category_apps (GsPlugin *plugin,
 	return TRUE;
 }
 
-static guint
-gs_appstream_count_component_for_groups (XbSilo      *silo,
-                                         const gchar *desktop_group)
+#define GS_APPSTREAM_CATEGORY_HISTOGRAM_KEY	"GnomeSoftware::CategoryHistogram"
+
+/* Protects building and attaching the category histogram to a silo */
+G_LOCK_DEFINE_STATIC (category_histogram);
+
+/* Count how many components are in each desktop group, in a single pass over
+ * @silo. The keys are desktop groups, either a single category (`X`) for the
+ * “all” group of a parent category, or two categories (`X::Y`) for the
+ * components which are in both. */
+static GHashTable *
+gs_appstream_build_category_histogram (XbSilo        *silo,
+                                       GCancellable  *cancellable,
+                                       GError       **error)
 {
-	guint limit = 10;
-	g_autofree gchar *xpath = NULL;
-	g_auto(GStrv) split = g_strsplit (desktop_group, "::", -1);
+	g_autoptr(GHashTable) histogram = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 	g_autoptr(GPtrArray) array = NULL;
+	g_autoptr(GPtrArray) categories = g_ptr_array_new ();
 	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GTimer) timer = g_timer_new ();
 
-	if (g_strv_length (split) == 1) { /* "all" group for a parent category */
-		xpath = g_strdup_printf ("components/component[not(@merge)]/categories/"
-					 "category[text()='%s']/../..",
-					 split[0]);
-	} else if (g_strv_length (split) == 2) {
-		xpath = g_strdup_printf ("components/component[not(@merge)]/categories/"
-					 "category[text()='%s']/../"
-					 "category[text()='%s']/../..",
-					 split[0], split[1]);
-	} else {
-		return 0;
-	}
-
-	array = xb_silo_query (silo, xpath, limit, &error_local);
+	array = xb_silo_query (silo, "components/component[not(@merge)]/categories", 0, &error_local);
 	if (array == NULL) {
 		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-			return 0;
-		g_warning ("%s", error_local->message);
-		return 0;
+			return g_steal_pointer (&histogram);
+		g_propagate_error (error, g_steal_pointer (&error_local));
+		return NULL;
+	}
+
+	for (guint i = 0; i < array->len; i++) {
+		XbNode *categories_node = g_ptr_array_index (array, i);
+
+		if (g_cancellable_set_error_if_cancelled (cancellable, error))
+			return NULL;
+
+		/* each category is only counted once per component */
+		g_ptr_array_set_size (categories, 0);
+		for (g_autoptr(XbNode) n = xb_node_get_child (categories_node); n != NULL; node_set_to_next (&n)) {
+			const gchar *category = xb_node_get_text (n);
+			if (g_strcmp0 (xb_node_get_element (n), "category") != 0 || category == NULL)
+				continue;
+			if (!g_ptr_array_find_with_equal_func (categories, category, g_str_equal, NULL))
+				g_ptr_array_add (categories, (gpointer) category);
+		}
+
+		for (guint j = 0; j < categories->len; j++) {
+			const gchar *category = g_ptr_array_index (categories, j);
+			guint count = GPOINTER_TO_UINT (g_hash_table_lookup (histogram, category));
+
+			g_hash_table_insert (histogram, g_strdup (category), GUINT_TO_POINTER (count + 1));
+
+			for (guint k = 0; k < categories->len; k++) {
+				g_autofree gchar *group = NULL;
+
+				if (k == j)
+					continue;
+
+				group = g_strdup_printf ("%s::%s", category, (const gchar *) g_ptr_array_index (categories, k));
+				count = GPOINTER_TO_UINT (g_hash_table_lookup (histogram, group));
+				g_hash_table_insert (histogram, g_steal_pointer (&group), GUINT_TO_POINTER (count + 1));
+			}
+		}
+	}
+
+	g_debug ("built category histogram of %u groups for %u components in %.0fms",
+		 g_hash_table_size (histogram), array->len,
+		 g_timer_elapsed (timer, NULL) * 1000);
+
+	return g_steal_pointer (&histogram);
+}
+
+/* Get the category histogram for @silo, building it if needed. It’s attached
+ * to @silo, so it’s rebuilt whenever the silo is. */
+static GHashTable *
+gs_appstream_ensure_category_histogram (XbSilo        *silo,
+                                        GCancellable  *cancellable,
+                                        GError       **error)
+{
+	GHashTable *histogram;
+
+	G_LOCK (category_histogram);
+
+	histogram = g_object_get_data (G_OBJECT (silo), GS_APPSTREAM_CATEGORY_HISTOGRAM_KEY);
+	if (histogram == NULL) {
+		histogram = gs_appstream_build_category_histogram (silo, cancellable, error);
+		if (histogram != NULL)
+			g_object_set_data_full (G_OBJECT (silo), GS_APPSTREAM_CATEGORY_HISTOGRAM_KEY,
+						histogram, (GDestroyNotify) g_hash_table_unref);
 	}
-	return array->len;
+
+	G_UNLOCK (category_histogram);
+
+	return histogram;
+}
+
+static guint
+gs_appstream_count_component_for_groups (GHashTable  *histogram,
+                                         const gchar *desktop_group)
+{
+	g_auto(GStrv) split = g_strsplit (desktop_group, "::", -1);
+
+	/* the histogram only has pairs of different categories */
+	if (g_strv_length (split) == 2 && g_str_equal (split[0], split[1]))
+		return GPOINTER_TO_UINT (g_hash_table_lookup (histogram, split[0]));
+	else if (g_strv_length (split) == 1 || g_strv_length (split) == 2)
+		return GPOINTER_TO_UINT (g_hash_table_lookup (histogram, desktop_group));
+
+	return 0;
 }
 
 /* we're not actually adding categories here, we're just setting the number of
@@ -1777,9 +2377,15 @@ gs_appstream_refine_category_sizes (XbSilo        *silo,
                                     GCancellable  *cancellable,
                                     GError       **error)
 {
+	GHashTable *histogram;
+
 	g_return_val_if_fail (XB_IS_SILO (silo), FALSE);
 	g_return_val_if_fail (list != NULL, FALSE);
 
+	histogram = gs_appstream_ensure_category_histogram (silo, cancellable, error);
+	if (histogram == NULL)
+		return FALSE;
+
 	for (guint j = 0; j < list->len; j++) {
 		GsCategory *parent = GS_CATEGORY (g_ptr_array_index (list, j));
 		GPtrArray *children = gs_category_get_children (parent);
@@ -1789,7 +2395,7 @@ gs_appstream_refine_category_sizes (XbSilo        *silo,
 			GPtrArray *groups = gs_category_get_desktop_groups (cat);
 			for (guint k = 0; k < groups->len; k++) {
 				const gchar *group = g_ptr_array_index (groups, k);
-				guint cnt = gs_appstream_count_component_for_groups (silo, group);
+				guint cnt = gs_appstream_count_component_for_groups (histogram, group);
 				if (cnt > 0) {
 					gs_category_increment_size (parent, cnt);
 					if (children->len > 1) {
@@ -2060,6 +2666,427 @@ gs_appstream_add_deployment_featured (XbSilo *silo,
 	return gs_appstream_add_featured_with_query (silo, query->str, list, cancellable, error);
 }
 
+/* Query properties which gs_appstream_add_apps_for_query() can combine,
+ * in the order they’re evaluated. The first one which is set is used to find
+ * the candidate components with an XPath query, and the others are tested on
+ * each candidate in turn, so the most selective and cheapest to test come
+ * first: few components are featured or curated, whereas testing a category
+ * means looking at every category of the component. */
+typedef enum {
+	QUERY_PREDICATE_DEPLOYMENT_FEATURED,
+	QUERY_PREDICATE_FEATURED,
+	QUERY_PREDICATE_CURATED,
+	QUERY_PREDICATE_RELEASED_SINCE,
+	QUERY_PREDICATE_INSTALLED,
+	QUERY_PREDICATE_CATEGORY,
+	N_QUERY_PREDICATES
+} QueryPredicate;
+
+typedef struct {
+	gboolean	 enabled[N_QUERY_PREDICATES];
+	GString		*xpaths[N_QUERY_PREDICATES];  /* (owned) (nullable), to find candidates from the silo root */
+	GString		*test_xpaths[N_QUERY_PREDICATES];  /* (owned) (nullable), relative to a component */
+	XbQuery		*queries[N_QUERY_PREDICATES];  /* (owned) (nullable), compiled from @test_xpaths */
+	guint64		 max_future_timestamp;
+	GPtrArray	*desktop_groups;  /* (unowned) (nullable) (element-type utf8) */
+	GHashTable	*installed_ids;  /* (owned) (nullable) (element-type utf8 utf8) */
+} QueryPlan;
+
+static void
+query_plan_clear (QueryPlan *plan)
+{
+	for (guint i = 0; i < N_QUERY_PREDICATES; i++) {
+		if (plan->xpaths[i] != NULL)
+			g_string_free (plan->xpaths[i], TRUE);
+		if (plan->test_xpaths[i] != NULL)
+			g_string_free (plan->test_xpaths[i], TRUE);
+		g_clear_object (&plan->queries[i]);
+	}
+	g_clear_pointer (&plan->installed_ids, g_hash_table_unref);
+}
+
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC (QueryPlan, query_plan_clear)
+
+/* Add a condition on a component’s grandchild, such as `kudos/kudo[…]`, for
+ * @predicate. It’s added both as a query for candidate components and as a
+ * test on a component, and multiple conditions are ORed together. */
+static void
+query_plan_add_condition (QueryPlan      *plan,
+                          QueryPredicate  predicate,
+                          const gchar    *condition)
+{
+	if (plan->xpaths[predicate] == NULL) {
+		plan->xpaths[predicate] = g_string_new (NULL);
+		plan->test_xpaths[predicate] = g_string_new (NULL);
+	}
+	xb_string_append_union (plan->xpaths[predicate], "components/component/%s/../..", condition);
+	xb_string_append_union (plan->test_xpaths[predicate], "%s", condition);
+	plan->enabled[predicate] = TRUE;
+}
+
+/* Whether gs_appstream_add_apps_for_query() supports all the properties which
+ * are set on @query. */
+gboolean
+gs_appstream_query_is_compound_supported (GsAppQuery *query)
+{
+	g_return_val_if_fail (GS_IS_APP_QUERY (query), FALSE);
+
+	if (gs_app_query_get_provides_files (query) != NULL ||
+	    gs_app_query_get_developers (query) != NULL ||
+	    gs_app_query_get_keywords (query) != NULL ||
+	    gs_app_query_get_alternate_of (query) != NULL ||
+	    gs_app_query_get_provides (query, NULL) != GS_APP_QUERY_PROVIDES_UNKNOWN)
+		return FALSE;
+
+	/* GS_APP_QUERY_TRISTATE_FALSE isn’t supported either */
+	if (gs_app_query_get_is_curated (query) == GS_APP_QUERY_TRISTATE_FALSE ||
+	    gs_app_query_get_is_featured (query) == GS_APP_QUERY_TRISTATE_FALSE ||
+	    gs_app_query_get_is_installed (query) == GS_APP_QUERY_TRISTATE_FALSE)
+		return FALSE;
+
+	return gs_app_query_get_n_properties_set (query) > 0;
+}
+
+static gboolean
+query_plan_init (QueryPlan   *plan,
+                 XbSilo      *silo,
+                 GsAppQuery  *query,
+                 GError     **error)
+{
+	GDateTime *released_since = gs_app_query_get_released_since (query);
+	const gchar * const *deployment_featured = gs_app_query_get_deployment_featured (query);
+	GsCategory *category = gs_app_query_get_category (query);
+	guint64 now = (guint64) g_get_real_time () / G_USEC_PER_SEC;
+
+	memset (plan, 0, sizeof (*plan));
+
+	for (gsize i = 0; deployment_featured != NULL && deployment_featured[i] != NULL; i++) {
+		g_autofree gchar *escaped = xb_string_escape (deployment_featured[i]);
+		g_autofree gchar *condition = NULL;
+
+		if (escaped == NULL || *escaped == '\0')
+			continue;
+		condition = g_strdup_printf ("custom/value[@key='GnomeSoftware::DeploymentFeatured'][text()='%s']", escaped);
+		query_plan_add_condition (plan, QUERY_PREDICATE_DEPLOYMENT_FEATURED, condition);
+	}
+
+	/* a deployment-featured query with no valid deployments matches
+	 * nothing, as in gs_appstream_add_deployment_featured() */
+	if (deployment_featured != NULL && !plan->enabled[QUERY_PREDICATE_DEPLOYMENT_FEATURED])
+		return TRUE;
+
+	if (gs_app_query_get_is_featured (query) == GS_APP_QUERY_TRISTATE_TRUE) {
+		query_plan_add_condition (plan, QUERY_PREDICATE_FEATURED, "custom/value[@key='GnomeSoftware::FeatureTile']");
+		query_plan_add_condition (plan, QUERY_PREDICATE_FEATURED, "custom/value[@key='GnomeSoftware::FeatureTile-css']");
+	}
+
+	if (gs_app_query_get_is_curated (query) == GS_APP_QUERY_TRISTATE_TRUE)
+		query_plan_add_condition (plan, QUERY_PREDICATE_CURATED, "kudos/kudo[text()='GnomeSoftware::popular']");
+
+	if (released_since != NULL) {
+		g_autoptr(GDateTime) now_dt = g_date_time_new_now_utc ();
+		guint64 age_secs = g_date_time_difference (now_dt, released_since) / G_TIME_SPAN_SECOND;
+		g_autofree gchar *condition = g_strdup_printf ("releases/release[@timestamp>%" G_GUINT64_FORMAT "]", now - age_secs);
+
+		query_plan_add_condition (plan, QUERY_PREDICATE_RELEASED_SINCE, condition);
+
+		/* as in gs_appstream_add_recent() */
+		plan->max_future_timestamp = now + (3 * 24 * 60 * 60);
+	}
+
+	/* installed AppData files are top-level components, so this is tested
+	 * on each component in C. The candidates found by the other predicates
+	 * are `components/component` nodes from the catalogs, so they are
+	 * matched to the installed components by ID. */
+	if (gs_app_query_get_is_installed (query) == GS_APP_QUERY_TRISTATE_TRUE) {
+		gboolean is_first = TRUE;
+
+		for (guint i = 0; i < QUERY_PREDICATE_INSTALLED; i++)
+			is_first = is_first && (plan->xpaths[i] == NULL);
+
+		plan->xpaths[QUERY_PREDICATE_INSTALLED] = g_string_new ("component/description/..");
+		plan->enabled[QUERY_PREDICATE_INSTALLED] = TRUE;
+
+		if (!is_first) {
+			g_autoptr(GPtrArray) installed = NULL;
+
+			plan->installed_ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+			installed = xb_silo_query (silo, "component/description/../id", 0, NULL);
+			for (guint j = 0; installed != NULL && j < installed->len; j++) {
+				const gchar *id = xb_node_get_text (g_ptr_array_index (installed, j));
+				if (id != NULL)
+					g_hash_table_add (plan->installed_ids, g_strdup (id));
+			}
+		}
+	}
+
+	/* categories are also tested in C, and are never used to find the
+	 * candidates, as the other predicates are all more selective */
+	if (category != NULL) {
+		plan->desktop_groups = gs_category_get_desktop_groups (category);
+		plan->enabled[QUERY_PREDICATE_CATEGORY] = TRUE;
+	}
+
+	/* compile the tests once, rather than once per component */
+	for (guint i = 0; i < N_QUERY_PREDICATES; i++) {
+		if (plan->test_xpaths[i] == NULL)
+			continue;
+
+		plan->queries[i] = xb_query_new (silo, plan->test_xpaths[i]->str, error);
+		if (plan->queries[i] == NULL)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+query_plan_component_is_in_category (QueryPlan *plan,
+                                     XbNode    *component)
+{
+	g_autoptr(XbNode) categories_node = NULL;
+	g_autoptr(GPtrArray) categories = NULL;
+
+	if (xb_node_get_attr (component, "merge") != NULL)
+		return FALSE;
+
+	categories_node = xb_node_query_first (component, "categories", NULL);
+	if (categories_node == NULL)
+		return FALSE;
+
+	categories = g_ptr_array_new ();
+	for (g_autoptr(XbNode) n = xb_node_get_child (categories_node); n != NULL; node_set_to_next (&n)) {
+		if (g_strcmp0 (xb_node_get_element (n), "category") == 0 && xb_node_get_text (n) != NULL)
+			g_ptr_array_add (categories, (gpointer) xb_node_get_text (n));
+	}
+
+	for (guint i = 0; i < plan->desktop_groups->len; i++) {
+		const gchar *desktop_group = g_ptr_array_index (plan->desktop_groups, i);
+		g_auto(GStrv) split = g_strsplit (desktop_group, "::", -1);
+		guint n_split = g_strv_length (split);
+
+		if ((n_split == 1 || n_split == 2) &&
+		    g_ptr_array_find_with_equal_func (categories, split[0], g_str_equal, NULL) &&
+		    (n_split == 1 || g_ptr_array_find_with_equal_func (categories, split[1], g_str_equal, NULL)))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gboolean
+query_plan_matches (QueryPlan      *plan,
+                    QueryPredicate  first_predicate,
+                    XbNode         *component)
+{
+	if (plan->enabled[QUERY_PREDICATE_RELEASED_SINCE]) {
+		guint64 timestamp = component_get_release_timestamp (component);
+		if (timestamp == G_MAXUINT64 || timestamp >= plan->max_future_timestamp)
+			return FALSE;
+	}
+
+	/* the candidates already match @first_predicate */
+	for (guint i = first_predicate + 1; i < N_QUERY_PREDICATES; i++) {
+		if (!plan->enabled[i])
+			continue;
+
+		if (i == QUERY_PREDICATE_INSTALLED) {
+			const gchar *component_id = xb_node_query_text (component, "id", NULL);
+
+			if (component_id == NULL ||
+			    !g_hash_table_contains (plan->installed_ids, component_id))
+				return FALSE;
+		} else if (i == QUERY_PREDICATE_CATEGORY) {
+			if (!query_plan_component_is_in_category (plan, component))
+				return FALSE;
+		} else {
+			g_autoptr(GPtrArray) results = xb_node_query_full (component, plan->queries[i], NULL);
+			if (results == NULL)
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* Add the apps in @silo which match all the properties set on @query, in a
+ * single pass over the candidate components. An app is only created for a
+ * component once it has matched all of them, so combining properties in one
+ * query is cheaper than intersecting the results of one query per property.
+ *
+ * Check gs_appstream_query_is_compound_supported() first. */
+gboolean
+gs_appstream_add_apps_for_query (GsPlugin      *plugin,
+                                 XbSilo        *silo,
+                                 GsAppQuery    *query,
+                                 GsAppList     *list,
+                                 GCancellable  *cancellable,
+                                 GError       **error)
+{
+	g_auto(QueryPlan) plan = { 0, };
+	g_autoptr(GPtrArray) components = NULL;
+	g_autoptr(GError) error_local = NULL;
+	QueryPredicate first_predicate = N_QUERY_PREDICATES;
+
+	g_return_val_if_fail (GS_IS_PLUGIN (plugin), FALSE);
+	g_return_val_if_fail (XB_IS_SILO (silo), FALSE);
+	g_return_val_if_fail (gs_appstream_query_is_compound_supported (query), FALSE);
+	g_return_val_if_fail (GS_IS_APP_LIST (list), FALSE);
+
+	if (!query_plan_init (&plan, silo, query, error))
+		return FALSE;
+
+	for (guint i = 0; i < N_QUERY_PREDICATES; i++) {
+		if (plan.xpaths[i] != NULL) {
+			first_predicate = i;
+			break;
+		}
+	}
+
+	/* nothing can match */
+	if (first_predicate == N_QUERY_PREDICATES)
+		return TRUE;
+
+	components = xb_silo_query (silo, plan.xpaths[first_predicate]->str, 0, &error_local);
+	if (components == NULL) {
+		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+			return TRUE;
+		g_propagate_error (error, g_steal_pointer (&error_local));
+		return FALSE;
+	}
+
+	for (guint i = 0; i < components->len; i++) {
+		XbNode *component = g_ptr_array_index (components, i);
+		g_autoptr(GsApp) app = NULL;
+
+		if (g_cancellable_set_error_if_cancelled (cancellable, error))
+			return FALSE;
+
+		if (!query_plan_matches (&plan, first_predicate, component))
+			continue;
+
+		/* create the app in the same way as the functions for the
+		 * individual properties would */
+		if (plan.enabled[QUERY_PREDICATE_RELEASED_SINCE] ||
+		    plan.enabled[QUERY_PREDICATE_INSTALLED]) {
+			app = gs_appstream_create_app (plugin, silo, component, error);
+			if (app == NULL)
+				return FALSE;
+		} else {
+			const gchar *component_id = xb_node_query_text (component, "id", NULL);
+			if (component_id == NULL)
+				continue;
+			app = gs_app_new (component_id);
+			gs_app_set_metadata (app, "GnomeSoftware::Creator",
+					     gs_plugin_get_name (plugin));
+			gs_app_add_quirk (app, GS_APP_QUIRK_IS_WILDCARD);
+		}
+
+		if ((plan.enabled[QUERY_PREDICATE_FEATURED] ||
+		     plan.enabled[QUERY_PREDICATE_DEPLOYMENT_FEATURED]) &&
+		    !gs_appstream_copy_metadata (app, component, error))
+			return FALSE;
+		if (plan.enabled[QUERY_PREDICATE_RELEASED_SINCE])
+			gs_app_set_release_date (app, component_get_release_timestamp (component));
+		if (plan.enabled[QUERY_PREDICATE_INSTALLED]) {
+			if (gs_app_get_state (app) != GS_APP_STATE_UPDATABLE &&
+			    gs_app_get_state (app) != GS_APP_STATE_UPDATABLE_LIVE)
+				gs_app_set_state (app, GS_APP_STATE_INSTALLED);
+			gs_app_set_scope (app, AS_COMPONENT_SCOPE_SYSTEM);
+		}
+
+		gs_app_list_add (list, app);
+	}
+
+	return TRUE;
+}
+
+static void
+precompute_key_colors_thread_cb (GTask        *task,
+				 gpointer      source_object,
+				 gpointer      task_data,
+				 GCancellable *cancellable)
+{
+	XbSilo *silo = task_data;
+	const gchar *query = "components/component/custom/value[@key='GnomeSoftware::FeatureTile']/../..|"
+			     "components/component/custom/value[@key='GnomeSoftware::FeatureTile-css']/../..|"
+			     "components/component/custom/value[@key='GnomeSoftware::DeploymentFeatured']/../..";
+	g_autoptr(GPtrArray) components = NULL;
+	g_autoptr(GTimer) timer = g_timer_new ();
+	guint n_calculated = 0;
+
+	/* drop old entries first, so the cache doesn’t keep growing as icons
+	 * are updated */
+	gs_key_colors_cache_prune ();
+
+	components = xb_silo_query (silo, query, 0, NULL);
+	if (components == NULL) {
+		g_task_return_boolean (task, TRUE);
+		return;
+	}
+
+	for (guint i = 0; i < components->len; i++) {
+		XbNode *component = g_ptr_array_index (components, i);
+		const gchar *component_id = xb_node_query_text (component, "id", NULL);
+		g_autoptr(GsApp) app = NULL;
+		g_autoptr(GIcon) icon = NULL;
+		g_autoptr(GArray) key_colors = NULL;
+		g_autofree gchar *icon_path = NULL;
+
+		if (g_task_return_error_if_cancelled (task))
+			return;
+		if (component_id == NULL)
+			continue;
+
+		app = gs_app_new (component_id);
+		gs_appstream_refine_icon (app, silo, component);
+		icon = gs_app_get_icon_for_size (app, 32, 1, NULL);
+		if (icon == NULL || !G_IS_FILE_ICON (icon))
+			continue;
+
+		icon_path = g_file_get_path (g_file_icon_get_file (G_FILE_ICON (icon)));
+		if (icon_path == NULL || !g_file_test (icon_path, G_FILE_TEST_EXISTS))
+			continue;
+
+		/* this stores them in the cache as a side-effect */
+		key_colors = gs_calculate_key_colors_for_file (icon_path);
+		if (key_colors != NULL)
+			n_calculated++;
+	}
+
+	g_debug ("Precomputed key colors for %u of %u featured apps in %.0fms",
+		 n_calculated, components->len,
+		 g_timer_elapsed (timer, NULL) * 1000);
+
+	g_task_return_boolean (task, TRUE);
+}
+
+/* Featured apps are shown on the overview page as soon as it’s opened, and
+ * their tiles are coloured using the key colors of their icons. Calculate and
+ * cache those in a background thread once the silo has been (re)built, so the
+ * overview page only has to read them from the cache. Old cache entries are
+ * pruned at the same time.
+ *
+ * Only local file icons are handled: themed icons need the GTK icon theme,
+ * which can only be used from the main thread, and remote icons are only
+ * calculated once they have been downloaded.
+ *
+ * This returns straight away. Cancel @cancellable to stop the calculation,
+ * for example when the silo is replaced again. */
+void
+gs_appstream_precompute_key_colors (XbSilo *silo,
+				    GCancellable *cancellable)
+{
+	g_autoptr(GTask) task = NULL;
+
+	g_return_if_fail (XB_IS_SILO (silo));
+
+	task = g_task_new (NULL, cancellable, NULL, NULL);
+	g_task_set_source_tag (task, gs_appstream_precompute_key_colors);
+	g_task_set_task_data (task, g_object_ref (silo), g_object_unref);
+	g_task_run_in_thread (task, precompute_key_colors_thread_cb);
+}
+
 gboolean
 gs_appstream_url_to_app (GsPlugin *plugin,
 			 XbSilo *silo,
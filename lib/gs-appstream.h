@@ -35,6 +35,9 @@ gboolean	 gs_appstream_search_developer_apps	(GsPlugin	*plugin,
 							 GsAppList	*list,
 							 GCancellable	*cancellable,
 							 GError		**error);
+gboolean	 gs_appstream_silo_build_search_index	(XbSilo		*silo,
+							 GCancellable	*cancellable,
+							 GError		**error);
 gboolean	 gs_appstream_refine_category_sizes	(XbSilo		*silo,
 							 GPtrArray	*list,
 							 GCancellable	*cancellable,
@@ -63,6 +66,16 @@ gboolean	 gs_appstream_add_deployment_featured	(XbSilo		*silo,
 							 GsAppList	*list,
 							 GCancellable	*cancellable,
 							 GError		**error);
+gboolean	 gs_appstream_query_is_compound_supported
+							(GsAppQuery	*query);
+gboolean	 gs_appstream_add_apps_for_query	(GsPlugin	*plugin,
+							 XbSilo		*silo,
+							 GsAppQuery	*query,
+							 GsAppList	*list,
+							 GCancellable	*cancellable,
+							 GError		**error);
+void		 gs_appstream_precompute_key_colors	(XbSilo		*silo,
+							 GCancellable	*cancellable);
 gboolean	 gs_appstream_add_alternates		(XbSilo		*silo,
 							 GsApp		*app,
 							 GsAppList	*list,
@@ -30,6 +30,25 @@
 
 G_DEFINE_QUARK (gs-download-error-quark, gs_download_error)
 
+/* Bounds for the size of each read from the input stream. Reads start small,
+ * so that small downloads and slow connections don’t need big buffers, and
+ * the buffer is doubled each time a read fills it faster than
+ * %BUFFER_GROWTH_INTERVAL_USECS, so that fast connections need fewer
+ * read/write round trips. */
+#define MIN_BUFFER_SIZE_BYTES 8192
+#define MAX_BUFFER_SIZE_BYTES (1024 * 1024)
+#define BUFFER_GROWTH_INTERVAL_USECS (50 * G_TIME_SPAN_MILLISECOND)
+
+/* Stored on partially downloaded files, to check whether they can be
+ * resumed. See gs_download_file_async(). */
+#define PARTIAL_VALIDATOR_ATTRIBUTE "xattr::gnome-software::partial-validator"
+
+/* URIs of the `.partial` files currently being downloaded to, so that
+ * concurrent downloads to the same output file don’t write to the same
+ * partial file. (element-type utf8) (owned) (lock partial_files_lock) */
+static GHashTable *partial_files_in_use = NULL;
+G_LOCK_DEFINE_STATIC (partial_files_lock);
+
 /**
  * gs_build_soup_session:
  *
@@ -109,6 +128,8 @@ typedef struct {
 	gsize buffer_size_bytes;
 	gchar *last_etag;  /* (nullable) (owned) */
 	GDateTime *last_modified_date;  /* (nullable) (owned) */
+	goffset resume_offset;
+	gchar *resume_validator;  /* (nullable) (owned) */
 	int io_priority;
 	GsDownloadProgressCallback progress_callback;  /* (nullable) */
 	gpointer progress_user_data;
@@ -122,8 +143,10 @@ typedef struct {
 	gsize total_written_bytes;
 	gsize expected_stream_size_bytes;
 	GBytes *currently_unwritten_chunk;  /* (nullable) (owned) */
+	gint64 read_start_time_usecs;
 
 	/* Output data. */
+	gboolean received_response;
 	gchar *new_etag;  /* (nullable) (owned) */
 	GDateTime *new_last_modified_date;  /* (nullable) (owned) */
 	GError *error;  /* (nullable) (owned) */
@@ -142,6 +165,7 @@ download_data_free (DownloadData *data)
 
 	g_clear_pointer (&data->last_etag, g_free);
 	g_clear_pointer (&data->last_modified_date, g_date_time_unref);
+	g_clear_pointer (&data->resume_validator, g_free);
 	g_clear_object (&data->message);
 	g_clear_pointer (&data->uri, g_free);
 	g_clear_pointer (&data->new_etag, g_free);
@@ -169,51 +193,22 @@ static void close_stream_cb (GObject      *source_object,
                              GAsyncResult *result,
                              gpointer      user_data);
 static void download_progress (GTask *task);
+static void start_read (GTask *task);
 
-/**
- * gs_download_stream_async:
- * @soup_session: a #SoupSession
- * @uri: (not nullable): the URI to download
- * @output_stream: (not nullable): an output stream to write the download to
- * @last_etag: (nullable): the last-known ETag of the URI, or %NULL if unknown
- * @last_modified_date: (nullable): the last-known Last-Modified date of the
- *   URI, or %NULL if unknown
- * @io_priority: I/O priority to download and write at
- * @progress_callback: (nullable): callback to call with progress information
- * @progress_user_data: (nullable) (closure progress_callback): data to pass
- *   to @progress_callback
- * @cancellable: (nullable): a #GCancellable, or %NULL
- * @callback: callback to call once the operation is complete
- * @user_data: (closure callback): data to pass to @callback
- *
- * Download @uri and write it to @output_stream asynchronously.
- *
- * If @last_etag is non-%NULL or @last_modified_date is non-%NULL, they will be
- * sent to the server, which may return a ‘not modified’ response. If so,
- * @output_stream will not be written to, and will be closed with a cancelled
- * close operation. This will ensure that the existing content of the output
- * stream (if it’s a file, for example) will not be overwritten.
- *
- * Note that @last_etag must be the ETag value returned by the server last time
- * the file was downloaded, not the local file ETag generated by GLib.
- *
- * If specified, @progress_callback will be called zero or more times until
- * @callback is called, providing progress updates on the download.
- *
- * Since: 43
- */
-void
-gs_download_stream_async (SoupSession                *soup_session,
-                          const gchar                *uri,
-                          GOutputStream              *output_stream,
-                          const gchar                *last_etag,
-                          GDateTime                  *last_modified_date,
-                          int                         io_priority,
-                          GsDownloadProgressCallback  progress_callback,
-                          gpointer                    progress_user_data,
-                          GCancellable               *cancellable,
-                          GAsyncReadyCallback         callback,
-                          gpointer                    user_data)
+static void
+download_stream_full_async (SoupSession                *soup_session,
+                            const gchar                *uri,
+                            GOutputStream              *output_stream,
+                            const gchar                *last_etag,
+                            GDateTime                  *last_modified_date,
+                            goffset                     resume_offset,
+                            const gchar                *resume_validator,
+                            int                         io_priority,
+                            GsDownloadProgressCallback  progress_callback,
+                            gpointer                    progress_user_data,
+                            GCancellable               *cancellable,
+                            GAsyncReadyCallback         callback,
+                            gpointer                    user_data)
 {
 	g_autoptr(GTask) task = NULL;
 	g_autoptr(GError) local_error = NULL;
@@ -225,6 +220,7 @@ gs_download_stream_async (SoupSession                *soup_session,
 	g_return_if_fail (uri != NULL);
 	g_return_if_fail (G_IS_OUTPUT_STREAM (output_stream));
 	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+	g_return_if_fail (resume_offset == 0 || resume_validator != NULL);
 
 	task = g_task_new (soup_session, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_download_stream_async);
@@ -233,7 +229,7 @@ gs_download_stream_async (SoupSession                *soup_session,
 	data->uri = g_strdup (uri);
 	data->output_stream = g_object_ref (output_stream);
 	data->close_output_stream = TRUE;
-	data->buffer_size_bytes = 8192;  /* arbitrarily chosen */
+	data->buffer_size_bytes = MIN_BUFFER_SIZE_BYTES;
 	data->io_priority = io_priority;
 	data->progress_callback = progress_callback;
 	data->progress_user_data = progress_user_data;
@@ -243,6 +239,10 @@ gs_download_stream_async (SoupSession                *soup_session,
 	/* local */
 	if (g_str_has_prefix (uri, "file://")) {
 		g_autoptr(GFile) local_file = g_file_new_for_path (uri + strlen ("file://"));
+
+		/* there’s no point resuming a local copy */
+		g_assert (resume_offset == 0);
+
 		g_file_read_async (local_file, io_priority, cancellable, open_input_stream_cb, g_steal_pointer (&task));
 		return;
 	}
@@ -284,6 +284,22 @@ gs_download_stream_async (SoupSession                *soup_session,
 #endif
 	}
 
+	/* Resume a partial download, but only if the file on the server is
+	 * still the one which was partially downloaded. Otherwise the server
+	 * will return the whole file. See RFC 7233, §3.2. */
+	if (resume_offset > 0) {
+		data->resume_offset = resume_offset;
+		data->resume_validator = g_strdup (resume_validator);
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+		soup_message_headers_set_range (soup_message_get_request_headers (msg), resume_offset, -1);
+		soup_message_headers_append (soup_message_get_request_headers (msg), "If-Range", resume_validator);
+#else
+		soup_message_headers_set_range (msg->request_headers, resume_offset, -1);
+		soup_message_headers_append (msg->request_headers, "If-Range", resume_validator);
+#endif
+	}
+
 #if SOUP_CHECK_VERSION(3, 0, 0)
 	soup_session_send_async (soup_session, msg, data->io_priority, cancellable, open_input_stream_cb, g_steal_pointer (&task));
 #else
@@ -291,6 +307,58 @@ gs_download_stream_async (SoupSession                *soup_session,
 #endif
 }
 
+/**
+ * gs_download_stream_async:
+ * @soup_session: a #SoupSession
+ * @uri: (not nullable): the URI to download
+ * @output_stream: (not nullable): an output stream to write the download to
+ * @last_etag: (nullable): the last-known ETag of the URI, or %NULL if unknown
+ * @last_modified_date: (nullable): the last-known Last-Modified date of the
+ *   URI, or %NULL if unknown
+ * @io_priority: I/O priority to download and write at
+ * @progress_callback: (nullable): callback to call with progress information
+ * @progress_user_data: (nullable) (closure progress_callback): data to pass
+ *   to @progress_callback
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback to call once the operation is complete
+ * @user_data: (closure callback): data to pass to @callback
+ *
+ * Download @uri and write it to @output_stream asynchronously.
+ *
+ * If @last_etag is non-%NULL or @last_modified_date is non-%NULL, they will be
+ * sent to the server, which may return a ‘not modified’ response. If so,
+ * @output_stream will not be written to, and will be closed with a cancelled
+ * close operation. This will ensure that the existing content of the output
+ * stream (if it’s a file, for example) will not be overwritten.
+ *
+ * Note that @last_etag must be the ETag value returned by the server last time
+ * the file was downloaded, not the local file ETag generated by GLib.
+ *
+ * If specified, @progress_callback will be called zero or more times until
+ * @callback is called, providing progress updates on the download.
+ *
+ * Since: 43
+ */
+void
+gs_download_stream_async (SoupSession                *soup_session,
+                          const gchar                *uri,
+                          GOutputStream              *output_stream,
+                          const gchar                *last_etag,
+                          GDateTime                  *last_modified_date,
+                          int                         io_priority,
+                          GsDownloadProgressCallback  progress_callback,
+                          gpointer                    progress_user_data,
+                          GCancellable               *cancellable,
+                          GAsyncReadyCallback         callback,
+                          gpointer                    user_data)
+{
+	download_stream_full_async (soup_session, uri, output_stream,
+				    last_etag, last_modified_date,
+				    0, NULL,
+				    io_priority, progress_callback, progress_user_data,
+				    cancellable, callback, user_data);
+}
+
 static void
 open_input_stream_cb (GObject      *source_object,
                       GAsyncResult *result,
@@ -322,7 +390,9 @@ open_input_stream_cb (GObject      *source_object,
 		data->close_input_stream = TRUE;
 	} else if (SOUP_IS_SESSION (source_object)) {
 		SoupSession *soup_session = SOUP_SESSION (source_object);
+		SoupMessageHeaders *response_headers;
 		guint status_code;
+		gboolean resumed;
 		const gchar *new_etag, *new_last_modified_str;
 
 		/* HTTP request. */
@@ -333,6 +403,7 @@ open_input_stream_cb (GObject      *source_object,
 		input_stream = soup_session_send_finish (soup_session, result, &local_error);
 		status_code = data->message->status_code;
 #endif
+		resumed = (status_code == SOUP_STATUS_PARTIAL_CONTENT && data->resume_offset > 0);
 
 		if (input_stream != NULL) {
 			g_assert (data->input_stream == NULL);
@@ -356,7 +427,21 @@ open_input_stream_cb (GObject      *source_object,
 						      "Skipped downloading ‘%s’: %s",
 						      data->uri, soup_status_get_phrase (status_code)));
 			return;
-		} else if (status_code != SOUP_STATUS_OK) {
+		} else if (status_code == SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE &&
+			   data->resume_offset > 0) {
+			/* The partially downloaded data can’t be valid, so drop
+			 * it, so the next attempt starts from the beginning. */
+			if (G_IS_SEEKABLE (data->output_stream) &&
+			    g_seekable_can_truncate (G_SEEKABLE (data->output_stream)))
+				g_seekable_truncate (G_SEEKABLE (data->output_stream), 0, cancellable, NULL);
+
+			finish_download (task,
+					 g_error_new (G_IO_ERROR,
+						      G_IO_ERROR_FAILED,
+						      "Failed to resume downloading ‘%s’: %s",
+						      data->uri, soup_status_get_phrase (status_code)));
+			return;
+		} else if (status_code != SOUP_STATUS_OK && !resumed) {
 			g_autoptr(GString) str = g_string_new (NULL);
 			g_string_append (str, soup_status_get_phrase (status_code));
 
@@ -378,30 +463,67 @@ open_input_stream_cb (GObject      *source_object,
 		}
 
 		g_assert (input_stream != NULL);
+		data->received_response = TRUE;
 
-		/* Get the expected download size. */
 #if SOUP_CHECK_VERSION(3, 0, 0)
-		data->expected_stream_size_bytes = soup_message_headers_get_content_length (soup_message_get_response_headers (data->message));
+		response_headers = soup_message_get_response_headers (data->message);
 #else
-		data->expected_stream_size_bytes = soup_message_headers_get_content_length (data->message->response_headers);
+		response_headers = data->message->response_headers;
 #endif
 
+		if (resumed) {
+			goffset range_start, range_end, range_total;
+
+			/* Check the server is continuing from where the
+			 * previous download stopped. */
+			if (!soup_message_headers_get_content_range (response_headers, &range_start, &range_end, &range_total) ||
+			    range_start != data->resume_offset) {
+				finish_download (task,
+						 g_error_new (G_IO_ERROR,
+							      G_IO_ERROR_FAILED,
+							      "Failed to resume downloading ‘%s’: Unexpected Content-Range",
+							      data->uri));
+				return;
+			}
+
+			g_debug ("Resuming download of %s from byte %" G_GOFFSET_FORMAT,
+				 data->uri, data->resume_offset);
+
+			/* Count the partially downloaded data as progress. */
+			data->total_read_bytes = (gsize) data->resume_offset;
+			data->total_written_bytes = (gsize) data->resume_offset;
+		} else if (data->resume_offset > 0) {
+			/* The server doesn’t support ranges, or the file has
+			 * changed since it was partially downloaded, so it
+			 * has returned the whole file. Start again. */
+			if (!G_IS_SEEKABLE (data->output_stream) ||
+			    !g_seekable_can_truncate (G_SEEKABLE (data->output_stream))) {
+				finish_download (task,
+						 g_error_new (G_IO_ERROR,
+							      G_IO_ERROR_NOT_SUPPORTED,
+							      "Failed to restart downloading ‘%s’: Output stream can’t be truncated",
+							      data->uri));
+				return;
+			} else if (!g_seekable_truncate (G_SEEKABLE (data->output_stream), 0, cancellable, &local_error)) {
+				finish_download (task, g_steal_pointer (&local_error));
+				return;
+			}
+
+			data->resume_offset = 0;
+		}
+
+		/* Get the expected download size. */
+		data->expected_stream_size_bytes = data->total_read_bytes +
+						   (gsize) soup_message_headers_get_content_length (response_headers);
+
 		/* Store the new ETag for later use. */
-#if SOUP_CHECK_VERSION(3, 0, 0)
-		new_etag = soup_message_headers_get_one (soup_message_get_response_headers (data->message), "ETag");
-#else
-		new_etag = soup_message_headers_get_one (data->message->response_headers, "ETag");
-#endif
+		new_etag = soup_message_headers_get_one (response_headers, "ETag");
 		if (new_etag != NULL && *new_etag == '\0')
 			new_etag = NULL;
 		data->new_etag = g_strdup (new_etag);
 
 		/* Store the Last-Modified date for later use. */
-#if SOUP_CHECK_VERSION(3, 0, 0)
-		new_last_modified_str = soup_message_headers_get_one (soup_message_get_response_headers (data->message), "Last-Modified");
-#else
-		new_last_modified_str = soup_message_headers_get_one (data->message->response_headers, "Last-Modified");
-#endif
+		new_last_modified_str = soup_message_headers_get_one (response_headers, "Last-Modified");
 		if (new_last_modified_str != NULL && *new_last_modified_str == '\0')
 			new_last_modified_str = NULL;
 		if (new_last_modified_str != NULL)
@@ -413,8 +535,19 @@ open_input_stream_cb (GObject      *source_object,
 	/* Splice in an asynchronous loop. We unfortunately can’t use
 	 * g_output_stream_splice_async() here, as it doesn’t provide a progress
 	 * callback. The approach is the same though. */
-	g_input_stream_read_bytes_async (input_stream, data->buffer_size_bytes, data->io_priority,
-					 cancellable, read_bytes_cb, g_steal_pointer (&task));
+	start_read (g_steal_pointer (&task));
+}
+
+/* task is (transfer full) */
+static void
+start_read (GTask *task)
+{
+	DownloadData *data = g_task_get_task_data (task);
+	GCancellable *cancellable = g_task_get_cancellable (task);
+
+	data->read_start_time_usecs = g_get_monotonic_time ();
+	g_input_stream_read_bytes_async (data->input_stream, data->buffer_size_bytes, data->io_priority,
+					 cancellable, read_bytes_cb, task);
 }
 
 static void
@@ -436,6 +569,13 @@ read_bytes_cb (GObject      *source_object,
 		return;
 	}
 
+	/* If the read filled the buffer quickly, data is arriving faster than
+	 * it’s being consumed, so read more at once next time. */
+	if (g_bytes_get_size (bytes) == data->buffer_size_bytes &&
+	    data->buffer_size_bytes < MAX_BUFFER_SIZE_BYTES &&
+	    g_get_monotonic_time () - data->read_start_time_usecs < BUFFER_GROWTH_INTERVAL_USECS)
+		data->buffer_size_bytes *= 2;
+
 	/* Report progress. */
 	data->total_read_bytes += g_bytes_get_size (bytes);
 	data->expected_stream_size_bytes = MAX (data->expected_stream_size_bytes, data->total_read_bytes);
@@ -496,8 +636,7 @@ write_bytes_cb (GObject      *source_object,
 		/* Full write succeeded. Start the next read. */
 		g_clear_pointer (&data->currently_unwritten_chunk, g_bytes_unref);
 
-		g_input_stream_read_bytes_async (data->input_stream, data->buffer_size_bytes, data->io_priority,
-						 cancellable, read_bytes_cb, g_steal_pointer (&task));
+		start_read (g_steal_pointer (&task));
 	}
 }
 
@@ -670,29 +809,149 @@ typedef struct {
 	gpointer progress_user_data;
 
 	/* In-progress data. */
+	GFile *partial_file;  /* (not nullable) (owned) */
+	gchar *claimed_partial_uri;  /* (nullable) (owned); set if partial_file is in partial_files_in_use */
 	gchar *last_etag;  /* (nullable) (owned) */
 	GDateTime *last_modified_date;  /* (nullable) (owned) */
+	goffset resume_offset;
+	gchar *resume_validator;  /* (nullable) (owned) */
 } DownloadFileData;
 
+/* Claim @partial_uri for the calling download. Returns %FALSE if another
+ * download is already using it. */
+static gboolean
+claim_partial_file (const gchar *partial_uri)
+{
+	G_LOCK (partial_files_lock);
+
+	if (partial_files_in_use == NULL)
+		partial_files_in_use = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	if (g_hash_table_contains (partial_files_in_use, partial_uri)) {
+		G_UNLOCK (partial_files_lock);
+		return FALSE;
+	}
+
+	g_hash_table_add (partial_files_in_use, g_strdup (partial_uri));
+
+	G_UNLOCK (partial_files_lock);
+
+	return TRUE;
+}
+
+static void
+release_partial_file (const gchar *partial_uri)
+{
+	G_LOCK (partial_files_lock);
+	g_hash_table_remove (partial_files_in_use, partial_uri);
+	G_UNLOCK (partial_files_lock);
+}
+
 static void
 download_file_data_free (DownloadFileData *data)
 {
 	g_free (data->uri);
 	g_clear_object (&data->output_file);
+	g_clear_object (&data->partial_file);
+	if (data->claimed_partial_uri != NULL)
+		release_partial_file (data->claimed_partial_uri);
+	g_free (data->claimed_partial_uri);
 	g_free (data->last_etag);
 	g_clear_pointer (&data->last_modified_date, g_date_time_unref);
+	g_free (data->resume_validator);
 	g_free (data);
 }
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (DownloadFileData, download_file_data_free)
 
-static void download_replace_file_cb (GObject      *source_object,
-                                      GAsyncResult *result,
-                                      gpointer      user_data);
+static void download_append_file_cb (GObject      *source_object,
+                                     GAsyncResult *result,
+                                     gpointer      user_data);
 static void download_file_cb (GObject      *source_object,
                               GAsyncResult *result,
                               gpointer      user_data);
 
+/* Returns the validator to send in If-Range to resume downloading into
+ * @partial_file, or %NULL if it can’t be resumed. */
+static gchar *
+get_partial_validator (GFile         *partial_file,
+                       goffset       *size_out,
+                       GCancellable  *cancellable)
+{
+	g_autoptr(GFileInfo) info = NULL;
+	const gchar *validator;
+
+	info = g_file_query_info (partial_file,
+				  PARTIAL_VALIDATOR_ATTRIBUTE "," G_FILE_ATTRIBUTE_STANDARD_SIZE,
+				  G_FILE_QUERY_INFO_NONE, cancellable, NULL);
+	if (info == NULL)
+		return NULL;
+
+	validator = g_file_info_get_attribute_string (info, PARTIAL_VALIDATOR_ATTRIBUTE);
+	if (validator == NULL || *validator == '\0' || g_file_info_get_size (info) <= 0)
+		return NULL;
+
+	*size_out = g_file_info_get_size (info);
+	return g_strdup (validator);
+}
+
+static void
+delete_partial_file (GFile        *partial_file,
+                     GCancellable *cancellable)
+{
+	g_autoptr(GError) local_error = NULL;
+
+	if (!g_file_delete (partial_file, cancellable, &local_error) &&
+	    !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+		g_debug ("Error deleting partial download ‘%s’: %s",
+			 g_file_peek_path (partial_file), local_error->message);
+}
+
+/* Keep the data downloaded so far if there’s a validator which can be used
+ * to check, next time, that the file on the server hasn’t changed. Otherwise
+ * the data is useless, so delete it.
+ *
+ * This is typically called after the download was cancelled, so it
+ * deliberately doesn’t use the task’s #GCancellable. */
+static void
+keep_partial_file (DownloadFileData *data,
+                   gboolean          received_response,
+                   const gchar      *new_etag,
+                   GDateTime        *new_last_modified_date)
+{
+	g_autofree gchar *validator = NULL;
+	g_autoptr(GFileInfo) info = NULL;
+
+	/* A uniquely named partial file is never resumed. */
+	if (data->claimed_partial_uri == NULL) {
+		delete_partial_file (data->partial_file, NULL);
+		return;
+	}
+
+	if (!received_response) {
+		/* The partial file is unchanged. */
+		validator = g_strdup (data->resume_validator);
+	} else if (new_etag != NULL && !g_str_has_prefix (new_etag, "W/")) {
+		/* Weak ETags can’t be used in If-Range. */
+		validator = g_strdup (new_etag);
+	} else if (new_last_modified_date != NULL) {
+		validator = date_time_to_rfc7231 (new_last_modified_date);
+	}
+
+	info = g_file_query_info (data->partial_file, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+				  G_FILE_QUERY_INFO_NONE, NULL, NULL);
+
+	if (validator != NULL && info != NULL && g_file_info_get_size (info) > 0 &&
+	    g_file_set_attribute_string (data->partial_file, PARTIAL_VALIDATOR_ATTRIBUTE, validator,
+					 G_FILE_QUERY_INFO_NONE, NULL, NULL)) {
+		g_debug ("Keeping %" G_GOFFSET_FORMAT " bytes of partial download of %s",
+			 g_file_info_get_size (info), data->uri);
+		return;
+	}
+
+	delete_partial_file (data->partial_file, NULL);
+}
+
 /**
  * gs_download_file_async:
  * @soup_session: a #SoupSession
@@ -712,6 +971,17 @@ static void download_file_cb (GObject      *source_object,
  * The ETag and modification time of @output_file will be queried and, if known,
  * used to skip the download if @output_file is already up to date.
  *
+ * The download is written to a `.partial` file next to @output_file, which
+ * replaces @output_file once the download is complete. If the download fails
+ * or is cancelled, the partial file is kept if the server provided a strong
+ * ETag or a Last-Modified date for it, and the next download of @uri to
+ * @output_file resumes from where it stopped using a `Range` request. The
+ * server only honours the range if the file is unchanged (using `If-Range`),
+ * so a stale partial download is never completed with data from a newer file.
+ *
+ * If another download to @output_file is already in progress, this one is
+ * written to a uniquely named partial file instead, which is not resumed.
+ *
  * If specified, @progress_callback will be called zero or more times until
  * @callback is called, providing progress updates on the download.
  *
@@ -727,27 +997,92 @@ gs_download_file_async (SoupSession                *soup_session,
                         GCancellable               *cancellable,
                         GAsyncReadyCallback         callback,
                         gpointer                    user_data)
+{
+	gs_download_file_full_async (soup_session, uri, output_file, NULL, io_priority,
+				     progress_callback, progress_user_data,
+				     cancellable, callback, user_data);
+}
+
+/**
+ * gs_download_file_full_async:
+ * @soup_session: a #SoupSession
+ * @uri: (not nullable): the URI to download
+ * @output_file: (not nullable): an output file to write the download to
+ * @etag_file: (nullable): file to query the ETag and modification time from,
+ *   or %NULL to use @output_file
+ * @io_priority: I/O priority to download and write at
+ * @progress_callback: (nullable): callback to call with progress information
+ * @progress_user_data: (nullable) (closure progress_callback): data to pass
+ *   to @progress_callback
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback to call once the operation is complete
+ * @user_data: (closure callback): data to pass to @callback
+ *
+ * Like gs_download_file_async(), but the ETag and modification time used to
+ * skip the download are queried from @etag_file. This is useful if
+ * @output_file is a staging copy of @etag_file, which is updated from
+ * @output_file after the download.
+ *
+ * If the download is skipped, the operation fails with
+ * %GS_DOWNLOAD_ERROR_NOT_MODIFIED and @output_file is left untouched.
+ *
+ * Finish the operation with gs_download_file_finish().
+ *
+ * Since: 46
+ */
+void
+gs_download_file_full_async (SoupSession                *soup_session,
+                             const gchar                *uri,
+                             GFile                      *output_file,
+                             GFile                      *etag_file,
+                             int                         io_priority,
+                             GsDownloadProgressCallback  progress_callback,
+                             gpointer                    progress_user_data,
+                             GCancellable               *cancellable,
+                             GAsyncReadyCallback         callback,
+                             gpointer                    user_data)
 {
 	g_autoptr(GTask) task = NULL;
 	DownloadFileData *data;
 	g_autoptr(DownloadFileData) data_owned = NULL;
 	g_autoptr(GFile) output_file_parent = NULL;
+	g_autofree gchar *partial_uri = NULL;
+	g_autofree gchar *output_uri = NULL;
 	g_autoptr(GError) local_error = NULL;
 
 	g_return_if_fail (SOUP_IS_SESSION (soup_session));
 	g_return_if_fail (uri != NULL);
 	g_return_if_fail (G_IS_FILE (output_file));
+	g_return_if_fail (etag_file == NULL || G_IS_FILE (etag_file));
 	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
 
 	task = g_task_new (soup_session, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_download_file_async);
 
+	output_uri = g_file_get_uri (output_file);
+	partial_uri = g_strconcat (output_uri, ".partial", NULL);
+
 	data = data_owned = g_new0 (DownloadFileData, 1);
 	data->uri = g_strdup (uri);
 	data->output_file = g_object_ref (output_file);
 	data->io_priority = io_priority;
 	data->progress_callback = progress_callback;
 	data->progress_user_data = progress_user_data;
+
+	/* Only one download at a time may use (and resume) the partial file.
+	 * Any others get a unique one, so they don’t corrupt each other. */
+	if (claim_partial_file (partial_uri)) {
+		data->claimed_partial_uri = g_steal_pointer (&partial_uri);
+		data->partial_file = g_file_new_for_uri (data->claimed_partial_uri);
+	} else {
+		static gint partial_counter = 0;
+		g_autofree gchar *unique_partial_uri = NULL;
+
+		unique_partial_uri = g_strdup_printf ("%s.%d.partial", output_uri,
+						      g_atomic_int_add (&partial_counter, 1));
+		data->partial_file = g_file_new_for_uri (unique_partial_uri);
+	}
+
 	g_task_set_task_data (task, g_steal_pointer (&data_owned), (GDestroyNotify) download_file_data_free);
 
 	/* Create the destination file’s directory.
@@ -765,36 +1100,36 @@ gs_download_file_async (SoupSession                *soup_session,
 	g_clear_error (&local_error);
 
 	/* Query the old ETag and modification date if the file already exists. */
-	data->last_etag = gs_utils_get_file_etag (output_file, &data->last_modified_date, cancellable);
+	data->last_etag = gs_utils_get_file_etag ((etag_file != NULL) ? etag_file : output_file,
+						  &data->last_modified_date, cancellable);
+
+	/* Check whether a previous download can be resumed. If not, start
+	 * from an empty partial file. Like above, these are likely to be
+	 * fast. */
+	if (data->claimed_partial_uri != NULL && !g_str_has_prefix (uri, "file://"))
+		data->resume_validator = get_partial_validator (data->partial_file, &data->resume_offset, cancellable);
+	if (data->resume_validator == NULL) {
+		data->resume_offset = 0;
+		delete_partial_file (data->partial_file, cancellable);
+	}
 
-	/* Create the output file.
-	 *
-	 * Note that `data->last_etag` is *not* passed in here, as the ETag from
-	 * the server and the file modification ETag that GLib uses are
-	 * different things. For g_file_replace_async(), GLib always uses an
-	 * ETag it generates internally based on the file mtime (see
-	 * _g_local_file_info_create_etag()), which will never match what the
-	 * server returns in its ETag header.
-	 *
-	 * This is fine, as we are using the ETag to avoid an unnecessary HTTP
-	 * download if possible. We don’t care about tracking changes to the
-	 * file on disk. */
-	g_file_replace_async (output_file,
-			      NULL,  /* ETag */
-			      FALSE,  /* make_backup */
-			      G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION,
-			      io_priority,
-			      cancellable,
-			      download_replace_file_cb,
-			      g_steal_pointer (&task));
+	/* Open the partial file for appending, so that nothing is lost if the
+	 * download fails part way through. The stream is truncated if the
+	 * server sends the whole file rather than the requested range. */
+	g_file_append_to_async (data->partial_file,
+				G_FILE_CREATE_PRIVATE,
+				io_priority,
+				cancellable,
+				download_append_file_cb,
+				g_steal_pointer (&task));
 }
 
 static void
-download_replace_file_cb (GObject      *source_object,
-                          GAsyncResult *result,
-                          gpointer      user_data)
+download_append_file_cb (GObject      *source_object,
+                         GAsyncResult *result,
+                         gpointer      user_data)
 {
-	GFile *output_file = G_FILE (source_object);
+	GFile *partial_file = G_FILE (source_object);
 	g_autoptr(GTask) task = g_steal_pointer (&user_data);
 	SoupSession *soup_session = g_task_get_source_object (task);
 	GCancellable *cancellable = g_task_get_cancellable (task);
@@ -802,7 +1137,7 @@ download_replace_file_cb (GObject      *source_object,
 	g_autoptr(GFileOutputStream) output_stream = NULL;
 	g_autoptr(GError) local_error = NULL;
 
-	output_stream = g_file_replace_finish (output_file, result, &local_error);
+	output_stream = g_file_append_to_finish (partial_file, result, &local_error);
 
 	if (output_stream == NULL) {
 		g_task_return_error (task, g_steal_pointer (&local_error));
@@ -810,10 +1145,12 @@ download_replace_file_cb (GObject      *source_object,
 	}
 
 	/* Do the download. */
-	gs_download_stream_async (soup_session, data->uri, G_OUTPUT_STREAM (output_stream),
-				  data->last_etag, data->last_modified_date, data->io_priority,
-				  data->progress_callback, data->progress_user_data,
-				  cancellable, download_file_cb, g_steal_pointer (&task));
+	download_stream_full_async (soup_session, data->uri, G_OUTPUT_STREAM (output_stream),
+				    data->last_etag, data->last_modified_date,
+				    data->resume_offset, data->resume_validator,
+				    data->io_priority,
+				    data->progress_callback, data->progress_user_data,
+				    cancellable, download_file_cb, g_steal_pointer (&task));
 }
 
 static void
@@ -825,10 +1162,30 @@ download_file_cb (GObject      *source_object,
 	g_autoptr(GTask) task = g_steal_pointer (&user_data);
 	GCancellable *cancellable = g_task_get_cancellable (task);
 	DownloadFileData *data = g_task_get_task_data (task);
+	DownloadData *stream_data = g_task_get_task_data (G_TASK (result));
 	g_autofree gchar *new_etag = NULL;
+	g_autoptr(GDateTime) new_last_modified_date = NULL;
 	g_autoptr(GError) local_error = NULL;
 
-	if (!gs_download_stream_finish (soup_session, result, &new_etag, NULL, &local_error)) {
+	if (!gs_download_stream_finish (soup_session, result, &new_etag, &new_last_modified_date, &local_error)) {
+		if (is_not_modidifed_error (local_error))
+			delete_partial_file (data->partial_file, NULL);
+		else
+			keep_partial_file (data, stream_data->received_response,
+					   new_etag, new_last_modified_date);
+
+		g_task_return_error (task, g_steal_pointer (&local_error));
+		return;
+	}
+
+	/* Move the complete download into place. This is atomic, so readers
+	 * of @output_file never see a partial download.
+	 * FIXME: This should be made async; it’s likely to be fast. */
+	g_file_set_attribute (data->partial_file, PARTIAL_VALIDATOR_ATTRIBUTE, G_FILE_ATTRIBUTE_TYPE_INVALID,
+			      NULL, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+
+	if (!g_file_move (data->partial_file, data->output_file, G_FILE_COPY_OVERWRITE,
+			  cancellable, NULL, NULL, &local_error)) {
 		g_task_return_error (task, g_steal_pointer (&local_error));
 		return;
 	}
@@ -856,7 +1213,7 @@ download_file_cb (GObject      *source_object,
  * @error: return location for a #GError
  *
  * Finish an asynchronous download operation started with
- * gs_download_file_async().
+ * gs_download_file_async() or gs_download_file_full_async().
  *
  * Returns: %TRUE on success, %FALSE otherwise
  * Since: 42
@@ -81,6 +81,16 @@ void		gs_download_file_async		(SoupSession                *soup_session,
 						 GCancellable               *cancellable,
 						 GAsyncReadyCallback         callback,
 						 gpointer                    user_data);
+void		gs_download_file_full_async	(SoupSession                *soup_session,
+						 const gchar                *uri,
+						 GFile                      *output_file,
+						 GFile                      *etag_file,
+						 int                         io_priority,
+						 GsDownloadProgressCallback  progress_callback,
+						 gpointer                    progress_user_data,
+						 GCancellable               *cancellable,
+						 GAsyncReadyCallback         callback,
+						 gpointer                    user_data);
 gboolean	gs_download_file_finish		(SoupSession   *soup_session,
 						 GAsyncResult  *result,
 						 GError       **error);
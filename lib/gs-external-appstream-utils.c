@@ -110,12 +110,9 @@ gs_external_appstream_install (const gchar   *appstream_file,
 	return g_subprocess_wait_check (subprocess, cancellable, error);
 }
 
-static void download_replace_file_cb (GObject      *source_object,
-				      GAsyncResult *result,
-				      gpointer      user_data);
-static void download_stream_cb (GObject      *source_object,
-                                GAsyncResult *result,
-                                gpointer      user_data);
+static void download_file_cb (GObject      *source_object,
+                              GAsyncResult *result,
+                              gpointer      user_data);
 
 /* A tuple to store the last-received progress data for a single download.
  * Each download (refresh_url_async()) has a pointer to the relevant
@@ -135,10 +132,6 @@ typedef struct {
 	ProgressTuple *progress_tuple;  /* (not nullable) */
 	SoupSession *soup_session;  /* (not nullable) (owned) */
 	gboolean system_wide;
-
-	/* In-progress data. */
-	gchar *last_etag;  /* (nullable) (owned) */
-	GDateTime *last_modified_date;  /* (nullable) (owned) */
 } DownloadAppStreamData;
 
 static void
@@ -148,8 +141,6 @@ download_appstream_data_free (DownloadAppStreamData *data)
 	g_clear_object (&data->task);
 	g_clear_object (&data->output_file);
 	g_clear_object (&data->soup_session);
-	g_free (data->last_etag);
-	g_clear_pointer (&data->last_modified_date, g_date_time_unref);
 	g_free (data);
 }
 
@@ -186,7 +177,6 @@ refresh_url_async (GSettings           *settings,
 	g_autofree gchar *hash = NULL;
 	g_autofree gchar *target_file_path = NULL;
 	g_autoptr(GFile) target_file = NULL;
-	g_autoptr(GFile) tmp_file_parent = NULL;
 	g_autoptr(GFile) tmp_file = NULL;
 	g_autoptr(GsApp) app_dl = gs_app_new ("external-appstream");
 	g_autoptr(GError) local_error = NULL;
@@ -280,90 +270,39 @@ refresh_url_async (GSettings           *settings,
 	data->system_wide = system_wide;
 	g_task_set_task_data (task, data, (GDestroyNotify) download_appstream_data_free);
 
-	/* Create the destination file’s directory.
-	 * FIXME: This should be made async; it hasn’t done for now as it’s
-	 * likely to be fast. */
-	tmp_file_parent = g_file_get_parent (tmp_file);
-
-	if (tmp_file_parent != NULL &&
-	    !g_file_make_directory_with_parents (tmp_file_parent, cancellable, &local_error) &&
-	    !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_EXISTS)) {
-		g_task_return_error (task, g_steal_pointer (&local_error));
-		return;
-	}
-
-	g_clear_error (&local_error);
-
-	/* Query the ETag and modification date of the target file, if the file already exists. For
-	 * system-wide installations, this is the ETag of the AppStream file installed system-wide.
-	 * For local installations, this is just the local output file. */
-	data->last_etag = gs_utils_get_file_etag (target_file, &data->last_modified_date, cancellable);
-	g_debug ("Queried ETag of file %s: %s", g_file_peek_path (target_file), data->last_etag);
-
-	/* Create the output file */
-	g_file_replace_async (tmp_file,
-			      NULL,  /* ETag */
-			      FALSE,  /* make_backup */
-			      G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION,
-			      G_PRIORITY_LOW,
-			      cancellable,
-			      download_replace_file_cb,
-			      g_steal_pointer (&task));
+	/* Do the download. It’s written to a partial file next to @tmp_file
+	 * first, so an interrupted download can be resumed on the next
+	 * refresh. The ETag and modification date are those of the target
+	 * file: for system-wide installations, this is the AppStream file
+	 * installed system-wide. For local installations, this is just the
+	 * local output file. */
+	gs_download_file_full_async (soup_session,
+				     url,
+				     tmp_file,
+				     target_file,
+				     G_PRIORITY_LOW,
+				     refresh_url_progress_cb,
+				     progress_tuple,
+				     cancellable,
+				     download_file_cb,
+				     g_steal_pointer (&task));
 }
 
 static void
-download_replace_file_cb (GObject      *source_object,
-                          GAsyncResult *result,
-                          gpointer      user_data)
-{
-	GFile *output_file = G_FILE (source_object);
-	g_autoptr(GTask) task = g_steal_pointer (&user_data);
-	GCancellable *cancellable = g_task_get_cancellable (task);
-	DownloadAppStreamData *data = g_task_get_task_data (task);
-	g_autoptr(GFileOutputStream) output_stream = NULL;
-	g_autoptr(GError) local_error = NULL;
-
-	output_stream = g_file_replace_finish (output_file, result, &local_error);
-
-	if (output_stream == NULL) {
-		g_task_return_error (task, g_steal_pointer (&local_error));
-		return;
-	}
-
-	/* Do the download. */
-	gs_download_stream_async (data->soup_session,
-				  data->url,
-				  G_OUTPUT_STREAM (output_stream),
-				  data->last_etag,
-				  data->last_modified_date,
-				  G_PRIORITY_LOW,
-				  refresh_url_progress_cb,
-				  data->progress_tuple,
-				  cancellable,
-				  download_stream_cb,
-				  g_steal_pointer (&task));
-}
-
-static void
-download_stream_cb (GObject      *source_object,
-                    GAsyncResult *result,
-                    gpointer      user_data)
+download_file_cb (GObject      *source_object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
 {
 	SoupSession *soup_session = SOUP_SESSION (source_object);
 	g_autoptr(GTask) task = g_steal_pointer (&user_data);
 	GCancellable *cancellable = g_task_get_cancellable (task);
 	DownloadAppStreamData *data = g_task_get_task_data (task);
 	g_autoptr(GError) local_error = NULL;
-	g_autofree gchar *new_etag = NULL;
 
-	if (!gs_download_stream_finish (soup_session, result, &new_etag, NULL, &local_error)) {
+	if (!gs_download_file_finish (soup_session, result, &local_error)) {
 		if (data->system_wide && g_error_matches (local_error, GS_DOWNLOAD_ERROR, GS_DOWNLOAD_ERROR_NOT_MODIFIED)) {
-			g_debug ("External AppStream file not modified, removing temporary download file %s",
+			g_debug ("External AppStream file not modified, keeping %s",
 				 g_file_peek_path (data->output_file));
-
-			/* System-wide installs should delete the empty file created when preparing to
-			 * download the external AppStream file. */
-			g_file_delete_async (data->output_file, G_PRIORITY_LOW, NULL, NULL, NULL);
 			g_task_return_boolean (task, TRUE);
 		} else if (!g_network_monitor_get_network_available (g_network_monitor_get_default ())) {
 			g_task_return_new_error (task,
@@ -382,8 +321,6 @@ download_stream_cb (GObject      *source_object,
 
 	g_debug ("Downloaded appstream file %s", g_file_peek_path (data->output_file));
 
-	gs_utils_set_file_etag (data->output_file, new_etag, cancellable);
-
 	if (data->system_wide) {
 		/* install file systemwide */
 		if (!gs_external_appstream_install (g_file_peek_path (data->output_file),
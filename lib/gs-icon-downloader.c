@@ -21,6 +21,12 @@
  * download using gs_icon_downloader_queue_app(). The actual download may
  * happen at any arbitrary time in the future.
  *
+ * Downloads are run asynchronously in the downloader’s worker thread, with a
+ * few in flight at once over the shared #SoupSession. Icons with the same URI
+ * are only downloaded once, even if several apps use them. Downloads for
+ * interactive requests are started before others, and queueing an app again
+ * interactively moves its queued downloads up the queue.
+ *
  * Since: 44
  */
 
@@ -39,8 +45,57 @@ struct _GsIconDownloader
 
 	GsWorkerThread	*worker; /* (owned) */
 	GCancellable	*cancellable; /* (owned) */
+
+	/* Only accessed from @worker: */
+	GHashTable	*requests;  /* (owned) (element-type utf8 IconRequest), queued and running downloads by URI */
+	GQueue		 requests_queue;  /* (element-type IconRequest), queued downloads, in the order to start them */
+	guint		 n_requests_running;
+	GTask		*drain_task;  /* (owned) (nullable), set while shutting down */
 };
 
+/* Enough to download a page of icons quickly, without opening so many
+ * connections to one server that they start being refused. */
+#define MAX_PARALLEL_ICON_DOWNLOADS 6
+
+/* The download of one remote icon URI, shared by all the icons (possibly in
+ * different apps) which have that URI. */
+typedef struct {
+	GsIconDownloader *self;  /* (unowned), kept alive by @tasks */
+	GPtrArray *icons;  /* (owned) (element-type GsRemoteIcon) (not nullable), waiting icons; the first is downloaded */
+	GPtrArray *tasks;  /* (owned) (element-type GTask) (not nullable), the app download for each of @icons */
+	gboolean interactive;
+	gboolean running;
+} IconRequest;
+
+static void
+icon_request_free (IconRequest *request)
+{
+	g_clear_pointer (&request->icons, g_ptr_array_unref);
+	g_clear_pointer (&request->tasks, g_ptr_array_unref);
+	g_free (request);
+}
+
+static const gchar *
+icon_request_get_uri (IconRequest *request)
+{
+	return gs_remote_icon_get_uri (g_ptr_array_index (request->icons, 0));
+}
+
+/* The download of all the remote icons of one app. This is the task data of
+ * the #GTask for the app. */
+typedef struct {
+	GsApp *app;  /* (owned) (not nullable) */
+	gboolean interactive;
+	guint n_icons_remaining;
+} AppDownload;
+
+static void
+app_download_free (AppDownload *data)
+{
+	g_clear_object (&data->app);
+	g_free (data);
+}
+
 G_DEFINE_FINAL_TYPE (GsIconDownloader, gs_icon_downloader, G_TYPE_OBJECT)
 
 typedef enum {
@@ -59,6 +114,9 @@ gs_icon_downloader_finalize (GObject *object)
 	g_clear_object (&self->cancellable);
 	g_clear_object (&self->worker);
 	g_clear_object (&self->soup_session);
+	g_clear_pointer (&self->requests, g_hash_table_unref);
+	g_assert (g_queue_is_empty (&self->requests_queue));
+	g_assert (self->drain_task == NULL);
 
 	G_OBJECT_CLASS (gs_icon_downloader_parent_class)->finalize (object);
 }
@@ -147,6 +205,9 @@ static void
 gs_icon_downloader_init (GsIconDownloader *self)
 {
 	self->worker = gs_worker_thread_new ("gs-icon-downloader");
+	self->cancellable = g_cancellable_new ();
+	self->requests = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) icon_request_free);
+	g_queue_init (&self->requests_queue);
 }
 
 /**
@@ -169,10 +230,10 @@ gs_icon_downloader_new (SoupSession *soup_session,
 }
 
 
-static void download_remote_icons_of_the_app_cb (GTask        *task,
-                                                 gpointer      source_object,
-                                                 gpointer      task_data,
-                                                 GCancellable *cancellable);
+static void queue_remote_icons_of_the_app_cb (GTask        *task,
+                                              gpointer      source_object,
+                                              gpointer      task_data,
+                                              GCancellable *cancellable);
 
 static void app_remote_icons_download_finished (GObject      *source_object,
                                                 GAsyncResult *result,
@@ -196,6 +257,7 @@ gs_icon_downloader_queue_app (GsIconDownloader *self,
 	g_autoptr(GTask) task = NULL;
 	g_autoptr(GPtrArray) icons = NULL;
 	gboolean has_remote_icon = FALSE;
+	AppDownload *data;
 
 	g_return_if_fail (GS_IS_ICON_DOWNLOADER (self));
 	g_return_if_fail (GS_IS_APP (app));
@@ -216,67 +278,202 @@ gs_icon_downloader_queue_app (GsIconDownloader *self,
 
 	gs_app_set_icons_state (app, GS_APP_ICONS_STATE_PENDING_DOWNLOAD);
 
+	data = g_new0 (AppDownload, 1);
+	data->app = g_object_ref (app);
+	data->interactive = interactive;
+
 	task = g_task_new (self, self->cancellable, app_remote_icons_download_finished, NULL);
-	g_task_set_task_data (task, g_object_ref (app), g_object_unref);
+	g_task_set_task_data (task, data, (GDestroyNotify) app_download_free);
 	g_task_set_source_tag (task, gs_icon_downloader_queue_app);
 
 	gs_worker_thread_queue (self->worker, interactive ? G_PRIORITY_DEFAULT : G_PRIORITY_LOW,
-				download_remote_icons_of_the_app_cb, g_steal_pointer (&task));
+				queue_remote_icons_of_the_app_cb, g_steal_pointer (&task));
+}
+
+static void start_icon_requests (GsIconDownloader *self);
+static void icon_request_complete (IconRequest *request);
+
+/* Insert @request in the queue after the other interactive requests, or at the
+ * end if it’s not interactive. Run in @worker. */
+static void
+enqueue_icon_request (GsIconDownloader *self,
+                      IconRequest      *request)
+{
+	GList *link;
+
+	if (!request->interactive) {
+		g_queue_push_tail (&self->requests_queue, request);
+		return;
+	}
+
+	for (link = self->requests_queue.head; link != NULL; link = link->next) {
+		if (!((IconRequest *) link->data)->interactive)
+			break;
+	}
+
+	if (link != NULL)
+		g_queue_insert_before (&self->requests_queue, link, request);
+	else
+		g_queue_push_tail (&self->requests_queue, request);
 }
 
 /* Run in @worker. */
 static void
-download_remote_icons_of_the_app_cb (GTask        *task,
-                                     gpointer      source_object,
-                                     gpointer      task_data,
-                                     GCancellable *cancellable)
+queue_remote_icons_of_the_app_cb (GTask        *task,
+                                  gpointer      source_object,
+                                  gpointer      task_data,
+                                  GCancellable *cancellable)
 {
 	GsIconDownloader *self = GS_ICON_DOWNLOADER (source_object);
-	g_autoptr(GPtrArray) remote_icons = NULL;
+	AppDownload *data = task_data;
 	g_autoptr(GPtrArray) icons = NULL;
-	GsApp *app;
 
 	g_assert (gs_worker_thread_is_in_worker_context (self->worker));
 
-	app = GS_APP (task_data);
-	icons = gs_app_dup_icons (app);
-	remote_icons = g_ptr_array_new_full (icons ? icons->len : 0, g_object_unref);
+	if (g_task_return_error_if_cancelled (task)) {
+		gs_app_set_icons_state (data->app, GS_APP_ICONS_STATE_AVAILABLE);
+		return;
+	}
 
+	icons = gs_app_dup_icons (data->app);
+
+	/* Join the download of each icon if it’s already queued or running,
+	 * otherwise queue a new one. */
 	for (guint j = 0; icons && j < icons->len; j++) {
 		GObject *icon = g_ptr_array_index (icons, j);
+		IconRequest *request;
+
+		if (!GS_IS_REMOTE_ICON (icon))
+			continue;
+
+		request = g_hash_table_lookup (self->requests, gs_remote_icon_get_uri (GS_REMOTE_ICON (icon)));
+		if (request == NULL) {
+			request = g_new0 (IconRequest, 1);
+			request->self = self;
+			request->icons = g_ptr_array_new_with_free_func (g_object_unref);
+			request->tasks = g_ptr_array_new_with_free_func (g_object_unref);
+			request->interactive = data->interactive;
+			g_ptr_array_add (request->icons, g_object_ref (icon));
+			g_hash_table_insert (self->requests, (gpointer) icon_request_get_uri (request), request);
+			enqueue_icon_request (self, request);
+		} else {
+			g_debug ("Waiting for existing download of remote icon %s",
+				 icon_request_get_uri (request));
+			g_ptr_array_add (request->icons, g_object_ref (icon));
+
+			/* Move it up the queue if this is the first
+			 * interactive request for it. */
+			if (data->interactive && !request->interactive && !request->running) {
+				g_queue_remove (&self->requests_queue, request);
+				request->interactive = TRUE;
+				enqueue_icon_request (self, request);
+			}
+		}
 
-		if (GS_IS_REMOTE_ICON (icon))
-			g_ptr_array_add (remote_icons, g_object_ref (icon));
+		g_ptr_array_add (request->tasks, g_object_ref (task));
+		data->n_icons_remaining++;
 	}
 
-	g_assert (remote_icons->len > 0);
+	/* The icons may have changed since the app was queued. */
+	if (data->n_icons_remaining == 0) {
+		gs_app_set_icons_state (data->app, GS_APP_ICONS_STATE_AVAILABLE);
+		g_task_return_boolean (task, TRUE);
+		return;
+	}
 
-	g_debug ("Downloading %u icons for app %s", remote_icons->len, gs_app_get_id (app));
+	g_debug ("Queued %u icons for app %s", data->n_icons_remaining, gs_app_get_id (data->app));
 
-	gs_app_set_icons_state (app, GS_APP_ICONS_STATE_DOWNLOADING);
+	start_icon_requests (self);
+}
 
-	for (guint j = 0; j < remote_icons->len; j++) {
-		GObject *icon = g_ptr_array_index (remote_icons, j);
-		g_autoptr(GError) local_error = NULL;
+static void icon_request_finished_cb (GObject      *source_object,
+                                      GAsyncResult *result,
+                                      gpointer      user_data);
 
-		gs_remote_icon_ensure_cached (GS_REMOTE_ICON (icon),
-					      self->soup_session,
-					      self->maximum_size_px,
-					      cancellable,
-					      &local_error);
+/* Start queued downloads until the maximum number are running. The
+ * downloads are async, so their callbacks are run in @worker too.
+ * Run in @worker. */
+static void
+start_icon_requests (GsIconDownloader *self)
+{
+	while (self->n_requests_running < MAX_PARALLEL_ICON_DOWNLOADS &&
+	       !g_queue_is_empty (&self->requests_queue)) {
+		IconRequest *request = g_queue_pop_head (&self->requests_queue);
 
-		if (local_error)
-			g_debug ("Error downloading remote icon: %s", local_error->message);
+		request->running = TRUE;
+		self->n_requests_running++;
 
-		if (g_task_return_error_if_cancelled (task)) {
-			gs_app_set_icons_state (app, GS_APP_ICONS_STATE_AVAILABLE);
-			return;
+		for (guint i = 0; i < request->tasks->len; i++) {
+			AppDownload *data = g_task_get_task_data (g_ptr_array_index (request->tasks, i));
+			gs_app_set_icons_state (data->app, GS_APP_ICONS_STATE_DOWNLOADING);
 		}
+
+		gs_remote_icon_ensure_cached_async (g_ptr_array_index (request->icons, 0),
+						    self->soup_session,
+						    self->maximum_size_px,
+						    request->interactive ? G_PRIORITY_DEFAULT : G_PRIORITY_LOW,
+						    self->cancellable,
+						    icon_request_finished_cb,
+						    request);
 	}
+}
 
-	gs_app_set_icons_state (app, GS_APP_ICONS_STATE_AVAILABLE);
+/* Run in @worker. */
+static void
+icon_request_finished_cb (GObject      *source_object,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+	IconRequest *request = user_data;
+	g_autoptr(GsIconDownloader) self = g_object_ref (request->self);
+	GsRemoteIcon *downloaded_icon = GS_REMOTE_ICON (source_object);
+	g_autoptr(GError) local_error = NULL;
 
-	g_task_return_boolean (task, TRUE);
+	if (!gs_remote_icon_ensure_cached_finish (downloaded_icon, result, &local_error))
+		g_debug ("Error downloading remote icon: %s", local_error->message);
+
+	/* The other icons with this URI share the cached file, so need its
+	 * dimensions too. */
+	for (guint i = 1; local_error == NULL && i < request->icons->len; i++) {
+		GObject *icon = g_ptr_array_index (request->icons, i);
+
+		g_object_set_data (icon, "width", g_object_get_data (G_OBJECT (downloaded_icon), "width"));
+		g_object_set_data (icon, "height", g_object_get_data (G_OBJECT (downloaded_icon), "height"));
+	}
+
+	self->n_requests_running--;
+	icon_request_complete (request);
+
+	/* Finish shutting down once the last download is done. */
+	if (self->drain_task != NULL && self->n_requests_running == 0)
+		g_task_return_boolean (g_steal_pointer (&self->drain_task), TRUE);
+	else
+		start_icon_requests (self);
+}
+
+/* Remove @request, and complete the download of each app which was only
+ * waiting for it. @request is freed. Run in @worker. */
+static void
+icon_request_complete (IconRequest *request)
+{
+	GsIconDownloader *self = request->self;
+	g_autoptr(GPtrArray) tasks = g_steal_pointer (&request->tasks);
+
+	g_hash_table_remove (self->requests, icon_request_get_uri (request));
+
+	for (guint i = 0; i < tasks->len; i++) {
+		GTask *task = g_ptr_array_index (tasks, i);
+		AppDownload *data = g_task_get_task_data (task);
+
+		g_assert (data->n_icons_remaining > 0);
+		if (--data->n_icons_remaining > 0)
+			continue;
+
+		gs_app_set_icons_state (data->app, GS_APP_ICONS_STATE_AVAILABLE);
+
+		if (!g_task_return_error_if_cancelled (task))
+			g_task_return_boolean (task, TRUE);
+	}
 }
 
 static void
@@ -293,6 +490,13 @@ app_remote_icons_download_finished (GObject      *source_object,
 		g_warning ("Failed to download icons of one app: %s", error->message);
 }
 
+static void drain_requests_cb (GTask        *task,
+                               gpointer      source_object,
+                               gpointer      task_data,
+                               GCancellable *cancellable);
+static void drained_cb (GObject      *source_object,
+                        GAsyncResult *result,
+                        gpointer      user_data);
 static void shutdown_cb (GObject      *source_object,
                          GAsyncResult *result,
                          gpointer      user_data);
@@ -306,8 +510,9 @@ static void shutdown_cb (GObject      *source_object,
  *
  * Shut down the icon downloader.
  *
- * This will shut down the internal worker thread that @self uses to
- * queue app downloads.
+ * This will cancel any icon downloads which are still queued or running,
+ * and then shut down the internal worker thread that @self uses to queue
+ * app downloads.
  *
  * This is a no-op if called subsequently.
  *
@@ -320,6 +525,7 @@ gs_icon_downloader_shutdown_async (GsIconDownloader    *self,
                                    gpointer             user_data)
 {
 	g_autoptr(GTask) task = NULL;
+	g_autoptr(GTask) drain_task = NULL;
 
 	g_return_if_fail (GS_IS_ICON_DOWNLOADER (self));
 	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
@@ -327,8 +533,55 @@ gs_icon_downloader_shutdown_async (GsIconDownloader    *self,
 	task = g_task_new (self, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_icon_downloader_shutdown_async);
 
-	gs_worker_thread_shutdown_async (self->worker, cancellable, shutdown_cb,
-					 g_steal_pointer (&task));
+	/* The running downloads have to finish before the worker thread is
+	 * shut down, as their callbacks are run in it. Waiting for them is
+	 * done in a separate task so that the worker thread is shut down from
+	 * this thread, rather than from itself. */
+	g_cancellable_cancel (self->cancellable);
+
+	drain_task = g_task_new (self, cancellable, drained_cb, g_steal_pointer (&task));
+	g_task_set_source_tag (drain_task, drain_requests_cb);
+
+	gs_worker_thread_queue (self->worker, G_PRIORITY_LOW,
+				drain_requests_cb, g_steal_pointer (&drain_task));
+}
+
+/* Run in @worker. */
+static void
+drain_requests_cb (GTask        *task,
+                   gpointer      source_object,
+                   gpointer      task_data,
+                   GCancellable *cancellable)
+{
+	GsIconDownloader *self = GS_ICON_DOWNLOADER (source_object);
+	IconRequest *request;
+
+	g_assert (gs_worker_thread_is_in_worker_context (self->worker));
+
+	/* Drop the queued downloads; their apps’ tasks return cancelled. */
+	while ((request = g_queue_pop_head (&self->requests_queue)) != NULL)
+		icon_request_complete (request);
+
+	if (self->n_requests_running == 0) {
+		g_task_return_boolean (task, TRUE);
+	} else {
+		g_assert (self->drain_task == NULL);
+		self->drain_task = g_object_ref (task);
+	}
+}
+
+static void
+drained_cb (GObject      *source_object,
+            GAsyncResult *result,
+            gpointer      user_data)
+{
+	GsIconDownloader *self = GS_ICON_DOWNLOADER (source_object);
+	g_autoptr(GTask) task = G_TASK (user_data);
+
+	g_assert (g_task_is_valid (result, source_object));
+
+	gs_worker_thread_shutdown_async (self->worker, g_task_get_cancellable (task),
+					 shutdown_cb, g_steal_pointer (&task));
 }
 
 static void
@@ -144,8 +144,29 @@ job_contains_app_by_unique_id (GsPluginJob *job,
 
 	/* FIXME: This could be improved in future by making GsPluginJob subclasses
 	 * implement an interface to query which apps they are acting on. */
-	if (GS_IS_PLUGIN_JOB_UPDATE_APPS (job))
+	if (GS_IS_PLUGIN_JOB_UPDATE_APPS (job)) {
 		apps = gs_plugin_job_update_apps_get_apps (GS_PLUGIN_JOB_UPDATE_APPS (job));
+	} else {
+		/* old-style jobs which modify an app, as scheduled by the
+		 * plugin loader’s queued operations */
+		switch (gs_plugin_job_get_action (job)) {
+		case GS_PLUGIN_ACTION_INSTALL:
+		case GS_PLUGIN_ACTION_REMOVE:
+		case GS_PLUGIN_ACTION_UPGRADE_DOWNLOAD:
+		case GS_PLUGIN_ACTION_UPGRADE_TRIGGER: {
+			GsApp *app = gs_plugin_job_get_app (job);
+
+			if (app != NULL &&
+			    g_strcmp0 (gs_app_get_unique_id (app), app_unique_id) == 0)
+				return TRUE;
+
+			apps = gs_plugin_job_get_list (job);
+			break;
+		}
+		default:
+			break;
+		}
+	}
 
 	if (apps == NULL)
 		return FALSE;
@@ -0,0 +1,28 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2021 Endless OS Foundation LLC
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+
+#include "gs-key-colors.h"
+
+G_BEGIN_DECLS
+
+/* Which implementation of the clustering code to use. All of them return
+ * identical results; this only exists so they can be compared in tests and
+ * benchmarks. */
+typedef enum {
+	GS_KEY_COLORS_IMPL_AUTO,
+	GS_KEY_COLORS_IMPL_SCALAR,
+	GS_KEY_COLORS_IMPL_SIMD,
+} GsKeyColorsImpl;
+
+gboolean gs_key_colors_simd_supported		(void);
+GArray	*gs_calculate_key_colors_with_impl	(GdkPixbuf	*pixbuf,
+						 GsKeyColorsImpl impl);
+
+G_END_DECLS
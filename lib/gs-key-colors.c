@@ -23,16 +23,34 @@
  *
  * Use gs_calculate_key_colors() to calculate the key colors from an app’s icon.
  *
+ * Calculating them is not free, so the key colors for icon files are cached
+ * on disk, keyed by the file’s path, modification time and size. Use
+ * gs_calculate_key_colors_for_file() to look them up in the cache, or
+ * calculate and cache them if needed.
+ *
  * Since: 40
  */
 
 #include "config.h"
 
+#include <sys/stat.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <gdk/gdk.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
 
 #include "gs-key-colors.h"
+#include "gs-key-colors-private.h"
+#include "gs-utils.h"
+
+/* The k-means clustering has a vectorised implementation for x86, which is
+ * chosen at runtime if the CPU supports it. SSE2 is always available on
+ * x86_64, but not necessarily on i386. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SSE2_K_MEANS 1
+#include <emmintrin.h>
+#define SSE2_TARGET __attribute__ ((target ("sse2")))
+#endif
 
 /* Hard-code the number of clusters to split the icon color space into. This
  * gives the maximum number of key colors returned for an icon. This number has
@@ -119,6 +137,205 @@ nearest_cluster (const Pixel8 *pixel,
 	return nearest_cluster;
 }
 
+/* Add the color of each pixel in @pixels to the accumulator for the cluster
+ * it’s assigned to. Pixels which aren’t assigned to a cluster are skipped. */
+static void
+accumulate_clusters_scalar (const ClusterPixel8    *pixels,
+                            gsize                   n_pixels,
+                            CentroidAccumulator    *accumulators,
+                            gsize                   n_cluster_centres)
+{
+	for (const ClusterPixel8 *p = pixels; p < pixels + n_pixels; p++) {
+		if (p->cluster >= n_cluster_centres)
+			continue;
+
+		accumulators[p->cluster].red += p->color.red;
+		accumulators[p->cluster].green += p->color.green;
+		accumulators[p->cluster].blue += p->color.blue;
+		accumulators[p->cluster].n_members++;
+	}
+}
+
+/* Reassign each pixel in @pixels to its nearest cluster, and return how many
+ * of them changed cluster. */
+static guint
+assign_clusters_scalar (ClusterPixel8 *pixels,
+                        gsize          n_pixels,
+                        const Pixel8  *cluster_centres,
+                        gsize          n_cluster_centres)
+{
+	guint n_assignments_changed = 0;
+
+	for (ClusterPixel8 *p = pixels; p < pixels + n_pixels; p++) {
+		gsize new_cluster;
+
+		if (p->cluster >= n_cluster_centres)
+			continue;
+
+		new_cluster = nearest_cluster (&p->color, cluster_centres, n_cluster_centres);
+		if (new_cluster != p->cluster)
+			n_assignments_changed++;
+		p->cluster = new_cluster;
+	}
+
+	return n_assignments_changed;
+}
+
+#ifdef HAVE_SSE2_K_MEANS
+/* The SSE2 implementation works on four pixels at a time, with each
+ * #ClusterPixel8 in one 32-bit lane: red in the low byte, then green, blue and
+ * the cluster/alpha byte in the high byte. All the arithmetic is on integers,
+ * so the results are identical to the scalar implementation. */
+
+static inline SSE2_TARGET __m128i
+select_epi32 (__m128i mask,
+              __m128i if_true,
+              __m128i if_false)
+{
+	return _mm_or_si128 (_mm_and_si128 (mask, if_true),
+			     _mm_andnot_si128 (mask, if_false));
+}
+
+static inline SSE2_TARGET guint
+sum_epi32 (__m128i v)
+{
+	guint32 lanes[4];
+
+	_mm_storeu_si128 ((__m128i *) lanes, v);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+/* Squared distance from each pixel to @centre. The channels are in the low 16
+ * bits of each lane, so _mm_sub_epi16() gives the signed difference in those
+ * and zero in the high 16 bits, which _mm_madd_epi16() then squares. */
+static inline SSE2_TARGET __m128i
+color_distance_sse2 (__m128i       red,
+                     __m128i       green,
+                     __m128i       blue,
+                     const Pixel8 *centre)
+{
+	__m128i dr = _mm_sub_epi16 (red, _mm_set1_epi32 (centre->red));
+	__m128i dg = _mm_sub_epi16 (green, _mm_set1_epi32 (centre->green));
+	__m128i db = _mm_sub_epi16 (blue, _mm_set1_epi32 (centre->blue));
+
+	return _mm_add_epi32 (_mm_add_epi32 (_mm_madd_epi16 (dr, dr),
+					     _mm_madd_epi16 (dg, dg)),
+			      _mm_madd_epi16 (db, db));
+}
+
+static SSE2_TARGET void
+accumulate_clusters_sse2 (const ClusterPixel8    *pixels,
+                          gsize                   n_pixels,
+                          CentroidAccumulator    *accumulators,
+                          gsize                   n_cluster_centres)
+{
+	const __m128i byte_mask = _mm_set1_epi32 (0xff);
+	__m128i acc_red[n_cluster_centres];
+	__m128i acc_green[n_cluster_centres];
+	__m128i acc_blue[n_cluster_centres];
+	__m128i acc_n_members[n_cluster_centres];
+	gsize i;
+
+	for (gsize c = 0; c < n_cluster_centres; c++) {
+		acc_red[c] = _mm_setzero_si128 ();
+		acc_green[c] = _mm_setzero_si128 ();
+		acc_blue[c] = _mm_setzero_si128 ();
+		acc_n_members[c] = _mm_setzero_si128 ();
+	}
+
+	for (i = 0; i + 4 <= n_pixels; i += 4) {
+		__m128i pixel = _mm_loadu_si128 ((const __m128i *) &pixels[i]);
+		__m128i red = _mm_and_si128 (pixel, byte_mask);
+		__m128i green = _mm_and_si128 (_mm_srli_epi32 (pixel, 8), byte_mask);
+		__m128i blue = _mm_and_si128 (_mm_srli_epi32 (pixel, 16), byte_mask);
+		__m128i cluster = _mm_srli_epi32 (pixel, 24);
+
+		/* Pixels which aren’t in any cluster never match */
+		for (gsize c = 0; c < n_cluster_centres; c++) {
+			__m128i in_cluster = _mm_cmpeq_epi32 (cluster, _mm_set1_epi32 (c));
+
+			acc_red[c] = _mm_add_epi32 (acc_red[c], _mm_and_si128 (in_cluster, red));
+			acc_green[c] = _mm_add_epi32 (acc_green[c], _mm_and_si128 (in_cluster, green));
+			acc_blue[c] = _mm_add_epi32 (acc_blue[c], _mm_and_si128 (in_cluster, blue));
+			acc_n_members[c] = _mm_sub_epi32 (acc_n_members[c], in_cluster);
+		}
+	}
+
+	for (gsize c = 0; c < n_cluster_centres; c++) {
+		accumulators[c].red += sum_epi32 (acc_red[c]);
+		accumulators[c].green += sum_epi32 (acc_green[c]);
+		accumulators[c].blue += sum_epi32 (acc_blue[c]);
+		accumulators[c].n_members += sum_epi32 (acc_n_members[c]);
+	}
+
+	accumulate_clusters_scalar (pixels + i, n_pixels - i, accumulators, n_cluster_centres);
+}
+
+static SSE2_TARGET guint
+assign_clusters_sse2 (ClusterPixel8 *pixels,
+                      gsize          n_pixels,
+                      const Pixel8  *cluster_centres,
+                      gsize          n_cluster_centres)
+{
+	const __m128i byte_mask = _mm_set1_epi32 (0xff);
+	const __m128i color_mask = _mm_set1_epi32 (0x00ffffff);
+	const __m128i n_clusters_vec = _mm_set1_epi32 (n_cluster_centres);
+	guint n_assignments_changed = 0;
+	gsize i;
+
+	for (i = 0; i + 4 <= n_pixels; i += 4) {
+		__m128i pixel = _mm_loadu_si128 ((const __m128i *) &pixels[i]);
+		__m128i red = _mm_and_si128 (pixel, byte_mask);
+		__m128i green = _mm_and_si128 (_mm_srli_epi32 (pixel, 8), byte_mask);
+		__m128i blue = _mm_and_si128 (_mm_srli_epi32 (pixel, 16), byte_mask);
+		__m128i cluster = _mm_srli_epi32 (pixel, 24);
+		__m128i nearest = _mm_setzero_si128 ();
+		__m128i nearest_distance = color_distance_sse2 (red, green, blue, &cluster_centres[0]);
+		__m128i in_any_cluster, new_cluster, changed;
+
+		/* Strictly less than, so ties go to the lowest cluster, as in
+		 * nearest_cluster() */
+		for (gsize c = 1; c < n_cluster_centres; c++) {
+			__m128i distance = color_distance_sse2 (red, green, blue, &cluster_centres[c]);
+			__m128i closer = _mm_cmplt_epi32 (distance, nearest_distance);
+
+			nearest_distance = select_epi32 (closer, distance, nearest_distance);
+			nearest = select_epi32 (closer, _mm_set1_epi32 (c), nearest);
+		}
+
+		in_any_cluster = _mm_cmplt_epi32 (cluster, n_clusters_vec);
+		new_cluster = select_epi32 (in_any_cluster, nearest, cluster);
+		changed = _mm_cmpeq_epi32 (new_cluster, cluster);
+		n_assignments_changed += 4 - __builtin_popcount (_mm_movemask_ps (_mm_castsi128_ps (changed)));
+
+		pixel = _mm_or_si128 (_mm_and_si128 (pixel, color_mask),
+				      _mm_slli_epi32 (new_cluster, 24));
+		_mm_storeu_si128 ((__m128i *) &pixels[i], pixel);
+	}
+
+	return n_assignments_changed +
+	       assign_clusters_scalar (pixels + i, n_pixels - i, cluster_centres, n_cluster_centres);
+}
+#endif  /* HAVE_SSE2_K_MEANS */
+
+/**
+ * gs_key_colors_simd_supported:
+ *
+ * Check whether the vectorised implementation of the key color calculation
+ * can be used on this CPU.
+ *
+ * Returns: %TRUE if it can be used
+ */
+gboolean
+gs_key_colors_simd_supported (void)
+{
+#ifdef HAVE_SSE2_K_MEANS
+	return __builtin_cpu_supports ("sse2");
+#else
+	return FALSE;
+#endif
+}
+
 /* A variant of g_random_int_range() which chooses without replacement,
  * tracking the used integers in @used_ints and @n_used_ints.
  * Once all integers in 0..max_ints have been used once, it will choose
@@ -174,13 +391,15 @@ random_int_range_no_replacement (guint max_ints,
  * are optimal, only that they’re good enough. */
 static void
 k_means (GArray    *colors,
-         GdkPixbuf *pb)
+         GdkPixbuf *pb,
+         gboolean   use_simd)
 {
 	gint rowstride, n_channels;
 	gint width, height;
 	guint8 *raw_pixels;
 	ClusterPixel8 *pixels;
 	const ClusterPixel8 *pixels_end;
+	gsize n_pixels;
 	Pixel8 cluster_centres[n_clusters];
 	CentroidAccumulator cluster_accumulators[n_clusters];
 	gboolean used_clusters[n_clusters];
@@ -202,7 +421,8 @@ k_means (GArray    *colors,
 	g_assert (n_channels == 4);
 
 	pixels = (ClusterPixel8 *) raw_pixels;
-	pixels_end = &pixels[height * width];
+	n_pixels = (gsize) height * width;
+	pixels_end = &pixels[n_pixels];
 
 	memset (cluster_centres, 0, sizeof (cluster_centres));
 	memset (used_clusters, 0, sizeof (used_clusters));
@@ -242,15 +462,12 @@ k_means (GArray    *colors,
 		 * the colors which are in it. */
 		memset (cluster_accumulators, 0, sizeof (cluster_accumulators));
 
-		for (const ClusterPixel8 *p = pixels; p < pixels_end; p++) {
-			if (p->cluster >= G_N_ELEMENTS (cluster_centres))
-				continue;
-
-			cluster_accumulators[p->cluster].red += p->color.red;
-			cluster_accumulators[p->cluster].green += p->color.green;
-			cluster_accumulators[p->cluster].blue += p->color.blue;
-			cluster_accumulators[p->cluster].n_members++;
-		}
+#ifdef HAVE_SSE2_K_MEANS
+		if (use_simd)
+			accumulate_clusters_sse2 (pixels, n_pixels, cluster_accumulators, G_N_ELEMENTS (cluster_centres));
+		else
+#endif
+			accumulate_clusters_scalar (pixels, n_pixels, cluster_accumulators, G_N_ELEMENTS (cluster_centres));
 
 		for (gsize i = 0; i < G_N_ELEMENTS (cluster_centres); i++) {
 			if (cluster_accumulators[i].n_members == 0)
@@ -262,18 +479,12 @@ k_means (GArray    *colors,
 		}
 
 		/* Update assignments of colors to clusters. */
-		n_assignments_changed = 0;
-		for (ClusterPixel8 *p = pixels; p < pixels_end; p++) {
-			gsize new_cluster;
-
-			if (p->cluster >= G_N_ELEMENTS (cluster_centres))
-				continue;
-
-			new_cluster = nearest_cluster (&p->color, cluster_centres, G_N_ELEMENTS (cluster_centres));
-			if (new_cluster != p->cluster)
-				n_assignments_changed++;
-			p->cluster = new_cluster;
-		}
+#ifdef HAVE_SSE2_K_MEANS
+		if (use_simd)
+			n_assignments_changed = assign_clusters_sse2 (pixels, n_pixels, cluster_centres, G_N_ELEMENTS (cluster_centres));
+		else
+#endif
+			n_assignments_changed = assign_clusters_scalar (pixels, n_pixels, cluster_centres, G_N_ELEMENTS (cluster_centres));
 
 		n_iterations++;
 	} while (n_assignments_changed > assignments_termination_limit && n_iterations < 50);
@@ -310,9 +521,28 @@ k_means (GArray    *colors,
  */
 GArray *
 gs_calculate_key_colors (GdkPixbuf *pixbuf)
+{
+	return gs_calculate_key_colors_with_impl (pixbuf, GS_KEY_COLORS_IMPL_AUTO);
+}
+
+/**
+ * gs_calculate_key_colors_with_impl:
+ * @pixbuf: an app icon to calculate key colors from
+ * @impl: implementation of the clustering code to use
+ *
+ * Like gs_calculate_key_colors(), but allows the implementation to be chosen
+ * so that they can be compared. %GS_KEY_COLORS_IMPL_SIMD falls back to the
+ * scalar implementation if gs_key_colors_simd_supported() is %FALSE.
+ *
+ * Returns: (transfer full) (element-type GdkRGBA): key colors for @pixbuf
+ */
+GArray *
+gs_calculate_key_colors_with_impl (GdkPixbuf       *pixbuf,
+                                   GsKeyColorsImpl  impl)
 {
 	g_autoptr(GdkPixbuf) pb_small = NULL;
 	g_autoptr(GArray) colors = g_array_new (FALSE, FALSE, sizeof (GdkRGBA));
+	gboolean use_simd = (impl != GS_KEY_COLORS_IMPL_SCALAR && gs_key_colors_simd_supported ());
 
 	/* people almost always use BILINEAR scaling with pixbufs, but we can
 	 * use NEAREST here since we only care about the rough colour data, not
@@ -328,7 +558,278 @@ gs_calculate_key_colors (GdkPixbuf *pixbuf)
 	}
 
 	/* get a list of key colors */
-	k_means (colors, pb_small);
+	k_means (colors, pb_small, use_simd);
+
+	return g_steal_pointer (&colors);
+}
+
+/* Bump this if the algorithm changes, to invalidate the cache */
+#define KEY_COLORS_CACHE_VERSION 1
+
+/* Entries are keyed by icon mtime, so updated icons leave old entries behind;
+ * drop those which haven’t been written for a while, and bound the total */
+#define KEY_COLORS_CACHE_MAX_AGE_SECS (30 * 24 * 60 * 60)
+#define KEY_COLORS_CACHE_MAX_ENTRIES 2000
+
+static gchar *
+key_colors_cache_filename (const gchar        *cache_key,
+			   GsUtilsCacheFlags   flags,
+			   GError            **error)
+{
+	return gs_utils_get_cache_filename ("key-colors", cache_key,
+					    GS_UTILS_CACHE_FLAG_WRITEABLE | flags,
+					    error);
+}
+
+static gchar *
+key_colors_cache_dirname (void)
+{
+	g_autofree gchar *filename = key_colors_cache_filename ("key-colors", GS_UTILS_CACHE_FLAG_NONE, NULL);
+
+	return (filename != NULL) ? g_path_get_dirname (filename) : NULL;
+}
+
+/**
+ * gs_key_colors_cache_key_for_file:
+ * @filename: path to an icon file
+ *
+ * Get the key to cache the key colors of @filename under. It changes if the
+ * file is modified.
+ *
+ * Returns: (transfer full) (nullable): cache key, or %NULL if @filename
+ *   can’t be accessed
+ * Since: 46
+ */
+gchar *
+gs_key_colors_cache_key_for_file (const gchar *filename)
+{
+	GStatBuf st;
+	g_autofree gchar *str = NULL;
+
+	g_return_val_if_fail (filename != NULL, NULL);
+
+	if (g_stat (filename, &st) != 0)
+		return NULL;
+
+	str = g_strdup_printf ("%u\n%s\n%" G_GINT64_FORMAT "\n%" G_GINT64_FORMAT,
+			       (guint) KEY_COLORS_CACHE_VERSION, filename,
+			       (gint64) st.st_mtime, (gint64) st.st_size);
+	return g_compute_checksum_for_string (G_CHECKSUM_SHA1, str, -1);
+}
+
+/**
+ * gs_key_colors_cache_lookup:
+ * @cache_key: key from gs_key_colors_cache_key_for_file()
+ *
+ * Look up previously calculated key colors in the on-disk cache.
+ *
+ * Returns: (transfer full) (nullable) (element-type GdkRGBA): key colors, or
+ *   %NULL if they’re not cached
+ * Since: 46
+ */
+GArray *
+gs_key_colors_cache_lookup (const gchar *cache_key)
+{
+	g_autofree gchar *filename = NULL;
+	g_autoptr(GMappedFile) mapped_file = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GVariant) variant = NULL;
+	g_autoptr(GArray) colors = NULL;
+	GVariantIter iter;
+	gdouble red, green, blue;
+
+	g_return_val_if_fail (cache_key != NULL, NULL);
+
+	filename = key_colors_cache_filename (cache_key, GS_UTILS_CACHE_FLAG_NONE, NULL);
+	if (filename == NULL)
+		return NULL;
+	mapped_file = g_mapped_file_new (filename, FALSE, NULL);
+	if (mapped_file == NULL)
+		return NULL;
+
+	bytes = g_mapped_file_get_bytes (mapped_file);
+	variant = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE ("a(ddd)"), bytes, FALSE));
+
+	/* empty entries are never written, so this one is corrupt; drop it so
+	 * the colors get calculated and cached again */
+	if (g_variant_n_children (variant) == 0 || !g_variant_is_normal_form (variant)) {
+		g_debug ("Removing invalid key colors cache entry ‘%s’", filename);
+		g_unlink (filename);
+		return NULL;
+	}
+
+	colors = g_array_sized_new (FALSE, FALSE, sizeof (GdkRGBA), g_variant_n_children (variant));
+	g_variant_iter_init (&iter, variant);
+	while (g_variant_iter_next (&iter, "(ddd)", &red, &green, &blue)) {
+		GdkRGBA rgba = { CLAMP (red, 0.0, 1.0), CLAMP (green, 0.0, 1.0), CLAMP (blue, 0.0, 1.0), 1.0 };
+		g_array_append_val (colors, rgba);
+	}
+
+	return g_steal_pointer (&colors);
+}
+
+/**
+ * gs_key_colors_cache_insert:
+ * @cache_key: key from gs_key_colors_cache_key_for_file()
+ * @colors: (element-type GdkRGBA): key colors to cache
+ *
+ * Store calculated key colors in the on-disk cache. Errors are ignored, as
+ * the colors can always be calculated again. Empty arrays are not cached.
+ *
+ * Since: 46
+ */
+void
+gs_key_colors_cache_insert (const gchar *cache_key,
+			    GArray      *colors)
+{
+	g_autofree gchar *filename = NULL;
+	g_autoptr(GVariant) variant = NULL;
+	g_autoptr(GError) local_error = NULL;
+	g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a(ddd)"));
+
+	g_return_if_fail (cache_key != NULL);
+	g_return_if_fail (colors != NULL);
+
+	if (colors->len == 0)
+		return;
+
+	for (guint i = 0; i < colors->len; i++) {
+		const GdkRGBA *rgba = &g_array_index (colors, GdkRGBA, i);
+		g_variant_builder_add (&builder, "(ddd)", (gdouble) rgba->red, (gdouble) rgba->green, (gdouble) rgba->blue);
+	}
+	variant = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+	filename = key_colors_cache_filename (cache_key, GS_UTILS_CACHE_FLAG_CREATE_DIRECTORY, &local_error);
+	if (filename == NULL ||
+	    !g_file_set_contents (filename,
+				  g_variant_get_data (variant),
+				  g_variant_get_size (variant),
+				  &local_error))
+		g_debug ("Failed to cache key colors: %s", local_error->message);
+}
+
+typedef struct {
+	gchar	*filename;  /* (owned) */
+	gint64	 mtime;
+} CacheEntry;
+
+static void
+cache_entry_clear (CacheEntry *entry)
+{
+	g_free (entry->filename);
+}
+
+static gint
+cache_entry_cmp_newest_first (gconstpointer a,
+			      gconstpointer b)
+{
+	const CacheEntry *entry_a = a;
+	const CacheEntry *entry_b = b;
+
+	if (entry_a->mtime > entry_b->mtime)
+		return -1;
+	if (entry_a->mtime < entry_b->mtime)
+		return 1;
+	return 0;
+}
+
+/**
+ * gs_key_colors_cache_prune:
+ *
+ * Delete entries from the on-disk cache which were written more than 30 days
+ * ago, and then the oldest entries until at most 2000 are left. Entries which
+ * are still needed are simply calculated and cached again.
+ *
+ * This does blocking I/O, so should be called from a worker thread.
+ *
+ * Since: 46
+ */
+void
+gs_key_colors_cache_prune (void)
+{
+	g_autofree gchar *dirname = key_colors_cache_dirname ();
+	g_autoptr(GDir) dir = NULL;
+	g_autoptr(GArray) entries = NULL;
+	gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+	const gchar *name;
+	guint n_deleted = 0;
+
+	if (dirname == NULL)
+		return;
+	dir = g_dir_open (dirname, 0, NULL);
+	if (dir == NULL)
+		return;
+
+	entries = g_array_new (FALSE, FALSE, sizeof (CacheEntry));
+	g_array_set_clear_func (entries, (GDestroyNotify) cache_entry_clear);
+
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		g_autofree gchar *filename = g_build_filename (dirname, name, NULL);
+		GStatBuf st;
+		CacheEntry entry;
+
+		if (g_stat (filename, &st) != 0 || !S_ISREG (st.st_mode))
+			continue;
+
+		if (now - (gint64) st.st_mtime > KEY_COLORS_CACHE_MAX_AGE_SECS) {
+			if (g_unlink (filename) == 0)
+				n_deleted++;
+			continue;
+		}
+
+		entry.filename = g_steal_pointer (&filename);
+		entry.mtime = (gint64) st.st_mtime;
+		g_array_append_val (entries, entry);
+	}
+
+	if (entries->len > KEY_COLORS_CACHE_MAX_ENTRIES) {
+		g_array_sort (entries, cache_entry_cmp_newest_first);
+		for (guint i = KEY_COLORS_CACHE_MAX_ENTRIES; i < entries->len; i++) {
+			if (g_unlink (g_array_index (entries, CacheEntry, i).filename) == 0)
+				n_deleted++;
+		}
+	}
+
+	if (n_deleted > 0)
+		g_debug ("Pruned %u entries from the key colors cache", n_deleted);
+}
+
+/**
+ * gs_calculate_key_colors_for_file:
+ * @filename: path to an icon file
+ *
+ * Get the key colors for the icon in @filename, from the cache if possible,
+ * otherwise by loading it and calculating them, and then caching them.
+ *
+ * This is safe to call from any thread.
+ *
+ * Returns: (transfer full) (nullable) (element-type GdkRGBA): key colors, or
+ *   %NULL if the icon couldn’t be loaded
+ * Since: 46
+ */
+GArray *
+gs_calculate_key_colors_for_file (const gchar *filename)
+{
+	g_autofree gchar *cache_key = NULL;
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	g_autoptr(GArray) colors = NULL;
+
+	g_return_val_if_fail (filename != NULL, NULL);
+
+	cache_key = gs_key_colors_cache_key_for_file (filename);
+	if (cache_key == NULL)
+		return NULL;
+
+	colors = gs_key_colors_cache_lookup (cache_key);
+	if (colors != NULL)
+		return g_steal_pointer (&colors);
+
+	pixbuf = gdk_pixbuf_new_from_file_at_size (filename, 32, 32, NULL);
+	if (pixbuf == NULL)
+		return NULL;
+
+	colors = gs_calculate_key_colors (pixbuf);
+	gs_key_colors_cache_insert (cache_key, colors);
 
 	return g_steal_pointer (&colors);
 }
@@ -23,5 +23,14 @@
 G_BEGIN_DECLS
 
 GArray	*gs_calculate_key_colors	(GdkPixbuf	*pixbuf);
+GArray	*gs_calculate_key_colors_for_file
+					(const gchar	*filename);
+
+gchar	*gs_key_colors_cache_key_for_file
+					(const gchar	*filename);
+GArray	*gs_key_colors_cache_lookup	(const gchar	*cache_key);
+void	 gs_key_colors_cache_insert	(const gchar	*cache_key,
+					 GArray		*colors);
+void	 gs_key_colors_cache_prune	(void);
 
 G_END_DECLS
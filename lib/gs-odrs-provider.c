@@ -31,9 +31,11 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <glib.h>
 #include <glib-object.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <gnome-software.h>
 #include <json-glib/json-glib.h>
 #include <libsoup/soup.h>
@@ -41,10 +43,13 @@
 #include <math.h>
 #include <string.h>
 
+#include "gs-app-private.h"
+
 G_DEFINE_QUARK (gs-odrs-provider-error-quark, gs_odrs_provider_error)
 
-/* Element in self->ratings, all allocated in one big block and sorted
- * alphabetically to reduce the number of allocations and fragmentation. */
+/* Element in the ratings parsed from the JSON, all allocated in one big block
+ * and sorted alphabetically to reduce the number of allocations and
+ * fragmentation. */
 typedef struct {
 	gchar *app_id;  /* (owned) */
 	guint32 n_star_ratings[6];
@@ -62,6 +67,33 @@ rating_clear (GsOdrsRating *rating)
 	g_free (rating->app_id);
 }
 
+/* The parsed ratings are saved as a binary index next to the downloaded JSON
+ * so later loads can memory map it rather than parsing the JSON again. It
+ * consists of a header, then the entries sorted by app ID, then the
+ * nul-terminated app IDs which the entries point into. Integers are in host
+ * byte order; an index from a machine with a different byte order fails the
+ * version check and is rebuilt. */
+#define RATINGS_INDEX_MAGIC "GSODRSI"
+#define RATINGS_INDEX_VERSION 1
+
+typedef struct {
+	gchar magic[8];  /* RATINGS_INDEX_MAGIC, nul-terminated */
+	guint32 version;
+	guint32 n_entries;
+	guint32 strings_len;
+	guint32 padding;
+	guint64 json_mtime;  /* of the JSON the index was built from */
+	guint64 json_size;
+} GsOdrsRatingsIndexHeader;
+
+typedef struct {
+	guint32 app_id_offset;  /* into the strings */
+	guint32 n_star_ratings[6];
+} GsOdrsRatingsIndexEntry;
+
+G_STATIC_ASSERT (sizeof (GsOdrsRatingsIndexHeader) % G_ALIGNOF (GsOdrsRatingsIndexEntry) == 0);
+G_STATIC_ASSERT (sizeof (RATINGS_INDEX_MAGIC) == sizeof (((GsOdrsRatingsIndexHeader *) NULL)->magic));
+
 struct _GsOdrsProvider
 {
 	GObject		 parent_instance;
@@ -69,8 +101,12 @@ struct _GsOdrsProvider
 	gchar		*distro;  /* (not nullable) (owned) */
 	gchar		*user_hash;  /* (not nullable) (owned) */
 	gchar		*review_server;  /* (not nullable) (owned) */
-	GArray		*ratings;  /* (element-type GsOdrsRating) (mutex ratings_mutex) (owned) (nullable) */
+	GBytes		*ratings;  /* (mutex ratings_mutex) (owned) (nullable), a validated ratings index */
 	GMutex		 ratings_mutex;
+	GMutex		 reviews_requests_mutex;
+	GHashTable	*reviews_requests;  /* (mutex reviews_requests_mutex) (owned) (element-type utf8 ReviewsRequest), queued and running requests by app ID */
+	GQueue		 reviews_requests_queue;  /* (mutex reviews_requests_mutex) (element-type ReviewsRequest), queued requests */
+	guint		 n_reviews_requests_running;  /* (mutex reviews_requests_mutex) */
 	guint64		 max_cache_age_secs;
 	guint		 n_results_max;
 	SoupSession	*session;  /* (owned) (not nullable) */
@@ -109,10 +145,10 @@ gs_odrs_provider_load_ratings_for_app (JsonObject   *json_app,
 	return TRUE;
 }
 
-static gboolean
-gs_odrs_provider_load_ratings (GsOdrsProvider  *self,
-                               const gchar     *filename,
-                               GError         **error)
+/* Returns the ratings sorted by app ID. */
+static GArray *
+gs_odrs_provider_parse_ratings (const gchar  *filename,
+                                GError      **error)
 {
 	JsonNode *json_root;
 	JsonObject *json_item;
@@ -121,7 +157,6 @@ gs_odrs_provider_load_ratings (GsOdrsProvider  *self,
 	JsonNode *json_app_node;
 	JsonObjectIter iter;
 	g_autoptr(GArray) new_ratings = NULL;
-	g_autoptr(GMutexLocker) locker = NULL;
 	g_autoptr(GError) local_error = NULL;
 
 	/* parse the data and find the success */
@@ -131,7 +166,7 @@ gs_odrs_provider_load_ratings (GsOdrsProvider  *self,
 			     GS_ODRS_PROVIDER_ERROR,
 			     GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
 			     "Error parsing ODRS data: %s", local_error->message);
-		return FALSE;
+		return NULL;
 	}
 	json_root = json_parser_get_root (json_parser);
 	if (json_root == NULL) {
@@ -139,14 +174,14 @@ gs_odrs_provider_load_ratings (GsOdrsProvider  *self,
 				     GS_ODRS_PROVIDER_ERROR,
 				     GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
 				     "no ratings root");
-		return FALSE;
+		return NULL;
 	}
 	if (json_node_get_node_type (json_root) != JSON_NODE_OBJECT) {
 		g_set_error_literal (error,
 				     GS_ODRS_PROVIDER_ERROR,
 				     GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
 				     "no ratings array");
-		return FALSE;
+		return NULL;
 	}
 
 	json_item = json_node_get_object (json_root);
@@ -174,10 +209,185 @@ gs_odrs_provider_load_ratings (GsOdrsProvider  *self,
 	/* Allow for binary searches later. */
 	g_array_sort (new_ratings, (GCompareFunc) rating_compare);
 
+	return g_steal_pointer (&new_ratings);
+}
+
+/* Builds a ratings index from @ratings, which must be sorted by app ID. */
+static GBytes *
+gs_odrs_provider_build_ratings_index (GArray   *ratings,
+                                      guint64   json_mtime,
+                                      guint64   json_size,
+                                      GError  **error)
+{
+	GsOdrsRatingsIndexHeader header = { RATINGS_INDEX_MAGIC, };
+	g_autoptr(GByteArray) index = NULL;
+	guint64 strings_len = 0;
+
+	for (guint i = 0; i < ratings->len; i++)
+		strings_len += strlen (g_array_index (ratings, GsOdrsRating, i).app_id) + 1;
+
+	if (ratings->len > G_MAXUINT32 / sizeof (GsOdrsRatingsIndexEntry) ||
+	    strings_len > G_MAXUINT32) {
+		g_set_error_literal (error,
+				     GS_ODRS_PROVIDER_ERROR,
+				     GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
+				     "too many ratings");
+		return NULL;
+	}
+
+	header.version = RATINGS_INDEX_VERSION;
+	header.n_entries = ratings->len;
+	header.strings_len = strings_len;
+	header.json_mtime = json_mtime;
+	header.json_size = json_size;
+
+	index = g_byte_array_sized_new (sizeof (header) +
+					ratings->len * sizeof (GsOdrsRatingsIndexEntry) +
+					strings_len);
+	g_byte_array_append (index, (const guint8 *) &header, sizeof (header));
+
+	strings_len = 0;
+	for (guint i = 0; i < ratings->len; i++) {
+		const GsOdrsRating *rating = &g_array_index (ratings, GsOdrsRating, i);
+		GsOdrsRatingsIndexEntry entry;
+
+		entry.app_id_offset = strings_len;
+		memcpy (entry.n_star_ratings, rating->n_star_ratings, sizeof (entry.n_star_ratings));
+		g_byte_array_append (index, (const guint8 *) &entry, sizeof (entry));
+		strings_len += strlen (rating->app_id) + 1;
+	}
+
+	for (guint i = 0; i < ratings->len; i++) {
+		const gchar *app_id = g_array_index (ratings, GsOdrsRating, i).app_id;
+		g_byte_array_append (index, (const guint8 *) app_id, strlen (app_id) + 1);
+	}
+
+	return g_byte_array_free_to_bytes (g_steal_pointer (&index));
+}
+
+/* Checks that @index is safe to look up ratings in, and up to date. */
+static gboolean
+gs_odrs_provider_ratings_index_is_valid (GBytes  *index,
+                                         guint64  json_mtime,
+                                         guint64  json_size)
+{
+	gsize len;
+	const guint8 *data = g_bytes_get_data (index, &len);
+	const GsOdrsRatingsIndexHeader *header = (const GsOdrsRatingsIndexHeader *) data;
+	const GsOdrsRatingsIndexEntry *entries;
+	const gchar *strings;
+
+	if (len < sizeof (*header) ||
+	    memcmp (header->magic, RATINGS_INDEX_MAGIC, sizeof (header->magic)) != 0 ||
+	    header->version != RATINGS_INDEX_VERSION ||
+	    header->json_mtime != json_mtime ||
+	    header->json_size != json_size)
+		return FALSE;
+
+	/* check the sizes add up, without overflowing */
+	if (header->n_entries > (len - sizeof (*header)) / sizeof (GsOdrsRatingsIndexEntry) ||
+	    len - sizeof (*header) - header->n_entries * sizeof (GsOdrsRatingsIndexEntry) != header->strings_len)
+		return FALSE;
+
+	entries = (const GsOdrsRatingsIndexEntry *) (data + sizeof (*header));
+	strings = (const gchar *) (entries + header->n_entries);
+
+	if (header->strings_len > 0 && strings[header->strings_len - 1] != '\0')
+		return FALSE;
+	for (guint i = 0; i < header->n_entries; i++) {
+		if (entries[i].app_id_offset >= header->strings_len)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static const GsOdrsRatingsIndexEntry *
+gs_odrs_provider_ratings_index_lookup (GBytes      *index,
+                                       const gchar *app_id)
+{
+	const guint8 *data = g_bytes_get_data (index, NULL);
+	const GsOdrsRatingsIndexHeader *header = (const GsOdrsRatingsIndexHeader *) data;
+	const GsOdrsRatingsIndexEntry *entries = (const GsOdrsRatingsIndexEntry *) (data + sizeof (*header));
+	const gchar *strings = (const gchar *) (entries + header->n_entries);
+	guint lower = 0;
+	guint upper = header->n_entries;
+
+	while (lower < upper) {
+		guint mid = lower + (upper - lower) / 2;
+		gint cmp = strcmp (app_id, strings + entries[mid].app_id_offset);
+
+		if (cmp == 0)
+			return &entries[mid];
+		else if (cmp < 0)
+			upper = mid;
+		else
+			lower = mid + 1;
+	}
+
+	return NULL;
+}
+
+/* Loads the ratings from the index next to @filename, building it from the
+ * JSON in @filename first if needed or if @rebuild_index is set. */
+static gboolean
+gs_odrs_provider_load_ratings (GsOdrsProvider  *self,
+                               const gchar     *filename,
+                               gboolean         rebuild_index,
+                               GError         **error)
+{
+	g_autofree gchar *index_filename = NULL;
+	g_autoptr(GBytes) index = NULL;
+	GStatBuf stat_buf;
+	g_autoptr(GMutexLocker) locker = NULL;
+	g_autoptr(GError) local_error = NULL;
+
+	if (g_stat (filename, &stat_buf) != 0) {
+		gint errsv = errno;
+		g_set_error (error,
+			     GS_ODRS_PROVIDER_ERROR,
+			     GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
+			     "Error loading ODRS data: %s", g_strerror (errsv));
+		return FALSE;
+	}
+
+	index_filename = g_strconcat (filename, ".idx", NULL);
+
+	if (!rebuild_index) {
+		g_autoptr(GMappedFile) mapped_file = g_mapped_file_new (index_filename, FALSE, NULL);
+
+		if (mapped_file != NULL)
+			index = g_mapped_file_get_bytes (mapped_file);
+		if (index != NULL &&
+		    !gs_odrs_provider_ratings_index_is_valid (index, stat_buf.st_mtime, stat_buf.st_size)) {
+			g_debug ("Ignoring out of date ODRS ratings index ‘%s’", index_filename);
+			g_clear_pointer (&index, g_bytes_unref);
+		}
+	}
+
+	if (index == NULL) {
+		g_autoptr(GArray) ratings = NULL;
+
+		ratings = gs_odrs_provider_parse_ratings (filename, error);
+		if (ratings == NULL)
+			return FALSE;
+
+		index = gs_odrs_provider_build_ratings_index (ratings, stat_buf.st_mtime, stat_buf.st_size, error);
+		if (index == NULL)
+			return FALSE;
+
+		/* the in-memory index is still usable if this fails */
+		if (!g_file_set_contents (index_filename,
+					  g_bytes_get_data (index, NULL),
+					  g_bytes_get_size (index),
+					  &local_error))
+			g_debug ("Failed to save ODRS ratings index: %s", local_error->message);
+	}
+
 	/* Update the shared state */
 	locker = g_mutex_locker_new (&self->ratings_mutex);
-	g_clear_pointer (&self->ratings, g_array_unref);
-	self->ratings = g_steal_pointer (&new_ratings);
+	g_clear_pointer (&self->ratings, g_bytes_unref);
+	self->ratings = g_steal_pointer (&index);
 
 	return TRUE;
 }
@@ -591,7 +801,7 @@ gs_odrs_provider_refine_ratings (GsOdrsProvider  *self,
 		if (!cache_filename)
 			return TRUE;
 
-		if (!gs_odrs_provider_load_ratings (self, cache_filename, NULL)) {
+		if (!gs_odrs_provider_load_ratings (self, cache_filename, FALSE, NULL)) {
 			g_autoptr(GFile) cache_file = g_file_new_for_path (cache_filename);
 			g_debug ("Failed to load cache file ‘%s’, deleting it", cache_filename);
 			g_file_delete (cache_file, NULL, NULL);
@@ -606,16 +816,12 @@ gs_odrs_provider_refine_ratings (GsOdrsProvider  *self,
 
 	for (guint i = 0; i < reviewable_ids->len; i++) {
 		const gchar *id = g_ptr_array_index (reviewable_ids, i);
-		const GsOdrsRating search_rating = { (gchar *) id, { 0, }};
-		guint found_index;
-		const GsOdrsRating *found_rating;
+		const GsOdrsRatingsIndexEntry *found_rating;
 
-		if (!g_array_binary_search (self->ratings, &search_rating,
-					    (GCompareFunc) rating_compare, &found_index))
+		found_rating = gs_odrs_provider_ratings_index_lookup (self->ratings, id);
+		if (found_rating == NULL)
 			continue;
 
-		found_rating = &g_array_index (self->ratings, GsOdrsRating, found_index);
-
 		/* copy into accumulator array */
 		for (guint j = 0; j < 6; j++)
 			ratings_raw[j] += found_rating->n_star_ratings[j];
@@ -676,33 +882,51 @@ gs_odrs_provider_get_compat_ids (GsApp *app)
 	return g_steal_pointer (&json_node);
 }
 
-static void open_input_stream_cb (GObject      *source_object,
-                                  GAsyncResult *result,
-                                  gpointer      user_data);
-static void parse_reviews_cb (GObject      *source_object,
-                              GAsyncResult *result,
-                              gpointer      user_data);
-static void set_reviews_on_app (GsOdrsProvider *self,
-                                GsApp          *app,
-                                GPtrArray      *reviews);
+/* Fetching reviews needs one request per app, as that’s all the ODRS API
+ * supports. To keep refining a long list of apps quick, requests for the
+ * same app ID are coalesced, and only this many are sent at once so the rest
+ * can reuse the session’s connections rather than all opening new ones. */
+#define MAX_PARALLEL_REVIEWS_REQUESTS 4
 
+/* One request to the server, shared by all the fetches for the same app ID
+ * which start while it’s queued or running. */
 typedef struct {
-	GsApp *app;  /* (not nullable) (owned) */
+	GsOdrsProvider *self;  /* (not nullable) (owned) */
+	gchar *app_id;  /* (not nullable) (owned) */
+	GsApp *app;  /* (not nullable) (owned), the app the request is built from */
 	gchar *cache_filename;  /* (not nullable) (owned) */
 	SoupMessage *message;  /* (nullable) (owned) */
-} FetchReviewsForAppData;
+	GPtrArray *tasks;  /* (element-type GTask) (not nullable) (owned), fetches waiting for the result */
+} ReviewsRequest;
 
 static void
-fetch_reviews_for_app_data_free (FetchReviewsForAppData *data)
+reviews_request_free (ReviewsRequest *request)
 {
-	g_clear_object (&data->app);
-	g_free (data->cache_filename);
-	g_clear_object (&data->message);
-
-	g_free (data);
+	g_clear_object (&request->self);
+	g_free (request->app_id);
+	g_clear_object (&request->app);
+	g_free (request->cache_filename);
+	g_clear_object (&request->message);
+	g_clear_pointer (&request->tasks, g_ptr_array_unref);
+
+	g_free (request);
 }
 
-G_DEFINE_AUTOPTR_CLEANUP_FUNC (FetchReviewsForAppData, fetch_reviews_for_app_data_free)
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ReviewsRequest, reviews_request_free)
+
+static void reviews_request_start (ReviewsRequest *request);
+static void open_input_stream_cb (GObject      *source_object,
+                                  GAsyncResult *result,
+                                  gpointer      user_data);
+static void parse_reviews_cb (GObject      *source_object,
+                              GAsyncResult *result,
+                              gpointer      user_data);
+static void reviews_request_complete (ReviewsRequest *request,
+                                      GPtrArray      *reviews,
+                                      GError         *error);
+static void set_reviews_on_app (GsOdrsProvider *self,
+                                GsApp          *app,
+                                GPtrArray      *reviews);
 
 static void
 gs_odrs_provider_fetch_reviews_for_app_async (GsOdrsProvider      *self,
@@ -711,33 +935,19 @@ gs_odrs_provider_fetch_reviews_for_app_async (GsOdrsProvider      *self,
                                               GAsyncReadyCallback  callback,
                                               gpointer             user_data)
 {
-	JsonNode *json_compat_ids;
-	const gchar *version;
 	g_autofree gchar *cachefn_basename = NULL;
 	g_autofree gchar *cachefn = NULL;
-	g_autofree gchar *request_body = NULL;
-	g_autofree gchar *uri = NULL;
 	g_autoptr(GFile) cachefn_file = NULL;
 	g_autoptr(GPtrArray) reviews = NULL;
-	g_autoptr(JsonBuilder) builder = NULL;
 	g_autoptr(JsonParser) json_parser = NULL;
-	g_autoptr(JsonGenerator) json_generator = NULL;
-	g_autoptr(JsonNode) json_root = NULL;
-	g_autoptr(SoupMessage) msg = NULL;
-#if SOUP_CHECK_VERSION(3, 0, 0)
-	g_autoptr(GBytes) bytes = NULL;
-#endif
 	g_autoptr(GTask) task = NULL;
-	FetchReviewsForAppData *data;
-	g_autoptr(FetchReviewsForAppData) data_owned = NULL;
+	ReviewsRequest *request;
+	g_autoptr(GMutexLocker) locker = NULL;
 	g_autoptr(GError) local_error = NULL;
 
 	task = g_task_new (self, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_odrs_provider_fetch_reviews_for_app_async);
-
-	data = data_owned = g_new0 (FetchReviewsForAppData, 1);
-	data->app = g_object_ref (app);
-	g_task_set_task_data (task, g_steal_pointer (&data_owned), (GDestroyNotify) fetch_reviews_for_app_data_free);
+	g_task_set_task_data (task, g_object_ref (app), g_object_unref);
 
 	/* look in the cache */
 	cachefn_basename = g_strdup_printf ("%s.json", gs_app_get_id (app));
@@ -751,7 +961,6 @@ gs_odrs_provider_fetch_reviews_for_app_async (GsOdrsProvider      *self,
 		return;
 	}
 
-	data->cache_filename = g_strdup (cachefn);
 	cachefn_file = g_file_new_for_path (cachefn);
 	if (gs_utils_get_file_age (cachefn_file) < self->max_cache_age_secs) {
 		g_debug ("got review data for %s from %s",
@@ -778,8 +987,48 @@ gs_odrs_provider_fetch_reviews_for_app_async (GsOdrsProvider      *self,
 		return;
 	}
 
+	/* join a request for the same app if there is one */
+	locker = g_mutex_locker_new (&self->reviews_requests_mutex);
+
+	request = g_hash_table_lookup (self->reviews_requests, gs_app_get_id (app));
+	if (request != NULL) {
+		g_debug ("waiting for existing ODRS request for %s", gs_app_get_id (app));
+		g_ptr_array_add (request->tasks, g_steal_pointer (&task));
+		return;
+	}
+
+	request = g_new0 (ReviewsRequest, 1);
+	request->self = g_object_ref (self);
+	request->app_id = g_strdup (gs_app_get_id (app));
+	request->app = g_object_ref (app);
+	request->cache_filename = g_steal_pointer (&cachefn);
+	request->tasks = g_ptr_array_new_with_free_func (g_object_unref);
+	g_ptr_array_add (request->tasks, g_steal_pointer (&task));
+	g_hash_table_insert (self->reviews_requests, request->app_id, request);
+
+	if (self->n_reviews_requests_running < MAX_PARALLEL_REVIEWS_REQUESTS)
+		reviews_request_start (request);
+	else
+		g_queue_push_tail (&self->reviews_requests_queue, request);
+}
+
+/* reviews_requests_mutex must be held */
+static void
+reviews_request_start (ReviewsRequest *request)
+{
+	GsOdrsProvider *self = request->self;
+	JsonNode *json_compat_ids;
+	const gchar *version;
+	g_autofree gchar *request_body = NULL;
+	g_autofree gchar *uri = NULL;
+	g_autoptr(JsonBuilder) builder = NULL;
+	g_autoptr(JsonGenerator) json_generator = NULL;
+	g_autoptr(JsonNode) json_root = NULL;
+
+	self->n_reviews_requests_running++;
+
 	/* not always available */
-	version = gs_app_get_version (app);
+	version = gs_app_get_version (request->app);
 	if (version == NULL)
 		version = "unknown";
 
@@ -789,7 +1038,7 @@ gs_odrs_provider_fetch_reviews_for_app_async (GsOdrsProvider      *self,
 	json_builder_set_member_name (builder, "user_hash");
 	json_builder_add_string_value (builder, self->user_hash);
 	json_builder_set_member_name (builder, "app_id");
-	json_builder_add_string_value (builder, gs_app_get_id (app));
+	json_builder_add_string_value (builder, request->app_id);
 	json_builder_set_member_name (builder, "locale");
 	json_builder_add_string_value (builder, setlocale (LC_MESSAGES, NULL));
 	json_builder_set_member_name (builder, "distro");
@@ -798,7 +1047,7 @@ gs_odrs_provider_fetch_reviews_for_app_async (GsOdrsProvider      *self,
 	json_builder_add_string_value (builder, version);
 	json_builder_set_member_name (builder, "limit");
 	json_builder_add_int_value (builder, self->n_results_max);
-	json_compat_ids = gs_odrs_provider_get_compat_ids (app);
+	json_compat_ids = gs_odrs_provider_get_compat_ids (request->app);
 	if (json_compat_ids != NULL) {
 		json_builder_set_member_name (builder, "compat_ids");
 		json_builder_add_value (builder, json_compat_ids);
@@ -813,21 +1062,22 @@ gs_odrs_provider_fetch_reviews_for_app_async (GsOdrsProvider      *self,
 	request_body = json_generator_to_data (json_generator, NULL);
 
 	uri = g_strdup_printf ("%s/fetch", self->review_server);
-	g_debug ("Updating ODRS cache for %s from %s to %s; request %s", gs_app_get_id (app),
-		 uri, cachefn, request_body);
-	msg = soup_message_new (SOUP_METHOD_POST, uri);
-	data->message = g_object_ref (msg);
+	g_debug ("Updating ODRS cache for %s from %s to %s; request %s", request->app_id,
+		 uri, request->cache_filename, request_body);
+	request->message = soup_message_new (SOUP_METHOD_POST, uri);
 
+	/* The request is shared between fetches, so isn’t cancelled if one
+	 * of them is; the result is still cached for next time. */
 #if SOUP_CHECK_VERSION(3, 0, 0)
-	g_odrs_provider_set_message_request_body (msg, "application/json; charset=utf-8",
+	g_odrs_provider_set_message_request_body (request->message, "application/json; charset=utf-8",
 						  request_body, strlen (request_body));
-	soup_session_send_async (self->session, msg, G_PRIORITY_DEFAULT,
-				 cancellable, open_input_stream_cb, g_steal_pointer (&task));
+	soup_session_send_async (self->session, request->message, G_PRIORITY_DEFAULT,
+				 NULL, open_input_stream_cb, request);
 #else
-	soup_message_set_request (msg, "application/json; charset=utf-8",
+	soup_message_set_request (request->message, "application/json; charset=utf-8",
 				  SOUP_MEMORY_COPY, request_body, strlen (request_body));
-	soup_session_send_async (self->session, msg, cancellable,
-				 open_input_stream_cb, g_steal_pointer (&task));
+	soup_session_send_async (self->session, request->message, NULL,
+				 open_input_stream_cb, request);
 #endif
 }
 
@@ -837,9 +1087,7 @@ open_input_stream_cb (GObject      *source_object,
                       gpointer      user_data)
 {
 	SoupSession *soup_session = SOUP_SESSION (source_object);
-	g_autoptr(GTask) task = g_steal_pointer (&user_data);
-	FetchReviewsForAppData *data = g_task_get_task_data (task);
-	GCancellable *cancellable = g_task_get_cancellable (task);
+	ReviewsRequest *request = user_data;
 	g_autoptr(GInputStream) input_stream = NULL;
 	guint status_code;
 	g_autoptr(JsonParser) json_parser = NULL;
@@ -847,43 +1095,43 @@ open_input_stream_cb (GObject      *source_object,
 
 #if SOUP_CHECK_VERSION(3, 0, 0)
 	input_stream = soup_session_send_finish (soup_session, result, &local_error);
-	status_code = soup_message_get_status (data->message);
+	status_code = soup_message_get_status (request->message);
 #else
 	input_stream = soup_session_send_finish (soup_session, result, &local_error);
-	status_code = data->message->status_code;
+	status_code = request->message->status_code;
 #endif
 
 	if (input_stream == NULL) {
 		if (!g_network_monitor_get_network_available (g_network_monitor_get_default ()))
-			g_task_return_new_error (task,
-						 GS_ODRS_PROVIDER_ERROR,
-						 GS_ODRS_PROVIDER_ERROR_NO_NETWORK,
-						 "server couldn't be reached");
+			reviews_request_complete (request, NULL,
+						  g_error_new (GS_ODRS_PROVIDER_ERROR,
+							       GS_ODRS_PROVIDER_ERROR_NO_NETWORK,
+							       "server couldn't be reached"));
 		else
-			g_task_return_new_error (task,
-						 GS_ODRS_PROVIDER_ERROR,
-						 GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
-						 "server returned no data");
+			reviews_request_complete (request, NULL,
+						  g_error_new (GS_ODRS_PROVIDER_ERROR,
+							       GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
+							       "server returned no data"));
 		return;
 	}
 
 	if (status_code != SOUP_STATUS_OK) {
 		if (!gs_odrs_provider_parse_success (input_stream, &local_error)) {
-			g_task_return_error (task, g_steal_pointer (&local_error));
+			reviews_request_complete (request, NULL, g_steal_pointer (&local_error));
 			return;
 		}
 
 		/* not sure what to do here */
-		g_task_return_new_error (task,
-					 GS_ODRS_PROVIDER_ERROR,
-					 GS_ODRS_PROVIDER_ERROR_DOWNLOADING,
-					 "status code invalid");
+		reviews_request_complete (request, NULL,
+					  g_error_new (GS_ODRS_PROVIDER_ERROR,
+						       GS_ODRS_PROVIDER_ERROR_DOWNLOADING,
+						       "status code invalid"));
 		return;
 	}
 
 	/* parse the data and find the array of ratings */
 	json_parser = json_parser_new_immutable ();
-	json_parser_load_from_stream_async (json_parser, input_stream, cancellable, parse_reviews_cb, g_steal_pointer (&task));
+	json_parser_load_from_stream_async (json_parser, input_stream, NULL, parse_reviews_cb, request);
 }
 
 static void
@@ -892,24 +1140,22 @@ parse_reviews_cb (GObject      *source_object,
                   gpointer      user_data)
 {
 	JsonParser *json_parser = JSON_PARSER (source_object);
-	g_autoptr(GTask) task = g_steal_pointer (&user_data);
-	GsOdrsProvider *self = g_task_get_source_object (task);
-	FetchReviewsForAppData *data = g_task_get_task_data (task);
+	ReviewsRequest *request = user_data;
 	g_autoptr(GPtrArray) reviews = NULL;
 	g_autoptr(JsonGenerator) cache_generator = NULL;
 	g_autoptr(GError) local_error = NULL;
 
 	if (!json_parser_load_from_stream_finish (json_parser, result, &local_error)) {
-		g_task_return_new_error (task,
-					 GS_ODRS_PROVIDER_ERROR,
-					 GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
-					 "Error parsing ODRS data: %s", local_error->message);
+		reviews_request_complete (request, NULL,
+					  g_error_new (GS_ODRS_PROVIDER_ERROR,
+						       GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
+						       "Error parsing ODRS data: %s", local_error->message));
 		return;
 	}
 
-	reviews = gs_odrs_provider_parse_reviews (self, json_parser, &local_error);
+	reviews = gs_odrs_provider_parse_reviews (request->self, json_parser, &local_error);
 	if (reviews == NULL) {
-		g_task_return_error (task, g_steal_pointer (&local_error));
+		reviews_request_complete (request, NULL, g_steal_pointer (&local_error));
 		return;
 	}
 
@@ -918,15 +1164,56 @@ parse_reviews_cb (GObject      *source_object,
 	json_generator_set_pretty (cache_generator, FALSE);
 	json_generator_set_root (cache_generator, json_parser_get_root (json_parser));
 
-	if (!json_generator_to_file (cache_generator, data->cache_filename, &local_error)) {
-		g_task_return_error (task, g_steal_pointer (&local_error));
+	if (!json_generator_to_file (cache_generator, request->cache_filename, &local_error)) {
+		reviews_request_complete (request, NULL, g_steal_pointer (&local_error));
 		return;
 	}
 
-	set_reviews_on_app (self, data->app, reviews);
-
 	/* success */
-	g_task_return_boolean (task, TRUE);
+	reviews_request_complete (request, reviews, NULL);
+}
+
+/* Returns the result to all the fetches waiting for @request, frees it, and
+ * starts the next queued request. @error is (transfer full) if non-NULL. */
+static void
+reviews_request_complete (ReviewsRequest *request,
+                          GPtrArray      *reviews,
+                          GError         *error)
+{
+	g_autoptr(ReviewsRequest) request_owned = request;
+	g_autoptr(GError) error_owned = error;
+	GsOdrsProvider *self = request->self;
+	g_autoptr(GPtrArray) apps_done = g_ptr_array_new ();
+
+	g_mutex_lock (&self->reviews_requests_mutex);
+
+	g_hash_table_remove (self->reviews_requests, request->app_id);
+	self->n_reviews_requests_running--;
+
+	while (self->n_reviews_requests_running < MAX_PARALLEL_REVIEWS_REQUESTS &&
+	       !g_queue_is_empty (&self->reviews_requests_queue))
+		reviews_request_start (g_queue_pop_head (&self->reviews_requests_queue));
+
+	g_mutex_unlock (&self->reviews_requests_mutex);
+
+	for (guint i = 0; i < request->tasks->len; i++) {
+		GTask *task = g_ptr_array_index (request->tasks, i);
+		GsApp *app = g_task_get_task_data (task);
+		g_autoptr(GError) local_error = NULL;
+
+		if (error_owned != NULL) {
+			g_task_return_error (task, g_error_copy (error_owned));
+		} else if (g_cancellable_set_error_if_cancelled (g_task_get_cancellable (task), &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+		} else {
+			/* the same app may be refined more than once at a time */
+			if (!g_ptr_array_find (apps_done, app, NULL)) {
+				set_reviews_on_app (self, app, reviews);
+				g_ptr_array_add (apps_done, app);
+			}
+			g_task_return_boolean (task, TRUE);
+		}
+	}
 }
 
 static void
@@ -1010,6 +1297,10 @@ gs_odrs_provider_invalidate_cache (AsReview *review, GError **error)
 	if (cachefn == NULL)
 		return FALSE;
 	cachefn_file = g_file_new_for_path (cachefn);
+
+	/* the reviews refined for the app are now out of date */
+	gs_app_invalidate_all_refined_flags ();
+
 	if (!g_file_query_exists (cachefn_file, NULL))
 		return TRUE;
 	return g_file_delete (cachefn_file, NULL, error);
@@ -1091,6 +1382,9 @@ static void
 gs_odrs_provider_init (GsOdrsProvider *self)
 {
 	g_mutex_init (&self->ratings_mutex);
+	g_mutex_init (&self->reviews_requests_mutex);
+	self->reviews_requests = g_hash_table_new (g_str_hash, g_str_equal);
+	g_queue_init (&self->reviews_requests_queue);
 }
 
 static void
@@ -1202,9 +1496,14 @@ gs_odrs_provider_finalize (GObject *object)
 	g_free (self->user_hash);
 	g_free (self->distro);
 	g_free (self->review_server);
-	g_clear_pointer (&self->ratings, g_array_unref);
+	g_clear_pointer (&self->ratings, g_bytes_unref);
 	g_mutex_clear (&self->ratings_mutex);
 
+	/* requests keep the provider alive until they complete */
+	g_assert (g_hash_table_size (self->reviews_requests) == 0);
+	g_clear_pointer (&self->reviews_requests, g_hash_table_unref);
+	g_mutex_clear (&self->reviews_requests_mutex);
+
 	G_OBJECT_CLASS (gs_odrs_provider_parent_class)->finalize (object);
 }
 
@@ -1392,7 +1691,7 @@ gs_odrs_provider_refresh_ratings_async (GsOdrsProvider             *self,
 		if (tmp < cache_age_secs) {
 			g_debug ("%s is only %" G_GUINT64_FORMAT " seconds old, so ignoring refresh",
 				 cache_filename, tmp);
-			if (!gs_odrs_provider_load_ratings (self, cache_filename, &error_local)) {
+			if (!gs_odrs_provider_load_ratings (self, cache_filename, FALSE, &error_local)) {
 				g_debug ("Failed to load cache file ‘%s’, deleting it", cache_filename);
 				g_file_delete (cache_file, NULL, NULL);
 
@@ -1423,9 +1722,11 @@ download_ratings_cb (GObject      *source_object,
 	GsOdrsProvider *self = g_task_get_source_object (task);
 	GFile *cache_file = g_task_get_task_data (task);
 	const gchar *cache_file_path = NULL;
+	gboolean downloaded;
 	g_autoptr(GError) local_error = NULL;
 
-	if (!gs_download_file_finish (soup_session, result, &local_error) &&
+	downloaded = gs_download_file_finish (soup_session, result, &local_error);
+	if (!downloaded &&
 	    !g_error_matches (local_error, GS_DOWNLOAD_ERROR, GS_DOWNLOAD_ERROR_NOT_MODIFIED)) {
 		g_task_return_new_error (task, GS_ODRS_PROVIDER_ERROR,
 					 GS_ODRS_PROVIDER_ERROR_DOWNLOADING,
@@ -1435,8 +1736,10 @@ download_ratings_cb (GObject      *source_object,
 
 	g_clear_error (&local_error);
 
+	/* rebuild the index from new data straight away, rather than relying
+	 * on the JSON’s mtime and size to have changed */
 	cache_file_path = g_file_peek_path (cache_file);
-	if (!gs_odrs_provider_load_ratings (self, cache_file_path, &local_error)) {
+	if (!gs_odrs_provider_load_ratings (self, cache_file_path, downloaded, &local_error)) {
 		g_debug ("Failed to load cache file ‘%s’, deleting it", cache_file_path);
 		g_file_delete (cache_file, NULL, NULL);
 
@@ -1444,6 +1747,10 @@ download_ratings_cb (GObject      *source_object,
 					 GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
 					 "%s", local_error->message);
 	} else {
+		/* anything refined from the old ratings is now out of date */
+		if (downloaded)
+			gs_app_invalidate_all_refined_flags ();
+
 		g_task_return_boolean (task, TRUE);
 	}
 }
@@ -62,6 +62,12 @@ struct _GsPluginJobListApps
 	GError *saved_error;  /* (owned) (nullable) */
 	guint n_pending_ops;
 
+	/* When truncating before refining, the apps which have not been
+	 * refined yet, and the refined apps which have been kept so far. */
+	GsAppList *candidates;  /* (owned) (nullable) */
+	GsAppList *kept_list;  /* (owned) (nullable) */
+	GsPluginRefineFlags refine_flags;
+
 	/* Results. */
 	GsAppList *result_list;  /* (owned) (nullable) */
 
@@ -87,6 +93,8 @@ gs_plugin_job_list_apps_dispose (GObject *object)
 	g_assert (self->merged_list == NULL);
 	g_assert (self->saved_error == NULL);
 	g_assert (self->n_pending_ops == 0);
+	g_assert (self->candidates == NULL);
+	g_assert (self->kept_list == NULL);
 
 	g_clear_object (&self->result_list);
 	g_clear_object (&self->query);
@@ -213,8 +221,51 @@ static void finish_op (GTask  *task,
 static void refine_cb (GObject      *source_object,
                        GAsyncResult *result,
                        gpointer      user_data);
+static void sort_refine_cb (GObject      *source_object,
+                            GAsyncResult *result,
+                            gpointer      user_data);
+static void refine_candidates (GTask *task);
+static void refine_candidates_cb (GObject      *source_object,
+                                  GAsyncResult *result,
+                                  gpointer      user_data);
+static void filter_results (GsPluginJobListApps *self,
+                            GsPluginLoader      *plugin_loader,
+                            GsAppList           *merged_list);
+static void filter_duplicate_results (GsPluginJobListApps *self,
+                                      GsAppList           *merged_list);
 static void finish_task (GTask     *task,
                          GsAppList *merged_list);
+static void finish_task_with_error (GTask  *task,
+                                    GError *error);
+
+/* Whether @sort_func only compares data which the plugins set when listing
+ * apps, so the results can be sorted before they are refined.
+ *
+ * The match value is set by the plugins when searching, and is never changed
+ * by refining, so sorting by it gives the same order before and after the
+ * refine. Other sort functions may not: gs_utils_app_sort_priority() falls
+ * back to the priority of the management plugin and then to the bundle kind,
+ * both of which refining can set, and the kudos and name sort functions
+ * need the corresponding refine flags. */
+static gboolean
+sort_func_is_refine_independent (GsAppListSortFunc sort_func)
+{
+	return (sort_func == gs_utils_app_sort_match_value);
+}
+
+/* Whether @list contains any wildcards. Refining replaces those with other
+ * apps, which are not guaranteed to sort in the same place, so a list with
+ * wildcards in can never be sorted before it’s refined. */
+static gboolean
+app_list_has_wildcards (GsAppList *list)
+{
+	for (guint i = 0; i < gs_app_list_length (list); i++) {
+		if (gs_app_has_quirk (gs_app_list_index (list, i), GS_APP_QUIRK_IS_WILDCARD))
+			return TRUE;
+	}
+
+	return FALSE;
+}
 
 static void
 gs_plugin_job_list_apps_run_async (GsPluginJob         *job,
@@ -318,7 +369,10 @@ finish_op (GTask  *task,
 	GsPluginLoader *plugin_loader = g_task_get_task_data (task);
 	g_autoptr(GsAppList) merged_list = NULL;
 	GsPluginRefineFlags refine_flags = GS_PLUGIN_REFINE_FLAGS_NONE;
+	GsPluginRefineFlags sort_refine_flags = GS_PLUGIN_REFINE_FLAGS_NONE;
 	GsAppQueryLicenseType license_type = GS_APP_QUERY_LICENSE_ANY;
+	GsAppListSortFunc sort_func = NULL;
+	guint max_results = 0;
 	g_autoptr(GError) error_owned = g_steal_pointer (&error);
 
 	if (error_owned != NULL && self->saved_error == NULL)
@@ -345,6 +399,9 @@ finish_op (GTask  *task,
 	if (self->query != NULL) {
 		refine_flags = gs_app_query_get_refine_flags (self->query);
 		license_type = gs_app_query_get_license_type (self->query);
+		sort_func = gs_app_query_get_sort_func (self->query, NULL);
+		sort_refine_flags = gs_app_query_get_sort_refine_flags (self->query);
+		max_results = gs_app_query_get_max_results (self->query);
 	}
 
 	if (!(refine_flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE) &&
@@ -358,6 +415,41 @@ finish_op (GTask  *task,
 	    refine_flags != GS_PLUGIN_REFINE_FLAGS_NONE) {
 		g_autoptr(GsPluginJob) refine_job = NULL;
 
+		self->refine_flags = refine_flags;
+
+		/* If only some of the apps will be returned, try to only refine
+		 * those. The sort keys must then be known before the full
+		 * refine: either the plugins set them when listing the apps,
+		 * the caller says which refine flags the sort function needs,
+		 * or the apps are picked at random. Unlike the sort-then-truncate
+		 * after a full refine, this refines the apps in batches and
+		 * refills from the remaining candidates whenever one is filtered
+		 * out, so it returns the same apps as long as refining can’t
+		 * change the sort order. */
+		if (max_results > 0 &&
+		    gs_app_list_length (merged_list) > max_results &&
+		    (sort_func == NULL ||
+		     (sort_func_is_refine_independent (sort_func) &&
+		      !app_list_has_wildcards (merged_list)))) {
+			self->candidates = g_steal_pointer (&merged_list);
+			self->kept_list = gs_app_list_new ();
+			if (sort_func == NULL)
+				gs_app_list_randomize (self->candidates);
+			refine_candidates (task);
+			return;
+		} else if (max_results > 0 &&
+			   gs_app_list_length (merged_list) > max_results &&
+			   sort_refine_flags != GS_PLUGIN_REFINE_FLAGS_NONE) {
+			refine_job = gs_plugin_job_refine_new (merged_list,
+							       sort_refine_flags |
+							       GS_PLUGIN_REFINE_FLAGS_DISABLE_FILTERING);
+			gs_plugin_loader_job_process_async (plugin_loader, refine_job,
+							    cancellable,
+							    sort_refine_cb,
+							    g_object_ref (task));
+			return;
+		}
+
 		refine_job = gs_plugin_job_refine_new (merged_list,
 						       refine_flags |
 						       GS_PLUGIN_REFINE_FLAGS_DISABLE_FILTERING);
@@ -378,15 +470,12 @@ refine_cb (GObject      *source_object,
 {
 	GsPluginLoader *plugin_loader = GS_PLUGIN_LOADER (source_object);
 	g_autoptr(GTask) task = G_TASK (user_data);
-	GsPluginJobListApps *self = g_task_get_source_object (task);
 	g_autoptr(GsAppList) new_list = NULL;
 	g_autoptr(GError) local_error = NULL;
 
 	new_list = gs_plugin_loader_job_process_finish (plugin_loader, result, &local_error);
 	if (new_list == NULL) {
-		gs_utils_error_convert_gio (&local_error);
-		g_task_return_error (task, g_steal_pointer (&local_error));
-		g_signal_emit_by_name (G_OBJECT (self), "completed");
+		finish_task_with_error (task, g_steal_pointer (&local_error));
 		return;
 	}
 
@@ -394,19 +483,123 @@ refine_cb (GObject      *source_object,
 }
 
 static void
-finish_task (GTask     *task,
-             GsAppList *merged_list)
+sort_refine_cb (GObject      *source_object,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+	GsPluginLoader *plugin_loader = GS_PLUGIN_LOADER (source_object);
+	g_autoptr(GTask) task = G_TASK (user_data);
+	GsPluginJobListApps *self = g_task_get_source_object (task);
+	g_autoptr(GsAppList) new_list = NULL;
+	g_autoptr(GError) local_error = NULL;
+
+	new_list = gs_plugin_loader_job_process_finish (plugin_loader, result, &local_error);
+	if (new_list == NULL) {
+		finish_task_with_error (task, g_steal_pointer (&local_error));
+		return;
+	}
+
+	/* the sort keys are now known, so the apps can be picked */
+	self->candidates = g_steal_pointer (&new_list);
+	self->kept_list = gs_app_list_new ();
+	refine_candidates (task);
+}
+
+static gboolean
+filter_not_in_set (GsApp    *app,
+                   gpointer  user_data)
+{
+	GHashTable *set = user_data;
+
+	return !g_hash_table_contains (set, app);
+}
+
+/* Refine the best of the remaining candidates, enough to fill up the results
+ * if none of them get filtered out. */
+static void
+refine_candidates (GTask *task)
 {
 	GsPluginJobListApps *self = g_task_get_source_object (task);
+	GCancellable *cancellable = g_task_get_cancellable (task);
 	GsPluginLoader *plugin_loader = g_task_get_task_data (task);
-	GsAppListFilterFlags dedupe_flags = GS_APP_LIST_FILTER_FLAG_NONE;
-	GsAppListSortFunc sort_func = NULL;
+	GsAppListSortFunc sort_func;
 	gpointer sort_func_data = NULL;
+	guint n_wanted;
+	g_autoptr(GsAppList) batch = NULL;
+	g_autoptr(GHashTable) batch_set = NULL;
+	g_autoptr(GsPluginJob) refine_job = NULL;
+
+	sort_func = gs_app_query_get_sort_func (self->query, &sort_func_data);
+	n_wanted = gs_app_query_get_max_results (self->query) - gs_app_list_length (self->kept_list);
+
+	batch = gs_app_list_copy (self->candidates);
+	if (sort_func != NULL) {
+		gs_app_list_sort_top (batch, sort_func, sort_func_data, n_wanted);
+	} else if (gs_app_list_length (batch) > n_wanted) {
+		/* the candidates were shuffled once up front */
+		gs_app_list_truncate (batch, n_wanted);
+	}
+
+	batch_set = g_hash_table_new (NULL, NULL);
+	for (guint i = 0; i < gs_app_list_length (batch); i++)
+		g_hash_table_add (batch_set, gs_app_list_index (batch, i));
+	gs_app_list_filter (self->candidates, filter_not_in_set, batch_set);
+
+	g_debug ("refining %u apps, %u more candidates left",
+		 gs_app_list_length (batch), gs_app_list_length (self->candidates));
+
+	refine_job = gs_plugin_job_refine_new (batch,
+					       self->refine_flags |
+					       GS_PLUGIN_REFINE_FLAGS_DISABLE_FILTERING);
+	gs_plugin_loader_job_process_async (plugin_loader, refine_job,
+					    cancellable,
+					    refine_candidates_cb,
+					    g_object_ref (task));
+}
+
+static void
+refine_candidates_cb (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+	GsPluginLoader *plugin_loader = GS_PLUGIN_LOADER (source_object);
+	g_autoptr(GTask) task = G_TASK (user_data);
+	GsPluginJobListApps *self = g_task_get_source_object (task);
+	g_autoptr(GsAppList) new_list = NULL;
+	g_autoptr(GsAppList) kept_list = NULL;
+	g_autoptr(GError) local_error = NULL;
+
+	new_list = gs_plugin_loader_job_process_finish (plugin_loader, result, &local_error);
+	if (new_list == NULL) {
+		finish_task_with_error (task, g_steal_pointer (&local_error));
+		return;
+	}
+
+	/* some of the refined apps may get filtered out, in which case the
+	 * next best candidates have to be refined to replace them */
+	filter_results (self, plugin_loader, new_list);
+	gs_app_list_add_list (self->kept_list, new_list);
+	filter_duplicate_results (self, self->kept_list);
+
+	if (gs_app_list_length (self->kept_list) < gs_app_query_get_max_results (self->query) &&
+	    gs_app_list_length (self->candidates) > 0) {
+		refine_candidates (task);
+		return;
+	}
+
+	g_clear_object (&self->candidates);
+	kept_list = g_steal_pointer (&self->kept_list);
+	finish_task (task, kept_list);
+}
+
+static void
+filter_results (GsPluginJobListApps *self,
+                GsPluginLoader      *plugin_loader,
+                GsAppList           *merged_list)
+{
 	GsAppQueryLicenseType license_type = GS_APP_QUERY_LICENSE_ANY;
 	GsAppListFilterFunc filter_func = NULL;
 	gpointer filter_func_data = NULL;
-	guint max_results = 0;
-	g_autofree gchar *job_debug = NULL;
 
 	/* Standard filtering.
 	 *
@@ -426,6 +619,13 @@ finish_task (GTask     *task,
 
 	if (filter_func != NULL)
 		gs_app_list_filter (merged_list, filter_func, filter_func_data);
+}
+
+static void
+filter_duplicate_results (GsPluginJobListApps *self,
+                          GsAppList           *merged_list)
+{
+	GsAppListFilterFlags dedupe_flags = GS_APP_LIST_FILTER_FLAG_NONE;
 
 	/* Filter duplicates with priority, taking into account the source name
 	 * & version, so we combine available updates with the installed app */
@@ -434,26 +634,44 @@ finish_task (GTask     *task,
 
 	if (dedupe_flags != GS_APP_LIST_FILTER_FLAG_NONE)
 		gs_app_list_filter_duplicates (merged_list, dedupe_flags);
+}
 
-	/* Sort the results. The refine may have added useful metadata. */
-	if (self->query != NULL)
+static void
+finish_task (GTask     *task,
+             GsAppList *merged_list)
+{
+	GsPluginJobListApps *self = g_task_get_source_object (task);
+	GsPluginLoader *plugin_loader = g_task_get_task_data (task);
+	GsAppListSortFunc sort_func = NULL;
+	gpointer sort_func_data = NULL;
+	guint max_results = 0;
+	g_autofree gchar *job_debug = NULL;
+
+	filter_results (self, plugin_loader, merged_list);
+	filter_duplicate_results (self, merged_list);
+
+	/* Sort the results, and truncate them if needed. The refine may have
+	 * added useful metadata. When truncating, only the apps which will be
+	 * kept need to be sorted. */
+	if (self->query != NULL) {
 		sort_func = gs_app_query_get_sort_func (self->query, &sort_func_data);
+		max_results = gs_app_query_get_max_results (self->query);
+	}
 
-	if (sort_func != NULL) {
+	if (max_results > 0 && gs_app_list_length (merged_list) > max_results)
+		g_debug ("truncating results from %u to %u",
+			 gs_app_list_length (merged_list), max_results);
+
+	if (sort_func != NULL && max_results > 0) {
+		gs_app_list_sort_top (merged_list, sort_func, sort_func_data, max_results);
+	} else if (sort_func != NULL) {
 		gs_app_list_sort (merged_list, sort_func, sort_func_data);
 	} else {
 		g_debug ("no ->sort_func() set, using random!");
 		gs_app_list_randomize (merged_list);
-	}
 
-	/* Truncate the results if needed. */
-	if (self->query != NULL)
-		max_results = gs_app_query_get_max_results (self->query);
-
-	if (max_results > 0 && gs_app_list_length (merged_list) > max_results) {
-		g_debug ("truncating results from %u to %u",
-			 gs_app_list_length (merged_list), max_results);
-		gs_app_list_truncate (merged_list, max_results);
+		if (max_results > 0 && gs_app_list_length (merged_list) > max_results)
+			gs_app_list_truncate (merged_list, max_results);
 	}
 
 	/* show elapsed time */
@@ -464,6 +682,8 @@ finish_task (GTask     *task,
 	g_assert (self->merged_list == NULL);
 	g_assert (self->saved_error == NULL);
 	g_assert (self->n_pending_ops == 0);
+	g_assert (self->candidates == NULL);
+	g_assert (self->kept_list == NULL);
 
 	/* success */
 	g_set_object (&self->result_list, merged_list);
@@ -479,6 +699,22 @@ finish_task (GTask     *task,
 #endif
 }
 
+/* @error is (transfer full) */
+static void
+finish_task_with_error (GTask  *task,
+                        GError *error)
+{
+	GsPluginJobListApps *self = g_task_get_source_object (task);
+	g_autoptr(GError) error_owned = g_steal_pointer (&error);
+
+	g_clear_object (&self->candidates);
+	g_clear_object (&self->kept_list);
+
+	gs_utils_error_convert_gio (&error_owned);
+	g_task_return_error (task, g_steal_pointer (&error_owned));
+	g_signal_emit_by_name (G_OBJECT (self), "completed");
+}
+
 static gboolean
 gs_plugin_job_list_apps_run_finish (GsPluginJob   *self,
                                     GAsyncResult  *result,
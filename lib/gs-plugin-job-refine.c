@@ -33,22 +33,43 @@
  * into the job will not be modified.
  *
  * Internally, the #GsPluginClass.refine_async() functions are called on all
- * the plugins in series, and in series with calls to
- * gs_odrs_provider_refine_async() and gs_rewrite_resources_async().
+ * the plugins, followed by calls to gs_odrs_provider_refine_async() and
+ * gs_rewrite_resources_async(). A plugin’s refine is started once all the
+ * plugins it depends on have finished refining: those with a lower order which
+ * it has a %GS_PLUGIN_RULE_RUN_AFTER or %GS_PLUGIN_RULE_RUN_BEFORE rule with,
+ * or which touch the same data according to
+ * gs_plugin_set_refine_dependencies(). Plugins which haven’t declared their
+ * dependencies depend on all the plugins with a lower order. Up to
+ * max_concurrent_plugin_refines() refines run at once.
  * Once all of those calls are finished,
  * zero or more recursive calls to run_refine_internal_async() are made in
  * parallel to do a similar refine process on the addons, runtime and related
  * components for all the components in the input #GsAppList. The refine job is
  * complete once all these recursive calls complete.
  *
+ * Apps which have already been completely refined are only passed to the
+ * plugins again if they need refining with some flags they have not already
+ * been refined with, or if they were refined with different
+ * %GS_PLUGIN_REFINE_FLAGS_ALLOW_PACKAGES or
+ * %GS_PLUGIN_REFINE_FLAGS_DISABLE_FILTERING flags; see
+ * gs_app_get_refined_flags(). Wildcards and apps which have never been refined
+ * are always passed to the plugins, whatever the flags. What an app has been
+ * refined with is only recorded once the whole refine, including the
+ * recursive refines, has succeeded. The record is dropped when the app’s
+ * state changes, or for all apps when a plugin calls
+ * gs_plugin_cache_invalidate() or gs_plugin_reload(), rebuilds its metadata
+ * silo or refreshes its package metadata, or when the ODRS ratings or cached
+ * reviews change.
+ *
  * The call to gs_rewrite_resources_async() will rewrite the CSS of apps to
  * refer to locally cached resources, rather than HTTP/HTTPS URIs for images
  * (for example).
  *
- * FIXME: Ideally, the #GsPluginClass.refine_async() calls would happen in
+ * FIXME: Ideally, all the #GsPluginClass.refine_async() calls would happen in
  * parallel, but this cannot be the case until the results of the refine_async()
  * call in one plugin don’t depend on the results of refine_async() in another.
- * This still happens with several pairs of plugins.
+ * This still happens with several pairs of plugins, which is why plugins have
+ * to opt in with gs_plugin_set_refine_dependencies().
  *
  * ```
  *                                    run_async()
@@ -224,6 +245,16 @@ app_is_non_wildcard (GsApp *app, gpointer user_data)
 	return !gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD);
 }
 
+/* Flags which don’t ask for any data to be refined, but change how the plugins
+ * refine it; so data refined with different values of them is cached
+ * separately. */
+#define REFINE_FLAGS_NOT_REQUIRE (GS_PLUGIN_REFINE_FLAGS_ALLOW_PACKAGES | \
+				  GS_PLUGIN_REFINE_FLAGS_DISABLE_FILTERING)
+
+/* Flags for data which can change without the app’s state changing or the
+ * plugins reloading, so are always refined. */
+#define REFINE_FLAGS_UNCACHEABLE (GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE_DATA)
+
 static void plugin_refine_cb (GObject      *source_object,
                               GAsyncResult *result,
                               gpointer      user_data);
@@ -233,6 +264,8 @@ static void odrs_provider_refine_cb (GObject      *source_object,
 static void rewrite_resources_cb (GObject      *source_object,
                                   GAsyncResult *result,
                                   gpointer      user_data);
+static void dispatch_plugin_refines (GTask   *task,
+                                     GError **error);
 static void finish_refine_internal_op (GTask  *task,
                                        GError *error);
 static void recursive_internal_refine_cb (GObject      *source_object,
@@ -244,6 +277,12 @@ static gboolean run_refine_internal_finish (GsPluginJobRefine  *self,
                                             GAsyncResult       *result,
                                             GError            **error);
 
+typedef enum {
+	PLUGIN_REFINE_PENDING,
+	PLUGIN_REFINE_RUNNING,
+	PLUGIN_REFINE_DONE,
+} PluginRefineState;
+
 typedef struct {
 	/* Input data. */
 	GsPluginLoader *plugin_loader;  /* (not nullable) (owned) */
@@ -253,8 +292,19 @@ typedef struct {
 	/* In-progress data. */
 	guint n_pending_ops;
 	guint n_pending_recursions;
-	guint next_plugin_index;
-	guint next_plugin_order;
+	GPtrArray *plugins;  /* (element-type GsPlugin) (owned) (nullable), enabled plugins which can refine, in order */
+	PluginRefineState *plugin_states;  /* (array length=plugins->len) (owned) (nullable) */
+	guint n_plugins_running;
+	guint n_plugins_done;
+	gboolean extra_refines_started;
+	gboolean refine_failed;
+
+	/* The apps from @list which need something refining, and the flags they
+	 * need refining with; see gs_app_get_refined_flags(). */
+	GsAppList *refine_list;  /* (not nullable) (owned) */
+	GsPluginRefineFlags refine_flags;
+	guint refine_list_initial_length;
+	guint refine_generation;
 
 #ifdef HAVE_SYSPROF
 	gint64 plugin_begin_time_nsec;
@@ -269,6 +319,9 @@ refine_internal_data_free (RefineInternalData *data)
 {
 	g_clear_object (&data->plugin_loader);
 	g_clear_object (&data->list);
+	g_clear_object (&data->refine_list);
+	g_clear_pointer (&data->plugins, g_ptr_array_unref);
+	g_clear_pointer (&data->plugin_states, g_free);
 
 	g_assert (data->n_pending_ops == 0);
 	g_assert (data->n_pending_recursions == 0);
@@ -295,7 +348,6 @@ run_refine_internal_async (GsPluginJobRefine   *self,
 	g_autoptr(GTask) task = NULL;
 	RefineInternalData *data;
 	g_autoptr(RefineInternalData) data_owned = NULL;
-	gboolean anything_ran = FALSE;
 	g_autoptr(GError) local_error = NULL;
 
 	task = g_task_new (self, cancellable, callback, user_data);
@@ -314,58 +366,148 @@ run_refine_internal_async (GsPluginJobRefine   *self,
 	gs_plugin_loader_run_adopt (plugin_loader, list);
 
 	data->n_pending_ops = 0;
-	data->next_plugin_order = 0;
 
-	/* run each plugin
-	 *
-	 * FIXME: For now, we have to run these vfuncs sequentially rather than
-	 * all in parallel. This is because there are still dependencies between
-	 * some of the plugins, where the code to refine an app in one plugin
-	 * depends on the results of refining it in another plugin first.
-	 *
-	 * Eventually, the plugins should all be changed/removed so that they
-	 * can operate independently. At that point, this code can be reverted
-	 * so that the refine_async() vfuncs are called in parallel. */
+	/* skip apps which all the plugins have already refined with these
+	 * flags; sample the generation first so invalidations which happen
+	 * while refining aren’t lost */
+	data->refine_generation = gs_app_get_refine_generation ();
+	data->refine_list = gs_app_list_new ();
+	data->refine_flags = flags & REFINE_FLAGS_NOT_REQUIRE;
+
+	for (guint i = 0; i < gs_app_list_length (list); i++) {
+		GsApp *app = gs_app_list_index (list, i);
+		GsPluginRefineFlags needed_flags = flags & ~REFINE_FLAGS_NOT_REQUIRE;
+		GsPluginRefineFlags refined_flags;
+
+		/* wildcards always have to be resolved, and apps which have
+		 * never been refined always go to the plugins, even with no
+		 * flags, as that’s how plugins adopt and fill in basic data */
+		if (!gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD) &&
+		    gs_app_get_refined_flags (app, &refined_flags) &&
+		    (refined_flags & REFINE_FLAGS_NOT_REQUIRE) == (flags & REFINE_FLAGS_NOT_REQUIRE)) {
+			needed_flags &= ~(refined_flags & ~REFINE_FLAGS_UNCACHEABLE);
+			if (needed_flags == 0)
+				continue;
+		}
+
+		gs_app_list_add (data->refine_list, app);
+		data->refine_flags |= needed_flags;
+	}
+
+	/* avoid having to merge apps added when resolving wildcards back into
+	 * @list in the common case */
+	if (gs_app_list_length (data->refine_list) == gs_app_list_length (list))
+		g_set_object (&data->refine_list, list);
+	data->refine_list_initial_length = gs_app_list_length (data->refine_list);
+
+	/* work out which plugins can refine */
 	plugins = gs_plugin_loader_get_plugins (plugin_loader);
+	data->plugins = g_ptr_array_new_with_free_func (g_object_unref);
 
-	for (guint i = 0; i < plugins->len; i++) {
+	for (guint i = 0; i < plugins->len && data->refine_list_initial_length > 0; i++) {
 		GsPlugin *plugin = g_ptr_array_index (plugins, i);
 		GsPluginClass *plugin_class = GS_PLUGIN_GET_CLASS (plugin);
 
-		if (gs_plugin_get_order (plugin) > data->next_plugin_order) {
-			if (!anything_ran)
-				data->next_plugin_order = gs_plugin_get_order (plugin);
-			else
-				return;
-		}
-
 		if (!gs_plugin_get_enabled (plugin))
 			continue;
 		if (plugin_class->refine_async == NULL)
 			continue;
 
-		/* at least one plugin supports this vfunc */
-		anything_ran = TRUE;
+		g_ptr_array_add (data->plugins, g_object_ref (plugin));
+	}
+
+	data->plugin_states = g_new0 (PluginRefineState, data->plugins->len);
 
-		/* Handle cancellation */
-		if (g_cancellable_set_error_if_cancelled (cancellable, &local_error))
-			break;
+	if (data->refine_list_initial_length == 0)
+		g_debug ("all apps already refined");
+	else if (data->plugins->len == 0)
+		g_debug ("no plugin could handle refining apps");
+
+	/* run the plugins whose dependencies are satisfied; the rest are run
+	 * from finish_refine_internal_op() as the others finish */
+	data->n_pending_ops++;
+	dispatch_plugin_refines (task, &local_error);
+	finish_refine_internal_op (task, g_steal_pointer (&local_error));
+}
 
-		/* FIXME: The next refine_async() call is made in
-		 * finish_refine_internal_op(). */
-		data->next_plugin_index = i + 1;
+/* Whether @plugin has to wait for @other_plugin, which comes before it in the
+ * plugin list, to finish refining before it can start. */
+static gboolean
+plugin_refine_depends_on (GsPlugin *plugin,
+                          GsPlugin *other_plugin)
+{
+	GsPluginRefineFlags reads, writes, other_reads, other_writes;
+	GPtrArray *rules;
+
+	/* plugins of the same order never depend on each other */
+	if (gs_plugin_get_order (plugin) <= gs_plugin_get_order (other_plugin))
+		return FALSE;
+
+	if (!gs_plugin_get_refine_dependencies (plugin, &reads, &writes) ||
+	    !gs_plugin_get_refine_dependencies (other_plugin, &other_reads, &other_writes))
+		return TRUE;
+
+	rules = gs_plugin_get_rules (plugin, GS_PLUGIN_RULE_RUN_AFTER);
+	for (guint i = 0; i < rules->len; i++) {
+		if (g_strcmp0 (g_ptr_array_index (rules, i), gs_plugin_get_name (other_plugin)) == 0)
+			return TRUE;
+	}
+	rules = gs_plugin_get_rules (other_plugin, GS_PLUGIN_RULE_RUN_BEFORE);
+	for (guint i = 0; i < rules->len; i++) {
+		if (g_strcmp0 (g_ptr_array_index (rules, i), gs_plugin_get_name (plugin)) == 0)
+			return TRUE;
+	}
+
+	return (other_writes & (reads | writes)) != 0 ||
+	       (other_reads & writes) != 0;
+}
+
+static guint
+max_concurrent_plugin_refines (void)
+{
+	/* most plugins refine in their own worker thread, so this mostly
+	 * limits how many threads are busy at once */
+	return MAX (g_get_num_processors (), 2);
+}
+
+/* Start refining with every pending plugin whose dependencies have all finished,
+ * up to the concurrency limit. */
+static void
+dispatch_plugin_refines (GTask   *task,
+                         GError **error)
+{
+	GCancellable *cancellable = g_task_get_cancellable (task);
+	RefineInternalData *data = g_task_get_task_data (task);
+
+	for (guint i = 0; i < data->plugins->len; i++) {
+		GsPlugin *plugin = g_ptr_array_index (data->plugins, i);
+		GsPluginClass *plugin_class = GS_PLUGIN_GET_CLASS (plugin);
+		gboolean ready = TRUE;
+
+		if (data->plugin_states[i] != PLUGIN_REFINE_PENDING)
+			continue;
+		if (data->n_plugins_running >= max_concurrent_plugin_refines ())
+			return;
+
+		for (guint j = 0; j < i && ready; j++) {
+			if (data->plugin_states[j] != PLUGIN_REFINE_DONE &&
+			    plugin_refine_depends_on (plugin, g_ptr_array_index (data->plugins, j)))
+				ready = FALSE;
+		}
+		if (!ready)
+			continue;
+
+		/* Handle cancellation */
+		if (g_cancellable_set_error_if_cancelled (cancellable, error))
+			return;
 
 		/* run the batched plugin symbol */
+		data->plugin_states[i] = PLUGIN_REFINE_RUNNING;
+		data->n_plugins_running++;
 		data->n_pending_ops++;
-		plugin_class->refine_async (plugin, list, flags,
+		plugin_class->refine_async (plugin, data->refine_list, data->refine_flags,
 					    cancellable, plugin_refine_cb, g_object_ref (task));
 	}
-
-	if (!anything_ran)
-		g_debug ("no plugin could handle refining apps");
-
-	data->n_pending_ops++;
-	finish_refine_internal_op (task, g_steal_pointer (&local_error));
 }
 
 static void
@@ -376,10 +518,11 @@ plugin_refine_cb (GObject      *source_object,
 	GsPlugin *plugin = GS_PLUGIN (source_object);
 	g_autoptr(GTask) task = g_steal_pointer (&user_data);
 	GsPluginClass *plugin_class = GS_PLUGIN_GET_CLASS (plugin);
+	RefineInternalData *data = g_task_get_task_data (task);
+	guint plugin_index;
 	g_autoptr(GError) local_error = NULL;
 #ifdef HAVE_SYSPROF
 	GsPluginJobRefine *self = g_task_get_source_object (task);
-	RefineInternalData *data = g_task_get_task_data (task);
 #endif
 
 	GS_PROFILER_ADD_MARK_TAKE (PluginJobRefine,
@@ -389,17 +532,26 @@ plugin_refine_cb (GObject      *source_object,
 						    gs_plugin_get_name (plugin)),
 				   NULL);
 
-	if (!plugin_class->refine_finish (plugin, result, &local_error) &&
-	    !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED) &&
-	    !g_error_matches (local_error, GS_PLUGIN_ERROR, GS_PLUGIN_ERROR_CANCELLED)) {
-		g_debug ("plugin '%s' failed to refine apps: %s",
-			 gs_plugin_get_name (plugin),
-			 local_error->message);
+	if (!plugin_class->refine_finish (plugin, result, &local_error)) {
+		/* the apps may have been only partially refined */
+		data->refine_failed = TRUE;
+
+		if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED) &&
+		    !g_error_matches (local_error, GS_PLUGIN_ERROR, GS_PLUGIN_ERROR_CANCELLED))
+			g_debug ("plugin '%s' failed to refine apps: %s",
+				 gs_plugin_get_name (plugin),
+				 local_error->message);
 		g_clear_error (&local_error);
 	}
 
 	gs_plugin_status_update (plugin, NULL, GS_PLUGIN_STATUS_FINISHED);
 
+	if (g_ptr_array_find (data->plugins, plugin, &plugin_index)) {
+		data->plugin_states[plugin_index] = PLUGIN_REFINE_DONE;
+		data->n_plugins_running--;
+		data->n_plugins_done++;
+	}
+
 	finish_refine_internal_op (task, NULL);
 }
 
@@ -410,9 +562,13 @@ odrs_provider_refine_cb (GObject      *source_object,
 {
 	GsOdrsProvider *odrs_provider = GS_ODRS_PROVIDER (source_object);
 	g_autoptr(GTask) task = g_steal_pointer (&user_data);
+	RefineInternalData *data = g_task_get_task_data (task);
 	g_autoptr(GError) local_error = NULL;
 
-	if (!gs_odrs_provider_refine_finish (odrs_provider, result, &local_error) &&
+	if (!gs_odrs_provider_refine_finish (odrs_provider, result, &local_error))
+		data->refine_failed = TRUE;
+
+	if (local_error != NULL &&
 	    !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED) &&
 	    !g_error_matches (local_error, GS_PLUGIN_ERROR, GS_PLUGIN_ERROR_CANCELLED)) {
 		g_debug ("ODRS provider failed to refine apps: %s",
@@ -428,9 +584,13 @@ rewrite_resources_cb (GObject      *source_object,
                       gpointer      user_data)
 {
 	g_autoptr(GTask) task = g_steal_pointer (&user_data);
+	RefineInternalData *data = g_task_get_task_data (task);
 	g_autoptr(GError) local_error = NULL;
 
-	if (!gs_rewrite_resources_finish (result, &local_error) &&
+	if (!gs_rewrite_resources_finish (result, &local_error))
+		data->refine_failed = TRUE;
+
+	if (local_error != NULL &&
 	    !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED) &&
 	    !g_error_matches (local_error, GS_PLUGIN_ERROR, GS_PLUGIN_ERROR_CANCELLED)) {
 		g_debug ("Rewriting resources failed when refine apps: %s",
@@ -454,8 +614,6 @@ finish_refine_internal_op (GTask  *task,
 	GsPluginRefineFlags flags = data->flags;
 	GsOdrsProvider *odrs_provider;
 	GsOdrsProviderRefineFlags odrs_refine_flags = 0;
-	GPtrArray *plugins;  /* (element-type GsPlugin) */
-	gboolean anything_ran = FALSE;
 
 	if (data->error == NULL && error_owned != NULL) {
 		data->error = g_steal_pointer (&error_owned);
@@ -470,68 +628,45 @@ finish_refine_internal_op (GTask  *task,
 	data->plugin_begin_time_nsec = SYSPROF_CAPTURE_CURRENT_TIME;
 #endif
 
-	if (data->n_pending_ops > 0)
-		return;
+	/* start any plugins which were waiting for the one which finished */
+	if (data->error == NULL) {
+		g_autoptr(GError) local_error = NULL;
 
-	/* We reach this line after all plugins of a certain order ran, and now
-	 * we need to run the next set of plugins. */
-	data->next_plugin_order++;
-
-	plugins = gs_plugin_loader_get_plugins (plugin_loader);
-
-	for (guint i = data->next_plugin_index; i < plugins->len; i++) {
-		GsPlugin *plugin = g_ptr_array_index (plugins, i);
-		GsPluginClass *plugin_class = GS_PLUGIN_GET_CLASS (plugin);
-
-		if (gs_plugin_get_order (plugin) > data->next_plugin_order) {
-			if (!anything_ran)
-				data->next_plugin_order = gs_plugin_get_order (plugin);
-			else
-				return;
-		}
-
-		if (!gs_plugin_get_enabled (plugin))
-			continue;
-		if (plugin_class->refine_async == NULL)
-			continue;
-		if (gs_plugin_get_order (plugin) < data->next_plugin_order)
-			continue;
+		dispatch_plugin_refines (task, &local_error);
+		if (local_error != NULL)
+			data->error = g_steal_pointer (&local_error);
+	}
 
-		/* at least one plugin supports this vfunc */
-		anything_ran = TRUE;
+	if (data->n_pending_ops > 0)
+		return;
 
-		/* FIXME: The next refine_async() call is made in
-		 * finish_refine_internal_op(). */
-		data->next_plugin_index = i + 1;
+	if (data->error == NULL && !data->extra_refines_started &&
+	    data->refine_list_initial_length > 0) {
+		GsPluginRefineFlags refine_flags = data->refine_flags;
 
-		/* run the batched plugin symbol */
-		data->n_pending_ops++;
-		plugin_class->refine_async (plugin, list, flags,
-					    cancellable, plugin_refine_cb, g_object_ref (task));
-	}
+		g_assert (data->n_plugins_done == data->plugins->len);
 
-	if (data->next_plugin_index == plugins->len) {
 		/* Avoid the ODRS and rewrite refines being run multiple times. */
-		data->next_plugin_index++;
+		data->extra_refines_started = TRUE;
 
 		/* Add ODRS data if needed */
 		odrs_provider = gs_plugin_loader_get_odrs_provider (plugin_loader);
 
-		if (flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_REVIEWS)
+		if (refine_flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_REVIEWS)
 			odrs_refine_flags |= GS_ODRS_PROVIDER_REFINE_FLAGS_GET_REVIEWS;
-		if (flags & (GS_PLUGIN_REFINE_FLAGS_REQUIRE_REVIEW_RATINGS |
-			     GS_PLUGIN_REFINE_FLAGS_REQUIRE_RATING))
+		if (refine_flags & (GS_PLUGIN_REFINE_FLAGS_REQUIRE_REVIEW_RATINGS |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_RATING))
 			odrs_refine_flags |= GS_ODRS_PROVIDER_REFINE_FLAGS_GET_RATINGS;
 
 		if (odrs_provider != NULL && odrs_refine_flags != 0) {
 			data->n_pending_ops++;
-			gs_odrs_provider_refine_async (odrs_provider, list, odrs_refine_flags,
+			gs_odrs_provider_refine_async (odrs_provider, data->refine_list, odrs_refine_flags,
 						       cancellable, odrs_provider_refine_cb, g_object_ref (task));
 		}
 
 		/* Rewrite app CSS if needed. */
 		data->n_pending_ops++;
-		gs_rewrite_resources_async (list, cancellable, rewrite_resources_cb, g_object_ref (task));
+		gs_rewrite_resources_async (data->refine_list, cancellable, rewrite_resources_cb, g_object_ref (task));
 	}
 
 	if (data->n_pending_ops > 0)
@@ -547,6 +682,12 @@ finish_refine_internal_op (GTask  *task,
 		return;
 	}
 
+	/* add any apps which wildcards were resolved to */
+	if (data->refine_list != list) {
+		for (guint i = data->refine_list_initial_length; i < gs_app_list_length (data->refine_list); i++)
+			gs_app_list_add (list, gs_app_list_index (data->refine_list, i));
+	}
+
 	/* filter any wildcard apps left in the list */
 	gs_app_list_filter (list, app_is_non_wildcard, NULL);
 
@@ -657,13 +798,23 @@ recursive_internal_refine_cb (GObject      *source_object,
 {
 	GsPluginJobRefine *self = GS_PLUGIN_JOB_REFINE (source_object);
 	g_autoptr(GTask) task = g_steal_pointer (&user_data);
+	RefineInternalData *data = g_task_get_task_data (task);
+	RefineInternalData *recursion_data = g_task_get_task_data (G_TASK (result));
 	g_autoptr(GError) local_error = NULL;
 
-	if (!run_refine_internal_finish (self, result, &local_error) &&
-	    !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED) &&
-	    !g_error_matches (local_error, GS_PLUGIN_ERROR, GS_PLUGIN_ERROR_CANCELLED)) {
-		g_debug ("failed to recursive-refine: %s", local_error->message);
-		g_clear_error (&local_error);
+	/* the related apps are part of what the parent apps were refined
+	 * with, so a partial refine of them is a partial refine overall */
+	if (recursion_data->refine_failed)
+		data->refine_failed = TRUE;
+
+	if (!run_refine_internal_finish (self, result, &local_error)) {
+		data->refine_failed = TRUE;
+
+		if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED) &&
+		    !g_error_matches (local_error, GS_PLUGIN_ERROR, GS_PLUGIN_ERROR_CANCELLED)) {
+			g_debug ("failed to recursive-refine: %s", local_error->message);
+			g_clear_error (&local_error);
+		}
 	}
 
 	finish_refine_internal_recursion (task, g_steal_pointer (&local_error));
@@ -691,10 +842,29 @@ finish_refine_internal_recursion (GTask  *task,
 
 	/* The entire refine operation (and all its sub-operations and
 	 * recursions) is complete. */
-	if (data->error != NULL)
+	if (data->error != NULL) {
 		g_task_return_error (task, g_steal_pointer (&data->error));
-	else
-		g_task_return_boolean (task, TRUE);
+		return;
+	}
+
+	/* remember what was refined so it can be skipped next time; only do
+	 * that if everything succeeded, as a failed or cancelled refine may
+	 * have left the apps partially refined */
+	if (!data->refine_failed &&
+	    !g_cancellable_is_cancelled (g_task_get_cancellable (task))) {
+		GsPluginRefineFlags cacheable_flags = data->refine_flags & ~REFINE_FLAGS_UNCACHEABLE;
+
+		for (guint i = 0; i < gs_app_list_length (data->refine_list); i++) {
+			GsApp *app = gs_app_list_index (data->refine_list, i);
+
+			if (!gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD))
+				gs_app_add_refined_flags (app, cacheable_flags,
+							  REFINE_FLAGS_NOT_REQUIRE,
+							  data->refine_generation);
+		}
+	}
+
+	g_task_return_boolean (task, TRUE);
 }
 
 static gboolean
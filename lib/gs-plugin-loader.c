@@ -59,6 +59,15 @@ struct _GsPluginLoader
 	GCancellable		*pending_apps_cancellable;  /* (nullable) (owned) */
 
 	GThreadPool		*queued_ops_pool;
+	guint			 max_parallel_ops_override;	/* 0 to use the default */
+	GMutex			 queued_ops_mutex;
+	GQueue			 queued_ops_waiting;		/* (element-type GTask) (owned), protected by queued_ops_mutex */
+	GHashTable		*queued_ops_running;		/* (element-type GsPluginJob), protected by queued_ops_mutex */
+	GHashTable		*queued_ops_running_keys;	/* resource key : number of running ops, protected by queued_ops_mutex */
+	gboolean		 queued_ops_exclusive_running;	/* protected by queued_ops_mutex */
+	gboolean		 queued_ops_shut_down;		/* protected by queued_ops_mutex */
+	guint			 queued_ops_watch_id;
+	GMutex			 install_queue_save_mutex;
 	gint			 active_jobs;
 
 	GSettings		*settings;
@@ -91,6 +100,9 @@ static void gs_plugin_loader_monitor_network (GsPluginLoader *plugin_loader);
 static void add_app_to_install_queue (GsPluginLoader *plugin_loader, GsApp *app);
 static gboolean remove_app_from_install_queue (GsPluginLoader *plugin_loader, GsApp *app);
 static void gs_plugin_loader_process_in_thread_pool_cb (gpointer data, gpointer user_data);
+static void job_manager_job_removed_cb (GsJobManager *job_manager,
+                                        GsPluginJob  *job,
+                                        gpointer      user_data);
 static void gs_plugin_loader_status_changed_cb (GsPlugin       *plugin,
                                                 GsApp          *app,
                                                 GsPluginStatus  status,
@@ -198,6 +210,7 @@ typedef struct {
 	GsPluginJob			*plugin_job;
 	gboolean			 anything_ran;
 	gchar				**tokens;
+	gchar				**queued_op_keys;	/* (nullable) NULL if the queued op must run alone */
 } GsPluginLoaderHelper;
 
 static GsPluginLoaderHelper *
@@ -261,6 +274,7 @@ gs_plugin_loader_helper_free (GsPluginLoaderHelper *helper)
 	if (helper->catlist != NULL)
 		g_ptr_array_unref (helper->catlist);
 	g_strfreev (helper->tokens);
+	g_strfreev (helper->queued_op_keys);
 	g_slice_free (GsPluginLoaderHelper, helper);
 }
 
@@ -1163,6 +1177,12 @@ save_install_queue (GsPluginLoader *plugin_loader)
 	g_autoptr(GError) error = NULL;
 	g_autoptr(GString) s = NULL;
 	g_autofree gchar *file = NULL;
+	g_autoptr(GMutexLocker) save_locker = NULL;
+
+	/* queued operations finish in parallel, so hold this while taking the
+	 * snapshot and writing it, so that an older snapshot can never
+	 * overwrite a newer one */
+	save_locker = g_mutex_locker_new (&plugin_loader->install_queue_save_mutex);
 
 	s = g_string_new ("");
 	g_mutex_lock (&plugin_loader->pending_apps_mutex);
@@ -2516,9 +2536,37 @@ gs_plugin_loader_dispose (GObject *object)
 					     plugin_loader->network_metered_notify_handler);
 		plugin_loader->network_metered_notify_handler = 0;
 	}
+	if (plugin_loader->queued_ops_watch_id != 0) {
+		gs_job_manager_remove_watch (plugin_loader->job_manager, plugin_loader->queued_ops_watch_id);
+		plugin_loader->queued_ops_watch_id = 0;
+	}
 	if (plugin_loader->queued_ops_pool != NULL) {
-		/* stop accepting more requests and wait until any currently
-		 * running ones are finished */
+		GQueue waiting = G_QUEUE_INIT;
+		GTask *task;
+
+		/* stop accepting more requests, cancel the ones which haven’t
+		 * started, and wait until any currently running ones are
+		 * finished */
+		g_mutex_lock (&plugin_loader->queued_ops_mutex);
+		plugin_loader->queued_ops_shut_down = TRUE;
+		waiting = plugin_loader->queued_ops_waiting;
+		g_queue_init (&plugin_loader->queued_ops_waiting);
+		g_mutex_unlock (&plugin_loader->queued_ops_mutex);
+
+		while ((task = g_queue_pop_head (&waiting)) != NULL) {
+			GsPluginLoaderHelper *helper = g_task_get_task_data (task);
+			GsApp *app = gs_plugin_job_get_app (helper->plugin_job);
+
+			if (app != NULL &&
+			    gs_app_get_pending_action (app) == gs_plugin_job_get_action (helper->plugin_job))
+				gs_app_set_pending_action (app, GS_PLUGIN_ACTION_UNKNOWN);
+
+			g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+						 "Plugin loader is shutting down");
+			gs_job_manager_remove_job (plugin_loader->job_manager, helper->plugin_job);
+			g_object_unref (task);
+		}
+
 		g_thread_pool_free (plugin_loader->queued_ops_pool, TRUE, TRUE);
 		plugin_loader->queued_ops_pool = NULL;
 	}
@@ -2551,7 +2599,11 @@ gs_plugin_loader_finalize (GObject *object)
 	g_ptr_array_unref (plugin_loader->file_monitors);
 	g_hash_table_unref (plugin_loader->events_by_id);
 	g_hash_table_unref (plugin_loader->disallow_updates);
+	g_hash_table_unref (plugin_loader->queued_ops_running);
+	g_hash_table_unref (plugin_loader->queued_ops_running_keys);
 
+	g_mutex_clear (&plugin_loader->queued_ops_mutex);
+	g_mutex_clear (&plugin_loader->install_queue_save_mutex);
 	g_mutex_clear (&plugin_loader->pending_apps_mutex);
 	g_mutex_clear (&plugin_loader->events_by_id_mutex);
 
@@ -2705,12 +2757,47 @@ gs_plugin_loader_settings_changed_cb (GSettings *settings,
 {
 	if (g_strcmp0 (key, "allow-updates") == 0)
 		gs_plugin_loader_allow_updates_recheck (plugin_loader);
+	else if (g_strcmp0 (key, "max-parallel-operations") == 0)
+		gs_plugin_loader_update_max_parallel_ops (plugin_loader);
 }
 
-static gint
-get_max_parallel_ops (void)
+static guint
+get_max_parallel_ops (GsPluginLoader *plugin_loader)
+{
+	guint max_ops;
+
+	if (plugin_loader->max_parallel_ops_override > 0)
+		return plugin_loader->max_parallel_ops_override;
+
+	max_ops = g_settings_get_uint (plugin_loader->settings, "max-parallel-operations");
+	if (max_ops > 0)
+		return max_ops;
+
+	/* on a metered connection the downloads would only compete for the
+	 * same limited bandwidth */
+	if (plugin_loader->network_monitor != NULL &&
+	    g_network_monitor_get_network_metered (plugin_loader->network_monitor))
+		return 1;
+
+	/* installing is mostly I/O and decompression bound, so don’t use
+	 * all the cores */
+	return CLAMP (g_get_num_processors () / 2, 1, 4);
+}
+
+static void
+gs_plugin_loader_update_max_parallel_ops (GsPluginLoader *plugin_loader)
 {
-	return 1;
+	g_autoptr(GError) error = NULL;
+	guint max_ops;
+
+	if (plugin_loader->queued_ops_pool == NULL)
+		return;
+
+	max_ops = get_max_parallel_ops (plugin_loader);
+	g_debug ("Allowing %u queued operations in parallel", max_ops);
+	if (!g_thread_pool_set_max_threads (plugin_loader->queued_ops_pool, (gint) max_ops, &error))
+		g_warning ("Failed to set the maximum number of ops in parallel: %s",
+			   error->message);
 }
 
 static void
@@ -2731,14 +2818,22 @@ gs_plugin_loader_init (GsPluginLoader *plugin_loader)
 	plugin_loader->scale = 1;
 	plugin_loader->plugins = g_ptr_array_new_with_free_func (g_object_unref);
 	plugin_loader->pending_apps = NULL;
+	plugin_loader->file_monitors = g_ptr_array_new_with_free_func (g_object_unref);
+	plugin_loader->locations = g_ptr_array_new_with_free_func (g_free);
+	plugin_loader->settings = g_settings_new ("org.gnome.software");
+
+	/* the number of threads is updated once the network monitor is set up */
 	plugin_loader->queued_ops_pool = g_thread_pool_new (gs_plugin_loader_process_in_thread_pool_cb,
 						   plugin_loader,
-						   get_max_parallel_ops (),
+						   1,
 						   FALSE,
 						   NULL);
-	plugin_loader->file_monitors = g_ptr_array_new_with_free_func (g_object_unref);
-	plugin_loader->locations = g_ptr_array_new_with_free_func (g_free);
-	plugin_loader->settings = g_settings_new ("org.gnome.software");
+	g_mutex_init (&plugin_loader->queued_ops_mutex);
+	g_mutex_init (&plugin_loader->install_queue_save_mutex);
+	g_queue_init (&plugin_loader->queued_ops_waiting);
+	plugin_loader->queued_ops_running = g_hash_table_new (g_direct_hash, g_direct_equal);
+	plugin_loader->queued_ops_running_keys = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
 	g_signal_connect (plugin_loader->settings, "changed",
 			  G_CALLBACK (gs_plugin_loader_settings_changed_cb), plugin_loader);
 	plugin_loader->events_by_id = g_hash_table_new_full ((GHashFunc) as_utils_data_id_hash,
@@ -2756,8 +2851,16 @@ gs_plugin_loader_init (GsPluginLoader *plugin_loader)
 								     FALSE,
 								     NULL);
 
-	/* get the job manager */
+	/* get the job manager, and re-check the queued operations whenever a
+	 * job which may have been blocking one of them finishes */
 	plugin_loader->job_manager = gs_job_manager_new ();
+	plugin_loader->queued_ops_watch_id = gs_job_manager_add_watch (plugin_loader->job_manager,
+								       NULL,
+								       G_TYPE_INVALID,
+								       NULL,
+								       job_manager_job_removed_cb,
+								       plugin_loader,
+								       NULL);
 
 	/* get the category manager */
 	plugin_loader->category_manager = gs_category_manager_new ();
@@ -2820,6 +2923,7 @@ gs_plugin_loader_init (GsPluginLoader *plugin_loader)
 
 	/* monitor the network as the many UI operations need the network */
 	gs_plugin_loader_monitor_network (plugin_loader);
+	gs_plugin_loader_update_max_parallel_ops (plugin_loader);
 
 	/* by default we only show project-less apps or compatible projects */
 	tmp = g_getenv ("GNOME_SOFTWARE_COMPATIBLE_PROJECTS");
@@ -3050,6 +3154,7 @@ gs_plugin_loader_network_metered_notify_cb (GObject    *obj,
 	GsPluginLoader *plugin_loader = GS_PLUGIN_LOADER (user_data);
 
 	gs_plugin_loader_network_changed_cb (monitor, g_network_monitor_get_network_available (monitor), plugin_loader);
+	gs_plugin_loader_update_max_parallel_ops (plugin_loader);
 }
 
 static void
@@ -3377,6 +3482,202 @@ gs_plugin_loader_process_old_api_job_cb (gpointer task_data,
 	gs_job_manager_remove_job (plugin_loader->job_manager, helper->plugin_job);
 }
 
+/* Keys for the resources which a queued operation touches, other than the app
+ * itself (which is tracked by the #GsJobManager). Queued operations which share
+ * a key are never run in parallel.
+ *
+ * Installing an app from a remote only writes that app’s refs, so installs in
+ * the same installation can run in parallel; the backends take their own
+ * locks on the installation while committing. What they can’t do is install
+ * the same missing runtime at the same time, so that is a key. Anything else
+ * (installs from local files, which may add remotes, repositories and
+ * upgrades) can change the installation as a whole, so it gets a key for the
+ * installation of the plugin which manages it.
+ *
+ * Returns %NULL if it’s not known what the operation touches, in which case it
+ * has to run on its own. */
+static gchar **
+queued_op_dup_keys (GsApp          *app,
+		    GsPluginAction  action)
+{
+	g_autoptr(GPtrArray) keys = NULL;
+	g_autoptr(GsPlugin) management_plugin = NULL;
+	GsApp *runtime;
+
+	if (app == NULL)
+		return NULL;
+	management_plugin = gs_app_dup_management_plugin (app);
+	if (management_plugin == NULL)
+		return NULL;
+
+	keys = g_ptr_array_new_with_free_func (g_free);
+	if (action != GS_PLUGIN_ACTION_INSTALL ||
+	    gs_app_get_local_file (app) != NULL ||
+	    gs_app_get_kind (app) == AS_COMPONENT_KIND_REPOSITORY)
+		g_ptr_array_add (keys, g_strdup_printf ("installation:%s:%s",
+							gs_plugin_get_name (management_plugin),
+							as_component_scope_to_string (gs_app_get_scope (app))));
+	runtime = gs_app_get_runtime (app);
+	if (runtime != NULL && gs_app_get_unique_id (runtime) != NULL &&
+	    !gs_app_is_installed (runtime))
+		g_ptr_array_add (keys, g_strdup_printf ("runtime:%s", gs_app_get_unique_id (runtime)));
+	g_ptr_array_add (keys, NULL);
+
+	return (gchar **) g_ptr_array_free (g_steal_pointer (&keys), FALSE);
+}
+
+/* Whether there’s a job for @app which has to finish before @plugin_job can
+ * start: either an earlier queued operation, or any other job modifying it,
+ * such as a removal or an update. Queued operations which are waiting behind
+ * @plugin_job are in @waiting_jobs but not in @skipped_jobs. */
+static gboolean
+queued_op_app_is_busy_locked (GsPluginLoader *plugin_loader,
+			      GsApp *app,
+			      GsPluginJob *plugin_job,
+			      GHashTable *waiting_jobs,
+			      GHashTable *skipped_jobs)
+{
+	g_autoptr(GPtrArray) pending_jobs = NULL;
+
+	if (app == NULL || gs_app_get_unique_id (app) == NULL)
+		return FALSE;
+
+	pending_jobs = gs_job_manager_get_pending_jobs_for_app (plugin_loader->job_manager, app);
+	for (guint i = 0; i < pending_jobs->len; i++) {
+		GsPluginJob *job = g_ptr_array_index (pending_jobs, i);
+
+		if (job == plugin_job)
+			continue;
+		if (g_hash_table_contains (waiting_jobs, job) &&
+		    !g_hash_table_contains (skipped_jobs, job))
+			continue;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gboolean
+queued_op_keys_contain_any (GHashTable *keys,
+			    gchar **op_keys)
+{
+	for (guint i = 0; op_keys != NULL && op_keys[i] != NULL; i++) {
+		if (g_hash_table_contains (keys, op_keys[i]))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* Push every waiting operation which doesn’t conflict with a running one, or
+ * with one which was queued before it, to the thread pool. The thread pool
+ * then limits how many of those run at once. */
+static void
+queued_ops_dispatch_locked (GsPluginLoader *plugin_loader)
+{
+	g_autoptr(GHashTable) waiting_jobs = NULL;
+	g_autoptr(GHashTable) skipped_jobs = NULL;
+	g_autoptr(GHashTable) skipped_keys = NULL;
+	gboolean skipped_exclusive = FALSE;
+	GList *l, *next;
+
+	if (plugin_loader->queued_ops_shut_down ||
+	    g_queue_is_empty (&plugin_loader->queued_ops_waiting))
+		return;
+
+	waiting_jobs = g_hash_table_new (g_direct_hash, g_direct_equal);
+	skipped_jobs = g_hash_table_new (g_direct_hash, g_direct_equal);
+	skipped_keys = g_hash_table_new (g_str_hash, g_str_equal);
+	for (l = plugin_loader->queued_ops_waiting.head; l != NULL; l = l->next) {
+		GsPluginLoaderHelper *helper = g_task_get_task_data (l->data);
+		g_hash_table_add (waiting_jobs, helper->plugin_job);
+	}
+
+	for (l = plugin_loader->queued_ops_waiting.head; l != NULL; l = next) {
+		GTask *task = l->data;
+		GsPluginLoaderHelper *helper = g_task_get_task_data (task);
+		GsApp *app = gs_plugin_job_get_app (helper->plugin_job);
+		gboolean exclusive = (helper->queued_op_keys == NULL);
+		gboolean blocked;
+
+		next = l->next;
+
+		if (exclusive)
+			blocked = skipped_exclusive ||
+				  g_hash_table_size (skipped_jobs) > 0 ||
+				  g_hash_table_size (plugin_loader->queued_ops_running) > 0;
+		else
+			blocked = skipped_exclusive ||
+				  plugin_loader->queued_ops_exclusive_running ||
+				  queued_op_keys_contain_any (skipped_keys, helper->queued_op_keys) ||
+				  queued_op_keys_contain_any (plugin_loader->queued_ops_running_keys, helper->queued_op_keys);
+		if (!blocked && app != NULL)
+			blocked = queued_op_app_is_busy_locked (plugin_loader, app, helper->plugin_job,
+								waiting_jobs, skipped_jobs) ||
+				  queued_op_app_is_busy_locked (plugin_loader, gs_app_get_runtime (app), helper->plugin_job,
+								waiting_jobs, skipped_jobs);
+
+		if (blocked) {
+			g_hash_table_add (skipped_jobs, helper->plugin_job);
+			if (exclusive)
+				skipped_exclusive = TRUE;
+			for (guint i = 0; !exclusive && helper->queued_op_keys[i] != NULL; i++)
+				g_hash_table_add (skipped_keys, helper->queued_op_keys[i]);
+			continue;
+		}
+
+		/* mark it as running as soon as it’s in the thread pool, so
+		 * nothing conflicting gets pushed after it */
+		g_hash_table_add (plugin_loader->queued_ops_running, helper->plugin_job);
+		if (exclusive)
+			plugin_loader->queued_ops_exclusive_running = TRUE;
+		for (guint i = 0; !exclusive && helper->queued_op_keys[i] != NULL; i++) {
+			guint n = GPOINTER_TO_UINT (g_hash_table_lookup (plugin_loader->queued_ops_running_keys,
+									 helper->queued_op_keys[i]));
+			g_hash_table_insert (plugin_loader->queued_ops_running_keys,
+					     g_strdup (helper->queued_op_keys[i]),
+					     GUINT_TO_POINTER (n + 1));
+		}
+
+		g_queue_delete_link (&plugin_loader->queued_ops_waiting, l);
+		g_thread_pool_push (plugin_loader->queued_ops_pool, task, NULL);
+	}
+}
+
+static void
+queued_op_release_locked (GsPluginLoader *plugin_loader,
+			  GsPluginLoaderHelper *helper)
+{
+	g_hash_table_remove (plugin_loader->queued_ops_running, helper->plugin_job);
+	if (helper->queued_op_keys == NULL) {
+		plugin_loader->queued_ops_exclusive_running = FALSE;
+		return;
+	}
+	for (guint i = 0; helper->queued_op_keys[i] != NULL; i++) {
+		guint n = GPOINTER_TO_UINT (g_hash_table_lookup (plugin_loader->queued_ops_running_keys,
+								 helper->queued_op_keys[i]));
+		if (n <= 1)
+			g_hash_table_remove (plugin_loader->queued_ops_running_keys, helper->queued_op_keys[i]);
+		else
+			g_hash_table_insert (plugin_loader->queued_ops_running_keys,
+					     g_strdup (helper->queued_op_keys[i]),
+					     GUINT_TO_POINTER (n - 1));
+	}
+}
+
+static void
+job_manager_job_removed_cb (GsJobManager *job_manager,
+                            GsPluginJob  *job,
+                            gpointer      user_data)
+{
+	GsPluginLoader *plugin_loader = GS_PLUGIN_LOADER (user_data);
+
+	/* a job outside the queue, such as a removal, may have been blocking
+	 * a queued operation on the same app */
+	g_mutex_lock (&plugin_loader->queued_ops_mutex);
+	queued_ops_dispatch_locked (plugin_loader);
+	g_mutex_unlock (&plugin_loader->queued_ops_mutex);
+}
+
 static void
 gs_plugin_loader_process_in_thread_pool_cb (gpointer data,
 					    gpointer user_data)
@@ -3395,6 +3696,12 @@ gs_plugin_loader_process_in_thread_pool_cb (gpointer data,
 	if (app != NULL && gs_app_get_pending_action (app) == action)
 		gs_app_set_pending_action (app, GS_PLUGIN_ACTION_UNKNOWN);
 
+	/* let any operations which were waiting for this one run */
+	g_mutex_lock (&plugin_loader->queued_ops_mutex);
+	queued_op_release_locked (plugin_loader, helper);
+	queued_ops_dispatch_locked (plugin_loader);
+	g_mutex_unlock (&plugin_loader->queued_ops_mutex);
+
 	g_object_unref (task);
 }
 
@@ -3425,7 +3732,13 @@ gs_plugin_loader_schedule_task (GsPluginLoader *plugin_loader,
 		    gs_app_get_state (app) != GS_APP_STATE_AVAILABLE_LOCAL)
 			add_app_to_install_queue (plugin_loader, app);
 	}
-	g_thread_pool_push (plugin_loader->queued_ops_pool, g_object_ref (task), NULL);
+
+	/* wait for any conflicting operations to finish first */
+	helper->queued_op_keys = queued_op_dup_keys (app, gs_plugin_job_get_action (helper->plugin_job));
+	g_mutex_lock (&plugin_loader->queued_ops_mutex);
+	g_queue_push_tail (&plugin_loader->queued_ops_waiting, g_object_ref (task));
+	queued_ops_dispatch_locked (plugin_loader);
+	g_mutex_unlock (&plugin_loader->queued_ops_mutex);
 }
 
 static void
@@ -3965,18 +4278,15 @@ gs_plugin_loader_get_odrs_provider (GsPluginLoader *plugin_loader)
  * @max_ops: the maximum number of parallel operations
  *
  * Sets the number of maximum number of queued operations (install/update/upgrade-download)
- * to be processed at a time. If @max_ops is 0, then it will set the default maximum number.
+ * to be processed at a time. If @max_ops is 0, then it will set the default maximum number,
+ * which comes from the `max-parallel-operations` setting.
  */
 void
 gs_plugin_loader_set_max_parallel_ops (GsPluginLoader *plugin_loader,
 				       guint max_ops)
 {
-	g_autoptr(GError) error = NULL;
-	if (max_ops == 0)
-		max_ops = get_max_parallel_ops ();
-	if (!g_thread_pool_set_max_threads (plugin_loader->queued_ops_pool, max_ops, &error))
-		g_warning ("Failed to set the maximum number of ops in parallel: %s",
-			   error->message);
+	plugin_loader->max_parallel_ops_override = max_ops;
+	gs_plugin_loader_update_max_parallel_ops (plugin_loader);
 }
 
 /**
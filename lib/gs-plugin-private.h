@@ -43,6 +43,9 @@ void		 gs_plugin_set_auth_array		(GsPlugin	*plugin,
 							 GPtrArray	*auth_array);
 GPtrArray	*gs_plugin_get_rules			(GsPlugin	*plugin,
 							 GsPluginRule	 rule);
+gboolean	 gs_plugin_get_refine_dependencies	(GsPlugin	*plugin,
+							 GsPluginRefineFlags *reads,
+							 GsPluginRefineFlags *writes);
 gpointer	 gs_plugin_get_symbol			(GsPlugin	*plugin,
 							 const gchar	*function_name);
 void		 gs_plugin_interactive_inc		(GsPlugin	*plugin);
@@ -37,6 +37,7 @@
 #include <string.h>
 
 #include "gs-app-list-private.h"
+#include "gs-app-private.h"
 #include "gs-download-utils.h"
 #include "gs-enums.h"
 #include "gs-os-release.h"
@@ -51,6 +52,9 @@ typedef struct
 	GModule			*module;
 	GsPluginFlags		 flags;
 	GPtrArray		*rules[GS_PLUGIN_RULE_LAST];
+	gboolean		 refine_dependencies_set;
+	GsPluginRefineFlags	 refine_reads;
+	GsPluginRefineFlags	 refine_writes;
 	GHashTable		*vfuncs;		/* string:pointer */
 	GMutex			 vfuncs_mutex;
 	gboolean		 enabled;
@@ -675,6 +679,67 @@ gs_plugin_get_rules (GsPlugin *plugin, GsPluginRule rule)
 	return priv->rules[rule];
 }
 
+/**
+ * gs_plugin_set_refine_dependencies:
+ * @plugin: a #GsPlugin
+ * @reads: the #GsPluginRefineFlags covering the app data which the plugin’s
+ *   refine_async() reads
+ * @writes: the #GsPluginRefineFlags covering the app data which the plugin’s
+ *   refine_async() sets
+ *
+ * Declares which app data the plugin’s #GsPluginClass.refine_async uses, so
+ * that it can run at the same time as refines in other plugins which don’t
+ * touch the same data, even if they have a different order. Rules such as
+ * %GS_PLUGIN_RULE_RUN_AFTER are still respected.
+ *
+ * Plugins which don’t call this are assumed to read and write everything, and
+ * are only run in parallel with plugins of the same order. Plugins which add
+ * or remove apps in the list being refined must not call this.
+ *
+ * Since: 46
+ **/
+void
+gs_plugin_set_refine_dependencies (GsPlugin            *plugin,
+                                   GsPluginRefineFlags  reads,
+                                   GsPluginRefineFlags  writes)
+{
+	GsPluginPrivate *priv = gs_plugin_get_instance_private (plugin);
+
+	g_return_if_fail (GS_IS_PLUGIN (plugin));
+
+	priv->refine_dependencies_set = TRUE;
+	priv->refine_reads = reads;
+	priv->refine_writes = writes;
+}
+
+/**
+ * gs_plugin_get_refine_dependencies:
+ * @plugin: a #GsPlugin
+ * @reads: (out) (optional): return location for the data read
+ * @writes: (out) (optional): return location for the data written
+ *
+ * Gets the dependencies set with gs_plugin_set_refine_dependencies().
+ *
+ * Returns: %TRUE if the plugin declared its dependencies, %FALSE otherwise
+ * Since: 46
+ **/
+gboolean
+gs_plugin_get_refine_dependencies (GsPlugin            *plugin,
+                                   GsPluginRefineFlags *reads,
+                                   GsPluginRefineFlags *writes)
+{
+	GsPluginPrivate *priv = gs_plugin_get_instance_private (plugin);
+
+	g_return_val_if_fail (GS_IS_PLUGIN (plugin), FALSE);
+
+	if (reads != NULL)
+		*reads = priv->refine_dependencies_set ? priv->refine_reads : GS_PLUGIN_REFINE_FLAGS_MASK;
+	if (writes != NULL)
+		*writes = priv->refine_dependencies_set ? priv->refine_writes : GS_PLUGIN_REFINE_FLAGS_MASK;
+
+	return priv->refine_dependencies_set;
+}
+
 /**
  * gs_plugin_check_distro_id:
  * @plugin: a #GsPlugin
@@ -1104,6 +1169,7 @@ void
 gs_plugin_reload (GsPlugin *plugin)
 {
 	g_debug ("emitting %s::reload in idle", gs_plugin_get_name (plugin));
+	gs_app_invalidate_all_refined_flags ();
 	g_idle_add_full (G_PRIORITY_DEFAULT_IDLE, gs_plugin_reload_cb,
 			 weak_ref_new (plugin), (GDestroyNotify) weak_ref_free);
 }
@@ -1259,6 +1325,9 @@ gs_plugin_cache_invalidate (GsPlugin *plugin)
 
 	locker = g_mutex_locker_new (&priv->cache_mutex);
 	g_hash_table_remove_all (priv->cache);
+
+	/* apps may need refining again from the new cache entries */
+	gs_app_invalidate_all_refined_flags ();
 }
 
 /**
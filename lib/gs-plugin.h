@@ -265,6 +265,9 @@ const gchar	*gs_plugin_get_language			(GsPlugin	*plugin);
 void		 gs_plugin_add_rule			(GsPlugin	*plugin,
 							 GsPluginRule	 rule,
 							 const gchar	*name);
+void		 gs_plugin_set_refine_dependencies	(GsPlugin	*plugin,
+							 GsPluginRefineFlags reads,
+							 GsPluginRefineFlags writes);
 
 /* helpers */
 gboolean	 gs_plugin_check_distro_id		(GsPlugin	*plugin,
@@ -20,6 +20,12 @@
  * Constructing a #GsRemoteIcon does not guarantee that the icon is cached. Call
  * gs_remote_icon_ensure_cached() for that.
  *
+ * Icons are cached exactly as they were downloaded, without being decoded and
+ * re-encoded, so the cached copy may be larger than it’s ever displayed at.
+ * gs_remote_icon_dup_icon_for_size() returns a scaled copy of it, which is
+ * created when it’s first needed. The cache is limited in size, and the least
+ * recently used icons are removed from it when it gets too big.
+ *
  * #GsRemoteIcon is immutable after construction and hence is entirely thread
  * safe.
  *
@@ -34,12 +40,14 @@
 #include <glib.h>
 #include <glib-object.h>
 #include <glib/gstdio.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <libsoup/soup.h>
 
 #include "gs-remote-icon.h"
+#include "gs-remote-icon-private.h"
 #include "gs-utils.h"
 
 /* FIXME: Work around the fact that GFileIcon is not derivable, by deriving from
@@ -163,12 +171,6 @@ gs_remote_icon_get_cache_filename (const gchar  *uri,
 						      uri,
 						      -1);
 	uri_basename = g_path_get_basename (uri);
-
-	/* convert filename from jpg to png, as we always convert to PNG on
-	 * download */
-	if (g_str_has_suffix (uri_basename, ".jpg"))
-		memcpy (uri_basename + strlen (uri_basename) - 4, ".png", 4);
-
 	cache_basename = g_strdup_printf ("%s-%s", uri_checksum, uri_basename);
 
 	flags = GS_UTILS_CACHE_FLAG_WRITEABLE;
@@ -236,19 +238,264 @@ gs_remote_icon_get_uri (GsRemoteIcon *self)
 	return self->uri;
 }
 
-static GdkPixbuf *
+/* The cache holds these files for each icon, all starting with the SHA-1
+ * checksum of its URI:
+ *  - `<checksum>-<basename>`: the icon, exactly as it was downloaded. This is
+ *    the #GFileIcon:file of the #GsRemoteIcon.
+ *  - `<checksum>.size`: the dimensions of the icon, so they can be looked up
+ *    without opening it. Its modification time is when the icon was last
+ *    used, for evicting icons from the cache.
+ *  - `<checksum>.<size>px.png`: a copy of the icon scaled to fit in a square
+ *    of `size` device pixels, created when the icon is cached if it’s bigger
+ *    than the maximum size it can be used at.
+ */
+#define CHECKSUM_LENGTH 40  /* SHA-1, in hex */
+
+/* Icons older than this are downloaded again. */
+#define CACHE_MAX_AGE_SECS (60 * 60 * 24 * 30)
+
+/* The last used time of an icon is only updated this often, to avoid writing
+ * to the cache every time it’s looked at. */
+#define CACHE_TOUCH_INTERVAL_SECS (60 * 60 * 24)
+
+/* Once the cache is bigger than this, the least recently used icons are
+ * removed from it. The check is done at most this often. */
+#define CACHE_MAX_SIZE_BYTES (64 * 1024 * 1024)
+#define CACHE_TRIM_INTERVAL_SECS (60 * 60)
+
+/* Build the filename of another file in the cache for the icon cached at
+ * @cache_filename, by replacing its basename with @suffix. */
+static gchar *
+gs_remote_icon_build_cache_filename (const gchar *cache_filename,
+                                     const gchar *suffix)
+{
+	g_autofree gchar *dirname = g_path_get_dirname (cache_filename);
+	g_autofree gchar *basename = g_path_get_basename (cache_filename);
+	g_autofree gchar *new_basename = NULL;
+
+	g_assert (strlen (basename) > CHECKSUM_LENGTH);
+	new_basename = g_strdup_printf ("%.*s%s", CHECKSUM_LENGTH, basename, suffix);
+
+	return g_build_filename (dirname, new_basename, NULL);
+}
+
+static gboolean
+gs_remote_icon_load_size_file (const gchar *size_filename,
+                               guint       *width_out,
+                               guint       *height_out)
+{
+	g_autoptr(GKeyFile) kf = g_key_file_new ();
+	guint64 width, height;
+
+	if (!g_key_file_load_from_file (kf, size_filename, G_KEY_FILE_NONE, NULL))
+		return FALSE;
+
+	width = g_key_file_get_uint64 (kf, "Icon", "Width", NULL);
+	height = g_key_file_get_uint64 (kf, "Icon", "Height", NULL);
+	if (width == 0 || height == 0 || width > G_MAXINT || height > G_MAXINT)
+		return FALSE;
+
+	*width_out = width;
+	*height_out = height;
+
+	return TRUE;
+}
+
+static gboolean
+gs_remote_icon_save_size_file (const gchar  *size_filename,
+                               guint         width,
+                               guint         height,
+                               GError      **error)
+{
+	g_autoptr(GKeyFile) kf = g_key_file_new ();
+
+	g_key_file_set_uint64 (kf, "Icon", "Width", width);
+	g_key_file_set_uint64 (kf, "Icon", "Height", height);
+
+	return g_key_file_save_to_file (kf, size_filename, error);
+}
+
+static void
+gs_remote_icon_set_size (GsRemoteIcon *self,
+                         guint         width,
+                         guint         height)
+{
+	g_object_set_data (G_OBJECT (self), "width", GUINT_TO_POINTER (width));
+	g_object_set_data (G_OBJECT (self), "height", GUINT_TO_POINTER (height));
+}
+
+/* If the icon cached at @cache_filename is bigger than @size_px square, ensure
+ * there’s an up to date copy of it scaled down to @size_px, so it never has to
+ * be scaled when it’s used. This is done when caching the icon, rather than in
+ * gs_remote_icon_dup_icon_for_size(), as that may be called from the UI
+ * thread. */
+static void
+gs_remote_icon_ensure_scaled (GsRemoteIcon *self,
+                              const gchar  *cache_filename,
+                              guint         size_px)
+{
+	g_autofree gchar *suffix = NULL;
+	g_autofree gchar *scaled_filename = NULL;
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	g_autofree gchar *buffer = NULL;
+	gsize buffer_len = 0;
+	GStatBuf stat_buf, scaled_stat_buf;
+	guint width, height;
+	g_autoptr(GError) local_error = NULL;
+
+	width = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (self), "width"));
+	height = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (self), "height"));
+
+	/* Already small enough */
+	if (width <= size_px && height <= size_px)
+		return;
+
+	suffix = g_strdup_printf (".%upx.png", size_px);
+	scaled_filename = gs_remote_icon_build_cache_filename (cache_filename, suffix);
+
+	/* Create the scaled copy if it doesn’t exist, or is older than the
+	 * icon it’s a copy of. */
+	if (g_stat (cache_filename, &stat_buf) != 0)
+		return;
+
+	if (g_stat (scaled_filename, &scaled_stat_buf) != 0 ||
+	    scaled_stat_buf.st_mtim.tv_sec < stat_buf.st_mtim.tv_sec) {
+		pixbuf = gdk_pixbuf_new_from_file_at_size (cache_filename, size_px, size_px, &local_error);
+		if (pixbuf == NULL ||
+		    !gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &buffer_len, "png", &local_error, NULL) ||
+		    !g_file_set_contents (scaled_filename, buffer, buffer_len, &local_error)) {
+			g_debug ("Failed to scale icon %s to %upx: %s",
+				 gs_remote_icon_get_uri (self), size_px, local_error->message);
+			return;
+		}
+	}
+
+	g_object_set_data (G_OBJECT (self), "scaled-size", GUINT_TO_POINTER (size_px));
+}
+
+/* Returns %TRUE if @cache_filename is a cached copy of the icon which is
+ * recent enough to use, and marks it as used. */
+static gboolean
+gs_remote_icon_check_cache (GsRemoteIcon *self,
+                            const gchar  *cache_filename,
+                            guint         maximum_icon_size)
+{
+	GStatBuf stat_buf;
+	g_autofree gchar *size_filename = NULL;
+	gint64 now_secs = g_get_real_time () / G_USEC_PER_SEC;
+	guint width = 0, height = 0;
+
+	/* Already in cache and not older than 30 days */
+	if (g_stat (cache_filename, &stat_buf) == -1 ||
+	    !S_ISREG (stat_buf.st_mode) ||
+	    now_secs - stat_buf.st_mtim.tv_sec >= CACHE_MAX_AGE_SECS)
+		return FALSE;
+
+	size_filename = gs_remote_icon_build_cache_filename (cache_filename, ".size");
+
+	/* Icons cached by older versions have no size file, so add one. */
+	if (!gs_remote_icon_load_size_file (size_filename, &width, &height)) {
+		gint file_width = 0, file_height = 0;
+
+		if (gdk_pixbuf_get_file_info (cache_filename, &file_width, &file_height) == NULL)
+			return FALSE;
+
+		width = file_width;
+		height = file_height;
+		gs_remote_icon_save_size_file (size_filename, width, height, NULL);
+	} else if (g_stat (size_filename, &stat_buf) == 0 &&
+		   now_secs - stat_buf.st_mtim.tv_sec >= CACHE_TOUCH_INTERVAL_SECS) {
+		g_utime (size_filename, NULL);
+	}
+
+	/* Ensure the downloaded image dimensions are stored on the icon */
+	if (!g_object_get_data (G_OBJECT (self), "width"))
+		gs_remote_icon_set_size (self, width, height);
+
+	gs_remote_icon_ensure_scaled (self, cache_filename, maximum_icon_size);
+
+	return TRUE;
+}
+
+static gboolean
+gs_remote_icon_trim_cache_if_needed (const gchar  *cache_filename,
+                                     GError      **error)
+{
+	static gint64 last_trim_secs = 0;
+	G_LOCK_DEFINE_STATIC (last_trim_secs);
+	gint64 now_secs = g_get_real_time () / G_USEC_PER_SEC;
+	g_autofree gchar *cache_dir = NULL;
+
+	G_LOCK (last_trim_secs);
+	if (last_trim_secs != 0 && now_secs - last_trim_secs < CACHE_TRIM_INTERVAL_SECS) {
+		G_UNLOCK (last_trim_secs);
+		return TRUE;
+	}
+	last_trim_secs = now_secs;
+	G_UNLOCK (last_trim_secs);
+
+	cache_dir = g_path_get_dirname (cache_filename);
+
+	return gs_remote_icon_trim_cache (cache_dir, CACHE_MAX_SIZE_BYTES, error);
+}
+
+/* Save the downloaded @bytes of the icon to the cache as they are, and record
+ * their dimensions. The whole image is only decoded if it has to be scaled
+ * down to @maximum_icon_size; otherwise, only enough is read to check it’s an
+ * image and get its size. */
+static gboolean
+gs_remote_icon_save (GsRemoteIcon  *self,
+                     GBytes        *bytes,
+                     const gchar   *cache_filename,
+                     guint          maximum_icon_size,
+                     GError       **error)
+{
+	g_autofree gchar *size_filename = NULL;
+	g_autoptr(GError) local_error = NULL;
+	gint width = 0, height = 0;
+
+	if (!g_file_set_contents (cache_filename,
+				  g_bytes_get_data (bytes, NULL),
+				  g_bytes_get_size (bytes),
+				  error))
+		return FALSE;
+
+	if (gdk_pixbuf_get_file_info (cache_filename, &width, &height) == NULL ||
+	    width <= 0 || height <= 0) {
+		g_unlink (cache_filename);
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_DATA,
+			     "Icon %s is not a supported image",
+			     gs_remote_icon_get_uri (self));
+		return FALSE;
+	}
+
+	size_filename = gs_remote_icon_build_cache_filename (cache_filename, ".size");
+	if (!gs_remote_icon_save_size_file (size_filename, width, height, error))
+		return FALSE;
+
+	/* Ensure the dimensions are set correctly on the icon. */
+	gs_remote_icon_set_size (self, width, height);
+
+	gs_remote_icon_ensure_scaled (self, cache_filename, maximum_icon_size);
+
+	if (!gs_remote_icon_trim_cache_if_needed (cache_filename, &local_error))
+		g_debug ("Failed to trim icon cache: %s", local_error->message);
+
+	return TRUE;
+}
+
+static GBytes *
 gs_icon_download (SoupSession   *session,
                   const gchar   *uri,
-                  const gchar   *destination_path,
-                  guint          max_size,
                   GCancellable  *cancellable,
                   GError       **error)
 {
 	guint status_code;
 	g_autoptr(SoupMessage) msg = NULL;
 	g_autoptr(GInputStream) stream = NULL;
-	g_autoptr(GdkPixbuf) pixbuf = NULL;
-	g_autoptr(GdkPixbuf) scaled_pixbuf = NULL;
+	g_autoptr(GOutputStream) output_stream = NULL;
 
 	/* Create the request */
 	msg = soup_message_new (SOUP_METHOD_GET, uri);
@@ -279,26 +526,14 @@ gs_icon_download (SoupSession   *session,
 		return NULL;
 	}
 
-	/* Typically these icons are 64x64px PNG files. If not, resize down
-	 * so it’s at most @max_size square, to minimise the size of the on-disk
-	 * cache.*/
-	pixbuf = gdk_pixbuf_new_from_stream (stream, cancellable, error);
-	if (pixbuf == NULL)
-		return NULL;
-
-	if ((guint) gdk_pixbuf_get_height (pixbuf) <= max_size &&
-	    (guint) gdk_pixbuf_get_width (pixbuf) <= max_size) {
-		scaled_pixbuf = g_object_ref (pixbuf);
-	} else {
-		scaled_pixbuf = gdk_pixbuf_scale_simple (pixbuf, max_size, max_size,
-							 GDK_INTERP_BILINEAR);
-	}
-
-	/* write file */
-	if (!gdk_pixbuf_save (scaled_pixbuf, destination_path, "png", error, NULL))
+	output_stream = g_memory_output_stream_new_resizable ();
+	if (g_output_stream_splice (output_stream, stream,
+				    G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+				    G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+				    cancellable, error) < 0)
 		return NULL;
 
-	return g_steal_pointer (&scaled_pixbuf);
+	return g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (output_stream));
 }
 
 /**
@@ -316,7 +551,9 @@ gs_icon_download (SoupSession   *session,
  * which should be saved to the cache. This is the maximum size that the icon
  * can ever be used at, as icons can be downscaled but never upscaled. Typically
  * this will be 160px multiplied by the device scale
- * (`gtk_widget_get_scale_factor()`).
+ * (`gtk_widget_get_scale_factor()`). Since 46, icons are cached as they were
+ * downloaded, along with a copy scaled down to @maximum_icon_size if they are
+ * bigger than that; see gs_remote_icon_dup_icon_for_size().
  *
  * This can be called from any thread, as #GsRemoteIcon is immutable and hence
  * thread-safe.
@@ -333,8 +570,7 @@ gs_remote_icon_ensure_cached (GsRemoteIcon  *self,
 {
 	const gchar *uri;
 	g_autofree gchar *cache_filename = NULL;
-	g_autoptr(GdkPixbuf) cached_pixbuf = NULL;
-	GStatBuf stat_buf;
+	g_autoptr(GBytes) bytes = NULL;
 
 	g_return_val_if_fail (GS_IS_REMOTE_ICON (self), FALSE);
 	g_return_val_if_fail (SOUP_IS_SESSION (soup_session), FALSE);
@@ -349,27 +585,425 @@ gs_remote_icon_ensure_cached (GsRemoteIcon  *self,
 	if (cache_filename == NULL)
 		return FALSE;
 
-	/* Already in cache and not older than 30 days */
-	if (g_stat (cache_filename, &stat_buf) != -1 &&
-	    S_ISREG (stat_buf.st_mode) &&
-	    (g_get_real_time () / G_USEC_PER_SEC) - stat_buf.st_mtim.tv_sec < (60 * 60 * 24 * 30)) {
-		gint width = 0, height = 0;
-		/* Ensure the downloaded image dimensions are stored on the icon */
-		if (!g_object_get_data (G_OBJECT (self), "width") &&
-		    gdk_pixbuf_get_file_info (cache_filename, &width, &height)) {
-			g_object_set_data (G_OBJECT (self), "width", GINT_TO_POINTER (width));
-			g_object_set_data (G_OBJECT (self), "height", GINT_TO_POINTER (height));
-		}
+	if (gs_remote_icon_check_cache (self, cache_filename, maximum_icon_size))
 		return TRUE;
+
+	bytes = gs_icon_download (soup_session, uri, cancellable, error);
+	if (bytes == NULL)
+		return FALSE;
+
+	return gs_remote_icon_save (self, bytes, cache_filename, maximum_icon_size, error);
+}
+
+typedef struct {
+	gchar *cache_filename;  /* (owned) (not nullable) */
+	guint maximum_icon_size;
+	gint io_priority;
+	SoupMessage *message;  /* (owned) (nullable) */
+	GOutputStream *output_stream;  /* (owned) (nullable) */
+} EnsureCachedData;
+
+static void
+ensure_cached_data_free (EnsureCachedData *data)
+{
+	g_free (data->cache_filename);
+	g_clear_object (&data->message);
+	g_clear_object (&data->output_stream);
+	g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EnsureCachedData, ensure_cached_data_free)
+
+static void ensure_cached_send_cb (GObject      *source_object,
+                                   GAsyncResult *result,
+                                   gpointer      user_data);
+static void ensure_cached_splice_cb (GObject      *source_object,
+                                     GAsyncResult *result,
+                                     gpointer      user_data);
+
+/**
+ * gs_remote_icon_ensure_cached_async:
+ * @self: a #GsRemoteIcon
+ * @soup_session: a #SoupSession to use to download the icon
+ * @maximum_icon_size: maximum size (in device pixels) of the icon to save
+ * @io_priority: I/O priority of the request, typically %G_PRIORITY_DEFAULT
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback for once the asynchronous operation is complete
+ * @user_data: data to pass to @callback
+ *
+ * Asynchronous version of gs_remote_icon_ensure_cached().
+ *
+ * The download of the icon is done asynchronously, in the thread-default
+ * main context of the caller, so several icons can be downloaded at once
+ * from one thread. Checking the cache and saving the downloaded icon to it,
+ * including scaling it down if needed, are still done synchronously in that
+ * thread, so this should not be called from the UI thread.
+ *
+ * Since: 46
+ */
+void
+gs_remote_icon_ensure_cached_async (GsRemoteIcon        *self,
+                                    SoupSession         *soup_session,
+                                    guint                maximum_icon_size,
+                                    gint                 io_priority,
+                                    GCancellable        *cancellable,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data)
+{
+	const gchar *uri;
+	g_autoptr(GTask) task = NULL;
+	g_autoptr(EnsureCachedData) data_owned = NULL;
+	EnsureCachedData *data;
+	g_autoptr(GError) local_error = NULL;
+
+	g_return_if_fail (GS_IS_REMOTE_ICON (self));
+	g_return_if_fail (SOUP_IS_SESSION (soup_session));
+	g_return_if_fail (maximum_icon_size > 0);
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+	task = g_task_new (self, cancellable, callback, user_data);
+	g_task_set_source_tag (task, gs_remote_icon_ensure_cached_async);
+
+	uri = gs_remote_icon_get_uri (self);
+
+	data = data_owned = g_new0 (EnsureCachedData, 1);
+	data->maximum_icon_size = maximum_icon_size;
+	data->io_priority = io_priority;
+	data->cache_filename = gs_remote_icon_get_cache_filename (uri, TRUE, &local_error);
+	if (data->cache_filename == NULL) {
+		g_task_return_error (task, g_steal_pointer (&local_error));
+		return;
+	}
+
+	if (gs_remote_icon_check_cache (self, data->cache_filename, maximum_icon_size)) {
+		g_task_return_boolean (task, TRUE);
+		return;
+	}
+
+	/* Create the request */
+	data->message = soup_message_new (SOUP_METHOD_GET, uri);
+	if (data->message == NULL) {
+		g_task_return_new_error (task,
+					 G_IO_ERROR,
+					 G_IO_ERROR_INVALID_DATA,
+					 "Icon has an invalid URL");
+		return;
+	}
+
+	g_task_set_task_data (task, g_steal_pointer (&data_owned), (GDestroyNotify) ensure_cached_data_free);
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+	soup_session_send_async (soup_session, data->message, io_priority, cancellable,
+				 ensure_cached_send_cb, g_steal_pointer (&task));
+#else
+	soup_session_send_async (soup_session, data->message, cancellable,
+				 ensure_cached_send_cb, g_steal_pointer (&task));
+#endif
+}
+
+static void
+ensure_cached_send_cb (GObject      *source_object,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+	SoupSession *soup_session = SOUP_SESSION (source_object);
+	g_autoptr(GTask) task = g_steal_pointer (&user_data);
+	GsRemoteIcon *self = g_task_get_source_object (task);
+	EnsureCachedData *data = g_task_get_task_data (task);
+	g_autoptr(GInputStream) stream = NULL;
+	guint status_code;
+	g_autoptr(GError) local_error = NULL;
+
+	stream = soup_session_send_finish (soup_session, result, &local_error);
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+	status_code = soup_message_get_status (data->message);
+#else
+	status_code = data->message->status_code;
+#endif
+	if (stream == NULL) {
+		g_task_return_error (task, g_steal_pointer (&local_error));
+		return;
+	} else if (status_code != SOUP_STATUS_OK) {
+		g_task_return_new_error (task,
+					 G_IO_ERROR,
+					 G_IO_ERROR_FAILED,
+					 "Failed to download icon %s: %s",
+					 gs_remote_icon_get_uri (self),
+					 soup_status_get_phrase (status_code));
+		return;
+	}
+
+	data->output_stream = g_memory_output_stream_new_resizable ();
+	g_output_stream_splice_async (data->output_stream, stream,
+				      G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+				      G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+				      data->io_priority, g_task_get_cancellable (task),
+				      ensure_cached_splice_cb, g_steal_pointer (&task));
+}
+
+static void
+ensure_cached_splice_cb (GObject      *source_object,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+	GOutputStream *output_stream = G_OUTPUT_STREAM (source_object);
+	g_autoptr(GTask) task = g_steal_pointer (&user_data);
+	GsRemoteIcon *self = g_task_get_source_object (task);
+	EnsureCachedData *data = g_task_get_task_data (task);
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GError) local_error = NULL;
+
+	if (g_output_stream_splice_finish (output_stream, result, &local_error) < 0) {
+		g_task_return_error (task, g_steal_pointer (&local_error));
+		return;
 	}
 
-	cached_pixbuf = gs_icon_download (soup_session, uri, cache_filename, maximum_icon_size, cancellable, error);
-	if (cached_pixbuf == NULL)
+	bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (output_stream));
+
+	if (!gs_remote_icon_save (self, bytes, data->cache_filename, data->maximum_icon_size, &local_error))
+		g_task_return_error (task, g_steal_pointer (&local_error));
+	else
+		g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * gs_remote_icon_ensure_cached_finish:
+ * @self: a #GsRemoteIcon
+ * @result: a #GAsyncResult
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish an asynchronous operation started with
+ * gs_remote_icon_ensure_cached_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 46
+ */
+gboolean
+gs_remote_icon_ensure_cached_finish (GsRemoteIcon  *self,
+                                     GAsyncResult  *result,
+                                     GError       **error)
+{
+	g_return_val_if_fail (GS_IS_REMOTE_ICON (self), FALSE);
+	g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+	g_return_val_if_fail (g_async_result_is_tagged (result, gs_remote_icon_ensure_cached_async), FALSE);
+	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/**
+ * gs_remote_icon_dup_icon_for_size:
+ * @self: a #GsRemoteIcon
+ * @size: size of the icon to load, in logical pixels
+ * @scale: scale of the icon to load, typically from
+ *   gtk_widget_get_scale_factor()
+ *
+ * Get an icon to load for @self at @size×@scale.
+ *
+ * The icon is cached as it was downloaded, which may be a lot larger than
+ * @size×@scale. If so, and gs_remote_icon_ensure_cached() created a copy of it
+ * scaled down to a size which is still big enough, that copy is returned.
+ * Otherwise, @self is returned.
+ *
+ * This does no disk or network I/O, and never scales an image, so it’s safe to
+ * call from the UI thread. The icon must have been cached using
+ * gs_remote_icon_ensure_cached() first.
+ *
+ * Returns: (transfer full): an icon to load for @self at @size×@scale
+ * Since: 46
+ */
+GIcon *
+gs_remote_icon_dup_icon_for_size (GsRemoteIcon *self,
+                                  guint         size,
+                                  guint         scale)
+{
+	GFile *file;
+	g_autofree gchar *cache_filename = NULL;
+	g_autofree gchar *suffix = NULL;
+	g_autofree gchar *scaled_filename = NULL;
+	g_autoptr(GFile) scaled_file = NULL;
+	GIcon *scaled_icon;
+	guint width, height, size_px, scaled_size_px;
+
+	g_return_val_if_fail (GS_IS_REMOTE_ICON (self), NULL);
+	g_return_val_if_fail (size > 0, NULL);
+	g_return_val_if_fail (scale >= 1, NULL);
+
+	width = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (self), "width"));
+	height = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (self), "height"));
+	scaled_size_px = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (self), "scaled-size"));
+	size_px = size * scale;
+
+	/* Not cached yet, already small enough, or the scaled copy is too
+	 * small to be used at this size */
+	if (width == 0 || height == 0 ||
+	    (width <= size_px && height <= size_px) ||
+	    scaled_size_px < size_px)
+		return G_ICON (g_object_ref (self));
+
+	file = g_file_icon_get_file (G_FILE_ICON (self));
+	cache_filename = g_file_get_path (file);
+	if (cache_filename == NULL)
+		return G_ICON (g_object_ref (self));
+
+	suffix = g_strdup_printf (".%upx.png", scaled_size_px);
+	scaled_filename = gs_remote_icon_build_cache_filename (cache_filename, suffix);
+
+	/* Same aspect ratio as gdk_pixbuf_new_from_file_at_size() */
+	if (width >= height) {
+		height = MAX (1, (guint) ((guint64) height * scaled_size_px / width));
+		width = scaled_size_px;
+	} else {
+		width = MAX (1, (guint) ((guint64) width * scaled_size_px / height));
+		height = scaled_size_px;
+	}
+
+	scaled_file = g_file_new_for_path (scaled_filename);
+	scaled_icon = g_file_icon_new (scaled_file);
+	g_object_set_data (G_OBJECT (scaled_icon), "width", GUINT_TO_POINTER (width));
+	g_object_set_data (G_OBJECT (scaled_icon), "height", GUINT_TO_POINTER (height));
+
+	return scaled_icon;
+}
+
+typedef struct {
+	GPtrArray *filenames;  /* (owned) (element-type filename) */
+	guint64 size;
+	gint64 last_used_secs;
+} CacheEntry;
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+	g_ptr_array_unref (entry->filenames);
+	g_free (entry);
+}
+
+static gint
+cache_entry_compare_last_used (gconstpointer a,
+                               gconstpointer b)
+{
+	const CacheEntry *entry_a = *((const CacheEntry **) a);
+	const CacheEntry *entry_b = *((const CacheEntry **) b);
+
+	if (entry_a->last_used_secs < entry_b->last_used_secs)
+		return -1;
+	else if (entry_a->last_used_secs > entry_b->last_used_secs)
+		return 1;
+	return 0;
+}
+
+/* Returns %TRUE if @name looks like one of the files stored for an icon. */
+static gboolean
+is_cache_filename (const gchar *name)
+{
+	for (gsize i = 0; i < CHECKSUM_LENGTH; i++) {
+		if (!g_ascii_isxdigit (name[i]))
+			return FALSE;
+	}
+
+	return (name[CHECKSUM_LENGTH] == '-' || name[CHECKSUM_LENGTH] == '.');
+}
+
+/**
+ * gs_remote_icon_trim_cache:
+ * @cache_dir: the directory icons are cached in
+ * @max_size: the maximum total size of the cached icons, in bytes
+ * @error: return location for a #GError, or %NULL
+ *
+ * Remove the least recently used icons from @cache_dir, along with their
+ * scaled copies, until the total size of the files for the remaining icons is
+ * at most @max_size. Files in @cache_dir which aren’t for a cached icon are
+ * left alone.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 46
+ */
+gboolean
+gs_remote_icon_trim_cache (const gchar  *cache_dir,
+                           guint64       max_size,
+                           GError      **error)
+{
+	g_autoptr(GDir) dir = NULL;
+	g_autoptr(GHashTable) entries = NULL;  /* (element-type utf8 CacheEntry) */
+	g_autoptr(GPtrArray) sorted = NULL;  /* (element-type CacheEntry) (unowned) */
+	GHashTableIter iter;
+	gpointer value;
+	g_autoptr(GError) local_error = NULL;
+	const gchar *name;
+	guint64 total_size = 0;
+
+	dir = g_dir_open (cache_dir, 0, &local_error);
+	if (dir == NULL) {
+		if (g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			return TRUE;
+		g_propagate_error (error, g_steal_pointer (&local_error));
 		return FALSE;
+	}
 
-	/* Ensure the dimensions are set correctly on the icon. */
-	g_object_set_data (G_OBJECT (self), "width", GUINT_TO_POINTER (gdk_pixbuf_get_width (cached_pixbuf)));
-	g_object_set_data (G_OBJECT (self), "height", GUINT_TO_POINTER (gdk_pixbuf_get_height (cached_pixbuf)));
+	/* Group the files by icon. */
+	entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) cache_entry_free);
+
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		g_autofree gchar *filename = NULL;
+		g_autofree gchar *checksum = NULL;
+		CacheEntry *entry;
+		GStatBuf stat_buf;
+
+		if (!is_cache_filename (name))
+			continue;
+
+		filename = g_build_filename (cache_dir, name, NULL);
+		if (g_lstat (filename, &stat_buf) != 0 || !S_ISREG (stat_buf.st_mode))
+			continue;
+
+		checksum = g_strndup (name, CHECKSUM_LENGTH);
+		entry = g_hash_table_lookup (entries, checksum);
+		if (entry == NULL) {
+			entry = g_new0 (CacheEntry, 1);
+			entry->filenames = g_ptr_array_new_with_free_func (g_free);
+			g_hash_table_insert (entries, g_steal_pointer (&checksum), entry);
+		}
+
+		g_ptr_array_add (entry->filenames, g_steal_pointer (&filename));
+		entry->size += stat_buf.st_size;
+		entry->last_used_secs = MAX (entry->last_used_secs, stat_buf.st_mtim.tv_sec);
+		total_size += stat_buf.st_size;
+	}
+
+	if (total_size <= max_size)
+		return TRUE;
+
+	/* Remove the least recently used icons first. */
+	sorted = g_ptr_array_sized_new (g_hash_table_size (entries));
+	g_hash_table_iter_init (&iter, entries);
+	while (g_hash_table_iter_next (&iter, NULL, &value))
+		g_ptr_array_add (sorted, value);
+	g_ptr_array_sort (sorted, cache_entry_compare_last_used);
+
+	for (guint i = 0; i < sorted->len && total_size > max_size; i++) {
+		CacheEntry *entry = g_ptr_array_index (sorted, i);
+
+		for (guint j = 0; j < entry->filenames->len; j++) {
+			const gchar *filename = g_ptr_array_index (entry->filenames, j);
+
+			if (g_unlink (filename) != 0 && errno != ENOENT) {
+				gint saved_errno = errno;
+				g_set_error (error,
+					     G_IO_ERROR,
+					     g_io_error_from_errno (saved_errno),
+					     "Failed to remove cached icon %s: %s",
+					     filename, g_strerror (saved_errno));
+				return FALSE;
+			}
+		}
+
+		total_size -= entry->size;
+	}
+
+	g_debug ("Trimmed icon cache %s to %" G_GUINT64_FORMAT " bytes",
+		 cache_dir, total_size);
 
 	return TRUE;
 }
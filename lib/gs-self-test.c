@@ -9,9 +9,16 @@
 
 #include "config.h"
 
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+#include <unistd.h>
+#include <utime.h>
+
 #include "gnome-software-private.h"
 
 #include "gs-debug.h"
+#include "gs-key-colors-private.h"
+#include "gs-remote-icon-private.h"
 #include "gs-test.h"
 
 static gboolean
@@ -131,6 +138,62 @@ gs_utils_cache_func (void)
 	g_assert (g_str_has_suffix (fn2, "test/295099f59d12b3eb0b955325fcb699cd23792a89-baz"));
 }
 
+static gboolean
+gs_utils_file_size_include_cb (const gchar *filename,
+			       GFileTest    file_kind,
+			       gpointer     user_data)
+{
+	return file_kind != G_FILE_TEST_IS_SYMLINK &&
+	       g_strcmp0 (filename, "sub2") != 0;
+}
+
+static void
+gs_utils_file_size_func (void)
+{
+	g_autofree gchar *tmp_dir = NULL;
+	g_autofree gchar *fn = NULL;
+	g_autoptr(GError) error = NULL;
+	const struct {
+		const gchar *path;
+		gsize len;
+	} files[] = {
+		{ "a", 10 },
+		{ "sub1/b", 20 },
+		{ "sub2/c", 30 },
+		{ "sub2/deep/d", 40 },
+	};
+
+	tmp_dir = g_dir_make_tmp ("gs-self-test-file-size-XXXXXX", &error);
+	g_assert_no_error (error);
+
+	for (gsize i = 0; i < G_N_ELEMENTS (files); i++) {
+		g_autofree gchar *path = g_build_filename (tmp_dir, files[i].path, NULL);
+		g_autofree gchar *dirname = g_path_get_dirname (path);
+		g_autofree gchar *contents = g_strnfill (files[i].len, 'x');
+
+		g_assert_cmpint (g_mkdir_with_parents (dirname, 0700), ==, 0);
+		g_file_set_contents (path, contents, files[i].len, &error);
+		g_assert_no_error (error);
+	}
+
+	/* linked directories are skipped, linked files count their target */
+	fn = g_build_filename (tmp_dir, "link-dir", NULL);
+	g_assert_cmpint (symlink ("sub1", fn), ==, 0);
+	g_free (fn);
+	fn = g_build_filename (tmp_dir, "link-file", NULL);
+	g_assert_cmpint (symlink ("a", fn), ==, 0);
+
+	g_assert_cmpuint (gs_utils_get_file_size (fn, NULL, NULL, NULL), ==, 10);
+	g_assert_cmpuint (gs_utils_get_file_size (tmp_dir, NULL, NULL, NULL), ==, 110);
+	g_assert_cmpuint (gs_utils_get_file_size (tmp_dir, gs_utils_file_size_include_cb, NULL, NULL), ==, 30);
+
+	g_free (fn);
+	fn = g_build_filename (tmp_dir, "missing", NULL);
+	g_assert_cmpuint (gs_utils_get_file_size (fn, NULL, NULL, NULL), ==, 0);
+
+	gs_utils_rmtree (tmp_dir, NULL);
+}
+
 static void
 gs_utils_error_func (void)
 {
@@ -211,6 +274,679 @@ gs_plugin_download_rewrite_func (void)
 	g_assert (css != NULL);
 }
 
+/* Stand-in for the ODRS server’s /fetch endpoint, which returns one review
+ * for whichever app ID is requested. */
+static gchar *
+odrs_server_build_reviews (const gchar *request_body,
+                           gsize        request_body_len)
+{
+	g_autoptr(JsonParser) parser = json_parser_new ();
+	g_autoptr(GError) error = NULL;
+	JsonObject *request;
+
+	json_parser_load_from_data (parser, request_body, request_body_len, &error);
+	g_assert_no_error (error);
+	request = json_node_get_object (json_parser_get_root (parser));
+
+	return g_strdup_printf ("[{\"app_id\": \"%s\", \"user_hash\": \"reviewer\", "
+				"\"user_skey\": \"skey\", \"rating\": 80, "
+				"\"summary\": \"Summary\", \"description\": \"Description\"}]",
+				json_object_get_string_member (request, "app_id"));
+}
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+static void
+odrs_server_fetch_cb (SoupServer        *server,
+                      SoupServerMessage *msg,
+                      const char        *path,
+                      GHashTable        *query,
+                      gpointer           user_data)
+{
+	guint *n_fetches = user_data;
+	g_autoptr(GBytes) request_body = soup_message_body_flatten (soup_server_message_get_request_body (msg));
+	g_autofree gchar *response = NULL;
+
+	(*n_fetches)++;
+	response = odrs_server_build_reviews (g_bytes_get_data (request_body, NULL),
+					      g_bytes_get_size (request_body));
+	soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
+	soup_server_message_set_response (msg, "application/json", SOUP_MEMORY_COPY,
+					  response, strlen (response));
+}
+#else
+static void
+odrs_server_fetch_cb (SoupServer        *server,
+                      SoupMessage       *msg,
+                      const char        *path,
+                      GHashTable        *query,
+                      SoupClientContext *client,
+                      gpointer           user_data)
+{
+	guint *n_fetches = user_data;
+	g_autofree gchar *response = NULL;
+
+	(*n_fetches)++;
+	response = odrs_server_build_reviews (msg->request_body->data,
+					      msg->request_body->length);
+	soup_message_set_status (msg, SOUP_STATUS_OK);
+	soup_message_set_response (msg, "application/json", SOUP_MEMORY_COPY,
+				   response, strlen (response));
+}
+#endif
+
+static void
+gs_odrs_provider_fetch_reviews_func (void)
+{
+	g_autoptr(SoupServer) server = NULL;
+	g_autoptr(SoupSession) session = NULL;
+	g_autoptr(GsOdrsProvider) provider = NULL;
+	g_autoptr(GsAppList) list = gs_app_list_new ();
+	g_autoptr(GAsyncResult) result1 = NULL;
+	g_autoptr(GAsyncResult) result2 = NULL;
+	g_autofree gchar *review_server = NULL;
+	GSList *uris;
+	guint port;
+	guint n_fetches = 0;
+	g_autoptr(GError) error = NULL;
+
+	/* serve reviews locally */
+	server = soup_server_new (NULL, NULL);
+	soup_server_add_handler (server, "/fetch", odrs_server_fetch_cb, &n_fetches, NULL);
+	soup_server_listen_local (server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, &error);
+	g_assert_no_error (error);
+
+	uris = soup_server_get_uris (server);
+	g_assert_nonnull (uris);
+#if SOUP_CHECK_VERSION(3, 0, 0)
+	port = g_uri_get_port (uris->data);
+	g_slist_free_full (uris, (GDestroyNotify) g_uri_unref);
+#else
+	port = soup_uri_get_port (uris->data);
+	g_slist_free_full (uris, (GDestroyNotify) soup_uri_free);
+#endif
+	review_server = g_strdup_printf ("http://127.0.0.1:%u", port);
+
+	session = soup_session_new ();
+	provider = gs_odrs_provider_new (review_server, "user-hash", "distro", 3600, 20, session);
+
+	for (guint i = 0; i < 10; i++) {
+		g_autofree gchar *id = g_strdup_printf ("org.example.App%u", i);
+		g_autoptr(GsApp) app = gs_app_new (id);
+		gs_app_list_add (list, app);
+	}
+
+	/* refine the same apps twice at once; each app should only be
+	 * fetched once, and only get its reviews once */
+	gs_odrs_provider_refine_async (provider, list, GS_ODRS_PROVIDER_REFINE_FLAGS_GET_REVIEWS,
+				       NULL, async_result_cb, &result1);
+	gs_odrs_provider_refine_async (provider, list, GS_ODRS_PROVIDER_REFINE_FLAGS_GET_REVIEWS,
+				       NULL, async_result_cb, &result2);
+
+	while (result1 == NULL || result2 == NULL)
+		g_main_context_iteration (NULL, TRUE);
+
+	gs_odrs_provider_refine_finish (provider, result1, &error);
+	g_assert_no_error (error);
+	gs_odrs_provider_refine_finish (provider, result2, &error);
+	g_assert_no_error (error);
+
+	g_assert_cmpuint (n_fetches, ==, gs_app_list_length (list));
+	for (guint i = 0; i < gs_app_list_length (list); i++) {
+		GsApp *app = gs_app_list_index (list, i);
+		GPtrArray *reviews = gs_app_get_reviews (app);
+
+		g_assert_cmpuint (reviews->len, ==, 1);
+		g_assert_cmpstr (as_review_get_summary (g_ptr_array_index (reviews, 0)), ==, "Summary");
+	}
+}
+
+typedef struct {
+	GBytes *png;  /* (owned) */
+	guint n_requests;
+} IconServer;
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+static void
+icon_server_cb (SoupServer        *server,
+                SoupServerMessage *msg,
+                const char        *path,
+                GHashTable        *query,
+                gpointer           user_data)
+{
+	IconServer *icon_server = user_data;
+
+	icon_server->n_requests++;
+	soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
+	soup_server_message_set_response (msg, "image/png", SOUP_MEMORY_COPY,
+					  g_bytes_get_data (icon_server->png, NULL),
+					  g_bytes_get_size (icon_server->png));
+}
+#else
+static void
+icon_server_cb (SoupServer        *server,
+                SoupMessage       *msg,
+                const char        *path,
+                GHashTable        *query,
+                SoupClientContext *client,
+                gpointer           user_data)
+{
+	IconServer *icon_server = user_data;
+
+	icon_server->n_requests++;
+	soup_message_set_status (msg, SOUP_STATUS_OK);
+	soup_message_set_response (msg, "image/png", SOUP_MEMORY_COPY,
+				   g_bytes_get_data (icon_server->png, NULL),
+				   g_bytes_get_size (icon_server->png));
+}
+#endif
+
+static void
+gs_icon_downloader_func (void)
+{
+	IconServer icon_server = { NULL, 0 };
+	g_autoptr(SoupServer) server = NULL;
+	g_autoptr(SoupSession) session = NULL;
+	g_autoptr(GsIconDownloader) downloader = NULL;
+	g_autoptr(GsAppList) list = gs_app_list_new ();
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	g_autoptr(GAsyncResult) result = NULL;
+	g_autoptr(GTimer) timer = NULL;
+	g_autofree gchar *buffer = NULL;
+	gsize buffer_len = 0;
+	gint64 now = g_get_real_time ();
+	GSList *uris;
+	guint port;
+	gboolean downloading;
+	g_autoptr(GError) error = NULL;
+
+	/* serve the same small icon for every path */
+	pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, 4, 4);
+	gdk_pixbuf_fill (pixbuf, 0xff0000ff);
+	gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &buffer_len, "png", &error, NULL);
+	g_assert_no_error (error);
+	icon_server.png = g_bytes_new_take (g_steal_pointer (&buffer), buffer_len);
+
+	server = soup_server_new (NULL, NULL);
+	soup_server_add_handler (server, "/icons", icon_server_cb, &icon_server, NULL);
+	soup_server_listen_local (server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, &error);
+	g_assert_no_error (error);
+
+	uris = soup_server_get_uris (server);
+	g_assert_nonnull (uris);
+#if SOUP_CHECK_VERSION(3, 0, 0)
+	port = g_uri_get_port (uris->data);
+	g_slist_free_full (uris, (GDestroyNotify) g_uri_unref);
+#else
+	port = soup_uri_get_port (uris->data);
+	g_slist_free_full (uris, (GDestroyNotify) soup_uri_free);
+#endif
+
+	/* 40 apps sharing 10 icons; the URIs are unique to this run so
+	 * nothing is already in the cache */
+	for (guint i = 0; i < 40; i++) {
+		g_autofree gchar *id = g_strdup_printf ("org.example.App%u", i);
+		g_autofree gchar *uri = g_strdup_printf ("http://127.0.0.1:%u/icons/%" G_GINT64_FORMAT "/icon-%u.png",
+							 port, now, i % 10);
+		g_autoptr(GsApp) app = gs_app_new (id);
+		g_autoptr(GIcon) icon = gs_remote_icon_new (uri);
+
+		gs_app_add_icon (app, icon);
+		gs_app_list_add (list, app);
+	}
+
+	session = soup_session_new ();
+	downloader = gs_icon_downloader_new (session, 64);
+
+	timer = g_timer_new ();
+	for (guint i = 0; i < gs_app_list_length (list); i++)
+		gs_icon_downloader_queue_app (downloader, gs_app_list_index (list, i), FALSE);
+
+	do {
+		g_main_context_iteration (NULL, TRUE);
+
+		downloading = FALSE;
+		for (guint i = 0; i < gs_app_list_length (list); i++) {
+			if (gs_app_get_icons_state (gs_app_list_index (list, i)) != GS_APP_ICONS_STATE_AVAILABLE)
+				downloading = TRUE;
+		}
+	} while (downloading);
+	g_print ("%.2fms ", g_timer_elapsed (timer, NULL) * 1000);
+
+	/* each icon was only downloaded once, and all the apps sharing it
+	 * know its size */
+	g_assert_cmpuint (icon_server.n_requests, ==, 10);
+	for (guint i = 0; i < gs_app_list_length (list); i++) {
+		g_autoptr(GPtrArray) icons = gs_app_dup_icons (gs_app_list_index (list, i));
+		GIcon *icon = g_ptr_array_index (icons, 0);
+
+		g_assert_cmpint (GPOINTER_TO_INT (g_object_get_data (G_OBJECT (icon), "width")), ==, 4);
+		g_assert_true (g_file_query_exists (g_file_icon_get_file (G_FILE_ICON (icon)), NULL));
+	}
+
+	gs_icon_downloader_shutdown_async (downloader, NULL, async_result_cb, &result);
+	while (result == NULL)
+		g_main_context_iteration (NULL, TRUE);
+	gs_icon_downloader_shutdown_finish (downloader, result, &error);
+	g_assert_no_error (error);
+
+	g_bytes_unref (icon_server.png);
+}
+
+static void
+gs_remote_icon_cache_func (void)
+{
+	IconServer icon_server = { NULL, 0 };
+	g_autoptr(SoupServer) server = NULL;
+	g_autoptr(SoupSession) session = NULL;
+	g_autoptr(GIcon) icon = NULL;
+	g_autoptr(GIcon) scaled_icon = NULL;
+	g_autoptr(GIcon) scaled_icon2 = NULL;
+	g_autoptr(GIcon) unscaled_icon = NULL;
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	g_autoptr(GAsyncResult) result = NULL;
+	g_autofree gchar *buffer = NULL;
+	g_autofree gchar *uri = NULL;
+	g_autofree gchar *cache_filename = NULL;
+	g_autofree gchar *scaled_filename = NULL;
+	g_autofree gchar *size_filename = NULL;
+	g_autofree gchar *cached_data = NULL;
+	gsize buffer_len = 0, cached_len = 0;
+	GSList *uris;
+	guint port;
+	g_autoptr(GError) error = NULL;
+
+	/* serve an icon which is bigger than it’s used at */
+	pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, 256, 128);
+	gdk_pixbuf_fill (pixbuf, 0x00ff00ff);
+	gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &buffer_len, "png", &error, NULL);
+	g_assert_no_error (error);
+	icon_server.png = g_bytes_new (buffer, buffer_len);
+
+	server = soup_server_new (NULL, NULL);
+	soup_server_add_handler (server, "/icons", icon_server_cb, &icon_server, NULL);
+	soup_server_listen_local (server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, &error);
+	g_assert_no_error (error);
+
+	uris = soup_server_get_uris (server);
+	g_assert_nonnull (uris);
+#if SOUP_CHECK_VERSION(3, 0, 0)
+	port = g_uri_get_port (uris->data);
+	g_slist_free_full (uris, (GDestroyNotify) g_uri_unref);
+#else
+	port = soup_uri_get_port (uris->data);
+	g_slist_free_full (uris, (GDestroyNotify) soup_uri_free);
+#endif
+
+	uri = g_strdup_printf ("http://127.0.0.1:%u/icons/%" G_GINT64_FORMAT "/large.png",
+			       port, g_get_real_time ());
+	icon = gs_remote_icon_new (uri);
+	session = soup_session_new ();
+
+	gs_remote_icon_ensure_cached_async (GS_REMOTE_ICON (icon), session, 64, G_PRIORITY_DEFAULT,
+					    NULL, async_result_cb, &result);
+	while (result == NULL)
+		g_main_context_iteration (NULL, TRUE);
+	gs_remote_icon_ensure_cached_finish (GS_REMOTE_ICON (icon), result, &error);
+	g_assert_no_error (error);
+
+	/* the icon is cached byte-for-byte, at its full size */
+	cache_filename = g_file_get_path (g_file_icon_get_file (G_FILE_ICON (icon)));
+	g_file_get_contents (cache_filename, &cached_data, &cached_len, &error);
+	g_assert_no_error (error);
+	g_assert_cmpmem (cached_data, cached_len, buffer, buffer_len);
+	g_assert_cmpuint (gs_icon_get_width (icon), ==, 256);
+	g_assert_cmpuint (gs_icon_get_height (icon), ==, 128);
+
+	/* a copy scaled to the maximum size is created when it’s cached, and
+	 * used for any size it’s big enough for */
+	scaled_icon = gs_remote_icon_dup_icon_for_size (GS_REMOTE_ICON (icon), 32, 2);
+	g_assert_true (G_IS_FILE_ICON (scaled_icon));
+	g_assert_false (GS_IS_REMOTE_ICON (scaled_icon));
+	g_assert_cmpuint (gs_icon_get_width (scaled_icon), ==, 64);
+	g_assert_cmpuint (gs_icon_get_height (scaled_icon), ==, 32);
+	scaled_filename = g_file_get_path (g_file_icon_get_file (G_FILE_ICON (scaled_icon)));
+	g_assert_true (g_str_has_suffix (scaled_filename, ".64px.png"));
+	g_assert_true (g_file_test (scaled_filename, G_FILE_TEST_IS_REGULAR));
+
+	scaled_icon2 = gs_remote_icon_dup_icon_for_size (GS_REMOTE_ICON (icon), 64, 1);
+	g_assert_true (g_icon_equal (scaled_icon, scaled_icon2));
+	g_assert_cmpuint (gs_icon_get_width (scaled_icon2), ==, 64);
+
+	/* no copy is needed at the full size */
+	unscaled_icon = gs_remote_icon_dup_icon_for_size (GS_REMOTE_ICON (icon), 256, 1);
+	g_assert_true (unscaled_icon == icon);
+	g_clear_object (&unscaled_icon);
+
+	/* nor is one scaled when the cached copy is too small */
+	unscaled_icon = gs_remote_icon_dup_icon_for_size (GS_REMOTE_ICON (icon), 64, 2);
+	g_assert_true (unscaled_icon == icon);
+
+	/* the scaled copy and size file are named after the URI checksum */
+	size_filename = g_strdup_printf ("%.*s.size",
+					 (gint) (strlen (scaled_filename) - strlen (".64px.png")),
+					 scaled_filename);
+	g_assert_true (g_file_test (size_filename, G_FILE_TEST_IS_REGULAR));
+
+	g_unlink (scaled_filename);
+	g_unlink (size_filename);
+	g_unlink (cache_filename);
+	g_bytes_unref (icon_server.png);
+}
+
+static void
+gs_remote_icon_trim_cache_func (void)
+{
+	g_autofree gchar *tmp_dir = NULL;
+	const gchar *old_checksum = "0000000000000000000000000000000000000000";
+	const gchar *new_checksum = "ffffffffffffffffffffffffffffffffffffffff";
+	g_autofree gchar *old_icon = NULL;
+	g_autofree gchar *old_scaled = NULL;
+	g_autofree gchar *new_icon = NULL;
+	g_autofree gchar *new_size = NULL;
+	g_autofree gchar *other = NULL;
+	g_autofree gchar *data = g_strnfill (1000, 'x');
+	struct utimbuf old_time = { 1000000, 1000000 };
+	g_autoptr(GError) error = NULL;
+
+	tmp_dir = g_dir_make_tmp ("gs-self-test-remote-icon-XXXXXX", &error);
+	g_assert_no_error (error);
+
+	old_icon = g_strdup_printf ("%s/%s-old.png", tmp_dir, old_checksum);
+	old_scaled = g_strdup_printf ("%s/%s.64px.png", tmp_dir, old_checksum);
+	new_icon = g_strdup_printf ("%s/%s-new.png", tmp_dir, new_checksum);
+	new_size = g_strdup_printf ("%s/%s.size", tmp_dir, new_checksum);
+	other = g_build_filename (tmp_dir, "other-file", NULL);
+
+	for (guint i = 0; i < 5; i++) {
+		const gchar *filenames[] = { old_icon, old_scaled, new_icon, new_size, other };
+		g_file_set_contents (filenames[i], data, -1, &error);
+		g_assert_no_error (error);
+	}
+	g_utime (old_icon, &old_time);
+	g_utime (old_scaled, &old_time);
+
+	/* under the limit, nothing is removed */
+	gs_remote_icon_trim_cache (tmp_dir, 5000, &error);
+	g_assert_no_error (error);
+	g_assert_true (g_file_test (old_icon, G_FILE_TEST_EXISTS));
+
+	/* over it, the least recently used icon and its scaled copies are
+	 * removed, and unknown files are ignored */
+	gs_remote_icon_trim_cache (tmp_dir, 2500, &error);
+	g_assert_no_error (error);
+	g_assert_false (g_file_test (old_icon, G_FILE_TEST_EXISTS));
+	g_assert_false (g_file_test (old_scaled, G_FILE_TEST_EXISTS));
+	g_assert_true (g_file_test (new_icon, G_FILE_TEST_EXISTS));
+	g_assert_true (g_file_test (new_size, G_FILE_TEST_EXISTS));
+	g_assert_true (g_file_test (other, G_FILE_TEST_EXISTS));
+
+	gs_utils_rmtree (tmp_dir, NULL);
+}
+
+typedef struct {
+	GBytes *content;  /* (owned) */
+	gboolean drop;
+	guint n_requests;
+	gchar *range;  /* (owned) (nullable) */
+	gchar *if_range;  /* (owned) (nullable) */
+} RangeServer;
+
+/* Serves range_server->content with ETag "v1", honouring Range requests if
+ * If-Range matches. If range_server->drop is set, it promises the whole
+ * content but only sends the first half, and never finishes the response. */
+static guint
+range_server_respond (RangeServer        *range_server,
+                      SoupMessageHeaders *request_headers,
+                      SoupMessageHeaders *response_headers,
+                      SoupMessageBody    *response_body)
+{
+	gsize size;
+	const gchar *data = g_bytes_get_data (range_server->content, &size);
+	SoupRange *ranges = NULL;
+	gint n_ranges = 0;
+
+	range_server->n_requests++;
+	g_free (range_server->range);
+	range_server->range = g_strdup (soup_message_headers_get_one (request_headers, "Range"));
+	g_free (range_server->if_range);
+	range_server->if_range = g_strdup (soup_message_headers_get_one (request_headers, "If-Range"));
+
+	soup_message_headers_append (response_headers, "ETag", "\"v1\"");
+
+	if (range_server->drop) {
+		soup_message_headers_set_encoding (response_headers, SOUP_ENCODING_CONTENT_LENGTH);
+		soup_message_headers_set_content_length (response_headers, (goffset) size);
+		soup_message_body_append (response_body, SOUP_MEMORY_COPY, data, size / 2);
+		return SOUP_STATUS_OK;
+	}
+
+	if (g_strcmp0 (range_server->if_range, "\"v1\"") == 0 &&
+	    soup_message_headers_get_ranges (request_headers, (goffset) size, &ranges, &n_ranges)) {
+		goffset start = ranges[0].start;
+
+		soup_message_headers_free_ranges (request_headers, ranges);
+		soup_message_headers_set_content_range (response_headers, start, (goffset) size - 1, (goffset) size);
+		soup_message_body_append (response_body, SOUP_MEMORY_COPY, data + start, size - (gsize) start);
+		soup_message_body_complete (response_body);
+		return SOUP_STATUS_PARTIAL_CONTENT;
+	}
+
+	soup_message_body_append (response_body, SOUP_MEMORY_COPY, data, size);
+	soup_message_body_complete (response_body);
+	return SOUP_STATUS_OK;
+}
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+static void
+range_server_cb (SoupServer        *server,
+                 SoupServerMessage *msg,
+                 const char        *path,
+                 GHashTable        *query,
+                 gpointer           user_data)
+{
+	guint status_code;
+
+	status_code = range_server_respond (user_data,
+					    soup_server_message_get_request_headers (msg),
+					    soup_server_message_get_response_headers (msg),
+					    soup_server_message_get_response_body (msg));
+	soup_server_message_set_status (msg, status_code, NULL);
+}
+#else
+static void
+range_server_cb (SoupServer        *server,
+                 SoupMessage       *msg,
+                 const char        *path,
+                 GHashTable        *query,
+                 SoupClientContext *client,
+                 gpointer           user_data)
+{
+	guint status_code;
+
+	status_code = range_server_respond (user_data,
+					    msg->request_headers,
+					    msg->response_headers,
+					    msg->response_body);
+	soup_message_set_status (msg, status_code);
+}
+#endif
+
+static gchar *
+range_server_listen (SoupServer  *server,
+                     RangeServer *range_server)
+{
+	GSList *uris;
+	guint port;
+	g_autoptr(GError) error = NULL;
+
+	soup_server_add_handler (server, "/catalogue", range_server_cb, range_server, NULL);
+	soup_server_listen_local (server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, &error);
+	g_assert_no_error (error);
+
+	uris = soup_server_get_uris (server);
+	g_assert_nonnull (uris);
+#if SOUP_CHECK_VERSION(3, 0, 0)
+	port = g_uri_get_port (uris->data);
+	g_slist_free_full (uris, (GDestroyNotify) g_uri_unref);
+#else
+	port = soup_uri_get_port (uris->data);
+	g_slist_free_full (uris, (GDestroyNotify) soup_uri_free);
+#endif
+
+	return g_strdup_printf ("http://127.0.0.1:%u/catalogue", port);
+}
+
+static void
+download_progress_cb (gsize    bytes_downloaded,
+                      gsize    total_download_size,
+                      gpointer user_data)
+{
+	gsize *bytes_downloaded_out = user_data;
+	*bytes_downloaded_out = bytes_downloaded;
+}
+
+static void
+gs_download_file_resume_func (void)
+{
+	RangeServer range_server = { NULL, TRUE, 0, NULL, NULL };
+	g_autoptr(SoupServer) server = NULL;
+	g_autoptr(SoupServer) server2 = NULL;
+	g_autoptr(SoupSession) session = NULL;
+	g_autoptr(GFile) output_file = NULL;
+	g_autoptr(GFile) partial_file = NULL;
+	g_autoptr(GAsyncResult) result = NULL;
+	g_autoptr(GAsyncResult) result2 = NULL;
+	g_autofree gchar *tmp_dir = NULL;
+	g_autofree gchar *output_path = NULL;
+	g_autofree gchar *partial_path = NULL;
+	g_autofree gchar *uri = NULL;
+	g_autofree gchar *uri2 = NULL;
+	g_autofree gchar *expected_range = NULL;
+	g_autofree gchar *contents = NULL;
+	gchar *content;
+	gsize content_size = 256 * 1024;
+	gsize contents_len = 0;
+	gsize bytes_downloaded = 0;
+	g_autoptr(GError) error = NULL;
+
+	content = g_malloc (content_size);
+	for (gsize i = 0; i < content_size; i++)
+		content[i] = (gchar) (i % 251);
+	range_server.content = g_bytes_new_take (content, content_size);
+
+	tmp_dir = g_dir_make_tmp ("gs-self-test-download-XXXXXX", &error);
+	g_assert_no_error (error);
+	output_path = g_build_filename (tmp_dir, "catalogue.xml.gz", NULL);
+	partial_path = g_strconcat (output_path, ".partial", NULL);
+	output_file = g_file_new_for_path (output_path);
+	partial_file = g_file_new_for_path (partial_path);
+
+	/* what can be resumed is stored in an extended attribute */
+	g_file_set_contents (partial_path, "", 0, &error);
+	g_assert_no_error (error);
+	if (!gs_utils_set_file_etag (partial_file, "test", NULL)) {
+		g_test_skip ("Extended attributes not supported");
+		gs_utils_rmtree (tmp_dir, NULL);
+		g_bytes_unref (range_server.content);
+		return;
+	}
+	g_unlink (partial_path);
+
+	/* the connection drops half way through the download */
+	session = soup_session_new ();
+	server = soup_server_new (NULL, NULL);
+	uri = range_server_listen (server, &range_server);
+
+	gs_download_file_async (session, uri, output_file, G_PRIORITY_DEFAULT,
+				download_progress_cb, &bytes_downloaded,
+				NULL, async_result_cb, &result);
+	while (bytes_downloaded < content_size / 2)
+		g_main_context_iteration (NULL, TRUE);
+	soup_server_disconnect (server);
+	while (result == NULL)
+		g_main_context_iteration (NULL, TRUE);
+	g_assert_false (gs_download_file_finish (session, result, &error));
+	g_assert_nonnull (error);
+	g_clear_error (&error);
+	g_clear_object (&result);
+
+	/* the destination is untouched, and the data so far is kept */
+	g_assert_false (g_file_test (output_path, G_FILE_TEST_EXISTS));
+	g_file_get_contents (partial_path, &contents, &contents_len, &error);
+	g_assert_no_error (error);
+	g_assert_cmpmem (contents, contents_len, content, content_size / 2);
+	g_clear_pointer (&contents, g_free);
+
+	/* retrying only downloads the rest */
+	range_server.drop = FALSE;
+	server2 = soup_server_new (NULL, NULL);
+	uri2 = range_server_listen (server2, &range_server);
+
+	gs_download_file_async (session, uri2, output_file, G_PRIORITY_DEFAULT,
+				NULL, NULL, NULL, async_result_cb, &result);
+	while (result == NULL)
+		g_main_context_iteration (NULL, TRUE);
+	gs_download_file_finish (session, result, &error);
+	g_assert_no_error (error);
+	g_clear_object (&result);
+
+	expected_range = g_strdup_printf ("bytes=%" G_GSIZE_FORMAT "-", content_size / 2);
+	g_assert_cmpuint (range_server.n_requests, ==, 2);
+	g_assert_cmpstr (range_server.range, ==, expected_range);
+	g_assert_cmpstr (range_server.if_range, ==, "\"v1\"");
+
+	g_assert_false (g_file_test (partial_path, G_FILE_TEST_EXISTS));
+	g_file_get_contents (output_path, &contents, &contents_len, &error);
+	g_assert_no_error (error);
+	g_assert_cmpmem (contents, contents_len, content, content_size);
+	g_clear_pointer (&contents, g_free);
+
+	/* a partial download of an older version of the file is replaced by
+	 * the whole new file */
+	g_file_set_contents (partial_path, "stale", -1, &error);
+	g_assert_no_error (error);
+	g_file_set_attribute_string (partial_file, "xattr::gnome-software::partial-validator", "\"v0\"",
+				     G_FILE_QUERY_INFO_NONE, NULL, &error);
+	g_assert_no_error (error);
+
+	gs_download_file_async (session, uri2, output_file, G_PRIORITY_DEFAULT,
+				NULL, NULL, NULL, async_result_cb, &result);
+	while (result == NULL)
+		g_main_context_iteration (NULL, TRUE);
+	gs_download_file_finish (session, result, &error);
+	g_assert_no_error (error);
+
+	g_assert_cmpstr (range_server.if_range, ==, "\"v0\"");
+	g_file_get_contents (output_path, &contents, &contents_len, &error);
+	g_assert_no_error (error);
+	g_assert_cmpmem (contents, contents_len, content, content_size);
+	g_clear_pointer (&contents, g_free);
+	g_clear_object (&result);
+
+	/* concurrent downloads to the same file don’t share a partial file */
+	g_unlink (output_path);
+	gs_download_file_async (session, uri2, output_file, G_PRIORITY_DEFAULT,
+				NULL, NULL, NULL, async_result_cb, &result);
+	gs_download_file_async (session, uri2, output_file, G_PRIORITY_DEFAULT,
+				NULL, NULL, NULL, async_result_cb, &result2);
+	while (result == NULL || result2 == NULL)
+		g_main_context_iteration (NULL, TRUE);
+	gs_download_file_finish (session, result, &error);
+	g_assert_no_error (error);
+	gs_download_file_finish (session, result2, &error);
+	g_assert_no_error (error);
+
+	g_file_get_contents (output_path, &contents, &contents_len, &error);
+	g_assert_no_error (error);
+	g_assert_cmpmem (contents, contents_len, content, content_size);
+	g_assert_false (g_file_test (partial_path, G_FILE_TEST_EXISTS));
+
+	gs_utils_rmtree (tmp_dir, NULL);
+	g_bytes_unref (range_server.content);
+	g_free (range_server.range);
+	g_free (range_server.if_range);
+}
+
 static void
 gs_plugin_func (void)
 {
@@ -580,6 +1316,58 @@ gs_app_unique_id_func (void)
 	g_clear_pointer (&data_id, g_free);
 }
 
+static void
+gs_app_refined_flags_func (void)
+{
+	g_autoptr(GsApp) app = gs_app_new ("test.desktop");
+	GsPluginRefineFlags refined_flags;
+	guint generation;
+
+	/* nothing refined to start with */
+	g_assert_false (gs_app_get_refined_flags (app, &refined_flags));
+	g_assert_cmpint (refined_flags, ==, GS_PLUGIN_REFINE_FLAGS_NONE);
+
+	/* a refine with no flags still counts as a refine */
+	generation = gs_app_get_refine_generation ();
+	gs_app_add_refined_flags (app, GS_PLUGIN_REFINE_FLAGS_NONE, GS_PLUGIN_REFINE_FLAGS_NONE, generation);
+	g_assert_true (gs_app_get_refined_flags (app, &refined_flags));
+	g_assert_cmpint (refined_flags, ==, GS_PLUGIN_REFINE_FLAGS_NONE);
+
+	gs_app_add_refined_flags (app, GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON, GS_PLUGIN_REFINE_FLAGS_NONE, generation);
+	gs_app_add_refined_flags (app, GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN, GS_PLUGIN_REFINE_FLAGS_NONE, generation);
+	g_assert_true (gs_app_get_refined_flags (app, &refined_flags));
+	g_assert_cmpint (refined_flags, ==,
+			 GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON |
+			 GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN);
+
+	/* refining in a different mode replaces what was refined */
+	gs_app_add_refined_flags (app,
+				  GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL |
+				  GS_PLUGIN_REFINE_FLAGS_DISABLE_FILTERING,
+				  GS_PLUGIN_REFINE_FLAGS_DISABLE_FILTERING,
+				  generation);
+	g_assert_true (gs_app_get_refined_flags (app, &refined_flags));
+	g_assert_cmpint (refined_flags, ==,
+			 GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL |
+			 GS_PLUGIN_REFINE_FLAGS_DISABLE_FILTERING);
+
+	/* state changes drop what was refined */
+	gs_app_set_state (app, GS_APP_STATE_AVAILABLE);
+	g_assert_false (gs_app_get_refined_flags (app, &refined_flags));
+	g_assert_cmpint (refined_flags, ==, GS_PLUGIN_REFINE_FLAGS_NONE);
+
+	/* as does invalidating everything */
+	gs_app_add_refined_flags (app, GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON, GS_PLUGIN_REFINE_FLAGS_NONE, generation);
+	g_assert_true (gs_app_get_refined_flags (app, &refined_flags));
+	g_assert_cmpint (refined_flags, ==, GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON);
+	gs_app_invalidate_all_refined_flags ();
+	g_assert_false (gs_app_get_refined_flags (app, &refined_flags));
+
+	/* results of a refine which started before the invalidation are ignored */
+	gs_app_add_refined_flags (app, GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON, GS_PLUGIN_REFINE_FLAGS_NONE, generation);
+	g_assert_false (gs_app_get_refined_flags (app, &refined_flags));
+}
+
 static void
 gs_app_addons_func (void)
 {
@@ -690,6 +1478,92 @@ gs_app_list_wildcard_dedupe_func (void)
 	g_assert_cmpint (gs_app_list_length (list), ==, 1);
 }
 
+static void
+gs_app_list_lookup_func (void)
+{
+	g_autoptr(GsAppList) list = gs_app_list_new ();
+	g_autoptr(GsApp) app1 = gs_app_new ("org.example.App1");
+	g_autoptr(GsApp) app2 = gs_app_new ("org.example.App2");
+	g_autoptr(GsApp) app3 = gs_app_new ("org.example.App1");
+
+	gs_app_set_origin (app1, "one");
+	gs_app_list_add (list, app1);
+	gs_app_list_add (list, app2);
+	gs_app_list_add (list, app1);
+	g_assert_cmpint (gs_app_list_length (list), ==, 2);
+	g_assert (gs_app_list_lookup (list, "*/*/one/org.example.App1/*") == app1);
+	g_assert (gs_app_list_lookup (list, "*/*/two/org.example.App1/*") == NULL);
+	g_assert (gs_app_list_lookup (list, "*/*/*/*/*") == app1);
+
+	/* the index follows changes to the unique ID of apps in the list */
+	gs_app_set_origin (app2, "two");
+	g_assert (gs_app_list_lookup (list, "*/*/two/org.example.App2/*") == app2);
+	gs_app_set_id (app2, "org.example.App1");
+	g_assert (gs_app_list_lookup (list, "*/*/two/org.example.App1/*") == app2);
+	g_assert (gs_app_list_lookup (list, "*/*/*/org.example.App2/*") == NULL);
+	gs_app_set_kind (app2, AS_COMPONENT_KIND_DESKTOP_APP);
+	g_assert (gs_app_list_lookup (list, "*/*/two/org.example.App1/*") == app2);
+	gs_app_set_unique_id (app2, "*/*/two/org.example.App3/*");
+	g_assert (gs_app_list_lookup (list, "*/*/*/org.example.App3/*") == app2);
+	gs_app_set_branch (app2, "stable");
+	g_assert (gs_app_list_lookup (list, "*/*/two/org.example.App1/stable") == app2);
+
+	/* same unique ID as app1, so not added */
+	gs_app_set_origin (app3, "one");
+	gs_app_list_add (list, app3);
+	g_assert_cmpint (gs_app_list_length (list), ==, 2);
+
+	/* removing, truncating and sorting keep the index in sync */
+	gs_app_list_remove (list, app1);
+	g_assert (gs_app_list_lookup (list, "*/*/one/org.example.App1/*") == NULL);
+	gs_app_list_add (list, app3);
+	g_assert_cmpint (gs_app_list_length (list), ==, 2);
+	g_assert (gs_app_list_lookup (list, "*/*/one/org.example.App1/*") == app3);
+	gs_app_list_truncate (list, 1);
+	g_assert (gs_app_list_lookup (list, "*/*/one/org.example.App1/*") == NULL);
+	g_assert (gs_app_list_lookup (list, "*/*/*/org.example.App1/*") == app2);
+}
+
+static gint
+gs_app_list_sort_top_cb (GsApp *app1, GsApp *app2, gpointer user_data)
+{
+	guint match1 = gs_app_get_match_value (app1);
+	guint match2 = gs_app_get_match_value (app2);
+
+	if (match1 != match2)
+		return (match1 < match2) ? 1 : -1;
+	return 0;
+}
+
+static void
+gs_app_list_sort_top_func (void)
+{
+	g_autoptr(GsAppList) list = gs_app_list_new ();
+	g_autoptr(GsAppList) expected = gs_app_list_new ();
+
+	/* some apps share a score, to check the selection is stable */
+	for (guint i = 0; i < 50; i++) {
+		g_autofree gchar *id = g_strdup_printf ("org.example.App%02u", i);
+		g_autoptr(GsApp) app = gs_app_new (id);
+		gs_app_set_match_value (app, i * 7 % 10);
+		gs_app_list_add (list, app);
+		gs_app_list_add (expected, app);
+	}
+
+	gs_app_list_sort (expected, gs_app_list_sort_top_cb, NULL);
+	gs_app_list_truncate (expected, 10);
+	gs_app_list_sort_top (list, gs_app_list_sort_top_cb, NULL, 10);
+
+	g_assert_cmpint (gs_app_list_length (list), ==, 10);
+	for (guint i = 0; i < 10; i++)
+		g_assert (gs_app_list_index (list, i) == gs_app_list_index (expected, i));
+	g_assert_true (gs_app_list_has_flag (list, GS_APP_LIST_FLAG_IS_TRUNCATED));
+
+	/* a limit larger than the list is a plain sort */
+	gs_app_list_sort_top (list, gs_app_list_sort_top_cb, NULL, 100);
+	g_assert_cmpint (gs_app_list_length (list), ==, 10);
+}
+
 static void
 gs_app_list_func (void)
 {
@@ -743,6 +1617,34 @@ gs_app_list_performance_func (void)
 	g_print ("%.2fms ", g_timer_elapsed (timer, NULL) * 1000);
 }
 
+static void
+gs_app_list_filter_duplicates_performance_func (void)
+{
+	g_autoptr(GsAppList) list = gs_app_list_new ();
+	g_autoptr(GTimer) timer = NULL;
+
+	/* every ID appears in two origins */
+	for (guint i = 0; i < 10000; i++) {
+		g_autofree gchar *id = g_strdup_printf ("%05u.desktop", i / 2);
+		g_autoptr(GsApp) app = gs_app_new (id);
+		gs_app_set_origin (app, (i % 2 == 0) ? "one" : "two");
+		gs_app_set_version (app, "1.0");
+		gs_app_add_source (app, id);
+		gs_app_list_add (list, app);
+	}
+	g_assert_cmpint (gs_app_list_length (list), ==, 10000);
+
+	timer = g_timer_new ();
+	gs_app_list_filter_duplicates (list, GS_APP_LIST_FILTER_FLAG_NONE);
+	g_assert_cmpint (gs_app_list_length (list), ==, 10000);
+	gs_app_list_filter_duplicates (list, GS_APP_LIST_FILTER_FLAG_KEY_ID |
+					     GS_APP_LIST_FILTER_FLAG_KEY_SOURCE |
+					     GS_APP_LIST_FILTER_FLAG_KEY_VERSION);
+	g_assert_cmpint (gs_app_list_length (list), ==, 5000);
+	g_assert_cmpstr (gs_app_get_origin (gs_app_list_index (list, 0)), ==, "one");
+	g_print ("%.2fms ", g_timer_elapsed (timer, NULL) * 1000);
+}
+
 static void
 gs_app_list_related_func (void)
 {
@@ -763,6 +1665,119 @@ gs_app_list_related_func (void)
 	g_assert_cmpint (gs_app_list_get_progress (list), ==, 50);
 }
 
+static void
+gs_key_colors_cache_func (void)
+{
+	g_autofree gchar *tmp_dir = NULL;
+	g_autofree gchar *fn = NULL;
+	g_autofree gchar *key1 = NULL;
+	g_autofree gchar *key2 = NULL;
+	g_autofree gchar *cache_fn = NULL;
+	struct utimbuf old_time = { 1000000, 1000000 };
+	g_autoptr(GArray) colors = g_array_new (FALSE, FALSE, sizeof (GdkRGBA));
+	g_autoptr(GArray) cached = NULL;
+	g_autoptr(GError) error = NULL;
+	GdkRGBA red = { 1.0, 0.0, 0.0, 1.0 };
+	GdkRGBA grey = { 0.5, 0.5, 0.5, 1.0 };
+
+	tmp_dir = g_dir_make_tmp ("gs-self-test-key-colors-XXXXXX", &error);
+	g_assert_no_error (error);
+	fn = g_build_filename (tmp_dir, "icon.png", NULL);
+	g_file_set_contents (fn, "1", -1, &error);
+	g_assert_no_error (error);
+
+	/* nothing is cached to begin with */
+	key1 = gs_key_colors_cache_key_for_file (fn);
+	g_assert_nonnull (key1);
+	g_assert_null (gs_key_colors_cache_lookup (key1));
+
+	g_array_append_val (colors, red);
+	g_array_append_val (colors, grey);
+	gs_key_colors_cache_insert (key1, colors);
+	cached = gs_key_colors_cache_lookup (key1);
+	g_assert_nonnull (cached);
+	g_assert_cmpuint (cached->len, ==, 2);
+	g_assert_true (gdk_rgba_equal (&g_array_index (cached, GdkRGBA, 0), &red));
+	g_assert_true (gdk_rgba_equal (&g_array_index (cached, GdkRGBA, 1), &grey));
+
+	/* changing the file changes the key */
+	g_file_set_contents (fn, "22", -1, &error);
+	g_assert_no_error (error);
+	key2 = gs_key_colors_cache_key_for_file (fn);
+	g_assert_cmpstr (key1, !=, key2);
+
+	/* pruning drops the entries which haven’t been written for a while,
+	 * such as the one for the old version of the file */
+	gs_key_colors_cache_insert (key2, colors);
+	cache_fn = gs_utils_get_cache_filename ("key-colors", key1, GS_UTILS_CACHE_FLAG_WRITEABLE, &error);
+	g_assert_no_error (error);
+	g_assert_cmpint (g_utime (cache_fn, &old_time), ==, 0);
+	gs_key_colors_cache_prune ();
+	g_assert_false (g_file_test (cache_fn, G_FILE_TEST_EXISTS));
+	g_clear_pointer (&cached, g_array_unref);
+	cached = gs_key_colors_cache_lookup (key2);
+	g_assert_nonnull (cached);
+
+	/* empty or corrupt entries are treated as missing, and deleted */
+	g_file_set_contents (cache_fn, "", 0, &error);
+	g_assert_no_error (error);
+	g_assert_null (gs_key_colors_cache_lookup (key1));
+	g_assert_false (g_file_test (cache_fn, G_FILE_TEST_EXISTS));
+
+	g_file_set_contents (cache_fn, "corrupt", -1, &error);
+	g_assert_no_error (error);
+	g_assert_null (gs_key_colors_cache_lookup (key1));
+	g_assert_false (g_file_test (cache_fn, G_FILE_TEST_EXISTS));
+
+	gs_utils_rmtree (tmp_dir, NULL);
+}
+
+static void
+gs_key_colors_simd_func (void)
+{
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	guint8 *pixels;
+	gint rowstride;
+
+	if (!gs_key_colors_simd_supported ()) {
+		g_test_skip ("SIMD implementation not supported on this CPU");
+		return;
+	}
+
+	/* random pixels, with some transparent ones and some duplicated
+	 * colors so there are ties between clusters */
+	pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, 37, 29);
+	pixels = gdk_pixbuf_get_pixels (pixbuf);
+	rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+	for (gint y = 0; y < gdk_pixbuf_get_height (pixbuf); y++) {
+		for (gint x = 0; x < gdk_pixbuf_get_width (pixbuf); x++) {
+			guint8 *p = pixels + y * rowstride + x * 4;
+			gboolean duplicate = g_test_rand_bit ();
+
+			p[0] = duplicate ? 0x80 : g_test_rand_int_range (0, 256);
+			p[1] = duplicate ? 0x40 : g_test_rand_int_range (0, 256);
+			p[2] = duplicate ? 0xc0 : g_test_rand_int_range (0, 256);
+			p[3] = g_test_rand_int_range (0, 256);
+		}
+	}
+
+	/* the initial clusters are random, so use the same seed for both */
+	for (guint32 seed = 0; seed < 20; seed++) {
+		g_autoptr(GArray) scalar_colors = NULL;
+		g_autoptr(GArray) simd_colors = NULL;
+
+		g_random_set_seed (seed);
+		scalar_colors = gs_calculate_key_colors_with_impl (pixbuf, GS_KEY_COLORS_IMPL_SCALAR);
+		g_random_set_seed (seed);
+		simd_colors = gs_calculate_key_colors_with_impl (pixbuf, GS_KEY_COLORS_IMPL_SIMD);
+
+		g_assert_cmpuint (scalar_colors->len, ==, simd_colors->len);
+		for (guint i = 0; i < scalar_colors->len; i++)
+			g_assert_true (gdk_rgba_equal (&g_array_index (scalar_colors, GdkRGBA, i),
+						       &g_array_index (simd_colors, GdkRGBA, i)));
+	}
+}
+
 int
 main (int argc, char **argv)
 {
@@ -775,19 +1790,31 @@ main (int argc, char **argv)
 	g_test_add_func ("/gnome-software/lib/utils{wilson}", gs_utils_wilson_func);
 	g_test_add_func ("/gnome-software/lib/utils{error}", gs_utils_error_func);
 	g_test_add_func ("/gnome-software/lib/utils{cache}", gs_utils_cache_func);
+	g_test_add_func ("/gnome-software/lib/utils{file-size}", gs_utils_file_size_func);
 	g_test_add_func ("/gnome-software/lib/utils{append-kv}", gs_utils_append_kv_func);
 	g_test_add_func ("/gnome-software/lib/os-release", gs_os_release_func);
+	g_test_add_func ("/gnome-software/lib/key-colors{cache}", gs_key_colors_cache_func);
+	g_test_add_func ("/gnome-software/lib/key-colors{simd}", gs_key_colors_simd_func);
 	g_test_add_func ("/gnome-software/lib/app", gs_app_func);
 	g_test_add_func ("/gnome-software/lib/app/progress-clamping", gs_app_progress_clamping_func);
+	g_test_add_func ("/gnome-software/lib/app{refined-flags}", gs_app_refined_flags_func);
 	g_test_add_func ("/gnome-software/lib/app{addons}", gs_app_addons_func);
 	g_test_add_func ("/gnome-software/lib/app{unique-id}", gs_app_unique_id_func);
 	g_test_add_data_func ("/gnome-software/lib/app{thread}", debug, gs_app_thread_func);
 	g_test_add_func ("/gnome-software/lib/app{list}", gs_app_list_func);
 	g_test_add_func ("/gnome-software/lib/app{list-wildcard-dedupe}", gs_app_list_wildcard_dedupe_func);
+	g_test_add_func ("/gnome-software/lib/app{list-lookup}", gs_app_list_lookup_func);
+	g_test_add_func ("/gnome-software/lib/app{list-sort-top}", gs_app_list_sort_top_func);
 	g_test_add_func ("/gnome-software/lib/app{list-performance}", gs_app_list_performance_func);
+	g_test_add_func ("/gnome-software/lib/app{list-filter-duplicates-performance}", gs_app_list_filter_duplicates_performance_func);
 	g_test_add_func ("/gnome-software/lib/app{list-related}", gs_app_list_related_func);
 	g_test_add_func ("/gnome-software/lib/plugin", gs_plugin_func);
 	g_test_add_func ("/gnome-software/lib/plugin{download-rewrite}", gs_plugin_download_rewrite_func);
+	g_test_add_func ("/gnome-software/lib/download{resume}", gs_download_file_resume_func);
+	g_test_add_func ("/gnome-software/lib/odrs-provider{fetch-reviews}", gs_odrs_provider_fetch_reviews_func);
+	g_test_add_func ("/gnome-software/lib/remote-icon{cache}", gs_remote_icon_cache_func);
+	g_test_add_func ("/gnome-software/lib/remote-icon{trim-cache}", gs_remote_icon_trim_cache_func);
+	g_test_add_func ("/gnome-software/lib/icon-downloader", gs_icon_downloader_func);
 
 	return g_test_run ();
 }
@@ -20,10 +20,14 @@
 
 #include "config.h"
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <fnmatch.h>
 #include <math.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <glib/gi18n-lib.h>
 #include <glib/gstdio.h>
 #include <json-glib/json-glib.h>
@@ -1393,6 +1397,224 @@ gs_utils_pixbuf_blur (GdkPixbuf *src, guint radius, guint iterations)
 		gs_pixbuf_blur_private (src, tmp, radius, div_kernel_size);
 }
 
+#ifndef AT_NO_AUTOMOUNT
+#define AT_NO_AUTOMOUNT 0
+#endif
+
+/* How long a directory size is reused for, if the directory itself hasn’t
+ * changed. Files can change size without their directory’s mtime changing,
+ * so this has to be short. It saves walking the same directories again and
+ * again while a page of apps is being refined. */
+#define FILE_SIZE_CACHE_MAX_AGE_USEC (30 * G_USEC_PER_SEC)
+
+/* Expired entries are removed when they’re looked up, but directories which
+ * are never looked at again would otherwise stay in the cache forever, so it
+ * is pruned once it has this many entries. */
+#define FILE_SIZE_CACHE_MAX_ENTRIES 256
+
+typedef struct {
+	GsFileSizeIncludeFunc include_func;
+	gpointer user_data;
+	dev_t dev;
+	ino_t ino;
+	gint64 mtime_nsec;
+	gint64 timestamp_usec;
+	guint64 size;
+} FileSizeCacheEntry;
+
+static GMutex file_size_cache_mutex;
+static GHashTable *file_size_cache = NULL;  /* (mutex file_size_cache_mutex) (element-type filename FileSizeCacheEntry) (owned) (nullable) */
+
+static gint64
+file_size_stat_mtime_nsec (const struct stat *st)
+{
+	return (gint64) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static gboolean
+file_size_cache_entry_is_expired (gpointer key,
+				  gpointer value,
+				  gpointer user_data)
+{
+	FileSizeCacheEntry *entry = value;
+	gint64 now_usec = *((gint64 *) user_data);
+
+	return now_usec - entry->timestamp_usec > FILE_SIZE_CACHE_MAX_AGE_USEC;
+}
+
+static gboolean
+file_size_cache_lookup (const gchar           *filename,
+			const struct stat     *st,
+			GsFileSizeIncludeFunc  include_func,
+			gpointer               user_data,
+			guint64               *size_out)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&file_size_cache_mutex);
+	FileSizeCacheEntry *entry;
+
+	entry = (file_size_cache != NULL) ? g_hash_table_lookup (file_size_cache, filename) : NULL;
+	if (entry == NULL)
+		return FALSE;
+
+	/* Drop entries which can’t be used, rather than leaving them until
+	 * they’re replaced */
+	if (entry->include_func != include_func ||
+	    entry->user_data != user_data ||
+	    entry->dev != st->st_dev ||
+	    entry->ino != st->st_ino ||
+	    entry->mtime_nsec != file_size_stat_mtime_nsec (st) ||
+	    g_get_monotonic_time () - entry->timestamp_usec > FILE_SIZE_CACHE_MAX_AGE_USEC) {
+		g_hash_table_remove (file_size_cache, filename);
+		return FALSE;
+	}
+
+	*size_out = entry->size;
+	return TRUE;
+}
+
+static void
+file_size_cache_insert (const gchar           *filename,
+			const struct stat     *st,
+			GsFileSizeIncludeFunc  include_func,
+			gpointer               user_data,
+			guint64                size)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&file_size_cache_mutex);
+	FileSizeCacheEntry *entry = g_new0 (FileSizeCacheEntry, 1);
+
+	entry->include_func = include_func;
+	entry->user_data = user_data;
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->mtime_nsec = file_size_stat_mtime_nsec (st);
+	entry->timestamp_usec = g_get_monotonic_time ();
+	entry->size = size;
+
+	if (file_size_cache == NULL)
+		file_size_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+	if (g_hash_table_size (file_size_cache) >= FILE_SIZE_CACHE_MAX_ENTRIES) {
+		g_hash_table_foreach_remove (file_size_cache, file_size_cache_entry_is_expired,
+					     &entry->timestamp_usec);
+
+		/* Everything is still fresh; start again rather than tracking
+		 * which entries were used least recently */
+		if (g_hash_table_size (file_size_cache) >= FILE_SIZE_CACHE_MAX_ENTRIES)
+			g_hash_table_remove_all (file_size_cache);
+	}
+
+	g_hash_table_replace (file_size_cache, g_strdup (filename), entry);
+}
+
+typedef struct {
+	GsFileSizeIncludeFunc include_func;
+	gpointer user_data;
+	GCancellable *cancellable;
+	int root_fd;
+	GMutex mutex;
+	guint64 size;  /* (mutex mutex) */
+} FileSizeWalk;
+
+/* Add up the sizes of the files below @rel_path, which is relative to
+ * @walk->root_fd, with "" meaning the root itself. If @subdirs_out is
+ * non-%NULL, subdirectories of @rel_path are added to it rather than being
+ * walked. Everything is looked up relative to an open directory, so no full
+ * paths have to be built, and mostly one fstatat() is needed per entry. */
+static guint64
+file_size_walk (FileSizeWalk *walk,
+		const gchar  *rel_path,
+		GPtrArray    *subdirs_out)
+{
+	GSList *dirs_to_do = NULL;
+	guint64 size = 0;
+
+	dirs_to_do = g_slist_prepend (dirs_to_do, g_strdup (rel_path));
+	while (dirs_to_do != NULL && !g_cancellable_is_cancelled (walk->cancellable)) {
+		g_autofree gchar *path = NULL;
+		struct dirent *entry;
+		DIR *dir;
+		int fd;
+
+		/* Steal the top `path` out of the `dirs_to_do`. */
+		path = dirs_to_do->data;
+		dirs_to_do = g_slist_delete_link (dirs_to_do, dirs_to_do);
+
+		fd = openat (walk->root_fd, (*path != '\0') ? path : ".",
+			     O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		dir = fdopendir (fd);
+		if (dir == NULL) {
+			close (fd);
+			continue;
+		}
+
+		while ((entry = readdir (dir)) != NULL && !g_cancellable_is_cancelled (walk->cancellable)) {
+			g_autofree gchar *child_path = NULL;
+			gboolean is_symlink;
+			struct stat st;
+
+			if (g_str_equal (entry->d_name, ".") || g_str_equal (entry->d_name, ".."))
+				continue;
+
+			if (entry->d_type == DT_UNKNOWN) {
+				if (fstatat (dirfd (dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT) != 0)
+					continue;
+				is_symlink = S_ISLNK (st.st_mode);
+			} else {
+				is_symlink = (entry->d_type == DT_LNK);
+			}
+
+			/* Follow symlinks, so linked files count their target size */
+			if (fstatat (dirfd (dir), entry->d_name, &st, AT_NO_AUTOMOUNT) != 0)
+				continue;
+
+			/* The `include_func()` expects a path relative to the
+			 * root, without a leading dir separator. */
+			if (walk->include_func != NULL || (S_ISDIR (st.st_mode) && !is_symlink))
+				child_path = (*path != '\0') ? g_build_filename (path, entry->d_name, NULL) : g_strdup (entry->d_name);
+
+			if (walk->include_func != NULL &&
+			    !walk->include_func (child_path,
+						 is_symlink ? G_FILE_TEST_IS_SYMLINK :
+						 S_ISDIR (st.st_mode) ? G_FILE_TEST_IS_DIR :
+						 G_FILE_TEST_IS_REGULAR,
+						 walk->user_data))
+				continue;
+
+			if (S_ISDIR (st.st_mode)) {
+				/* Skip symlinks, they can point to a shared storage */
+				if (is_symlink)
+					continue;
+				if (subdirs_out != NULL)
+					g_ptr_array_add (subdirs_out, g_steal_pointer (&child_path));
+				else
+					dirs_to_do = g_slist_prepend (dirs_to_do, g_steal_pointer (&child_path));
+			} else {
+				size += st.st_size;
+			}
+		}
+
+		closedir (dir);
+	}
+	g_slist_free_full (dirs_to_do, g_free);
+
+	return size;
+}
+
+static void
+file_size_walk_thread_cb (gpointer data,
+			  gpointer user_data)
+{
+	const gchar *rel_path = data;
+	FileSizeWalk *walk = user_data;
+	guint64 size = file_size_walk (walk, rel_path, NULL);
+
+	g_mutex_lock (&walk->mutex);
+	walk->size += size;
+	g_mutex_unlock (&walk->mutex);
+}
+
 /**
  * gs_utils_get_file_size:
  * @filename: a file name to get the size of; it can be a file or a directory
@@ -1405,6 +1627,10 @@ gs_utils_pixbuf_blur (GdkPixbuf *src, guint radius, guint iterations)
  * When the @include_func is not %NULL, it can limit which files are included
  * in the resulting size. When it's %NULL, all files and subdirectories are included.
  *
+ * The subdirectories of a directory are walked in parallel, so @include_func
+ * may be called from several threads at once. The size of a directory may be
+ * reused for a short time if the directory itself has not changed.
+ *
  * Returns: disk size of the @filename; or 0 when not found
  *
  * Since: 41
@@ -1415,62 +1641,53 @@ gs_utils_get_file_size (const gchar *filename,
 			gpointer user_data,
 			GCancellable *cancellable)
 {
+	FileSizeWalk walk = { include_func, user_data, cancellable, -1, };
+	g_autoptr(GPtrArray) subdirs = NULL;
+	struct stat st;
 	guint64 size = 0;
 
 	g_return_val_if_fail (filename != NULL, 0);
 
-	if (g_file_test (filename, G_FILE_TEST_IS_DIR)) {
-		GSList *dirs_to_do = NULL;
-		gsize base_len = strlen (filename);
-
-		/* The `include_func()` expects a path relative to the `filename`, without
-		   a leading dir separator. As the `dirs_to_do` contains the full path,
-		   constructed with `g_build_filename()`, the added dir separator needs
-		   to be skipped, when it's not part of the `filename` already. */
-		if (!g_str_has_suffix (filename, G_DIR_SEPARATOR_S))
-			base_len++;
-
-		dirs_to_do = g_slist_prepend (dirs_to_do, g_strdup (filename));
-		while (dirs_to_do != NULL && !g_cancellable_is_cancelled (cancellable)) {
-			g_autofree gchar *path = NULL;
-			g_autoptr(GDir) dir = NULL;
-
-			/* Steal the top `path` out of the `dirs_to_do`. */
-			path = dirs_to_do->data;
-			dirs_to_do = g_slist_remove (dirs_to_do, path);
-
-			dir = g_dir_open (path, 0, NULL);
-			if (dir) {
-				const gchar *name;
-				while (name = g_dir_read_name (dir), name != NULL && !g_cancellable_is_cancelled (cancellable)) {
-					g_autofree gchar *full_path = g_build_filename (path, name, NULL);
-					GStatBuf st;
-
-					if (g_stat (full_path, &st) == 0 && (include_func == NULL ||
-					    include_func (full_path + base_len,
-							  g_file_test (full_path, G_FILE_TEST_IS_SYMLINK) ? G_FILE_TEST_IS_SYMLINK :
-							  S_ISDIR (st.st_mode) ? G_FILE_TEST_IS_DIR :
-							  G_FILE_TEST_IS_REGULAR,
-							  user_data))) {
-						if (S_ISDIR (st.st_mode)) {
-							/* Skip symlinks, they can point to a shared storage */
-							if (!g_file_test (full_path, G_FILE_TEST_IS_SYMLINK))
-								dirs_to_do = g_slist_prepend (dirs_to_do, g_steal_pointer (&full_path));
-						} else {
-							size += st.st_size;
-						}
-					}
-				}
-			}
-		}
-		g_slist_free_full (dirs_to_do, g_free);
-	} else {
-		GStatBuf st;
+	if (stat (filename, &st) != 0)
+		return 0;
+	if (!S_ISDIR (st.st_mode))
+		return st.st_size;
 
-		if (g_stat (filename, &st) == 0)
-			size = st.st_size;
+	if (file_size_cache_lookup (filename, &st, include_func, user_data, &size))
+		return size;
+
+	walk.root_fd = open (filename, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (walk.root_fd < 0)
+		return 0;
+	g_mutex_init (&walk.mutex);
+
+	/* List the top level, then walk each of its subdirectories in
+	 * parallel; for app data these are typically independent trees of
+	 * similar sizes */
+	subdirs = g_ptr_array_new_with_free_func (g_free);
+	size = file_size_walk (&walk, "", subdirs);
+
+	if (subdirs->len > 1) {
+		GThreadPool *pool;
+
+		pool = g_thread_pool_new (file_size_walk_thread_cb, &walk,
+					  (gint) MIN (subdirs->len, g_get_num_processors ()),
+					  FALSE, NULL);
+		for (guint i = 0; i < subdirs->len; i++)
+			g_thread_pool_push (pool, g_ptr_array_index (subdirs, i), NULL);
+		g_thread_pool_free (pool, FALSE, TRUE);
+	} else if (subdirs->len == 1) {
+		file_size_walk_thread_cb (g_ptr_array_index (subdirs, 0), &walk);
 	}
 
+	size += walk.size;
+
+	g_mutex_clear (&walk.mutex);
+	close (walk.root_fd);
+
+	if (!g_cancellable_is_cancelled (cancellable))
+		file_size_cache_insert (filename, &st, include_func, user_data, size);
+
 	return size;
 }
 
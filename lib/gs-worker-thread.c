@@ -23,6 +23,25 @@
  * The priority passed to gs_worker_thread_queue() will be used to adjust the
  * worker thread’s I/O priority (using `ioprio_set()`) when executing that task.
  *
+ * Tasks queued with gs_worker_thread_queue() are serialised: they only run in
+ * the worker thread, one at a time. Tasks which can safely run at the same time
+ * as other tasks from the same #GsWorkerThread can be queued using
+ * gs_worker_thread_queue_full() without
+ * %GS_WORKER_THREAD_QUEUE_FLAGS_MUST_SERIALISE. The worker thread still runs
+ * them if it’s free, but otherwise they can be stolen by a small pool of helper
+ * threads shared between all #GsWorkerThreads. This means a long-running task
+ * (such as a metadata refresh) in one worker doesn’t delay more urgent tasks
+ * (such as an interactive refine) queued to it behind the long one.
+ *
+ * Tasks are always picked in priority order, so a high priority task queued
+ * while a low priority one is running will be run as soon as that task
+ * finishes, ahead of any other queued low priority tasks.
+ *
+ * Stolen tasks are run with the global default #GMainContext as the
+ * thread-default main context, rather than the worker thread’s; they must not
+ * rely on sources attached to the thread-default main context being
+ * dispatched in the worker thread.
+ *
  * It is intended that gs_worker_thread_queue() is an alternative to using
  * g_task_run_in_thread(). g_task_run_in_thread() queues tasks into a single
  * process-wide thread pool, so they are mixed in with other tasks, and it can
@@ -42,6 +61,7 @@
 #include <glib-object.h>
 
 #include "gs-ioprio.h"
+#include "gs-profiler.h"
 #include "gs-worker-thread.h"
 
 typedef enum {
@@ -59,8 +79,22 @@ struct _GsWorkerThread
 	GsWorkerThreadState	 worker_state;  /* (atomic) */
 	GMainContext		*worker_context;  /* (owned); may be NULL before setup or after shutdown */
 	GThread			*worker_thread;  /* (atomic); may be NULL before setup or after shutdown */
+
+	GQueue			 queue;  /* (mutex executor_mutex) (element-type WorkData) (owned), sorted by priority */
+	guint			 n_stolen_running;  /* (mutex executor_mutex) */
 };
 
+/* The helper threads shared between all #GsWorkerThreads, which steal tasks
+ * which don’t need serialising from their queues. */
+static GMutex executor_mutex;
+static GCond executor_work_cond;  /* signalled when a stealable task is queued */
+static GCond executor_idle_cond;  /* signalled when a stolen task finishes */
+static GPtrArray *executor_workers = NULL;  /* (mutex executor_mutex) (element-type GsWorkerThread) (unowned) (owned) */
+static gboolean executor_started = FALSE;  /* (mutex executor_mutex) */
+
+/* The #GsWorkerThread whose task the current thread is running, if any. */
+static GPrivate current_worker = G_PRIVATE_INIT (NULL);
+
 typedef enum {
 	PROP_NAME = 1,
 } GsWorkerThreadProperty;
@@ -122,6 +156,7 @@ gs_worker_thread_dispose (GObject *object)
 }
 
 static gpointer thread_cb (gpointer data);
+static gpointer executor_thread_cb (gpointer data);
 
 static void
 gs_worker_thread_constructed (GObject *object)
@@ -130,6 +165,26 @@ gs_worker_thread_constructed (GObject *object)
 
 	G_OBJECT_CLASS (gs_worker_thread_parent_class)->constructed (object);
 
+	/* Make the queue available for stealing, starting the helper threads
+	 * when the first worker is created. They run for the lifetime of the
+	 * process, like the #GTask thread pool. */
+	g_mutex_lock (&executor_mutex);
+
+	if (executor_workers == NULL)
+		executor_workers = g_ptr_array_new ();
+	g_ptr_array_add (executor_workers, self);
+
+	if (!executor_started) {
+		guint n_threads = CLAMP (g_get_num_processors () / 2, 1, 4);
+
+		for (guint i = 0; i < n_threads; i++) {
+			g_thread_unref (g_thread_new ("gs-worker-helper", executor_thread_cb, NULL));
+		}
+		executor_started = TRUE;
+	}
+
+	g_mutex_unlock (&executor_mutex);
+
 	/* Start up a worker thread and its #GMainContext. The worker will run
 	 * and process events on @worker_context until @worker_state changes
 	 * from %GS_WORKER_THREAD_STATE_RUNNING. */
@@ -209,6 +264,10 @@ typedef struct {
 	GTaskThreadFunc work_func;
 	GTask *task;  /* (owned) */
 	gint priority;
+	GsWorkerThreadQueueFlags flags;
+#ifdef HAVE_SYSPROF
+	gint64 queued_time_nsec;
+#endif
 } WorkData;
 
 static void
@@ -220,24 +279,118 @@ work_data_free (WorkData *data)
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (WorkData, work_data_free)
 
-static gboolean
-work_run_cb (gpointer _data)
+static void
+work_run (GsWorkerThread *self,
+          WorkData       *data)
 {
-	WorkData *data = _data;
 	GTask *task = data->task;
 	gpointer source_object = g_task_get_source_object (task);
 	gpointer task_data = g_task_get_task_data (task);
 	GCancellable *cancellable = g_task_get_cancellable (task);
+	gpointer previous_worker = g_private_get (&current_worker);
+
+	GS_PROFILER_ADD_MARK_TAKE (WorkerThread,
+				   data->queued_time_nsec,
+				   g_strdup_printf ("%s:queued", self->name),
+				   g_strdup (g_task_get_name (task)));
 
 	/* Set the I/O priority of the thread to match the priority of the
 	 * task. */
 	gs_ioprio_set (data->priority);
 
+	g_private_set (&current_worker, self);
+
+	GS_PROFILER_BEGIN_SCOPED_TAKE (WorkerThread,
+				       g_strdup_printf ("%s:run", self->name),
+				       g_strdup (g_task_get_name (task)));
 	data->work_func (task, source_object, task_data, cancellable);
+	GS_PROFILER_END_SCOPED (WorkerThread);
+
+	g_private_set (&current_worker, previous_worker);
+}
+
+/* Run the highest priority task in the queue in the worker thread. One of
+ * these is invoked for each queued task, so there’s nothing to do if the task
+ * has been stolen. */
+static gboolean
+work_run_cb (gpointer user_data)
+{
+	GsWorkerThread *self = GS_WORKER_THREAD (user_data);
+	g_autoptr(WorkData) data = NULL;
+
+	g_mutex_lock (&executor_mutex);
+	data = g_queue_pop_head (&self->queue);
+	g_mutex_unlock (&executor_mutex);
+
+	if (data != NULL)
+		work_run (self, data);
 
 	return G_SOURCE_REMOVE;
 }
 
+/* Find the highest priority task which doesn’t need serialising in any of the
+ * queues, and remove it from its queue. */
+static WorkData *
+executor_steal_locked (GsWorkerThread **worker_out)
+{
+	GsWorkerThread *best_worker = NULL;
+	GList *best_link = NULL;
+	WorkData *data;
+
+	for (guint i = 0; executor_workers != NULL && i < executor_workers->len; i++) {
+		GsWorkerThread *worker = g_ptr_array_index (executor_workers, i);
+
+		for (GList *l = worker->queue.head; l != NULL; l = l->next) {
+			WorkData *candidate = l->data;
+
+			if (candidate->flags & GS_WORKER_THREAD_QUEUE_FLAGS_MUST_SERIALISE)
+				continue;
+
+			if (best_link == NULL ||
+			    candidate->priority < ((WorkData *) best_link->data)->priority) {
+				best_worker = worker;
+				best_link = l;
+			}
+
+			/* the rest of this queue is lower priority */
+			break;
+		}
+	}
+
+	if (best_link == NULL)
+		return NULL;
+
+	data = best_link->data;
+	g_queue_delete_link (&best_worker->queue, best_link);
+	best_worker->n_stolen_running++;
+	*worker_out = best_worker;
+
+	return data;
+}
+
+static gpointer
+executor_thread_cb (gpointer user_data)
+{
+	while (TRUE) {
+		GsWorkerThread *worker = NULL;
+		g_autoptr(WorkData) data = NULL;
+
+		g_mutex_lock (&executor_mutex);
+		while ((data = executor_steal_locked (&worker)) == NULL)
+			g_cond_wait (&executor_work_cond, &executor_mutex);
+		g_mutex_unlock (&executor_mutex);
+
+		work_run (worker, data);
+
+		g_mutex_lock (&executor_mutex);
+		worker->n_stolen_running--;
+		g_cond_broadcast (&executor_idle_cond);
+		g_mutex_unlock (&executor_mutex);
+	}
+
+	return NULL;
+}
+
 /**
  * gs_worker_thread_queue:
  * @self: a #GsWorkerThread
@@ -269,6 +422,9 @@ work_run_cb (gpointer _data)
  * It is an error to call this function after gs_worker_thread_shutdown_async()
  * has called.
  *
+ * This is equivalent to calling gs_worker_thread_queue_full() with
+ * %GS_WORKER_THREAD_QUEUE_FLAGS_MUST_SERIALISE.
+ *
  * Since: 42
  */
 void
@@ -277,7 +433,40 @@ gs_worker_thread_queue (GsWorkerThread  *self,
                         GTaskThreadFunc  work_func,
                         GTask           *task)
 {
-	g_autoptr(WorkData) data = NULL;
+	gs_worker_thread_queue_full (self, priority, GS_WORKER_THREAD_QUEUE_FLAGS_MUST_SERIALISE,
+				     work_func, task);
+}
+
+/**
+ * gs_worker_thread_queue_full:
+ * @self: a #GsWorkerThread
+ * @priority: (default G_PRIORITY_DEFAULT): priority to queue the task at,
+ *   typically #G_PRIORITY_DEFAULT
+ * @flags: flags affecting how the task is run
+ * @work_func: (not nullable): function to run the task
+ * @task: (transfer full) (not nullable): the #GTask containing context data to
+ *   pass to @work_func
+ *
+ * Queue @task to be run at the given @priority, as with
+ * gs_worker_thread_queue().
+ *
+ * If @flags doesn’t contain %GS_WORKER_THREAD_QUEUE_FLAGS_MUST_SERIALISE,
+ * @work_func may be run in a helper thread rather than the worker thread, at
+ * the same time as other tasks queued to @self. It must do its own locking of
+ * any state it shares with them. gs_worker_thread_is_in_worker_context() will
+ * return %TRUE while it runs.
+ *
+ * Since: 46
+ */
+void
+gs_worker_thread_queue_full (GsWorkerThread           *self,
+                             gint                      priority,
+                             GsWorkerThreadQueueFlags  flags,
+                             GTaskThreadFunc           work_func,
+                             GTask                    *task)
+{
+	WorkData *data;
+	GList *link;
 
 	g_return_if_fail (GS_IS_WORKER_THREAD (self));
 	g_return_if_fail (work_func != NULL);
@@ -290,16 +479,41 @@ gs_worker_thread_queue (GsWorkerThread  *self,
 	data->work_func = work_func;
 	data->task = g_steal_pointer (&task);
 	data->priority = priority;
+	data->flags = flags;
+#ifdef HAVE_SYSPROF
+	data->queued_time_nsec = SYSPROF_CAPTURE_CURRENT_TIME;
+#endif
+
+	/* Insert after all the tasks with the same or higher priority. */
+	g_mutex_lock (&executor_mutex);
+
+	for (link = self->queue.tail; link != NULL; link = link->prev) {
+		if (((WorkData *) link->data)->priority <= priority)
+			break;
+	}
 
+	if (link != NULL)
+		g_queue_insert_after (&self->queue, link, data);
+	else
+		g_queue_push_head (&self->queue, data);
+
+	if (!(flags & GS_WORKER_THREAD_QUEUE_FLAGS_MUST_SERIALISE))
+		g_cond_signal (&executor_work_cond);
+
+	g_mutex_unlock (&executor_mutex);
+
+	/* Wake the worker thread to run the highest priority task, if a helper
+	 * thread doesn’t get to it first. */
 	g_main_context_invoke_full (self->worker_context, priority,
-				    work_run_cb, g_steal_pointer (&data), (GDestroyNotify) work_data_free);
+				    work_run_cb, self, NULL);
 }
 
 /**
  * gs_worker_thread_is_in_worker_context:
  * @self: a #GsWorkerThread
  *
- * Returns whether the calling thread is the worker thread.
+ * Returns whether the calling thread is the worker thread, or is running a
+ * task stolen from it (see gs_worker_thread_queue_full()).
  *
  * This is intended to be used as a precondition check to ensure that worker
  * code is not accidentally run from the wrong thread.
@@ -320,7 +534,8 @@ gs_worker_thread_queue (GsWorkerThread  *self,
 gboolean
 gs_worker_thread_is_in_worker_context (GsWorkerThread *self)
 {
-	return g_main_context_is_owner (self->worker_context);
+	return (g_main_context_is_owner (self->worker_context) ||
+		g_private_get (&current_worker) == self);
 }
 
 static void shutdown_cb (GTask        *task,
@@ -385,6 +600,16 @@ shutdown_cb (GTask        *task,
 							   GS_WORKER_THREAD_STATE_SHUT_DOWN);
 	g_assert (updated_state);
 
+	/* This is the lowest priority task, so all the others have been taken
+	 * from the queue; wait for any stolen ones to finish, and stop any more
+	 * being looked for. */
+	g_mutex_lock (&executor_mutex);
+	g_assert (g_queue_is_empty (&self->queue));
+	while (self->n_stolen_running > 0)
+		g_cond_wait (&executor_idle_cond, &executor_mutex);
+	g_ptr_array_remove_fast (executor_workers, self);
+	g_mutex_unlock (&executor_mutex);
+
 	/* Tidy up. We can’t join the thread here as this function is executing
 	 * within the thread and that would deadlock. */
 	g_clear_pointer (&self->worker_context, g_main_context_unref);
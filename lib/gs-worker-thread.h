@@ -16,6 +16,22 @@
 
 G_BEGIN_DECLS
 
+/**
+ * GsWorkerThreadQueueFlags:
+ * @GS_WORKER_THREAD_QUEUE_FLAGS_NONE: No flags set; the task may run at the
+ *   same time as other tasks from the same #GsWorkerThread.
+ * @GS_WORKER_THREAD_QUEUE_FLAGS_MUST_SERIALISE: The task must only run in the
+ *   worker thread, one at a time with the other tasks which set this flag.
+ *
+ * Flags for gs_worker_thread_queue_full().
+ *
+ * Since: 46
+ */
+typedef enum {
+	GS_WORKER_THREAD_QUEUE_FLAGS_NONE = 0,
+	GS_WORKER_THREAD_QUEUE_FLAGS_MUST_SERIALISE = 1 << 0,
+} GsWorkerThreadQueueFlags;
+
 #define GS_TYPE_WORKER_THREAD (gs_worker_thread_get_type ())
 
 G_DECLARE_FINAL_TYPE (GsWorkerThread, gs_worker_thread, GS, WORKER_THREAD, GObject)
@@ -26,6 +42,11 @@ void		 gs_worker_thread_queue			(GsWorkerThread  *self,
 							 gint             priority,
 							 GTaskThreadFunc  work_func,
 							 GTask           *task);
+void		 gs_worker_thread_queue_full		(GsWorkerThread           *self,
+							 gint                      priority,
+							 GsWorkerThreadQueueFlags  flags,
+							 GTaskThreadFunc           work_func,
+							 GTask                    *task);
 
 gboolean	 gs_worker_thread_is_in_worker_context	(GsWorkerThread *self);
 
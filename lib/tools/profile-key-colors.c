@@ -14,14 +14,21 @@
 #include <gdk/gdk.h>
 #include <locale.h>
 #include <math.h>
+#include <string.h>
 
-#include "gs-key-colors.h"
+#include "gs-key-colors-private.h"
 
 /* Test program which can be used to check the output and performance of the
  * gs_calculate_key_colors() function. It is linked against libgnomesoftware, so
  * will use the function implementation from there. It outputs a HTML page which
  * lists each icon from the flathub appstream data in your home directory, along
- * with its extracted key colors and how long extraction took. */
+ * with its extracted key colors and how long extraction took, and how long
+ * looking them up in the on-disk cache took afterwards. If the CPU supports the
+ * vectorised implementation of the calculation, the scalar implementation is
+ * timed as well for comparison.
+ *
+ * The cache is stored in a temporary directory, so the first measurements are
+ * always uncached. */
 
 static void
 print_colours (GString *html_output,
@@ -85,9 +92,19 @@ main (void)
 	g_autoptr(GPtrArray) pixbufs = g_ptr_array_new_with_free_func (g_object_unref);
 	g_autoptr(GString) html_output = g_string_new ("");
 	g_autoptr(GArray) durations = g_array_new (FALSE, FALSE, sizeof (gint64));
+	g_autoptr(GArray) cached_durations = g_array_new (FALSE, FALSE, sizeof (gint64));
+	g_autoptr(GArray) scalar_durations = g_array_new (FALSE, FALSE, sizeof (gint64));
+	g_autofree gchar *cache_dir = NULL;
 
 	setlocale (LC_ALL, "");
 
+	/* Use an empty cache, so the uncached timings are accurate. This has
+	 * to be done before g_get_user_cache_dir() is first called. */
+	cache_dir = g_dir_make_tmp ("profile-key-colors-XXXXXX", NULL);
+	if (cache_dir == NULL)
+		return 1;
+	g_setenv ("XDG_CACHE_HOME", cache_dir, TRUE);
+
 	/* Load pixbufs from the icons directory. */
 	dir = g_dir_open (icons_dir, 0, NULL);
 	if (dir == NULL)
@@ -130,6 +147,8 @@ main (void)
 			 "          <td>Icon</td>\n"
 			 "          <td>Code duration (μs)</td>\n"
 			 "          <td>Code colours</td>\n"
+			 "          <td>Cached duration (μs)</td>\n"
+			 "          <td>Scalar code duration (μs)</td>\n"
 			 "        </tr>\n"
 			 "      </thead>\n");
 
@@ -139,14 +158,44 @@ main (void)
 		const gchar *filename = filenames->pdata[i];
 		g_autofree gchar *basename = g_path_get_basename (filename);
 		g_autoptr(GArray) colours = NULL;
-		gint64 start_time, duration;
+		g_autoptr(GArray) cached_colours = NULL;
+		g_autoptr(GArray) scalar_colours = NULL;
+		g_autofree gchar *cache_key = NULL;
+		gint64 start_time, duration, cached_duration, scalar_duration = 0;
+		guint32 seed = g_random_int ();
 
 		g_message ("Processing %u of %u, %s", i + 1, pixbufs->len, filename);
 
+		g_random_set_seed (seed);
 		start_time = g_get_real_time ();
 		colours = gs_calculate_key_colors (pixbuf);
 		duration = g_get_real_time () - start_time;
 
+		/* The initial clusters are random, so use the same seed to get
+		 * comparable timings and identical results */
+		if (gs_key_colors_simd_supported ()) {
+			g_random_set_seed (seed);
+			start_time = g_get_real_time ();
+			scalar_colours = gs_calculate_key_colors_with_impl (pixbuf, GS_KEY_COLORS_IMPL_SCALAR);
+			scalar_duration = g_get_real_time () - start_time;
+
+			if (scalar_colours->len != colours->len ||
+			    memcmp (scalar_colours->data, colours->data, colours->len * sizeof (GdkRGBA)) != 0)
+				g_warning ("Scalar key colours for %s don’t match", filename);
+		}
+
+		cache_key = gs_key_colors_cache_key_for_file (filename);
+		if (cache_key == NULL)
+			return 3;
+		gs_key_colors_cache_insert (cache_key, colours);
+
+		start_time = g_get_real_time ();
+		cached_colours = gs_key_colors_cache_lookup (cache_key);
+		cached_duration = g_get_real_time () - start_time;
+
+		if (cached_colours == NULL || cached_colours->len != colours->len)
+			g_warning ("Cached key colours for %s don’t match", filename);
+
 		g_string_append_printf (html_output,
 					"<tr>\n"
 					"<th>%s</th>\n"
@@ -155,17 +204,28 @@ main (void)
 					"<td>",
 					basename, filename, duration);
 		print_colours (html_output, colours);
-		g_string_append (html_output,
-				 "</td>\n"
-				 "</tr>\n");
+		g_string_append_printf (html_output,
+					"</td>\n"
+					"<td class='number'>%" G_GINT64_FORMAT "</td>\n"
+					"<td class='number'>%" G_GINT64_FORMAT "</td>\n"
+					"</tr>\n",
+					cached_duration, scalar_duration);
 
 		g_array_append_val (durations, duration);
+		g_array_append_val (cached_durations, cached_duration);
+		if (scalar_colours != NULL)
+			g_array_append_val (scalar_durations, scalar_duration);
 	}
 
 	/* Summary statistics for the timings. */
 	g_string_append (html_output, "<tfoot><tr><td></td><td></td><td>");
 	print_summary_statistics (html_output, durations);
-	g_string_append (html_output, "</td><td></td></tr></tfoot>");
+	g_string_append (html_output, "</td><td></td><td>");
+	print_summary_statistics (html_output, cached_durations);
+	g_string_append (html_output, "</td><td>");
+	if (scalar_durations->len > 0)
+		print_summary_statistics (html_output, scalar_durations);
+	g_string_append (html_output, "</td></tr></tfoot>");
 
 	g_string_append (html_output, "</table></body></html>");
 
@@ -15,6 +15,7 @@
 #include <gnome-software.h>
 #include <xmlb.h>
 
+#include "gs-app-private.h"
 #include "gs-appstream.h"
 #include "gs-external-appstream-utils.h"
 #include "gs-plugin-appstream.h"
@@ -30,15 +31,31 @@
  * Refines:     | [source]->[name,summary,pixbuf,id,kind]
  */
 
+/* An index from component ID and package name to the components in the silo,
+ * so that refining an app is a hash table lookup rather than compiling and
+ * running a new XPath query for every app. The arrays of components are in
+ * document order, which is the order the equivalent queries return them in. */
+typedef struct {
+	GHashTable		*components_by_id;  /* (owned) (element-type utf8 GPtrArray<XbNode>), components/component */
+	GHashTable		*components_by_pkgname;  /* (owned) (element-type utf8 GPtrArray<XbNode>), components/component */
+	GHashTable		*appdata_by_id;  /* (owned) (element-type utf8 GPtrArray<XbNode>), top-level component */
+} GsPluginAppstreamRefineIndex;
+
 struct _GsPluginAppstream
 {
 	GsPlugin		 parent;
 
 	GsWorkerThread		*worker;  /* (owned) */
 
-	XbSilo			*silo;
+	XbSilo			*silo;  /* (owned) (nullable) (lock silo_lock) */
 	GRWLock			 silo_lock;
+	GMutex			 silo_build_mutex;  /* held while building a replacement for @silo */
 	GSettings		*settings;
+
+	GsPluginAppstreamRefineIndex *refine_index;  /* (owned) (nullable) (lock refine_index_mutex), for @silo */
+	GMutex			 refine_index_mutex;
+
+	GCancellable		*key_colors_cancellable;  /* (owned) (nullable) (lock silo_build_mutex) */
 };
 
 G_DEFINE_TYPE (GsPluginAppstream, gs_plugin_appstream, GS_TYPE_PLUGIN)
@@ -46,14 +63,28 @@ G_DEFINE_TYPE (GsPluginAppstream, gs_plugin_appstream, GS_TYPE_PLUGIN)
 #define assert_in_worker(self) \
 	g_assert (gs_worker_thread_is_in_worker_context (self->worker))
 
+static void
+refine_index_free (GsPluginAppstreamRefineIndex *refine_index)
+{
+	g_hash_table_unref (refine_index->components_by_id);
+	g_hash_table_unref (refine_index->components_by_pkgname);
+	g_hash_table_unref (refine_index->appdata_by_id);
+	g_free (refine_index);
+}
+
 static void
 gs_plugin_appstream_dispose (GObject *object)
 {
 	GsPluginAppstream *self = GS_PLUGIN_APPSTREAM (object);
 
+	g_cancellable_cancel (self->key_colors_cancellable);
+	g_clear_object (&self->key_colors_cancellable);
 	g_clear_object (&self->silo);
 	g_clear_object (&self->settings);
 	g_rw_lock_clear (&self->silo_lock);
+	g_mutex_clear (&self->silo_build_mutex);
+	g_clear_pointer (&self->refine_index, refine_index_free);
+	g_mutex_clear (&self->refine_index_mutex);
 	g_clear_object (&self->worker);
 
 	G_OBJECT_CLASS (gs_plugin_appstream_parent_class)->dispose (object);
@@ -67,6 +98,8 @@ gs_plugin_appstream_init (GsPluginAppstream *self)
 	/* XbSilo needs external locking as we destroy the silo and build a new
 	 * one when something changes */
 	g_rw_lock_init (&self->silo_lock);
+	g_mutex_init (&self->silo_build_mutex);
+	g_mutex_init (&self->refine_index_mutex);
 
 	/* need package name */
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "dpkg");
@@ -651,33 +684,55 @@ gs_add_appstream_metainfo_location (GPtrArray *locations, const gchar *root)
 			 g_build_filename (root, "appdata", NULL));
 }
 
+/* Replace @self->silo with @silo. Any queries still using the old silo keep
+ * it alive until they finish with it. */
+static void
+gs_plugin_appstream_publish_silo (GsPluginAppstream *self,
+                                  XbSilo            *silo)
+{
+	g_autoptr(XbSilo) old_silo = NULL;
+	g_autoptr(GRWLockWriterLocker) writer_locker = NULL;
+	GsPluginAppstreamRefineIndex *old_refine_index = NULL;
+
+	writer_locker = g_rw_lock_writer_locker_new (&self->silo_lock);
+	old_silo = g_steal_pointer (&self->silo);
+	self->silo = g_object_ref (silo);
+
+	/* the refine index is for the old silo, and is rebuilt on demand */
+	g_mutex_lock (&self->refine_index_mutex);
+	old_refine_index = g_steal_pointer (&self->refine_index);
+	g_mutex_unlock (&self->refine_index_mutex);
+
+	g_clear_pointer (&writer_locker, g_rw_lock_writer_locker_free);
+	g_clear_pointer (&old_refine_index, refine_index_free);
+}
+
+/* Must be called with @self->silo_build_mutex held, but not @self->silo_lock,
+ * so queries can carry on using the old silo while the new one is built. */
 static gboolean
-gs_plugin_appstream_check_silo (GsPluginAppstream  *self,
-                                GCancellable       *cancellable,
-                                GError            **error)
+gs_plugin_appstream_rebuild_silo (GsPluginAppstream  *self,
+                                  GCancellable       *cancellable,
+                                  GError            **error)
 {
 	const gchar *test_xml;
 	g_autofree gchar *blobfn = NULL;
 	g_autoptr(XbBuilder) builder = NULL;
 	g_autoptr(XbNode) n = NULL;
 	g_autoptr(GFile) file = NULL;
+	g_autoptr(XbSilo) silo = NULL;
 	g_autoptr(GRWLockReaderLocker) reader_locker = NULL;
-	g_autoptr(GRWLockWriterLocker) writer_locker = NULL;
 	g_autoptr(GPtrArray) parent_appdata = g_ptr_array_new_with_free_func (g_free);
 	g_autoptr(GPtrArray) parent_appstream = g_ptr_array_new_with_free_func (g_free);
 	const gchar *const *locales = g_get_language_names ();
 	g_autoptr(GMainContext) old_thread_default = NULL;
+	g_autoptr(GError) error_index = NULL;
 
+	/* another task may have regenerated it while waiting for the lock */
 	reader_locker = g_rw_lock_reader_locker_new (&self->silo_lock);
-	/* everything is okay */
 	if (self->silo != NULL && xb_silo_is_valid (self->silo))
 		return TRUE;
 	g_clear_pointer (&reader_locker, g_rw_lock_reader_locker_free);
 
-	/* drat! silo needs regenerating */
-	writer_locker = g_rw_lock_writer_locker_new (&self->silo_lock);
-	g_clear_object (&self->silo);
-
 	/* FIXME: https://gitlab.gnome.org/GNOME/gnome-software/-/issues/1422 */
 	old_thread_default = g_main_context_ref_thread_default ();
 	if (old_thread_default == g_main_context_default ())
@@ -831,11 +886,11 @@ gs_plugin_appstream_check_silo (GsPluginAppstream  *self,
 	if (old_thread_default != NULL)
 		g_main_context_pop_thread_default (old_thread_default);
 
-	self->silo = xb_builder_ensure (builder, file,
-					XB_BUILDER_COMPILE_FLAG_IGNORE_INVALID |
-					XB_BUILDER_COMPILE_FLAG_SINGLE_LANG,
-					NULL, error);
-	if (self->silo == NULL) {
+	silo = xb_builder_ensure (builder, file,
+				  XB_BUILDER_COMPILE_FLAG_IGNORE_INVALID |
+				  XB_BUILDER_COMPILE_FLAG_SINGLE_LANG,
+				  NULL, error);
+	if (silo == NULL) {
 		if (old_thread_default != NULL)
 			g_main_context_push_thread_default (old_thread_default);
 		return FALSE;
@@ -845,7 +900,7 @@ gs_plugin_appstream_check_silo (GsPluginAppstream  *self,
 	for (guint i = 0; i < parent_appstream->len; i++) {
 		const gchar *fn = g_ptr_array_index (parent_appstream, i);
 		g_autoptr(GFile) file_tmp = g_file_new_for_path (fn);
-		if (!xb_silo_watch_file (self->silo, file_tmp, cancellable, error)) {
+		if (!xb_silo_watch_file (silo, file_tmp, cancellable, error)) {
 			if (old_thread_default != NULL)
 				g_main_context_push_thread_default (old_thread_default);
 			return FALSE;
@@ -854,7 +909,7 @@ gs_plugin_appstream_check_silo (GsPluginAppstream  *self,
 	for (guint i = 0; i < parent_appdata->len; i++) {
 		const gchar *fn = g_ptr_array_index (parent_appdata, i);
 		g_autoptr(GFile) file_tmp = g_file_new_for_path (fn);
-		if (!xb_silo_watch_file (self->silo, file_tmp, cancellable, error)) {
+		if (!xb_silo_watch_file (silo, file_tmp, cancellable, error)) {
 			if (old_thread_default != NULL)
 				g_main_context_push_thread_default (old_thread_default);
 			return FALSE;
@@ -864,9 +919,11 @@ gs_plugin_appstream_check_silo (GsPluginAppstream  *self,
 	if (old_thread_default != NULL)
 		g_main_context_push_thread_default (old_thread_default);
 
-	/* test we found something */
-	n = xb_silo_query_first (self->silo, "components/component", NULL);
+	/* test we found something; the silo is still used, so this isn’t
+	 * retried until something changes */
+	n = xb_silo_query_first (silo, "components/component", NULL);
 	if (n == NULL) {
+		gs_plugin_appstream_publish_silo (self, silo);
 		g_warning ("No AppStream data, try 'make install-sample-data' in data/");
 		g_set_error (error,
 			     GS_PLUGIN_ERROR,
@@ -875,10 +932,67 @@ gs_plugin_appstream_check_silo (GsPluginAppstream  *self,
 		return FALSE;
 	}
 
+	/* precompile the search index; searching still works without it */
+	if (!gs_appstream_silo_build_search_index (silo, cancellable, &error_index)) {
+		if (g_cancellable_set_error_if_cancelled (cancellable, error))
+			return FALSE;
+		g_debug ("failed to build search index: %s", error_index->message);
+	}
+
+	gs_plugin_appstream_publish_silo (self, silo);
+
+	/* anything refined from the old silo is now out of date */
+	gs_app_invalidate_all_refined_flags ();
+
+	/* warm the key colors cache for the overview page, in the background
+	 * so the silo build isn’t held up, and stopping any calculation for
+	 * the previous silo */
+	g_cancellable_cancel (self->key_colors_cancellable);
+	g_clear_object (&self->key_colors_cancellable);
+	self->key_colors_cancellable = g_cancellable_new ();
+	gs_appstream_precompute_key_colors (silo, self->key_colors_cancellable);
+
 	/* success */
 	return TRUE;
 }
 
+/* Ensure @self->silo is up to date, rebuilding it if needed.
+ *
+ * If another thread is already rebuilding it, and @wait_for_rebuild is
+ * %FALSE, this returns immediately so the caller can query the old silo
+ * rather than stalling until the rebuild is finished. */
+static gboolean
+gs_plugin_appstream_check_silo (GsPluginAppstream  *self,
+                                gboolean            wait_for_rebuild,
+                                GCancellable       *cancellable,
+                                GError            **error)
+{
+	g_autoptr(GRWLockReaderLocker) reader_locker = NULL;
+	gboolean have_silo;
+	gboolean ret;
+
+	reader_locker = g_rw_lock_reader_locker_new (&self->silo_lock);
+	/* everything is okay */
+	if (self->silo != NULL && xb_silo_is_valid (self->silo))
+		return TRUE;
+	have_silo = (self->silo != NULL);
+	g_clear_pointer (&reader_locker, g_rw_lock_reader_locker_free);
+
+	/* drat! silo needs regenerating */
+	if (!g_mutex_trylock (&self->silo_build_mutex)) {
+		if (have_silo && !wait_for_rebuild) {
+			g_debug ("using old silo while it is rebuilt");
+			return TRUE;
+		}
+		g_mutex_lock (&self->silo_build_mutex);
+	}
+
+	ret = gs_plugin_appstream_rebuild_silo (self, cancellable, error);
+	g_mutex_unlock (&self->silo_build_mutex);
+
+	return ret;
+}
+
 static gint
 get_priority_for_interactivity (gboolean interactive)
 {
@@ -922,7 +1036,7 @@ setup_thread_cb (GTask        *task,
 
 	assert_in_worker (self);
 
-	if (!gs_plugin_appstream_check_silo (self, cancellable, &local_error))
+	if (!gs_plugin_appstream_check_silo (self, TRUE, cancellable, &local_error))
 		g_task_return_error (task, g_steal_pointer (&local_error));
 	else
 		g_task_return_boolean (task, TRUE);
@@ -995,7 +1109,7 @@ gs_plugin_url_to_app (GsPlugin *plugin,
 	g_autoptr(GRWLockReaderLocker) locker = NULL;
 
 	/* check silo is valid */
-	if (!gs_plugin_appstream_check_silo (self, cancellable, error))
+	if (!gs_plugin_appstream_check_silo (self, FALSE, cancellable, error))
 		return FALSE;
 
 	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
@@ -1048,15 +1162,211 @@ gs_plugin_appstream_set_compulsory_quirk (GsApp *app, XbNode *component)
 	}
 }
 
+static void
+refine_index_add (GHashTable  *table,
+                  const gchar *key,
+                  XbNode      *component)
+{
+	GPtrArray *components;
+
+	if (key == NULL)
+		return;
+
+	components = g_hash_table_lookup (table, key);
+	if (components == NULL) {
+		components = g_ptr_array_new_with_free_func (g_object_unref);
+		g_hash_table_insert (table, (gpointer) key, components);
+	}
+	g_ptr_array_add (components, g_object_ref (component));
+}
+
+/* The keys are strings from @silo, which the components in the index keep
+ * alive. */
+static GsPluginAppstreamRefineIndex *
+refine_index_new (XbSilo  *silo,
+                  GError **error)
+{
+	g_autoptr(GPtrArray) components = NULL;
+	g_autoptr(GPtrArray) appdata = NULL;
+	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GTimer) timer = g_timer_new ();
+	GsPluginAppstreamRefineIndex *refine_index;
+
+	components = xb_silo_query (silo, "components/component", 0, &error_local);
+	if (components == NULL) {
+		if (!g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+			g_propagate_error (error, g_steal_pointer (&error_local));
+			return NULL;
+		}
+		components = g_ptr_array_new_with_free_func (g_object_unref);
+	}
+	g_clear_error (&error_local);
+
+	appdata = xb_silo_query (silo, "component", 0, &error_local);
+	if (appdata == NULL) {
+		if (!g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+			g_propagate_error (error, g_steal_pointer (&error_local));
+			return NULL;
+		}
+		appdata = g_ptr_array_new_with_free_func (g_object_unref);
+	}
+
+	refine_index = g_new0 (GsPluginAppstreamRefineIndex, 1);
+	refine_index->components_by_id = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) g_ptr_array_unref);
+	refine_index->components_by_pkgname = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) g_ptr_array_unref);
+	refine_index->appdata_by_id = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) g_ptr_array_unref);
+
+	for (guint i = 0; i < components->len; i++) {
+		XbNode *component = g_ptr_array_index (components, i);
+		g_autoptr(GPtrArray) children = xb_node_get_children (component);
+
+		for (guint j = 0; j < children->len; j++) {
+			XbNode *n = g_ptr_array_index (children, j);
+			const gchar *element = xb_node_get_element (n);
+
+			if (g_strcmp0 (element, "id") == 0)
+				refine_index_add (refine_index->components_by_id, xb_node_get_text (n), component);
+			else if (g_strcmp0 (element, "pkgname") == 0)
+				refine_index_add (refine_index->components_by_pkgname, xb_node_get_text (n), component);
+		}
+	}
+
+	for (guint i = 0; i < appdata->len; i++) {
+		XbNode *component = g_ptr_array_index (appdata, i);
+		g_autoptr(GPtrArray) children = xb_node_get_children (component);
+
+		for (guint j = 0; j < children->len; j++) {
+			XbNode *n = g_ptr_array_index (children, j);
+			if (g_strcmp0 (xb_node_get_element (n), "id") == 0)
+				refine_index_add (refine_index->appdata_by_id, xb_node_get_text (n), component);
+		}
+	}
+
+	g_debug ("built refine index for %u components in %.0fms",
+		 components->len + appdata->len, g_timer_elapsed (timer, NULL) * 1000);
+
+	return refine_index;
+}
+
+/* Get the refine index for @self->silo, building it if needed.
+ *
+ * Must be called with @self->silo_lock held for reading, and the returned
+ * index is only valid while it is held. */
+static GsPluginAppstreamRefineIndex *
+gs_plugin_appstream_ensure_refine_index (GsPluginAppstream  *self,
+                                         GError            **error)
+{
+	GsPluginAppstreamRefineIndex *refine_index;
+
+	g_mutex_lock (&self->refine_index_mutex);
+	if (self->refine_index == NULL)
+		self->refine_index = refine_index_new (self->silo, error);
+	refine_index = self->refine_index;
+	g_mutex_unlock (&self->refine_index_mutex);
+
+	return refine_index;
+}
+
+static gboolean
+component_has_child (XbNode      *component,
+                     const gchar *element)
+{
+	g_autoptr(GPtrArray) children = xb_node_get_children (component);
+
+	for (guint i = 0; i < children->len; i++) {
+		if (g_strcmp0 (xb_node_get_element (g_ptr_array_index (children, i)), element) == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gboolean
+component_has_origin (XbNode      *component,
+                      const gchar *origin)
+{
+	g_autoptr(XbNode) parent = NULL;
+
+	if (origin == NULL)
+		return TRUE;
+
+	parent = xb_node_get_parent (component);
+	return parent != NULL && g_strcmp0 (xb_node_get_attr (parent, "origin"), origin) == 0;
+}
+
+static void
+add_component_if_new (GPtrArray *components,
+                      XbNode    *component)
+{
+	if (!g_ptr_array_find (components, component, NULL))
+		g_ptr_array_add (components, g_object_ref (component));
+}
+
+/* Equivalent to the union of these queries, in this order:
+ *  - components[@origin=$origin]/component/id[text()=$id]/../pkgname/..
+ *  - components[@origin=$origin]/component[@type='web-application']/id[text()=$id]/..
+ *  - component/id[text()=$id]/..
+ * where @origin may be %NULL to match components from any origin. */
+static GPtrArray *
+refine_index_lookup_id (GsPluginAppstreamRefineIndex *refine_index,
+                        const gchar                  *origin,
+                        const gchar                  *id)
+{
+	GPtrArray *by_id = g_hash_table_lookup (refine_index->components_by_id, id);
+	GPtrArray *appdata = g_hash_table_lookup (refine_index->appdata_by_id, id);
+	g_autoptr(GPtrArray) components = g_ptr_array_new_with_free_func (g_object_unref);
+
+	for (guint i = 0; by_id != NULL && i < by_id->len; i++) {
+		XbNode *component = g_ptr_array_index (by_id, i);
+		if (component_has_origin (component, origin) &&
+		    component_has_child (component, "pkgname"))
+			add_component_if_new (components, component);
+	}
+	for (guint i = 0; by_id != NULL && i < by_id->len; i++) {
+		XbNode *component = g_ptr_array_index (by_id, i);
+		if (component_has_origin (component, origin) &&
+		    g_strcmp0 (xb_node_get_attr (component, "type"), "web-application") == 0)
+			add_component_if_new (components, component);
+	}
+	for (guint i = 0; appdata != NULL && i < appdata->len; i++)
+		add_component_if_new (components, g_ptr_array_index (appdata, i));
+
+	return g_steal_pointer (&components);
+}
+
+/* Equivalent to the first result of the union of these queries:
+ *  - components/component[@type='desktop-application']/pkgname[text()=$pkgname]/..
+ *  - components/component[@type='console-application']/pkgname[text()=$pkgname]/..
+ *  - components/component[@type='web-application']/pkgname[text()=$pkgname]/..
+ *  - components/component/pkgname[text()=$pkgname]/.. */
+static XbNode *
+refine_index_lookup_pkgname (GsPluginAppstreamRefineIndex *refine_index,
+                             const gchar                  *pkgname)
+{
+	const gchar *preferred_types[] = { "desktop-application", "console-application", "web-application" };
+	GPtrArray *by_pkgname = g_hash_table_lookup (refine_index->components_by_pkgname, pkgname);
+
+	if (by_pkgname == NULL)
+		return NULL;
+
+	for (gsize i = 0; i < G_N_ELEMENTS (preferred_types); i++) {
+		for (guint j = 0; j < by_pkgname->len; j++) {
+			XbNode *component = g_ptr_array_index (by_pkgname, j);
+			if (g_strcmp0 (xb_node_get_attr (component, "type"), preferred_types[i]) == 0)
+				return component;
+		}
+	}
+
+	return g_ptr_array_index (by_pkgname, 0);
+}
+
 static gboolean
 gs_plugin_appstream_refine_state (GsPluginAppstream  *self,
                                   GsApp              *app,
                                   GError            **error)
 {
-	g_autofree gchar *xpath = NULL;
-	g_autoptr(GError) error_local = NULL;
 	g_autoptr(GRWLockReaderLocker) locker = NULL;
-	g_autoptr(XbNode) component = NULL;
+	GsPluginAppstreamRefineIndex *refine_index;
 
 	/* Ignore apps with no ID */
 	if (gs_app_get_id (app) == NULL)
@@ -1064,14 +1374,12 @@ gs_plugin_appstream_refine_state (GsPluginAppstream  *self,
 
 	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
 
-	xpath = g_strdup_printf ("component/id[text()='%s']", gs_app_get_id (app));
-	component = xb_silo_query_first (self->silo, xpath, &error_local);
-	if (component == NULL) {
-		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-			return TRUE;
-		g_propagate_error (error, g_steal_pointer (&error_local));
+	/* installed AppData files are top-level components */
+	refine_index = gs_plugin_appstream_ensure_refine_index (self, error);
+	if (refine_index == NULL)
 		return FALSE;
-	}
+	if (!g_hash_table_contains (refine_index->appdata_by_id, gs_app_get_id (app)))
+		return TRUE;
 	gs_app_set_state (app, GS_APP_STATE_INSTALLED);
 	return TRUE;
 }
@@ -1084,10 +1392,9 @@ gs_plugin_refine_from_id (GsPluginAppstream    *self,
                           GError              **error)
 {
 	const gchar *id, *origin;
-	g_autoptr(GError) error_local = NULL;
 	g_autoptr(GRWLockReaderLocker) locker = NULL;
-	g_autoptr(GString) xpath = g_string_new (NULL);
 	g_autoptr(GPtrArray) components = NULL;
+	GsPluginAppstreamRefineIndex *refine_index;
 
 	/* not enough info to find */
 	id = gs_app_get_id (app);
@@ -1097,23 +1404,17 @@ gs_plugin_refine_from_id (GsPluginAppstream    *self,
 	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
 
 	origin = gs_app_get_origin_appstream (app);
+	if (origin != NULL && *origin == '\0')
+		origin = NULL;
 
-	/* look in AppStream then fall back to AppData */
-	if (origin && *origin) {
-		xb_string_append_union (xpath, "components[@origin='%s']/component/id[text()='%s']/../pkgname/..", origin, id);
-		xb_string_append_union (xpath, "components[@origin='%s']/component[@type='web-application']/id[text()='%s']/..", origin, id);
-	} else {
-		xb_string_append_union (xpath, "components/component/id[text()='%s']/../pkgname/..", id);
-		xb_string_append_union (xpath, "components/component[@type='web-application']/id[text()='%s']/..", id);
-	}
-	xb_string_append_union (xpath, "component/id[text()='%s']/..", id);
-	components = xb_silo_query (self->silo, xpath->str, 0, &error_local);
-	if (components == NULL) {
-		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-			return TRUE;
-		g_propagate_error (error, g_steal_pointer (&error_local));
+	refine_index = gs_plugin_appstream_ensure_refine_index (self, error);
+	if (refine_index == NULL)
 		return FALSE;
-	}
+
+	/* look in AppStream then fall back to AppData */
+	components = refine_index_lookup_id (refine_index, origin, id);
+	if (components->len == 0)
+		return TRUE;
 	for (guint i = 0; i < components->len; i++) {
 		XbNode *component = g_ptr_array_index (components, i);
 		if (!gs_appstream_refine_app (GS_PLUGIN (self), app, self->silo,
@@ -1140,7 +1441,6 @@ gs_plugin_refine_from_pkgname (GsPluginAppstream    *self,
                                GError              **error)
 {
 	GPtrArray *sources = gs_app_get_sources (app);
-	g_autoptr(GError) error_local = NULL;
 
 	/* not enough info to find */
 	if (sources->len == 0)
@@ -1150,23 +1450,19 @@ gs_plugin_refine_from_pkgname (GsPluginAppstream    *self,
 	for (guint j = 0; j < sources->len; j++) {
 		const gchar *pkgname = g_ptr_array_index (sources, j);
 		g_autoptr(GRWLockReaderLocker) locker = NULL;
-		g_autoptr(GString) xpath = g_string_new (NULL);
-		g_autoptr(XbNode) component = NULL;
+		GsPluginAppstreamRefineIndex *refine_index;
+		XbNode *component;
 
 		locker = g_rw_lock_reader_locker_new (&self->silo_lock);
 
-		/* prefer actual apps and then fallback to anything else */
-		xb_string_append_union (xpath, "components/component[@type='desktop-application']/pkgname[text()='%s']/..", pkgname);
-		xb_string_append_union (xpath, "components/component[@type='console-application']/pkgname[text()='%s']/..", pkgname);
-		xb_string_append_union (xpath, "components/component[@type='web-application']/pkgname[text()='%s']/..", pkgname);
-		xb_string_append_union (xpath, "components/component/pkgname[text()='%s']/..", pkgname);
-		component = xb_silo_query_first (self->silo, xpath->str, &error_local);
-		if (component == NULL) {
-			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-				continue;
-			g_propagate_error (error, g_steal_pointer (&error_local));
+		refine_index = gs_plugin_appstream_ensure_refine_index (self, error);
+		if (refine_index == NULL)
 			return FALSE;
-		}
+
+		/* prefer actual apps and then fallback to anything else */
+		component = refine_index_lookup_pkgname (refine_index, pkgname);
+		if (component == NULL)
+			continue;
 		if (!gs_appstream_refine_app (GS_PLUGIN (self), app, self->silo, component, flags, error))
 			return FALSE;
 		gs_plugin_appstream_set_compulsory_quirk (app, component);
@@ -1202,9 +1498,11 @@ gs_plugin_appstream_refine_async (GsPlugin            *plugin,
 	task = gs_plugin_refine_data_new_task (plugin, list, flags, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_plugin_appstream_refine_async);
 
-	/* Queue a job for the refine. */
-	gs_worker_thread_queue (self->worker, get_priority_for_interactivity (interactive),
-				refine_thread_cb, g_steal_pointer (&task));
+	/* Queue a job for the refine. It only reads the silo, under
+	 * @silo_lock, so can run alongside other such jobs. */
+	gs_worker_thread_queue_full (self->worker, get_priority_for_interactivity (interactive),
+				     GS_WORKER_THREAD_QUEUE_FLAGS_NONE,
+				     refine_thread_cb, g_steal_pointer (&task));
 }
 
 static gboolean refine_wildcard (GsPluginAppstream    *self,
@@ -1232,7 +1530,7 @@ refine_thread_cb (GTask        *task,
 	assert_in_worker (self);
 
 	/* check silo is valid */
-	if (!gs_plugin_appstream_check_silo (self, cancellable, &local_error)) {
+	if (!gs_plugin_appstream_check_silo (self, FALSE, cancellable, &local_error)) {
 		g_task_return_error (task, g_steal_pointer (&local_error));
 		return;
 	}
@@ -1376,8 +1674,9 @@ gs_plugin_appstream_refine_categories_async (GsPlugin                      *plug
 	}
 
 	/* Queue a job to get the apps. */
-	gs_worker_thread_queue (self->worker, get_priority_for_interactivity (interactive),
-				refine_categories_thread_cb, g_steal_pointer (&task));
+	gs_worker_thread_queue_full (self->worker, get_priority_for_interactivity (interactive),
+				     GS_WORKER_THREAD_QUEUE_FLAGS_NONE,
+				     refine_categories_thread_cb, g_steal_pointer (&task));
 }
 
 /* Run in @worker. */
@@ -1395,7 +1694,7 @@ refine_categories_thread_cb (GTask        *task,
 	assert_in_worker (self);
 
 	/* check silo is valid */
-	if (!gs_plugin_appstream_check_silo (self, cancellable, &local_error)) {
+	if (!gs_plugin_appstream_check_silo (self, FALSE, cancellable, &local_error)) {
 		g_task_return_error (task, g_steal_pointer (&local_error));
 		return;
 	}
@@ -1440,8 +1739,9 @@ gs_plugin_appstream_list_apps_async (GsPlugin              *plugin,
 	g_task_set_source_tag (task, gs_plugin_appstream_list_apps_async);
 
 	/* Queue a job to get the apps. */
-	gs_worker_thread_queue (self->worker, get_priority_for_interactivity (interactive),
-				list_apps_thread_cb, g_steal_pointer (&task));
+	gs_worker_thread_queue_full (self->worker, get_priority_for_interactivity (interactive),
+				     GS_WORKER_THREAD_QUEUE_FLAGS_NONE,
+				     list_apps_thread_cb, g_steal_pointer (&task));
 }
 
 /* Run in @worker. */
@@ -1485,7 +1785,33 @@ list_apps_thread_cb (GTask        *task,
 		age_secs = g_date_time_difference (now, released_since) / G_TIME_SPAN_SECOND;
 	}
 
-	/* Currently only support a subset of query properties, and only one set at once.
+	/* Queries with several properties set are evaluated in a single pass
+	 * over the silo, for the subset of properties which can be combined. */
+	if (data->query != NULL && gs_app_query_get_n_properties_set (data->query) > 1) {
+		if (!gs_appstream_query_is_compound_supported (data->query)) {
+			g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+						 "Unsupported query");
+			return;
+		}
+
+		if (!gs_plugin_appstream_check_silo (self, FALSE, cancellable, &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+			return;
+		}
+
+		locker = g_rw_lock_reader_locker_new (&self->silo_lock);
+
+		if (!gs_appstream_add_apps_for_query (GS_PLUGIN (self), self->silo, data->query, list,
+						      cancellable, &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+			return;
+		}
+
+		g_task_return_pointer (task, g_steal_pointer (&list), g_object_unref);
+		return;
+	}
+
+	/* Otherwise only support a subset of query properties.
 	 * Also don’t currently support GS_APP_QUERY_TRISTATE_FALSE. */
 	if ((released_since == NULL &&
 	     is_curated == GS_APP_QUERY_TRISTATE_UNSET &&
@@ -1506,7 +1832,7 @@ list_apps_thread_cb (GTask        *task,
 	}
 
 	/* check silo is valid */
-	if (!gs_plugin_appstream_check_silo (self, cancellable, &local_error)) {
+	if (!gs_plugin_appstream_check_silo (self, FALSE, cancellable, &local_error)) {
 		g_task_return_error (task, g_steal_pointer (&local_error));
 		return;
 	}
@@ -1618,7 +1944,7 @@ refresh_metadata_thread_cb (GTask        *task,
 	assert_in_worker (self);
 
 	/* Checking the silo will refresh it if needed. */
-	if (!gs_plugin_appstream_check_silo (self, cancellable, &local_error))
+	if (!gs_plugin_appstream_check_silo (self, TRUE, cancellable, &local_error))
 		g_task_return_error (task, g_steal_pointer (&local_error));
 	else
 		g_task_return_boolean (task, TRUE);
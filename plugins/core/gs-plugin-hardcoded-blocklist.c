@@ -17,7 +17,7 @@
  * SECTION:
  * Blocklists some applications based on a hardcoded list.
  *
- * This plugin executes entirely in the main thread.
+ * Refining is done in a #GTask worker thread.
  */
 
 struct _GsPluginHardcodedBlocklist
@@ -32,6 +32,9 @@ gs_plugin_hardcoded_blocklist_init (GsPluginHardcodedBlocklist *self)
 {
 	/* need ID */
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "appstream");
+
+	/* only reads the ID, and sets a quirk which no refine depends on */
+	gs_plugin_set_refine_dependencies (GS_PLUGIN (self), 0, 0);
 }
 
 static gboolean
@@ -72,6 +75,11 @@ refine_app (GsPlugin             *plugin,
 	return TRUE;
 }
 
+static void refine_thread_cb (GTask        *task,
+                              gpointer      source_object,
+                              gpointer      task_data,
+                              GCancellable *cancellable);
+
 static void
 gs_plugin_hardcoded_blocklist_refine_async (GsPlugin            *plugin,
                                             GsAppList           *list,
@@ -81,14 +89,27 @@ gs_plugin_hardcoded_blocklist_refine_async (GsPlugin            *plugin,
                                             gpointer             user_data)
 {
 	g_autoptr(GTask) task = NULL;
-	g_autoptr(GError) local_error = NULL;
 
-	task = g_task_new (plugin, cancellable, callback, user_data);
+	task = gs_plugin_refine_data_new_task (plugin, list, flags, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_plugin_hardcoded_blocklist_refine_async);
 
-	for (guint i = 0; i < gs_app_list_length (list); i++) {
-		GsApp *app = gs_app_list_index (list, i);
-		if (!refine_app (plugin, app, flags, cancellable, &local_error)) {
+	g_task_run_in_thread (task, refine_thread_cb);
+}
+
+/* Run in a #GTask worker thread. */
+static void
+refine_thread_cb (GTask        *task,
+                  gpointer      source_object,
+                  gpointer      task_data,
+                  GCancellable *cancellable)
+{
+	GsPlugin *plugin = GS_PLUGIN (source_object);
+	GsPluginRefineData *data = task_data;
+	g_autoptr(GError) local_error = NULL;
+
+	for (guint i = 0; i < gs_app_list_length (data->list); i++) {
+		GsApp *app = gs_app_list_index (data->list, i);
+		if (!refine_app (plugin, app, data->flags, cancellable, &local_error)) {
 			g_task_return_error (task, g_steal_pointer (&local_error));
 			return;
 		}
@@ -45,6 +45,11 @@ gs_plugin_icons_init (GsPluginIcons *self)
 	/* needs remote icons downloaded */
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "appstream");
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "epiphany");
+
+	/* only loads icons which other plugins have already added */
+	gs_plugin_set_refine_dependencies (GS_PLUGIN (self),
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON,
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON);
 }
 
 static void
@@ -19,7 +19,8 @@
  * Marks the application as Free Software if it comes from an origin
  * that is recognized as being DFSGish-free.
  *
- * This plugin executes entirely in the main thread.
+ * The settings are loaded in the main thread, and refining is done in a
+ * #GTask worker thread.
  */
 
 struct _GsPluginProvenanceLicense {
@@ -91,6 +92,10 @@ gs_plugin_provenance_license_init (GsPluginProvenanceLicense *self)
 
 	/* need this set */
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "provenance");
+	gs_plugin_set_refine_dependencies (GS_PLUGIN (self),
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_PROVENANCE,
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE);
 }
 
 static void
@@ -106,9 +111,10 @@ gs_plugin_provenance_license_dispose (GObject *object)
 }
 
 static gboolean
-refine_app (GsPluginProvenanceLicense  *self,
-            GsApp                      *app,
+refine_app (GsApp                      *app,
             GsPluginRefineFlags         flags,
+            gchar                     **sources,
+            const gchar                *license_id,
             GCancellable               *cancellable,
             GError                    **error)
 {
@@ -123,17 +129,38 @@ refine_app (GsPluginProvenanceLicense  *self,
 		return TRUE;
 
 	/* nothing to search */
-	if (self->sources == NULL || self->sources[0] == NULL)
+	if (sources == NULL || sources[0] == NULL)
 		return TRUE;
 
 	/* simple case */
 	origin = gs_app_get_origin (app);
-	if (origin != NULL && gs_utils_strv_fnmatch (self->sources, origin))
-		gs_app_set_license (app, GS_APP_QUALITY_NORMAL, self->license_id);
+	if (origin != NULL && gs_utils_strv_fnmatch (sources, origin))
+		gs_app_set_license (app, GS_APP_QUALITY_NORMAL, license_id);
 
 	return TRUE;
 }
 
+typedef struct {
+	GsAppList *list;  /* (owned) (not nullable) */
+	GsPluginRefineFlags flags;
+	gchar **sources;  /* (owned) (not nullable) */
+	gchar *license_id;  /* (owned) (nullable) */
+} RefineData;
+
+static void
+refine_data_free (RefineData *data)
+{
+	g_clear_object (&data->list);
+	g_strfreev (data->sources);
+	g_free (data->license_id);
+	g_free (data);
+}
+
+static void refine_thread_cb (GTask        *task,
+                              gpointer      source_object,
+                              gpointer      task_data,
+                              GCancellable *cancellable);
+
 static void
 gs_plugin_provenance_license_refine_async (GsPlugin            *plugin,
                                            GsAppList           *list,
@@ -144,7 +171,7 @@ gs_plugin_provenance_license_refine_async (GsPlugin            *plugin,
 {
 	GsPluginProvenanceLicense *self = GS_PLUGIN_PROVENANCE_LICENSE (plugin);
 	g_autoptr(GTask) task = NULL;
-	g_autoptr(GError) local_error = NULL;
+	RefineData *data;
 
 	task = g_task_new (plugin, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_plugin_provenance_license_refine_async);
@@ -161,9 +188,31 @@ gs_plugin_provenance_license_refine_async (GsPlugin            *plugin,
 		return;
 	}
 
-	for (guint i = 0; i < gs_app_list_length (list); i++) {
-		GsApp *app = gs_app_list_index (list, i);
-		if (!refine_app (self, app, flags, cancellable, &local_error)) {
+	/* copy the settings, as they can change in the main thread */
+	data = g_new0 (RefineData, 1);
+	data->list = g_object_ref (list);
+	data->flags = flags;
+	data->sources = g_strdupv (self->sources);
+	data->license_id = g_strdup (self->license_id);
+	g_task_set_task_data (task, data, (GDestroyNotify) refine_data_free);
+
+	g_task_run_in_thread (task, refine_thread_cb);
+}
+
+/* Run in a #GTask worker thread. */
+static void
+refine_thread_cb (GTask        *task,
+                  gpointer      source_object,
+                  gpointer      task_data,
+                  GCancellable *cancellable)
+{
+	RefineData *data = task_data;
+	g_autoptr(GError) local_error = NULL;
+
+	for (guint i = 0; i < gs_app_list_length (data->list); i++) {
+		GsApp *app = gs_app_list_index (data->list, i);
+		if (!refine_app (app, data->flags, data->sources, data->license_id,
+				 cancellable, &local_error)) {
 			g_task_return_error (task, g_steal_pointer (&local_error));
 			return;
 		}
@@ -18,7 +18,8 @@
  * Sets the package provenance to TRUE if installed by an official
  * software source. Also sets compulsory quirk when a required repository.
  *
- * This plugin executes entirely in the main thread.
+ * The settings are loaded in the main thread, and refining is done in a
+ * #GTask worker thread.
  */
 
 struct _GsPluginProvenance {
@@ -135,6 +136,12 @@ gs_plugin_provenance_init (GsPluginProvenance *self)
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "dummy");
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "packagekit");
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "rpm-ostree");
+
+	/* only looks at the origin and ID to set quirks */
+	gs_plugin_set_refine_dependencies (GS_PLUGIN (self),
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_SETUP_ACTION,
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_PROVENANCE);
 }
 
 static void
@@ -220,6 +227,29 @@ refine_app (GsPlugin             *plugin,
 	return TRUE;
 }
 
+typedef struct {
+	GsAppList *list;  /* (owned) (not nullable) */
+	GsPluginRefineFlags flags;
+	GHashTable *repos;  /* (owned) (not nullable) */
+	GPtrArray *provenance_wildcards;  /* (owned) (nullable) */
+	GPtrArray *compulsory_wildcards;  /* (owned) (nullable) */
+} RefineData;
+
+static void
+refine_data_free (RefineData *data)
+{
+	g_clear_object (&data->list);
+	g_clear_pointer (&data->repos, g_hash_table_unref);
+	g_clear_pointer (&data->provenance_wildcards, g_ptr_array_unref);
+	g_clear_pointer (&data->compulsory_wildcards, g_ptr_array_unref);
+	g_free (data);
+}
+
+static void refine_thread_cb (GTask        *task,
+                              gpointer      source_object,
+                              gpointer      task_data,
+                              GCancellable *cancellable);
+
 static void
 gs_plugin_provenance_refine_async (GsPlugin            *plugin,
                                    GsAppList           *list,
@@ -230,10 +260,7 @@ gs_plugin_provenance_refine_async (GsPlugin            *plugin,
 {
 	GsPluginProvenance *self = GS_PLUGIN_PROVENANCE (plugin);
 	g_autoptr(GTask) task = NULL;
-	g_autoptr(GError) local_error = NULL;
-	g_autoptr(GHashTable) repos = NULL;
-	g_autoptr(GPtrArray) provenance_wildcards = NULL;
-	g_autoptr(GPtrArray) compulsory_wildcards = NULL;
+	RefineData *data;
 
 	task = g_task_new (plugin, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_plugin_provenance_refine_async);
@@ -244,19 +271,45 @@ gs_plugin_provenance_refine_async (GsPlugin            *plugin,
 		return;
 	}
 
-	repos = g_hash_table_ref (self->repos);
-	provenance_wildcards = self->provenance_wildcards != NULL ? g_ptr_array_ref (self->provenance_wildcards) : NULL;
-	compulsory_wildcards = self->compulsory_wildcards != NULL ? g_ptr_array_ref (self->compulsory_wildcards) : NULL;
-
 	/* nothing to search */
-	if (g_hash_table_size (repos) == 0 && provenance_wildcards == NULL && compulsory_wildcards == NULL) {
+	if (g_hash_table_size (self->repos) == 0 &&
+	    self->provenance_wildcards == NULL &&
+	    self->compulsory_wildcards == NULL) {
 		g_task_return_boolean (task, TRUE);
 		return;
 	}
 
-	for (guint i = 0; i < gs_app_list_length (list); i++) {
-		GsApp *app = gs_app_list_index (list, i);
-		if (!refine_app (plugin, app, flags, repos, provenance_wildcards, compulsory_wildcards, cancellable, &local_error)) {
+	/* the settings are replaced, not modified, when they change, so the
+	 * thread can use the current ones without locking */
+	data = g_new0 (RefineData, 1);
+	data->list = g_object_ref (list);
+	data->flags = flags;
+	data->repos = g_hash_table_ref (self->repos);
+	data->provenance_wildcards = self->provenance_wildcards != NULL ? g_ptr_array_ref (self->provenance_wildcards) : NULL;
+	data->compulsory_wildcards = self->compulsory_wildcards != NULL ? g_ptr_array_ref (self->compulsory_wildcards) : NULL;
+	g_task_set_task_data (task, data, (GDestroyNotify) refine_data_free);
+
+	/* matching against the wildcards is slow for big lists, so do it off
+	 * the main thread, where it can run alongside other plugins’ refines */
+	g_task_run_in_thread (task, refine_thread_cb);
+}
+
+/* Run in a #GTask worker thread. */
+static void
+refine_thread_cb (GTask        *task,
+                  gpointer      source_object,
+                  gpointer      task_data,
+                  GCancellable *cancellable)
+{
+	GsPlugin *plugin = GS_PLUGIN (source_object);
+	RefineData *data = task_data;
+	g_autoptr(GError) local_error = NULL;
+
+	for (guint i = 0; i < gs_app_list_length (data->list); i++) {
+		GsApp *app = gs_app_list_index (data->list, i);
+		if (!refine_app (plugin, app, data->flags, data->repos,
+				 data->provenance_wildcards, data->compulsory_wildcards,
+				 cancellable, &local_error)) {
 			g_task_return_error (task, g_steal_pointer (&local_error));
 			return;
 		}
@@ -65,6 +65,245 @@ gs_plugins_core_search_repo_name_func (GsPluginLoader *plugin_loader)
 	g_assert_cmpint (gs_app_get_kind (app), ==, AS_COMPONENT_KIND_DESKTOP_APP);
 }
 
+static GsAppList *
+search_keywords (GsPluginLoader      *plugin_loader,
+		 const gchar * const *keywords)
+{
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GsAppList) list = NULL;
+	g_autoptr(GsPluginJob) plugin_job = NULL;
+	g_autoptr(GsAppQuery) query = NULL;
+
+	query = gs_app_query_new ("keywords", keywords,
+				  "dedupe-flags", GS_PLUGIN_JOB_DEDUPE_FLAGS_DEFAULT,
+				  "sort-func", gs_utils_app_sort_match_value,
+				  NULL);
+	plugin_job = gs_plugin_job_list_apps_new (query, GS_PLUGIN_LIST_APPS_FLAGS_NONE);
+
+	list = gs_plugin_loader_job_process (plugin_loader, plugin_job, NULL, &error);
+	gs_test_flush_main_context ();
+	g_assert_no_error (error);
+	g_assert_nonnull (list);
+
+	return g_steal_pointer (&list);
+}
+
+static void
+gs_plugins_core_search_index_func (GsPluginLoader *plugin_loader)
+{
+	GsApp *app;
+	g_autoptr(GsAppList) list_prefix = NULL;
+	g_autoptr(GsAppList) list_substring = NULL;
+	g_autoptr(GsAppList) list_none = NULL;
+	const gchar *keywords_prefix[] = { "arach", NULL };
+	const gchar *keywords_substring[] = { "achn", NULL };
+	const gchar *keywords_none[] = { "arachne", "fedora", NULL };
+
+	/* drop all caches */
+	gs_utils_rmtree (g_getenv ("GS_SELF_TEST_CACHEDIR"), NULL);
+	gs_test_reinitialise_plugin_loader (plugin_loader, allowlist, NULL);
+
+	/* a token prefix matches the pkgname at full weight */
+	list_prefix = search_keywords (plugin_loader, keywords_prefix);
+	g_assert_cmpint (gs_app_list_length (list_prefix), ==, 1);
+	app = gs_app_list_index (list_prefix, 0);
+	g_assert_cmpstr (gs_app_get_id (app), ==, "arachne.desktop");
+	g_assert_cmpint (gs_app_get_match_value (app) & AS_SEARCH_TOKEN_MATCH_PKGNAME, !=, 0);
+
+	/* a substring in the middle of the pkgname is only a partial match */
+	list_substring = search_keywords (plugin_loader, keywords_substring);
+	g_assert_cmpint (gs_app_list_length (list_substring), ==, 1);
+	app = gs_app_list_index (list_substring, 0);
+	g_assert_cmpstr (gs_app_get_id (app), ==, "arachne.desktop");
+	g_assert_cmpint (gs_app_get_match_value (app) & AS_SEARCH_TOKEN_MATCH_PKGNAME, ==, 0);
+	g_assert_cmpint (gs_app_get_match_value (app), !=, 0);
+
+	/* all keywords must match */
+	list_none = search_keywords (plugin_loader, keywords_none);
+	g_assert_cmpint (gs_app_list_length (list_none), ==, 0);
+}
+
+/* Reloads the appstream plugin with @xml rather than the shared fixture from
+ * main(). The previous fixture is returned, to be passed back to this once the
+ * test is done with @xml. */
+static gchar *
+reinitialise_with_appstream_xml (GsPluginLoader *plugin_loader,
+				 const gchar    *xml)
+{
+	g_autofree gchar *old_xml = g_strdup (g_getenv ("GS_SELF_TEST_APPSTREAM_XML"));
+
+	g_setenv ("GS_SELF_TEST_APPSTREAM_XML", xml, TRUE);
+	gs_utils_rmtree (g_getenv ("GS_SELF_TEST_CACHEDIR"), NULL);
+	gs_test_reinitialise_plugin_loader (plugin_loader, allowlist, NULL);
+
+	return g_steal_pointer (&old_xml);
+}
+
+static void
+gs_plugins_core_search_index_stem_func (GsPluginLoader *plugin_loader)
+{
+	GsApp *app;
+	g_autofree gchar *old_xml = NULL;
+	g_autoptr(GsAppList) list_stem = NULL;
+	g_autoptr(GsAppList) list_substring = NULL;
+	g_autoptr(XbBuilder) builder = NULL;
+	g_autoptr(XbBuilderSource) source = NULL;
+	g_autoptr(XbSilo) silo = NULL;
+	g_autoptr(XbNode) xb_node = NULL;
+	const gchar *keywords_stem[] = { "editing", NULL };
+	const gchar *keywords_substring[] = { "tedit", NULL };
+	const gchar *xml =
+		"<?xml version=\"1.0\"?>\n"
+		"<components origin=\"yellow\" version=\"0.9\">\n"
+		"  <component type=\"desktop\">\n"
+		"    <id>org.example.TextEditor.desktop</id>\n"
+		"    <name>Text Editor</name>\n"
+		"    <summary>Change plain text files</summary>\n"
+		"    <pkgname>TextEditor</pkgname>\n"
+		"  </component>\n"
+		"  <info>\n"
+		"    <scope>user</scope>\n"
+		"  </info>\n"
+		"</components>\n";
+
+	old_xml = reinitialise_with_appstream_xml (plugin_loader, xml);
+
+	/* search tokens are stemmed like the `~=stem(?)` XPath queries, so
+	 * if libxmlb stems, ‘editing’ is searched for as ‘edit’, which
+	 * prefixes ‘editor’; either way, the search must agree with libxmlb */
+	builder = xb_builder_new ();
+	source = xb_builder_source_new ();
+	g_assert_true (xb_builder_source_load_xml (source, xml, XB_BUILDER_SOURCE_FLAG_NONE, NULL));
+	xb_builder_import_source (builder, source);
+	silo = xb_builder_compile (builder, XB_BUILDER_COMPILE_FLAG_NONE, NULL, NULL);
+	g_assert_nonnull (silo);
+	xb_node = xb_silo_query_first (silo, "components/component/name[text()~=stem('editing')]", NULL);
+
+	list_stem = search_keywords (plugin_loader, keywords_stem);
+	if (xb_node != NULL) {
+		g_assert_cmpint (gs_app_list_length (list_stem), ==, 1);
+		app = gs_app_list_index (list_stem, 0);
+		g_assert_cmpstr (gs_app_get_id (app), ==, "org.example.TextEditor.desktop");
+		g_assert_cmpint (gs_app_get_match_value (app) & AS_SEARCH_TOKEN_MATCH_NAME, !=, 0);
+	} else {
+		g_assert_cmpint (gs_app_list_length (list_stem), ==, 0);
+	}
+
+	/* substring matches ignore the case of the name and pkgname */
+	list_substring = search_keywords (plugin_loader, keywords_substring);
+	g_assert_cmpint (gs_app_list_length (list_substring), ==, 1);
+	app = gs_app_list_index (list_substring, 0);
+	g_assert_cmpstr (gs_app_get_id (app), ==, "org.example.TextEditor.desktop");
+
+	g_free (reinitialise_with_appstream_xml (plugin_loader, old_xml));
+}
+
+typedef struct {
+	GHashTable *seen;  /* (element-type GsApp) */
+	const gchar *reject_id;  /* (nullable) */
+} TruncateFilterData;
+
+static gboolean
+truncate_filter_cb (GsApp    *app,
+		    gpointer  user_data)
+{
+	TruncateFilterData *data = user_data;
+
+	g_hash_table_add (data->seen, app);
+	return g_strcmp0 (gs_app_get_id (app), data->reject_id) != 0;
+}
+
+static GsAppList *
+search_keywords_truncated (GsPluginLoader      *plugin_loader,
+			   const gchar * const *keywords,
+			   TruncateFilterData  *data)
+{
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GsAppList) list = NULL;
+	g_autoptr(GsPluginJob) plugin_job = NULL;
+	g_autoptr(GsAppQuery) query = NULL;
+
+	query = gs_app_query_new ("keywords", keywords,
+				  "refine-flags", GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON,
+				  "dedupe-flags", GS_PLUGIN_JOB_DEDUPE_FLAGS_DEFAULT,
+				  "max-results", 1,
+				  "sort-func", gs_utils_app_sort_match_value,
+				  "filter-func", truncate_filter_cb,
+				  "filter-user-data", data,
+				  NULL);
+	plugin_job = gs_plugin_job_list_apps_new (query, GS_PLUGIN_LIST_APPS_FLAGS_NONE);
+
+	list = gs_plugin_loader_job_process (plugin_loader, plugin_job, NULL, &error);
+	gs_test_flush_main_context ();
+	g_assert_no_error (error);
+	g_assert_nonnull (list);
+
+	return g_steal_pointer (&list);
+}
+
+static void
+gs_plugins_core_search_truncate_func (GsPluginLoader *plugin_loader)
+{
+	g_autofree gchar *old_xml = NULL;
+	g_autoptr(GsAppList) list_all = NULL;
+	g_autoptr(GsAppList) list_top = NULL;
+	g_autoptr(GsAppList) list_next = NULL;
+	g_autoptr(GHashTable) seen_top = g_hash_table_new (NULL, NULL);
+	g_autoptr(GHashTable) seen_next = g_hash_table_new (NULL, NULL);
+	TruncateFilterData data_top = { seen_top, NULL };
+	TruncateFilterData data_next = { seen_next, NULL };
+	const gchar *keywords[] = { "editor", NULL };
+	const gchar *xml =
+		"<?xml version=\"1.0\"?>\n"
+		"<components origin=\"yellow\" version=\"0.9\">\n"
+		"  <component type=\"desktop\">\n"
+		"    <id>org.example.Editor.desktop</id>\n"
+		"    <name>Editor</name>\n"
+		"    <summary>Edit files</summary>\n"
+		"    <pkgname>editor</pkgname>\n"
+		"  </component>\n"
+		"  <component type=\"desktop\">\n"
+		"    <id>org.example.TextEditor.desktop</id>\n"
+		"    <name>Text Editor</name>\n"
+		"    <summary>Change plain text files</summary>\n"
+		"    <pkgname>text-editor</pkgname>\n"
+		"  </component>\n"
+		"  <component type=\"desktop\">\n"
+		"    <id>org.example.Notes.desktop</id>\n"
+		"    <name>Notes</name>\n"
+		"    <summary>A simple editor for notes</summary>\n"
+		"    <pkgname>notes</pkgname>\n"
+		"  </component>\n"
+		"  <info>\n"
+		"    <scope>user</scope>\n"
+		"  </info>\n"
+		"</components>\n";
+
+	old_xml = reinitialise_with_appstream_xml (plugin_loader, xml);
+
+	list_all = search_keywords (plugin_loader, keywords);
+	g_assert_cmpint (gs_app_list_length (list_all), ==, 3);
+
+	/* the match values are known before refining, so only the app which
+	 * is returned gets refined and filtered */
+	list_top = search_keywords_truncated (plugin_loader, keywords, &data_top);
+	g_assert_cmpint (gs_app_list_length (list_top), ==, 1);
+	g_assert_cmpstr (gs_app_get_id (gs_app_list_index (list_top, 0)), ==,
+			 gs_app_get_id (gs_app_list_index (list_all, 0)));
+	g_assert_cmpint (g_hash_table_size (seen_top), ==, 1);
+
+	/* if the best app is filtered out after refining, the next best one
+	 * is refined to replace it, but the worst one is still never touched */
+	data_next.reject_id = gs_app_get_id (gs_app_list_index (list_all, 0));
+	list_next = search_keywords_truncated (plugin_loader, keywords, &data_next);
+	g_assert_cmpint (gs_app_list_length (list_next), ==, 1);
+	g_assert_cmpstr (gs_app_get_id (gs_app_list_index (list_next, 0)), ==,
+			 gs_app_get_id (gs_app_list_index (list_all, 1)));
+	g_assert_cmpint (g_hash_table_size (seen_next), ==, 2);
+
+	g_free (reinitialise_with_appstream_xml (plugin_loader, old_xml));
+}
+
 static void
 gs_plugins_core_os_release_func (GsPluginLoader *plugin_loader)
 {
@@ -193,6 +432,95 @@ gs_plugins_core_generic_updates_func (GsPluginLoader *plugin_loader)
 	}
 }
 
+static GsAppList *
+list_apps_for_query (GsPluginLoader *plugin_loader,
+		     GsAppQuery     *query)
+{
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GsAppList) list = NULL;
+	g_autoptr(GsPluginJob) plugin_job = NULL;
+
+	plugin_job = gs_plugin_job_list_apps_new (query, GS_PLUGIN_LIST_APPS_FLAGS_NONE);
+	list = gs_plugin_loader_job_process (plugin_loader, plugin_job, NULL, &error);
+	gs_test_flush_main_context ();
+	g_assert_no_error (error);
+	g_assert_nonnull (list);
+
+	return g_steal_pointer (&list);
+}
+
+static void
+gs_plugins_core_compound_query_func (GsPluginLoader *plugin_loader)
+{
+	GsApp *app;
+	g_autofree gchar *old_xml = NULL;
+	g_autoptr(GsAppList) list_featured = NULL;
+	g_autoptr(GsAppList) list_installed = NULL;
+	g_autoptr(GsAppQuery) query_featured = NULL;
+	g_autoptr(GsAppQuery) query_installed = NULL;
+	/* the catalog, followed by the AppData file of an installed app */
+	const gchar *xml =
+		"<?xml version=\"1.0\"?>\n"
+		"<components origin=\"yellow\" version=\"0.9\">\n"
+		"  <component type=\"desktop\">\n"
+		"    <id>org.example.Curated.desktop</id>\n"
+		"    <name>Curated</name>\n"
+		"    <summary>Curated but not featured</summary>\n"
+		"    <pkgname>curated</pkgname>\n"
+		"    <kudos>\n"
+		"      <kudo>GnomeSoftware::popular</kudo>\n"
+		"    </kudos>\n"
+		"  </component>\n"
+		"  <component type=\"desktop\">\n"
+		"    <id>org.example.Featured.desktop</id>\n"
+		"    <name>Featured</name>\n"
+		"    <summary>Curated and featured</summary>\n"
+		"    <pkgname>featured</pkgname>\n"
+		"    <kudos>\n"
+		"      <kudo>GnomeSoftware::popular</kudo>\n"
+		"    </kudos>\n"
+		"    <custom>\n"
+		"      <value key=\"GnomeSoftware::FeatureTile\">True</value>\n"
+		"    </custom>\n"
+		"  </component>\n"
+		"  <info>\n"
+		"    <scope>user</scope>\n"
+		"  </info>\n"
+		"</components>\n"
+		"<component type=\"desktop\">\n"
+		"  <id>org.example.Curated.desktop</id>\n"
+		"  <name>Curated</name>\n"
+		"  <summary>Curated but not featured</summary>\n"
+		"  <description><p>Installed</p></description>\n"
+		"</component>\n";
+
+	old_xml = reinitialise_with_appstream_xml (plugin_loader, xml);
+
+	/* both components are curated, but only one is also featured */
+	query_featured = gs_app_query_new ("is-curated", GS_APP_QUERY_TRISTATE_TRUE,
+					   "is-featured", GS_APP_QUERY_TRISTATE_TRUE,
+					   "dedupe-flags", GS_PLUGIN_JOB_DEDUPE_FLAGS_DEFAULT,
+					   NULL);
+	list_featured = list_apps_for_query (plugin_loader, query_featured);
+	g_assert_cmpint (gs_app_list_length (list_featured), ==, 1);
+	app = gs_app_list_index (list_featured, 0);
+	g_assert_cmpstr (gs_app_get_id (app), ==, "org.example.Featured.desktop");
+
+	/* the curated catalog components are matched to the installed
+	 * top-level component by ID */
+	query_installed = gs_app_query_new ("is-curated", GS_APP_QUERY_TRISTATE_TRUE,
+					    "is-installed", GS_APP_QUERY_TRISTATE_TRUE,
+					    "dedupe-flags", GS_PLUGIN_JOB_DEDUPE_FLAGS_DEFAULT,
+					    NULL);
+	list_installed = list_apps_for_query (plugin_loader, query_installed);
+	g_assert_cmpint (gs_app_list_length (list_installed), ==, 1);
+	app = gs_app_list_index (list_installed, 0);
+	g_assert_cmpstr (gs_app_get_id (app), ==, "org.example.Curated.desktop");
+	g_assert_cmpint (gs_app_get_state (app), ==, GS_APP_STATE_INSTALLED);
+
+	g_free (reinitialise_with_appstream_xml (plugin_loader, old_xml));
+}
+
 int
 main (int argc, char **argv)
 {
@@ -262,6 +590,18 @@ main (int argc, char **argv)
 	g_test_add_data_func ("/gnome-software/plugins/core/search-repo-name",
 			      plugin_loader,
 			      (GTestDataFunc) gs_plugins_core_search_repo_name_func);
+	g_test_add_data_func ("/gnome-software/plugins/core/search-index",
+			      plugin_loader,
+			      (GTestDataFunc) gs_plugins_core_search_index_func);
+	g_test_add_data_func ("/gnome-software/plugins/core/search-index-stem",
+			      plugin_loader,
+			      (GTestDataFunc) gs_plugins_core_search_index_stem_func);
+	g_test_add_data_func ("/gnome-software/plugins/core/search-truncate",
+			      plugin_loader,
+			      (GTestDataFunc) gs_plugins_core_search_truncate_func);
+	g_test_add_data_func ("/gnome-software/plugins/core/compound-query",
+			      plugin_loader,
+			      (GTestDataFunc) gs_plugins_core_compound_query_func);
 	g_test_add_data_func ("/gnome-software/plugins/core/os-release",
 			      plugin_loader,
 			      (GTestDataFunc) gs_plugins_core_os_release_func);
@@ -577,6 +577,54 @@ gs_plugins_dummy_wildcard_func (GsPluginLoader *plugin_loader)
 	}
 }
 
+static void
+gs_plugins_dummy_install_queue_refine_func (GsPluginLoader *plugin_loader)
+{
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GsApp) queued_app = NULL;
+	g_autoptr(GsApp) app = NULL;
+	g_autoptr(GsAppList) queue = gs_app_list_new ();
+	g_autoptr(GsAppList) list = NULL;
+	g_autoptr(GsPluginJob) plugin_job = NULL;
+	GsApp *resolved_app;
+
+	/* create a queued app the same way load_install_queue() does, and
+	 * refine it with no flags, as
+	 * gs_plugin_loader_maybe_flush_pending_install_queue() does; the
+	 * wildcard must still be resolved, or the app is dropped from the
+	 * queue */
+	queued_app = gs_app_new (NULL);
+	gs_app_set_from_unique_id (queued_app, "*/*/*/chiron.desktop/*", AS_COMPONENT_KIND_DESKTOP_APP);
+	gs_app_set_state (queued_app, GS_APP_STATE_QUEUED_FOR_INSTALL);
+	gs_app_add_quirk (queued_app, GS_APP_QUIRK_IS_WILDCARD);
+	gs_app_set_state (queued_app, GS_APP_STATE_AVAILABLE);
+	gs_app_list_add (queue, queued_app);
+
+	plugin_job = gs_plugin_job_refine_new (queue, GS_PLUGIN_REFINE_FLAGS_NONE);
+	list = gs_plugin_loader_job_process (plugin_loader, plugin_job, NULL, &error);
+	gs_test_flush_main_context ();
+	g_assert_no_error (error);
+	g_assert_nonnull (list);
+	g_assert_cmpint (gs_app_list_length (list), ==, 1);
+
+	resolved_app = gs_app_list_lookup (list, gs_app_get_unique_id (queued_app));
+	g_assert_nonnull (resolved_app);
+	g_assert_false (gs_app_has_quirk (resolved_app, GS_APP_QUIRK_IS_WILDCARD));
+	g_assert_cmpstr (gs_app_get_id (resolved_app), ==, "chiron.desktop");
+	g_clear_object (&plugin_job);
+	g_clear_object (&list);
+
+	/* an app which has never been refined must reach the plugins even if
+	 * no data is required */
+	app = gs_app_new ("chiron.desktop");
+	plugin_job = gs_plugin_job_refine_new_for_app (app, GS_PLUGIN_REFINE_FLAGS_DISABLE_FILTERING);
+	list = gs_plugin_loader_job_process (plugin_loader, plugin_job, NULL, &error);
+	gs_test_flush_main_context ();
+	g_assert_no_error (error);
+	g_assert_nonnull (list);
+	g_assert_nonnull (gs_app_get_name (app));
+}
+
 static void
 async_result_cb (GObject      *source_object,
                  GAsyncResult *result,
@@ -898,6 +946,9 @@ main (int argc, char **argv)
 	g_test_add_data_func ("/gnome-software/plugins/dummy/wildcard",
 			      plugin_loader,
 			      (GTestDataFunc) gs_plugins_dummy_wildcard_func);
+	g_test_add_data_func ("/gnome-software/plugins/dummy/install-queue-refine",
+			      plugin_loader,
+			      (GTestDataFunc) gs_plugins_dummy_install_queue_refine_func);
 	g_test_add_data_func ("/gnome-software/plugins/dummy/plugin-cache",
 			      plugin_loader,
 			      (GTestDataFunc) gs_plugins_dummy_plugin_cache_func);
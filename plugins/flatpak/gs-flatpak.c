@@ -29,7 +29,9 @@
 
 #include <config.h>
 
+#include <errno.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <xmlb.h>
 
 #include "gs-appstream.h"
@@ -52,8 +54,12 @@ struct _GsFlatpak {
 	GFileMonitor		*monitor;
 	AsComponentScope	 scope;
 	GsPlugin		*plugin;
-	XbSilo			*silo;
+	GPtrArray		*silos;  /* (element-type XbSilo) (owned) (nullable) (lock silo_lock); one per enabled remote, then @installed_silo */
+	GHashTable		*remote_silos;  /* (element-type utf8 XbSilo) (owned) (nullable) (lock silo_lock); remote name ~> silo from @silos */
+	XbSilo			*installed_silo;  /* (owned) (nullable) (lock silo_lock); installed desktop files */
+	guint			 silos_generation;  /* (lock silo_lock); incremented when the silos are invalidated */
 	GRWLock			 silo_lock;
+	GMutex			 silo_build_mutex;  /* held while building replacements for @silos */
 	gchar			*id;
 	guint			 changed_id;
 	GHashTable		*app_silos;
@@ -63,6 +69,7 @@ struct _GsFlatpak {
 	gboolean		 requires_full_rescan;
 	gint			 busy; /* (atomic) */
 	gboolean		 changed_while_busy;
+	GCancellable		*key_colors_cancellable;  /* (owned) (nullable) (lock silo_build_mutex) */
 };
 
 G_DEFINE_TYPE (GsFlatpak, gs_flatpak, G_TYPE_OBJECT)
@@ -643,11 +650,25 @@ static void
 gs_flatpak_invalidate_silo (GsFlatpak *self)
 {
 	g_rw_lock_writer_lock (&self->silo_lock);
-	if (self->silo != NULL)
-		xb_silo_invalidate (self->silo);
+	for (guint i = 0; self->silos != NULL && i < self->silos->len; i++)
+		xb_silo_invalidate (g_ptr_array_index (self->silos, i));
+	self->silos_generation++;
 	g_rw_lock_writer_unlock (&self->silo_lock);
 }
 
+/* Must be called with @self->silo_lock held. */
+static gboolean
+gs_flatpak_silos_are_valid (GsFlatpak *self)
+{
+	if (self->silos == NULL)
+		return FALSE;
+	for (guint i = 0; i < self->silos->len; i++) {
+		if (!xb_silo_is_valid (g_ptr_array_index (self->silos, i)))
+			return FALSE;
+	}
+	return TRUE;
+}
+
 static void
 gs_flatpak_internal_data_changed (GsFlatpak *self)
 {
@@ -1174,31 +1195,13 @@ gs_flatpak_rescan_installed (GsFlatpak *self,
 	}
 }
 
-static gboolean
-gs_flatpak_rescan_appstream_store (GsFlatpak *self,
-				   gboolean interactive,
-				   GCancellable *cancellable,
-				   GError **error)
+static XbBuilder *
+gs_flatpak_new_builder (GsFlatpak *self)
 {
 	const gchar *const *locales = g_get_language_names ();
-	g_autofree gchar *blobfn = NULL;
-	g_autoptr(GFile) file = NULL;
-	g_autoptr(GPtrArray) xremotes = NULL;
-	g_autoptr(GRWLockReaderLocker) reader_locker = NULL;
-	g_autoptr(GRWLockWriterLocker) writer_locker = NULL;
 	g_autoptr(XbBuilder) builder = NULL;
 	g_autoptr(GMainContext) old_thread_default = NULL;
 
-	reader_locker = g_rw_lock_reader_locker_new (&self->silo_lock);
-	/* everything is okay */
-	if (self->silo != NULL && xb_silo_is_valid (self->silo))
-		return TRUE;
-	g_clear_pointer (&reader_locker, g_rw_lock_reader_locker_free);
-
-	/* drat! silo needs regenerating */
-	writer_locker = g_rw_lock_writer_locker_new (&self->silo_lock);
-	g_clear_object (&self->silo);
-
 	/* FIXME: https://gitlab.gnome.org/GNOME/gnome-software/-/issues/1422 */
 	old_thread_default = g_main_context_ref_thread_default ();
 	if (old_thread_default == g_main_context_default ())
@@ -1208,7 +1211,6 @@ gs_flatpak_rescan_appstream_store (GsFlatpak *self,
 	builder = xb_builder_new ();
 	if (old_thread_default != NULL)
 		g_main_context_push_thread_default (old_thread_default);
-	g_clear_pointer (&old_thread_default, g_main_context_unref);
 
 	/* verbose profiling */
 	if (g_getenv ("GS_XMLB_VERBOSE") != NULL) {
@@ -1221,42 +1223,32 @@ gs_flatpak_rescan_appstream_store (GsFlatpak *self,
 	for (guint i = 0; locales[i] != NULL; i++)
 		xb_builder_add_locale (builder, locales[i]);
 
-	/* go through each remote adding metadata */
-	xremotes = flatpak_installation_list_remotes (gs_flatpak_get_installation (self, interactive),
-						      cancellable,
-						      error);
-	if (xremotes == NULL) {
-		gs_flatpak_error_convert (error);
-		return FALSE;
-	}
-	for (guint i = 0; i < xremotes->len; i++) {
-		g_autoptr(GError) error_local = NULL;
-		FlatpakRemote *xremote = g_ptr_array_index (xremotes, i);
-		if (flatpak_remote_get_disabled (xremote))
-			continue;
-		g_debug ("found remote %s",
-			 flatpak_remote_get_name (xremote));
-		if (!gs_flatpak_add_apps_from_xremote (self, builder, xremote, interactive, cancellable, &error_local)) {
-			g_debug ("Failed to add apps from remote ‘%s’; skipping: %s",
-				 flatpak_remote_get_name (xremote), error_local->message);
-			if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
-				gs_flatpak_error_convert (error);
-				return FALSE;
-			}
-		}
-	}
+	return g_steal_pointer (&builder);
+}
 
-	/* add any installed files without AppStream info */
-	gs_flatpak_rescan_installed (self, builder, cancellable, error);
+/* Compile @builder into the per-user cache file @basename, or load it from
+ * there if none of the sources have changed since it was last compiled. */
+static XbSilo *
+gs_flatpak_ensure_silo (GsFlatpak     *self,
+			XbBuilder     *builder,
+			const gchar   *basename,
+			GCancellable  *cancellable,
+			GError       **error)
+{
+	g_autofree gchar *blobfn = NULL;
+	g_autoptr(GFile) file = NULL;
+	g_autoptr(XbSilo) silo = NULL;
+	g_autoptr(GMainContext) old_thread_default = NULL;
+	g_autoptr(GError) error_index = NULL;
 
 	/* create per-user cache */
 	blobfn = gs_utils_get_cache_filename (gs_flatpak_get_id (self),
-					      "components.xmlb",
+					      basename,
 					      GS_UTILS_CACHE_FLAG_WRITEABLE |
 					      GS_UTILS_CACHE_FLAG_CREATE_DIRECTORY,
 					      error);
 	if (blobfn == NULL)
-		return FALSE;
+		return NULL;
 	file = g_file_new_for_path (blobfn);
 	g_debug ("ensuring %s", blobfn);
 
@@ -1267,21 +1259,359 @@ gs_flatpak_rescan_appstream_store (GsFlatpak *self,
 	if (old_thread_default != NULL)
 		g_main_context_pop_thread_default (old_thread_default);
 
-	self->silo = xb_builder_ensure (builder, file,
-					XB_BUILDER_COMPILE_FLAG_IGNORE_INVALID |
-					XB_BUILDER_COMPILE_FLAG_SINGLE_LANG,
-					cancellable, error);
+	silo = xb_builder_ensure (builder, file,
+				  XB_BUILDER_COMPILE_FLAG_IGNORE_INVALID |
+				  XB_BUILDER_COMPILE_FLAG_SINGLE_LANG,
+				  cancellable, error);
 
 	if (old_thread_default != NULL)
 		g_main_context_push_thread_default (old_thread_default);
 
-	if (self->silo == NULL)
+	if (silo == NULL)
+		return NULL;
+
+	/* precompile the search index; searching still works without it */
+	if (!gs_appstream_silo_build_search_index (silo, cancellable, &error_index)) {
+		if (g_cancellable_set_error_if_cancelled (cancellable, error))
+			return NULL;
+		g_debug ("failed to build search index for %s: %s", basename, error_index->message);
+	}
+
+	return g_steal_pointer (&silo);
+}
+
+/* A silo to compile in gs_flatpak_rebuild_silos(), or one which is being
+ * reused as-is, in which case @builder is %NULL. */
+typedef struct {
+	GsFlatpak *self;  /* (unowned) */
+	gchar *remote_name;  /* (owned) (nullable); NULL for installed desktop files */
+	gchar *basename;  /* (owned) */
+	XbBuilder *builder;  /* (owned) (nullable) */
+	XbSilo *silo;  /* (owned) (nullable) */
+	GError *error;  /* (owned) (nullable) */
+} SiloBuildData;
+
+static void
+silo_build_data_free (SiloBuildData *data)
+{
+	g_free (data->remote_name);
+	g_free (data->basename);
+	g_clear_object (&data->builder);
+	g_clear_object (&data->silo);
+	g_clear_error (&data->error);
+	g_free (data);
+}
+
+/* Run in a thread from the pool in gs_flatpak_rebuild_silos(). */
+static void
+silo_build_thread_cb (gpointer data,
+		      gpointer user_data)
+{
+	SiloBuildData *build = data;
+	GCancellable *cancellable = user_data;
+
+	build->silo = gs_flatpak_ensure_silo (build->self, build->builder, build->basename,
+					      cancellable, &build->error);
+}
+
+/* Delete the compiled silos in the cache which aren’t one of @builds, such as
+ * those of remotes which have since been removed or disabled, or the single
+ * `components.xmlb` which older versions used for all the remotes. Silos
+ * which are still mapped by queries remain valid until they’re unmapped. */
+static void
+gs_flatpak_remove_stale_silos (GsFlatpak *self,
+			       GPtrArray *builds)
+{
+	g_autofree gchar *blobfn = NULL;
+	g_autofree gchar *cachedir = NULL;
+	g_autoptr(GDir) dir = NULL;
+	g_autoptr(GHashTable) basenames = NULL;
+	const gchar *name;
+
+	blobfn = gs_utils_get_cache_filename (gs_flatpak_get_id (self),
+					      "components.xmlb",
+					      GS_UTILS_CACHE_FLAG_WRITEABLE,
+					      NULL);
+	if (blobfn == NULL)
+		return;
+	cachedir = g_path_get_dirname (blobfn);
+	dir = g_dir_open (cachedir, 0, NULL);
+	if (dir == NULL)
+		return;
+
+	basenames = g_hash_table_new (g_str_hash, g_str_equal);
+	for (guint i = 0; i < builds->len; i++) {
+		SiloBuildData *build = g_ptr_array_index (builds, i);
+		g_hash_table_add (basenames, build->basename);
+	}
+
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		g_autofree gchar *filename = NULL;
+
+		if (!g_str_has_prefix (name, "components") ||
+		    !g_str_has_suffix (name, ".xmlb") ||
+		    g_hash_table_contains (basenames, name))
+			continue;
+
+		filename = g_build_filename (cachedir, name, NULL);
+		g_debug ("removing stale silo %s", filename);
+		if (g_unlink (filename) != 0) {
+			gint errsv = errno;
+			g_debug ("failed to remove %s: %s", filename, g_strerror (errsv));
+		}
+	}
+}
+
+/* Must be called with @self->silo_build_mutex held, but not @self->silo_lock,
+ * so queries can carry on using the old silos while the new ones are built. */
+static gboolean
+gs_flatpak_rebuild_silos (GsFlatpak *self,
+			  gboolean interactive,
+			  GCancellable *cancellable,
+			  GError **error)
+{
+	g_autoptr(GPtrArray) xremotes = NULL;
+	g_autoptr(GPtrArray) builds = NULL;
+	g_autoptr(GPtrArray) silos = NULL;
+	g_autoptr(GHashTable) remote_silos = NULL;
+	g_autoptr(XbSilo) installed_silo = NULL;
+	g_autoptr(GHashTable) valid_remote_silos = NULL;
+	g_autoptr(XbSilo) valid_installed_silo = NULL;
+	g_autoptr(GPtrArray) old_silos = NULL;
+	g_autoptr(GHashTable) old_remote_silos = NULL;
+	g_autoptr(XbSilo) old_installed_silo = NULL;
+	g_autoptr(GRWLockReaderLocker) reader_locker = NULL;
+	g_autoptr(GRWLockWriterLocker) writer_locker = NULL;
+	gboolean changed = FALSE;
+	guint generation;
+	guint n_to_compile = 0;
+	SiloBuildData *installed_build;
+
+	/* another thread may have regenerated them while waiting for the lock;
+	 * if not, note which of the current silos can be reused */
+	reader_locker = g_rw_lock_reader_locker_new (&self->silo_lock);
+	if (gs_flatpak_silos_are_valid (self))
+		return TRUE;
+
+	valid_remote_silos = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+	if (self->remote_silos != NULL) {
+		GHashTableIter iter;
+		gpointer key, value;
+
+		g_hash_table_iter_init (&iter, self->remote_silos);
+		while (g_hash_table_iter_next (&iter, &key, &value)) {
+			if (xb_silo_is_valid (value))
+				g_hash_table_insert (valid_remote_silos, g_strdup (key), g_object_ref (value));
+		}
+	}
+	if (self->installed_silo != NULL && xb_silo_is_valid (self->installed_silo))
+		valid_installed_silo = g_object_ref (self->installed_silo);
+	if (self->silos == NULL)
+		changed = TRUE;
+	generation = self->silos_generation;
+
+	g_clear_pointer (&reader_locker, g_rw_lock_reader_locker_free);
+
+	/* Each remote gets its own silo, so refreshing one remote doesn’t
+	 * cause all the others to be recompiled. Silos which are still valid
+	 * are reused as-is; invalidated ones are passed to xb_builder_ensure(),
+	 * which only recompiles them if their sources have changed. Queries
+	 * are run across all the silos.
+	 *
+	 * The sources for each silo are gathered here, as that may involve
+	 * refreshing a remote; the silos are then compiled in parallel. */
+	builds = g_ptr_array_new_with_free_func ((GDestroyNotify) silo_build_data_free);
+
+	/* go through each remote adding metadata */
+	xremotes = flatpak_installation_list_remotes (gs_flatpak_get_installation (self, interactive),
+						      cancellable,
+						      error);
+	if (xremotes == NULL) {
+		gs_flatpak_error_convert (error);
 		return FALSE;
+	}
+	for (guint i = 0; i < xremotes->len; i++) {
+		g_autoptr(GError) error_local = NULL;
+		FlatpakRemote *xremote = g_ptr_array_index (xremotes, i);
+		const gchar *remote_name = flatpak_remote_get_name (xremote);
+		SiloBuildData *build;
+		XbSilo *valid_silo;
+
+		if (flatpak_remote_get_disabled (xremote))
+			continue;
+		g_debug ("found remote %s", remote_name);
+
+		build = g_new0 (SiloBuildData, 1);
+		build->self = self;
+		build->remote_name = g_strdup (remote_name);
+		build->basename = g_strdup_printf ("components-%s.xmlb", remote_name);
+
+		valid_silo = g_hash_table_lookup (valid_remote_silos, remote_name);
+		if (valid_silo != NULL) {
+			build->silo = g_object_ref (valid_silo);
+		} else {
+			build->builder = gs_flatpak_new_builder (self);
+
+			if (!gs_flatpak_add_apps_from_xremote (self, build->builder, xremote, interactive, cancellable, &error_local)) {
+				g_debug ("Failed to add apps from remote ‘%s’; skipping: %s",
+					 remote_name, error_local->message);
+				silo_build_data_free (build);
+				if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+					gs_flatpak_error_convert (error);
+					return FALSE;
+				}
+				continue;
+			}
+			n_to_compile++;
+		}
+
+		g_ptr_array_add (builds, build);
+	}
+
+	/* add any installed files without AppStream info */
+	installed_build = g_new0 (SiloBuildData, 1);
+	installed_build->self = self;
+	installed_build->basename = g_strdup ("components-installed.xmlb");
+
+	if (valid_installed_silo != NULL) {
+		installed_build->silo = g_object_ref (valid_installed_silo);
+	} else {
+		installed_build->builder = gs_flatpak_new_builder (self);
+		gs_flatpak_rescan_installed (self, installed_build->builder, cancellable, error);
+		n_to_compile++;
+	}
+
+	g_ptr_array_add (builds, installed_build);
+
+	/* Compile the silos which need it. Each is independent of the others,
+	 * so parse them in parallel, up to one per CPU. The ID is calculated
+	 * lazily, so make sure that’s done before using it in other threads. */
+	if (n_to_compile > 1) {
+		GThreadPool *pool;
+
+		gs_flatpak_get_id (self);
+		pool = g_thread_pool_new (silo_build_thread_cb, cancellable,
+					  (gint) MIN (n_to_compile, g_get_num_processors ()),
+					  FALSE, NULL);
+		for (guint i = 0; i < builds->len; i++) {
+			SiloBuildData *build = g_ptr_array_index (builds, i);
+			if (build->builder != NULL)
+				g_thread_pool_push (pool, build, NULL);
+		}
+		g_thread_pool_free (pool, FALSE, TRUE);
+	} else {
+		for (guint i = 0; i < builds->len; i++) {
+			SiloBuildData *build = g_ptr_array_index (builds, i);
+			if (build->builder != NULL)
+				silo_build_thread_cb (build, cancellable);
+		}
+	}
+
+	/* gather the results in the order of the remotes */
+	silos = g_ptr_array_new_with_free_func (g_object_unref);
+	remote_silos = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	for (guint i = 0; i < builds->len; i++) {
+		SiloBuildData *build = g_ptr_array_index (builds, i);
+
+		if (build->silo == NULL) {
+			g_propagate_error (error, g_steal_pointer (&build->error));
+			return FALSE;
+		}
+		if (build->builder != NULL)
+			changed = TRUE;
+
+		if (build->remote_name != NULL)
+			g_hash_table_insert (remote_silos, g_strdup (build->remote_name), build->silo);
+		else
+			installed_silo = g_object_ref (build->silo);
+		g_ptr_array_add (silos, g_object_ref (build->silo));
+	}
+
+	/* Swap in the new silos. Queries still using the old ones keep them
+	 * alive until they finish with them. */
+	writer_locker = g_rw_lock_writer_locker_new (&self->silo_lock);
+
+	if (self->silos == NULL || self->silos->len != silos->len)
+		changed = TRUE;
+
+	old_silos = g_steal_pointer (&self->silos);
+	old_remote_silos = g_steal_pointer (&self->remote_silos);
+	old_installed_silo = g_steal_pointer (&self->installed_silo);
+	self->silos = g_steal_pointer (&silos);
+	self->remote_silos = g_steal_pointer (&remote_silos);
+	self->installed_silo = g_steal_pointer (&installed_silo);
+
+	/* if they were invalidated while being built, they may be out of
+	 * date already */
+	if (self->silos_generation != generation) {
+		for (guint i = 0; i < self->silos->len; i++)
+			xb_silo_invalidate (g_ptr_array_index (self->silos, i));
+	}
+
+	g_clear_pointer (&writer_locker, g_rw_lock_writer_locker_free);
+
+	/* anything refined from the old silos is now out of date */
+	if (changed) {
+		gs_app_invalidate_all_refined_flags ();
+		gs_flatpak_remove_stale_silos (self, builds);
+	}
+
+	/* warm the key colors cache for the overview page, in the background
+	 * so the silo build isn’t held up, and stopping any calculation for
+	 * the previous silos */
+	g_cancellable_cancel (self->key_colors_cancellable);
+	g_clear_object (&self->key_colors_cancellable);
+	self->key_colors_cancellable = g_cancellable_new ();
+	for (guint i = 0; i < builds->len; i++) {
+		SiloBuildData *build = g_ptr_array_index (builds, i);
+
+		if (build->builder != NULL && build->remote_name != NULL)
+			gs_appstream_precompute_key_colors (build->silo, self->key_colors_cancellable);
+	}
 
 	/* success */
 	return TRUE;
 }
 
+/* Ensure @self->silos are up to date, rebuilding them if needed.
+ *
+ * If another thread is already rebuilding them, and @wait_for_rebuild is
+ * %FALSE, this returns immediately so the caller can query the old silos
+ * rather than stalling until the rebuild is finished. */
+static gboolean
+gs_flatpak_rescan_appstream_store (GsFlatpak *self,
+				   gboolean wait_for_rebuild,
+				   gboolean interactive,
+				   GCancellable *cancellable,
+				   GError **error)
+{
+	g_autoptr(GRWLockReaderLocker) reader_locker = NULL;
+	gboolean have_silos;
+	gboolean ret;
+
+	reader_locker = g_rw_lock_reader_locker_new (&self->silo_lock);
+	/* everything is okay */
+	if (gs_flatpak_silos_are_valid (self))
+		return TRUE;
+	have_silos = (self->silos != NULL);
+	g_clear_pointer (&reader_locker, g_rw_lock_reader_locker_free);
+
+	/* drat! some silos need regenerating */
+	if (!g_mutex_trylock (&self->silo_build_mutex)) {
+		if (have_silos && !wait_for_rebuild) {
+			g_debug ("using old silos while they are rebuilt");
+			return TRUE;
+		}
+		g_mutex_lock (&self->silo_build_mutex);
+	}
+
+	ret = gs_flatpak_rebuild_silos (self, interactive, cancellable, error);
+	g_mutex_unlock (&self->silo_build_mutex);
+
+	return ret;
+}
+
 static gboolean
 gs_flatpak_rescan_app_data (GsFlatpak *self,
 			    gboolean interactive,
@@ -1297,7 +1627,7 @@ gs_flatpak_rescan_app_data (GsFlatpak *self,
 		return res;
 	}
 
-	if (!gs_flatpak_rescan_appstream_store (self, interactive, cancellable, error)) {
+	if (!gs_flatpak_rescan_appstream_store (self, FALSE, interactive, cancellable, error)) {
 		gs_flatpak_internal_data_changed (self);
 		return FALSE;
 	}
@@ -1323,16 +1653,16 @@ ensure_flatpak_silo_with_locker (GsFlatpak            *self,
 
 	*locker = g_rw_lock_reader_locker_new (&self->silo_lock);
 
-	while (self->silo == NULL) {
+	while (self->silos == NULL) {
 		g_clear_pointer (locker, g_rw_lock_reader_locker_free);
 
-		if (!gs_flatpak_rescan_appstream_store (self, interactive, cancellable, error)) {
+		if (!gs_flatpak_rescan_appstream_store (self, TRUE, interactive, cancellable, error)) {
 			gs_flatpak_internal_data_changed (self);
 			return FALSE;
 		}
 
 		/* At this point either rescan_appstream_store() returned an error or it successfully
-		 * initialised self->silo. There is the possibility that another thread will invalidate
+		 * initialised self->silos. There is the possibility that another thread will invalidate
 		 * the silo before we regain the lock. If so, we’ll have to rescan again. */
 		*locker = g_rw_lock_reader_locker_new (&self->silo_lock);
 	}
@@ -1549,14 +1879,14 @@ gs_flatpak_refresh_appstream (GsFlatpak     *self,
 			continue;
 		}
 
-		/* add the new AppStream repo to the shared silo */
+		/* add the new AppStream repo to its silo */
 		file = flatpak_remote_get_appstream_dir (xremote, NULL);
 		appstream_fn = g_file_get_path (file);
 		g_debug ("using AppStream metadata found at: %s", appstream_fn);
 	}
 
 	/* ensure the AppStream silo is up to date */
-	if (!gs_flatpak_rescan_appstream_store (self, interactive, cancellable, error)) {
+	if (!gs_flatpak_rescan_appstream_store (self, TRUE, interactive, cancellable, error)) {
 		gs_flatpak_internal_data_changed (self);
 		return FALSE;
 	}
@@ -3358,6 +3688,19 @@ propagate_cancelled_error (GError **dest,
 	return FALSE;
 }
 
+/* Components are only ever looked up by origin, and each remote’s components
+ * (with that remote as their origin) are all in its own silo.
+ *
+ * Must be called with @self->silo_lock held. */
+static XbSilo *
+gs_flatpak_get_silo_for_origin (GsFlatpak   *self,
+				const gchar *origin)
+{
+	if (origin == NULL || self->remote_silos == NULL)
+		return NULL;
+	return g_hash_table_lookup (self->remote_silos, origin);
+}
+
 static gboolean
 gs_flatpak_refine_appstream (GsFlatpak *self,
 			     GsApp *app,
@@ -3381,7 +3724,11 @@ gs_flatpak_refine_appstream (GsFlatpak *self,
 	source_safe = xb_string_escape (source);
 	xpath = g_strdup_printf ("components[@origin='%s']/component/bundle[@type='flatpak'][text()='%s']/..",
 				 origin, source_safe);
-	component = xb_silo_query_first (silo, xpath, &error_local);
+	if (silo != NULL)
+		component = xb_silo_query_first (silo, xpath, &error_local);
+	else
+		g_set_error (&error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+			     "no AppStream data for origin %s", origin);
 
 	if (propagate_cancelled_error (error, &error_local))
 		return FALSE;
@@ -3391,7 +3738,7 @@ gs_flatpak_refine_appstream (GsFlatpak *self,
 
 	/* If the app was renamed, use the appstream data from the new name;
 	 * usually it will not exist under the old name */
-	if (component == NULL && gs_flatpak_app_get_ref_kind (app) == FLATPAK_REF_KIND_APP) {
+	if (component == NULL && silo != NULL && gs_flatpak_app_get_ref_kind (app) == FLATPAK_REF_KIND_APP) {
 		g_autoptr(GError) renamed_component_error = NULL;
 
 		component = get_renamed_component (self, app, silo,
@@ -3474,7 +3821,9 @@ gs_flatpak_refine_app_unlocked (GsFlatpak *self,
 		return FALSE;
 
 	/* always do AppStream properties */
-	if (!gs_flatpak_refine_appstream (self, app, self->silo, flags, interactive, cancellable, error))
+	if (!gs_flatpak_refine_appstream (self, app,
+					  gs_flatpak_get_silo_for_origin (self, gs_app_get_origin (app)),
+					  flags, interactive, cancellable, error))
 		return FALSE;
 
 	/* AppStream sets the source to appname/arch/branch */
@@ -3501,7 +3850,9 @@ gs_flatpak_refine_app_unlocked (GsFlatpak *self,
 
 	/* if the state was changed, perhaps set the version from the release */
 	if (old_state != gs_app_get_state (app)) {
-		if (!gs_flatpak_refine_appstream (self, app, self->silo, flags, interactive, cancellable, error))
+		if (!gs_flatpak_refine_appstream (self, app,
+						  gs_flatpak_get_silo_for_origin (self, gs_app_get_origin (app)),
+						  flags, interactive, cancellable, error))
 			return FALSE;
 	}
 
@@ -3658,8 +4009,9 @@ gs_flatpak_refine_wildcard (GsFlatpak *self, GsApp *app,
 {
 	const gchar *id;
 	g_autofree gchar *xpath = NULL;
-	g_autoptr(GError) error_local = NULL;
-	g_autoptr(GPtrArray) components = NULL;
+	g_autoptr(GPtrArray) silos = NULL;
+	g_autoptr(GPtrArray) components = g_ptr_array_new_with_free_func (g_object_unref);
+	g_autoptr(GPtrArray) component_silos = g_ptr_array_new ();
 	g_autoptr(GRWLockReaderLocker) locker = NULL;
 
 	GS_PROFILER_BEGIN_SCOPED (FlatpakRefineWildcard, "Flatpak (refine wildcard)", NULL);
@@ -3674,16 +4026,34 @@ gs_flatpak_refine_wildcard (GsFlatpak *self, GsApp *app,
 
 	GS_PROFILER_BEGIN_SCOPED (FlatpakRefineWildcardQuerySilo, "Flatpak (query silo)", NULL);
 
+	/* The lock is dropped and retaken while refining the new apps below,
+	 * which may replace @self->silos, so keep hold of the current ones. */
+	silos = g_ptr_array_ref (self->silos);
+
 	/* find all apps when matching any prefixes */
 	xpath = g_strdup_printf ("components/component/id[text()='%s']/..", id);
-	components = xb_silo_query (self->silo, xpath, 0, &error_local);
-	if (components == NULL) {
-		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-			return TRUE;
-		g_propagate_error (error, g_steal_pointer (&error_local));
-		return FALSE;
+	for (guint i = 0; i < silos->len; i++) {
+		XbSilo *silo = g_ptr_array_index (silos, i);
+		g_autoptr(GError) error_local = NULL;
+		g_autoptr(GPtrArray) silo_components = NULL;
+
+		silo_components = xb_silo_query (silo, xpath, 0, &error_local);
+		if (silo_components == NULL) {
+			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+				continue;
+			g_propagate_error (error, g_steal_pointer (&error_local));
+			return FALSE;
+		}
+
+		for (guint j = 0; j < silo_components->len; j++) {
+			g_ptr_array_add (components, g_object_ref (g_ptr_array_index (silo_components, j)));
+			g_ptr_array_add (component_silos, silo);
+		}
 	}
 
+	if (components->len == 0)
+		return TRUE;
+
 	GS_PROFILER_END_SCOPED (FlatpakRefineWildcardQuerySilo);
 
 	gs_flatpak_ensure_remote_title (self, interactive, cancellable);
@@ -3694,7 +4064,7 @@ gs_flatpak_refine_wildcard (GsFlatpak *self, GsApp *app,
 		g_autoptr(GsApp) new = NULL;
 
 		GS_PROFILER_BEGIN_SCOPED (FlatpakRefineWildcardCreateAppstreamApp, "Flatpak (create Appstream app)", NULL);
-		new = gs_appstream_create_app (self->plugin, self->silo, component, error);
+		new = gs_appstream_create_app (self->plugin, g_ptr_array_index (component_silos, i), component, error);
 		GS_PROFILER_END_SCOPED (FlatpakRefineWildcardCreateAppstreamApp);
 
 		if (new == NULL)
@@ -4280,16 +4650,18 @@ gs_flatpak_search (GsFlatpak *self,
 	if (!ensure_flatpak_silo_with_locker (self, &locker, interactive, cancellable, error))
 		return FALSE;
 
-	if (!gs_appstream_search (self->plugin, self->silo, values, list_tmp,
-				  cancellable, error))
-		return FALSE;
+	for (guint i = 0; i < self->silos->len; i++) {
+		if (!gs_appstream_search (self->plugin, g_ptr_array_index (self->silos, i), values, list_tmp,
+					  cancellable, error))
+			return FALSE;
+	}
 
 	gs_flatpak_ensure_remote_title (self, interactive, cancellable);
 
 	gs_flatpak_claim_app_list (self, list_tmp, interactive);
 	gs_app_list_add_list (list, list_tmp);
 
-	/* Also search silos from installed apps which were missing from self->silo */
+	/* Also search silos from installed apps which were missing from self->silos */
 	app_silo_locker = g_mutex_locker_new (&self->app_silos_mutex);
 	g_hash_table_iter_init (&iter, self->app_silos);
 	while (g_hash_table_iter_next (&iter, &key, &value)) {
@@ -4353,16 +4725,18 @@ gs_flatpak_search_developer_apps (GsFlatpak *self,
 	if (!ensure_flatpak_silo_with_locker (self, &locker, interactive, cancellable, error))
 		return FALSE;
 
-	if (!gs_appstream_search_developer_apps (self->plugin, self->silo, values, list_tmp,
-						 cancellable, error))
-		return FALSE;
+	for (guint i = 0; i < self->silos->len; i++) {
+		if (!gs_appstream_search_developer_apps (self->plugin, g_ptr_array_index (self->silos, i), values, list_tmp,
+							 cancellable, error))
+			return FALSE;
+	}
 
 	gs_flatpak_ensure_remote_title (self, interactive, cancellable);
 
 	gs_flatpak_claim_app_list (self, list_tmp, interactive);
 	gs_app_list_add_list (list, list_tmp);
 
-	/* Also search silos from installed apps which were missing from self->silo */
+	/* Also search silos from installed apps which were missing from self->silos */
 	app_silo_locker = g_mutex_locker_new (&self->app_silos_mutex);
 	g_hash_table_iter_init (&iter, self->app_silos);
 	while (g_hash_table_iter_next (&iter, &key, &value)) {
@@ -4421,9 +4795,14 @@ gs_flatpak_add_category_apps (GsFlatpak *self,
 	if (!ensure_flatpak_silo_with_locker (self, &locker, interactive, cancellable, error))
 		return FALSE;
 
-	return gs_appstream_add_category_apps (self->plugin, self->silo,
-					       category, list,
-					       cancellable, error);
+	for (guint i = 0; i < self->silos->len; i++) {
+		if (!gs_appstream_add_category_apps (self->plugin, g_ptr_array_index (self->silos, i),
+						     category, list,
+						     cancellable, error))
+			return FALSE;
+	}
+
+	return TRUE;
 }
 
 gboolean
@@ -4438,7 +4817,12 @@ gs_flatpak_refine_category_sizes (GsFlatpak     *self,
 	if (!ensure_flatpak_silo_with_locker (self, &locker, interactive, cancellable, error))
 		return FALSE;
 
-	return gs_appstream_refine_category_sizes (self->silo, list, cancellable, error);
+	for (guint i = 0; i < self->silos->len; i++) {
+		if (!gs_appstream_refine_category_sizes (g_ptr_array_index (self->silos, i), list, cancellable, error))
+			return FALSE;
+	}
+
+	return TRUE;
 }
 
 gboolean
@@ -4454,9 +4838,11 @@ gs_flatpak_add_popular (GsFlatpak *self,
 	if (!ensure_flatpak_silo_with_locker (self, &locker, interactive, cancellable, error))
 		return FALSE;
 
-	if (!gs_appstream_add_popular (self->silo, list_tmp,
-				       cancellable, error))
-		return FALSE;
+	for (guint i = 0; i < self->silos->len; i++) {
+		if (!gs_appstream_add_popular (g_ptr_array_index (self->silos, i), list_tmp,
+					       cancellable, error))
+			return FALSE;
+	}
 
 	gs_app_list_add_list (list, list_tmp);
 
@@ -4476,9 +4862,11 @@ gs_flatpak_add_featured (GsFlatpak *self,
 	if (!ensure_flatpak_silo_with_locker (self, &locker, interactive, cancellable, error))
 		return FALSE;
 
-	if (!gs_appstream_add_featured (self->silo, list_tmp,
-					cancellable, error))
-		return FALSE;
+	for (guint i = 0; i < self->silos->len; i++) {
+		if (!gs_appstream_add_featured (g_ptr_array_index (self->silos, i), list_tmp,
+						cancellable, error))
+			return FALSE;
+	}
 
 	gs_app_list_add_list (list, list_tmp);
 
@@ -4498,7 +4886,12 @@ gs_flatpak_add_deployment_featured (GsFlatpak *self,
 	if (!ensure_flatpak_silo_with_locker (self, &locker, interactive, cancellable, error))
 		return FALSE;
 
-	return gs_appstream_add_deployment_featured (self->silo, deployments, list, cancellable, error);
+	for (guint i = 0; i < self->silos->len; i++) {
+		if (!gs_appstream_add_deployment_featured (g_ptr_array_index (self->silos, i), deployments, list, cancellable, error))
+			return FALSE;
+	}
+
+	return TRUE;
 }
 
 gboolean
@@ -4515,9 +4908,11 @@ gs_flatpak_add_alternates (GsFlatpak *self,
 	if (!ensure_flatpak_silo_with_locker (self, &locker, interactive, cancellable, error))
 		return FALSE;
 
-	if (!gs_appstream_add_alternates (self->silo, app, list_tmp,
-					  cancellable, error))
-		return FALSE;
+	for (guint i = 0; i < self->silos->len; i++) {
+		if (!gs_appstream_add_alternates (g_ptr_array_index (self->silos, i), app, list_tmp,
+						  cancellable, error))
+			return FALSE;
+	}
 
 	gs_app_list_add_list (list, list_tmp);
 
@@ -4538,9 +4933,11 @@ gs_flatpak_add_recent (GsFlatpak *self,
 	if (!ensure_flatpak_silo_with_locker (self, &locker, interactive, cancellable, error))
 		return FALSE;
 
-	if (!gs_appstream_add_recent (self->plugin, self->silo, list_tmp, age,
-				      cancellable, error))
-		return FALSE;
+	for (guint i = 0; i < self->silos->len; i++) {
+		if (!gs_appstream_add_recent (self->plugin, g_ptr_array_index (self->silos, i), list_tmp, age,
+					      cancellable, error))
+			return FALSE;
+	}
 
 	gs_flatpak_claim_app_list (self, list_tmp, interactive);
 	gs_app_list_add_list (list, list_tmp);
@@ -4562,8 +4959,10 @@ gs_flatpak_url_to_app (GsFlatpak *self,
 	if (!ensure_flatpak_silo_with_locker (self, &locker, interactive, cancellable, error))
 		return FALSE;
 
-	if (!gs_appstream_url_to_app (self->plugin, self->silo, list_tmp, url, cancellable, error))
-		return FALSE;
+	for (guint i = 0; i < self->silos->len; i++) {
+		if (!gs_appstream_url_to_app (self->plugin, g_ptr_array_index (self->silos, i), list_tmp, url, cancellable, error))
+			return FALSE;
+	}
 
 	gs_flatpak_claim_app_list (self, list_tmp, interactive);
 	gs_app_list_add_list (list, list_tmp);
@@ -4613,8 +5012,11 @@ gs_flatpak_finalize (GObject *object)
 		g_signal_handler_disconnect (self->monitor, self->changed_id);
 		self->changed_id = 0;
 	}
-	if (self->silo != NULL)
-		g_object_unref (self->silo);
+	g_cancellable_cancel (self->key_colors_cancellable);
+	g_clear_object (&self->key_colors_cancellable);
+	g_clear_pointer (&self->silos, g_ptr_array_unref);
+	g_clear_pointer (&self->remote_silos, g_hash_table_unref);
+	g_clear_object (&self->installed_silo);
 	if (self->monitor != NULL)
 		g_object_unref (self->monitor);
 
@@ -4627,6 +5029,7 @@ gs_flatpak_finalize (GObject *object)
 	g_hash_table_unref (self->broken_remotes);
 	g_mutex_clear (&self->broken_remotes_mutex);
 	g_rw_lock_clear (&self->silo_lock);
+	g_mutex_clear (&self->silo_build_mutex);
 	g_hash_table_unref (self->app_silos);
 	g_mutex_clear (&self->app_silos_mutex);
 	g_clear_pointer (&self->remote_title, g_hash_table_unref);
@@ -4645,9 +5048,10 @@ gs_flatpak_class_init (GsFlatpakClass *klass)
 static void
 gs_flatpak_init (GsFlatpak *self)
 {
-	/* XbSilo needs external locking as we destroy the silo and build a new
-	 * one when something changes */
+	/* XbSilo needs external locking as we destroy the silos and build new
+	 * ones when something changes */
 	g_rw_lock_init (&self->silo_lock);
+	g_mutex_init (&self->silo_build_mutex);
 
 	g_mutex_init (&self->installed_refs_mutex);
 	self->installed_refs = NULL;
@@ -18,6 +18,7 @@
 #include <string.h>
 
 #include "packagekit-common.h"
+#include "gs-app-private.h"
 #include "gs-markdown.h"
 #include "gs-packagekit-helper.h"
 #include "gs-packagekit-task.h"
@@ -4337,6 +4338,9 @@ refresh_metadata_cb (GObject      *source_object,
 	if (!gs_plugin_packagekit_results_valid (results, g_task_get_cancellable (task), &local_error)) {
 		g_task_return_error (task, g_steal_pointer (&local_error));
 	} else {
+		/* anything refined from the old package metadata is now out
+		 * of date */
+		gs_app_invalidate_all_refined_flags ();
 		gs_plugin_updates_changed (plugin);
 		g_task_return_boolean (task, TRUE);
 	}
@@ -25,6 +25,11 @@
  * the real work is done in the snapd daemon. FIXME: This means the plugin can
  * therefore execute entirely in the main thread, making asynchronous calls,
  * once all the vfuncs have been ported.
+ *
+ * Details of snaps from the store are cached in memory and persisted to disk,
+ * so they can be reused across restarts without querying the store again
+ * until they expire. The on-disk cache is a memory-mapped #GVariant, and
+ * snaps are only decoded from it when first looked up.
  */
 
 struct _GsPluginSnap {
@@ -35,21 +40,50 @@ struct _GsPluginSnap {
 	SnapdSystemConfinement	 system_confinement;
 
 	GMutex			 store_snaps_lock;
-	GHashTable		*store_snaps;
+	GHashTable		*store_snaps;  /* (owned) (locked-by store_snaps_lock) */
+	gchar			*store_snaps_filename;  /* (owned) (nullable) */
+	gboolean		 store_snaps_save_pending;  /* (locked-by store_snaps_lock) */
 };
 
 G_DEFINE_TYPE (GsPluginSnap, gs_plugin_snap, GS_TYPE_PLUGIN)
 
+/* Bump this whenever the format of the on-disk store snap cache changes. */
+#define STORE_SNAP_CACHE_VERSION 1
+#define STORE_SNAP_CACHE_FORMAT "(ua{s(xba{sv})})"
+
+/* How long a cached store snap is used before asking the store again. Older
+ * entries are still used if the store can't be reached, until they are too
+ * old to be worth keeping at all. */
+#define STORE_SNAP_CACHE_MAX_AGE_USECS G_TIME_SPAN_DAY
+#define STORE_SNAP_CACHE_MAX_STALE_AGE_USECS (30 * G_TIME_SPAN_DAY)
+
 typedef struct {
-	SnapdSnap *snap;
+	SnapdSnap *snap;  /* (owned) (nullable), decoded from @serialized on first use */
+	GVariant *serialized;  /* (owned) (not nullable), a{sv} of @snap's properties */
+	gint64 cached_at_usecs;  /* wall clock time, so it can be persisted */
 	gboolean full_details;
 } CacheEntry;
 
+static GVariant *serialize_object (GObject *object);
+
 static CacheEntry *
-cache_entry_new (SnapdSnap *snap, gboolean full_details)
+cache_entry_new (SnapdSnap *snap, gboolean full_details, gint64 cached_at_usecs)
 {
 	CacheEntry *entry = g_slice_new (CacheEntry);
 	entry->snap = g_object_ref (snap);
+	entry->serialized = g_variant_ref_sink (serialize_object (G_OBJECT (snap)));
+	entry->cached_at_usecs = cached_at_usecs;
+	entry->full_details = full_details;
+	return entry;
+}
+
+static CacheEntry *
+cache_entry_new_serialized (GVariant *serialized, gboolean full_details, gint64 cached_at_usecs)
+{
+	CacheEntry *entry = g_slice_new (CacheEntry);
+	entry->snap = NULL;
+	entry->serialized = g_variant_ref (serialized);
+	entry->cached_at_usecs = cached_at_usecs;
 	entry->full_details = full_details;
 	return entry;
 }
@@ -57,10 +91,231 @@ cache_entry_new (SnapdSnap *snap, gboolean full_details)
 static void
 cache_entry_free (CacheEntry *entry)
 {
-	g_object_unref (entry->snap);
+	g_clear_object (&entry->snap);
+	g_variant_unref (entry->serialized);
 	g_slice_free (CacheEntry, entry);
 }
 
+static gint64
+cache_get_age (gint64 cached_at_usecs, gint64 now_usecs)
+{
+	/* treat entries from the future (the clock went backwards) as expired */
+	if (cached_at_usecs > now_usecs)
+		return G_MAXINT64;
+	return now_usecs - cached_at_usecs;
+}
+
+/* Snaps are serialized generically from their GObject properties, so that
+ * new properties in snapd-glib are persisted without changes here. Only the
+ * value types used by snapd-glib objects are supported; properties of any
+ * other type are skipped. */
+static GVariant *
+serialize_value (const GValue *value)
+{
+	if (G_VALUE_HOLDS (value, G_TYPE_STRV)) {
+		const gchar * const *strv = g_value_get_boxed (value);
+		return (strv != NULL) ? g_variant_new_strv (strv, -1) : NULL;
+	} else if (G_VALUE_HOLDS (value, G_TYPE_DATE_TIME)) {
+		GDateTime *date_time = g_value_get_boxed (value);
+		g_autofree gchar *str = NULL;
+
+		if (date_time == NULL)
+			return NULL;
+		str = g_date_time_format_iso8601 (date_time);
+		return g_variant_new_string (str);
+	} else if (G_VALUE_HOLDS (value, G_TYPE_PTR_ARRAY)) {
+		/* all the arrays in snapd-glib hold objects, so store the type
+		 * of each element alongside it */
+		GPtrArray *array = g_value_get_boxed (value);
+		GVariantBuilder builder;
+
+		if (array == NULL)
+			return NULL;
+		g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sa{sv})"));
+		for (guint i = 0; i < array->len; i++) {
+			GObject *element = g_ptr_array_index (array, i);
+			g_variant_builder_add (&builder, "(s@a{sv})",
+					       G_OBJECT_TYPE_NAME (element),
+					       serialize_object (element));
+		}
+		return g_variant_builder_end (&builder);
+	} else if (G_VALUE_HOLDS_STRING (value)) {
+		const gchar *str = g_value_get_string (value);
+		return (str != NULL) ? g_variant_new_string (str) : NULL;
+	} else if (G_VALUE_HOLDS_BOOLEAN (value)) {
+		return g_variant_new_boolean (g_value_get_boolean (value));
+	} else if (G_VALUE_HOLDS_INT (value)) {
+		return g_variant_new_int32 (g_value_get_int (value));
+	} else if (G_VALUE_HOLDS_UINT (value)) {
+		return g_variant_new_uint32 (g_value_get_uint (value));
+	} else if (G_VALUE_HOLDS_INT64 (value)) {
+		return g_variant_new_int64 (g_value_get_int64 (value));
+	} else if (G_VALUE_HOLDS_UINT64 (value)) {
+		return g_variant_new_uint64 (g_value_get_uint64 (value));
+	} else if (G_VALUE_HOLDS_DOUBLE (value)) {
+		return g_variant_new_double (g_value_get_double (value));
+	} else if (G_VALUE_HOLDS_ENUM (value)) {
+		return g_variant_new_int32 (g_value_get_enum (value));
+	} else if (G_VALUE_HOLDS_FLAGS (value)) {
+		return g_variant_new_uint32 (g_value_get_flags (value));
+	}
+
+	return NULL;
+}
+
+static GVariant *
+serialize_object (GObject *object)
+{
+	g_autofree GParamSpec **pspecs = NULL;
+	guint n_pspecs;
+	GVariantBuilder builder;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+	pspecs = g_object_class_list_properties (G_OBJECT_GET_CLASS (object), &n_pspecs);
+	for (guint i = 0; i < n_pspecs; i++) {
+		GParamSpec *pspec = pspecs[i];
+		g_auto(GValue) value = G_VALUE_INIT;
+		GVariant *serialized;
+
+		/* only properties which can be set again when deserializing */
+		if (!(pspec->flags & G_PARAM_READABLE) ||
+		    !(pspec->flags & G_PARAM_WRITABLE) ||
+		    (pspec->flags & G_PARAM_DEPRECATED))
+			continue;
+
+		g_value_init (&value, G_PARAM_SPEC_VALUE_TYPE (pspec));
+		g_object_get_property (object, pspec->name, &value);
+		serialized = serialize_value (&value);
+		if (serialized != NULL)
+			g_variant_builder_add (&builder, "{sv}", pspec->name, serialized);
+	}
+
+	return g_variant_builder_end (&builder);
+}
+
+static GObject *deserialize_object (GType     type,
+                                    GVariant *properties);
+
+/* @value must already be initialised to the type of the property. Returns
+ * %FALSE if @variant doesn't hold a value of that type. */
+static gboolean
+deserialize_value (GVariant *variant,
+                   GValue   *value)
+{
+	if (G_VALUE_HOLDS (value, G_TYPE_STRV) &&
+	    g_variant_is_of_type (variant, G_VARIANT_TYPE_STRING_ARRAY)) {
+		g_value_take_boxed (value, g_variant_dup_strv (variant, NULL));
+	} else if (G_VALUE_HOLDS (value, G_TYPE_DATE_TIME) &&
+		   g_variant_is_of_type (variant, G_VARIANT_TYPE_STRING)) {
+		g_autoptr(GDateTime) date_time = NULL;
+
+		date_time = g_date_time_new_from_iso8601 (g_variant_get_string (variant, NULL), NULL);
+		if (date_time == NULL)
+			return FALSE;
+		g_value_set_boxed (value, date_time);
+	} else if (G_VALUE_HOLDS (value, G_TYPE_PTR_ARRAY) &&
+		   g_variant_is_of_type (variant, G_VARIANT_TYPE ("a(sa{sv})"))) {
+		g_autoptr(GPtrArray) array = g_ptr_array_new_with_free_func (g_object_unref);
+
+		for (gsize i = 0; i < g_variant_n_children (variant); i++) {
+			const gchar *type_name;
+			g_autoptr(GVariant) element_properties = NULL;
+			GType element_type;
+
+			g_variant_get_child (variant, i, "(&s@a{sv})", &type_name, &element_properties);
+
+			/* only instantiate the snapd-glib types which can be
+			 * in the cache, whatever the file claims */
+			element_type = g_type_from_name (type_name);
+			if (element_type == G_TYPE_INVALID ||
+			    !g_str_has_prefix (type_name, "Snapd") ||
+			    !g_type_is_a (element_type, G_TYPE_OBJECT) ||
+			    G_TYPE_IS_ABSTRACT (element_type)) {
+				g_debug ("Skipping cached object of unknown type %s", type_name);
+				continue;
+			}
+
+			g_ptr_array_add (array, deserialize_object (element_type, element_properties));
+		}
+		g_value_set_boxed (value, array);
+	} else if (G_VALUE_HOLDS_STRING (value) &&
+		   g_variant_is_of_type (variant, G_VARIANT_TYPE_STRING)) {
+		g_value_set_string (value, g_variant_get_string (variant, NULL));
+	} else if (G_VALUE_HOLDS_BOOLEAN (value) &&
+		   g_variant_is_of_type (variant, G_VARIANT_TYPE_BOOLEAN)) {
+		g_value_set_boolean (value, g_variant_get_boolean (variant));
+	} else if (G_VALUE_HOLDS_INT (value) &&
+		   g_variant_is_of_type (variant, G_VARIANT_TYPE_INT32)) {
+		g_value_set_int (value, g_variant_get_int32 (variant));
+	} else if (G_VALUE_HOLDS_UINT (value) &&
+		   g_variant_is_of_type (variant, G_VARIANT_TYPE_UINT32)) {
+		g_value_set_uint (value, g_variant_get_uint32 (variant));
+	} else if (G_VALUE_HOLDS_INT64 (value) &&
+		   g_variant_is_of_type (variant, G_VARIANT_TYPE_INT64)) {
+		g_value_set_int64 (value, g_variant_get_int64 (variant));
+	} else if (G_VALUE_HOLDS_UINT64 (value) &&
+		   g_variant_is_of_type (variant, G_VARIANT_TYPE_UINT64)) {
+		g_value_set_uint64 (value, g_variant_get_uint64 (variant));
+	} else if (G_VALUE_HOLDS_DOUBLE (value) &&
+		   g_variant_is_of_type (variant, G_VARIANT_TYPE_DOUBLE)) {
+		g_value_set_double (value, g_variant_get_double (variant));
+	} else if (G_VALUE_HOLDS_ENUM (value) &&
+		   g_variant_is_of_type (variant, G_VARIANT_TYPE_INT32)) {
+		g_value_set_enum (value, g_variant_get_int32 (variant));
+	} else if (G_VALUE_HOLDS_FLAGS (value) &&
+		   g_variant_is_of_type (variant, G_VARIANT_TYPE_UINT32)) {
+		g_value_set_flags (value, g_variant_get_uint32 (variant));
+	} else {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static GObject *
+deserialize_object (GType     type,
+                    GVariant *properties)
+{
+	g_autoptr(GTypeClass) klass = g_type_class_ref (type);
+	gsize n_properties = g_variant_n_children (properties);
+	g_autofree const gchar **names = g_new0 (const gchar *, n_properties);
+	GValue *values = g_new0 (GValue, n_properties);
+	guint n_values = 0;
+	GObject *object;
+
+	for (gsize i = 0; i < n_properties; i++) {
+		const gchar *name;
+		g_autoptr(GVariant) variant = NULL;
+		GParamSpec *pspec;
+
+		g_variant_get_child (properties, i, "{&sv}", &name, &variant);
+
+		/* ignore properties which have changed since the cache
+		 * was written */
+		pspec = g_object_class_find_property (G_OBJECT_CLASS (klass), name);
+		if (pspec == NULL || !(pspec->flags & G_PARAM_WRITABLE))
+			continue;
+
+		g_value_init (&values[n_values], G_PARAM_SPEC_VALUE_TYPE (pspec));
+		if (!deserialize_value (variant, &values[n_values])) {
+			g_value_unset (&values[n_values]);
+			continue;
+		}
+
+		/* @name points into @properties, which outlives @names */
+		names[n_values++] = name;
+	}
+
+	object = g_object_new_with_properties (type, n_values, names, values);
+
+	for (guint i = 0; i < n_values; i++)
+		g_value_unset (&values[i]);
+	g_free (values);
+
+	return object;
+}
+
 static SnapdAuthData *
 get_auth_data (GsPluginSnap *self)
 {
@@ -251,6 +506,7 @@ static SnapdSnap *get_store_snap_finish (GsPluginSnap  *self,
 static void add_channels (GsPluginSnap *self,
                           SnapdSnap    *snap,
                           GsAppList    *list);
+static void store_snap_cache_load (GsPluginSnap *self);
 
 static void
 gs_plugin_snap_setup_async (GsPlugin            *plugin,
@@ -267,6 +523,9 @@ gs_plugin_snap_setup_async (GsPlugin            *plugin,
 	task = g_task_new (plugin, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_plugin_snap_setup_async);
 
+	/* cheap, as the cache is memory-mapped and only decoded on use */
+	store_snap_cache_load (self);
+
 	client = get_client (self, interactive, &local_error);
 	if (client == NULL) {
 		g_task_return_error (task, g_steal_pointer (&local_error));
@@ -319,10 +578,13 @@ gs_plugin_snap_setup_finish (GsPlugin      *plugin,
 	return g_task_propagate_boolean (G_TASK (result), error);
 }
 
+/* Stale entries are only returned if @allow_stale is set, which should only
+ * be done as a fallback when the store can't be queried. */
 static SnapdSnap *
 store_snap_cache_lookup (GsPluginSnap *self,
                          const gchar  *name,
-                         gboolean      need_details)
+                         gboolean      need_details,
+                         gboolean      allow_stale)
 {
 	CacheEntry *entry;
 	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->store_snaps_lock);
@@ -334,15 +596,95 @@ store_snap_cache_lookup (GsPluginSnap *self,
 	if (need_details && !entry->full_details)
 		return NULL;
 
+	if (!allow_stale &&
+	    cache_get_age (entry->cached_at_usecs, g_get_real_time ()) > STORE_SNAP_CACHE_MAX_AGE_USECS)
+		return NULL;
+
+	/* entries loaded from disk are decoded on first use */
+	if (entry->snap == NULL)
+		entry->snap = SNAPD_SNAP (deserialize_object (SNAPD_TYPE_SNAP, entry->serialized));
+
 	return g_object_ref (entry->snap);
 }
 
+static void
+store_snap_cache_save_cb (GObject      *source_object,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+	GFile *file = G_FILE (source_object);
+	g_autoptr(GError) local_error = NULL;
+
+	if (!g_file_replace_contents_finish (file, result, NULL, &local_error))
+		g_debug ("Failed to save store snap cache: %s", local_error->message);
+}
+
+static gboolean
+store_snap_cache_save_idle_cb (gpointer user_data)
+{
+	GsPluginSnap *self = GS_PLUGIN_SNAP (user_data);
+	g_autoptr(GMutexLocker) locker = NULL;
+	GVariantBuilder builder;
+	GHashTableIter iter;
+	gpointer key, value;
+	gint64 now_usecs = g_get_real_time ();
+	g_autoptr(GVariant) cache = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GFile) file = NULL;
+
+	locker = g_mutex_locker_new (&self->store_snaps_lock);
+	self->store_snaps_save_pending = FALSE;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(xba{sv})}"));
+	g_hash_table_iter_init (&iter, self->store_snaps);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		CacheEntry *entry = value;
+
+		if (cache_get_age (entry->cached_at_usecs, now_usecs) > STORE_SNAP_CACHE_MAX_STALE_AGE_USECS)
+			continue;
+
+		g_variant_builder_add (&builder, "{s(xb@a{sv})}",
+				       (const gchar *) key,
+				       entry->cached_at_usecs,
+				       entry->full_details,
+				       entry->serialized);
+	}
+
+	cache = g_variant_ref_sink (g_variant_new ("(u@a{s(xba{sv})})",
+						   (guint32) STORE_SNAP_CACHE_VERSION,
+						   g_variant_builder_end (&builder)));
+	g_clear_pointer (&locker, g_mutex_locker_free);
+
+	/* written atomically, as the previous file may still be mapped */
+	bytes = g_variant_get_data_as_bytes (cache);
+	file = g_file_new_for_path (self->store_snaps_filename);
+	g_file_replace_contents_bytes_async (file, bytes, NULL, FALSE,
+					     G_FILE_CREATE_REPLACE_DESTINATION,
+					     NULL, store_snap_cache_save_cb, NULL);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Must be called with store_snaps_lock held. Saves are coalesced, as several
+ * updates often happen in quick succession. */
+static void
+store_snap_cache_queue_save_locked (GsPluginSnap *self)
+{
+	if (self->store_snaps_filename == NULL || self->store_snaps_save_pending)
+		return;
+
+	self->store_snaps_save_pending = TRUE;
+	g_idle_add_full (G_PRIORITY_LOW, store_snap_cache_save_idle_cb,
+			 g_object_ref (self), g_object_unref);
+}
+
 static void
 store_snap_cache_update (GsPluginSnap *self,
                          GPtrArray    *snaps,
                          gboolean      full_details)
 {
 	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->store_snaps_lock);
+	gint64 now_usecs = g_get_real_time ();
 	guint i;
 
 	for (i = 0; i < snaps->len; i++) {
@@ -352,8 +694,81 @@ store_snap_cache_update (GsPluginSnap *self,
 			snapd_snap_get_publisher_display_name (snap),
 			snapd_snap_get_version (snap),
 			snapd_snap_get_revision (snap));
-		g_hash_table_insert (self->store_snaps, g_strdup (snapd_snap_get_name (snap)), cache_entry_new (snap, full_details));
+		g_hash_table_insert (self->store_snaps, g_strdup (snapd_snap_get_name (snap)), cache_entry_new (snap, full_details, now_usecs));
+	}
+
+	if (snaps->len > 0)
+		store_snap_cache_queue_save_locked (self);
+}
+
+static void
+store_snap_cache_load (GsPluginSnap *self)
+{
+	g_autoptr(GMappedFile) mapped_file = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GVariant) cache = NULL;
+	g_autoptr(GVariant) entries = NULL;
+	g_autoptr(GMutexLocker) locker = NULL;
+	guint32 version;
+	gint64 now_usecs = g_get_real_time ();
+	g_autoptr(GError) local_error = NULL;
+
+	g_free (self->store_snaps_filename);
+	self->store_snaps_filename = gs_utils_get_cache_filename ("snap", "store-snaps.gvariant",
+								  GS_UTILS_CACHE_FLAG_WRITEABLE |
+								  GS_UTILS_CACHE_FLAG_CREATE_DIRECTORY,
+								  &local_error);
+	if (self->store_snaps_filename == NULL) {
+		g_debug ("Not caching store snaps on disk: %s", local_error->message);
+		return;
+	}
+
+	mapped_file = g_mapped_file_new (self->store_snaps_filename, FALSE, &local_error);
+	if (mapped_file == NULL) {
+		if (!g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			g_debug ("Failed to load store snap cache: %s", local_error->message);
+		return;
+	}
+
+	/* GVariant copes with truncated or corrupt data by returning
+	 * default values, so the mapped data can be used as-is */
+	bytes = g_mapped_file_get_bytes (mapped_file);
+	cache = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (STORE_SNAP_CACHE_FORMAT), bytes, FALSE));
+	g_variant_get (cache, "(u@a{s(xba{sv})})", &version, &entries);
+	if (version != STORE_SNAP_CACHE_VERSION) {
+		g_debug ("Ignoring store snap cache with version %u", version);
+		return;
+	}
+
+	/* g_type_from_name() only finds types which have been registered */
+	g_type_ensure (SNAPD_TYPE_SNAP);
+	g_type_ensure (SNAPD_TYPE_APP);
+	g_type_ensure (SNAPD_TYPE_CHANNEL);
+	g_type_ensure (SNAPD_TYPE_MEDIA);
+	g_type_ensure (SNAPD_TYPE_PRICE);
+
+	/* setup is run again when the self tests reinitialise the plugins */
+	locker = g_mutex_locker_new (&self->store_snaps_lock);
+	g_hash_table_remove_all (self->store_snaps);
+
+	for (gsize i = 0; i < g_variant_n_children (entries); i++) {
+		const gchar *name;
+		gint64 cached_at_usecs;
+		gboolean full_details;
+		g_autoptr(GVariant) serialized = NULL;
+
+		g_variant_get_child (entries, i, "{&s(xb@a{sv})}",
+				     &name, &cached_at_usecs, &full_details, &serialized);
+
+		if (cache_get_age (cached_at_usecs, now_usecs) > STORE_SNAP_CACHE_MAX_STALE_AGE_USECS)
+			continue;
+
+		g_hash_table_insert (self->store_snaps, g_strdup (name),
+				     cache_entry_new_serialized (serialized, full_details, cached_at_usecs));
 	}
+
+	g_debug ("Loaded %u store snaps from %s",
+		 g_hash_table_size (self->store_snaps), self->store_snaps_filename);
 }
 
 static GPtrArray *
@@ -496,6 +911,7 @@ gs_plugin_snap_dispose (GObject *object)
 	g_clear_pointer (&self->store_name, g_free);
 	g_clear_pointer (&self->store_hostname, g_free);
 	g_clear_pointer (&self->store_snaps, g_hash_table_unref);
+	g_clear_pointer (&self->store_snaps_filename, g_free);
 
 	G_OBJECT_CLASS (gs_plugin_snap_parent_class)->dispose (object);
 }
@@ -915,6 +1331,20 @@ gs_plugin_snap_list_apps_finish (GsPlugin      *plugin,
 	return g_task_propagate_pointer (G_TASK (result), error);
 }
 
+/* Whether @error means that snapd or the store couldn’t be reached, as
+ * opposed to the query failing or being cancelled. */
+static gboolean
+is_transport_error (const GError *error)
+{
+	return (g_error_matches (error, SNAPD_ERROR, SNAPD_ERROR_CONNECTION_FAILED) ||
+		g_error_matches (error, SNAPD_ERROR, SNAPD_ERROR_READ_FAILED) ||
+		g_error_matches (error, SNAPD_ERROR, SNAPD_ERROR_WRITE_FAILED) ||
+		g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NETWORK_UNREACHABLE) ||
+		g_error_matches (error, G_IO_ERROR, G_IO_ERROR_HOST_UNREACHABLE) ||
+		g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CONNECTION_REFUSED) ||
+		g_error_matches (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT));
+}
+
 static SnapdSnap *
 get_store_snap (GsPluginSnap  *self,
                 SnapdClient   *client,
@@ -925,21 +1355,48 @@ get_store_snap (GsPluginSnap  *self,
 {
 	SnapdSnap *snap = NULL;
 	g_autoptr(GPtrArray) snaps = NULL;
+	g_autoptr(GError) local_error = NULL;
 
 	/* use cached version if available */
-	snap = store_snap_cache_lookup (self, name, need_details);
+	snap = store_snap_cache_lookup (self, name, need_details, FALSE);
 	if (snap != NULL)
-		return g_object_ref (snap);
+		return snap;
 
-	snaps = find_snaps (self, client,
-			    SNAPD_FIND_FLAGS_SCOPE_WIDE | SNAPD_FIND_FLAGS_MATCH_NAME,
-			    NULL, name, cancellable, error);
-	if (snaps == NULL || snaps->len < 1)
+	snaps = snapd_client_find_section_sync (client,
+						SNAPD_FIND_FLAGS_SCOPE_WIDE | SNAPD_FIND_FLAGS_MATCH_NAME,
+						NULL, name, NULL, cancellable, &local_error);
+	if (snaps == NULL) {
+		/* fall back to expired details if the store can't be reached */
+		if (is_transport_error (local_error)) {
+			snap = store_snap_cache_lookup (self, name, need_details, TRUE);
+			if (snap != NULL)
+				return snap;
+		}
+
+		snapd_error_convert (&local_error);
+		g_propagate_error (error, g_steal_pointer (&local_error));
+		return NULL;
+	}
+
+	store_snap_cache_update (self, snaps, TRUE);
+	if (snaps->len < 1)
 		return NULL;
 
 	return g_object_ref (g_ptr_array_index (snaps, 0));
 }
 
+typedef struct {
+	gchar *name;  /* (owned) (not nullable) */
+	gboolean need_details;
+} GetStoreSnapData;
+
+static void
+get_store_snap_data_free (GetStoreSnapData *data)
+{
+	g_free (data->name);
+	g_free (data);
+}
+
 static void get_store_snap_cb (GObject      *source_object,
                                GAsyncResult *result,
                                gpointer      user_data);
@@ -954,15 +1411,21 @@ get_store_snap_async (GsPluginSnap        *self,
                       gpointer             user_data)
 {
 	g_autoptr(GTask) task = NULL;
+	GetStoreSnapData *data;
 	SnapdSnap *snap = NULL;
 
 	task = g_task_new (self, cancellable, callback, user_data);
 	g_task_set_source_tag (task, get_store_snap_async);
 
+	data = g_new0 (GetStoreSnapData, 1);
+	data->name = g_strdup (name);
+	data->need_details = need_details;
+	g_task_set_task_data (task, data, (GDestroyNotify) get_store_snap_data_free);
+
 	/* use cached version if available */
-	snap = store_snap_cache_lookup (self, name, need_details);
+	snap = store_snap_cache_lookup (self, name, need_details, FALSE);
 	if (snap != NULL) {
-		g_task_return_pointer (task, g_object_ref (snap), (GDestroyNotify) g_object_unref);
+		g_task_return_pointer (task, snap, (GDestroyNotify) g_object_unref);
 		return;
 	}
 
@@ -981,11 +1444,22 @@ get_store_snap_cb (GObject      *source_object,
 	SnapdClient *client = SNAPD_CLIENT (source_object);
 	g_autoptr(GTask) task = g_steal_pointer (&user_data);
 	GsPluginSnap *self = g_task_get_source_object (task);
+	GetStoreSnapData *data = g_task_get_task_data (task);
 	g_autoptr(GPtrArray) snaps = NULL;
+	g_autoptr(SnapdSnap) stale_snap = NULL;
 	g_autoptr(GError) local_error = NULL;
 
 	snaps = snapd_client_find_section_finish (client, result, NULL, &local_error);
 
+	/* fall back to expired details if the store can't be reached */
+	if (snaps == NULL && is_transport_error (local_error)) {
+		stale_snap = store_snap_cache_lookup (self, data->name, data->need_details, TRUE);
+		if (stale_snap != NULL) {
+			g_task_return_pointer (task, g_steal_pointer (&stale_snap), (GDestroyNotify) g_object_unref);
+			return;
+		}
+	}
+
 	if (snaps == NULL || snaps->len < 1) {
 		snapd_error_convert (&local_error);
 		g_task_return_error (task, g_steal_pointer (&local_error));
@@ -1431,7 +1905,7 @@ get_snaps_cb (GObject      *object,
 
 		/* get information from locally installed snaps and information we already have */
 		local_snap = find_snap_in_array (local_snaps, snap_name);
-		store_snap = store_snap_cache_lookup (self, snap_name, FALSE);
+		store_snap = store_snap_cache_lookup (self, snap_name, FALSE, FALSE);
 		if (store_snap != NULL)
 			store_channel = expand_channel_name (snapd_snap_get_channel (store_snap));
 
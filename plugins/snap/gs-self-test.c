@@ -15,6 +15,7 @@
 #include "gs-test.h"
 
 static gboolean snap_installed = FALSE;
+static guint n_find_section_calls = 0;
 
 SnapdAuthData *
 snapd_login_sync (const gchar *username, const gchar *password, const gchar *otp,
@@ -189,6 +190,8 @@ snapd_client_find_section_sync (SnapdClient *client,
 {
 	GPtrArray *snaps;
 
+	n_find_section_calls++;
+
 	snaps = g_ptr_array_new_with_free_func (g_object_unref);
 	g_ptr_array_add (snaps, make_snap ("snap", SNAPD_SNAP_STATUS_AVAILABLE));
 
@@ -362,10 +365,87 @@ gs_plugins_snap_test_func (GsPluginLoader *plugin_loader)
 	g_assert (ret);
 }
 
+static void
+gs_plugins_snap_cache_func (GsPluginLoader *plugin_loader)
+{
+	const gchar * const allowlist[] = { "snap", NULL };
+	g_autoptr(GsApp) app = NULL;
+	g_autoptr(GsAppList) list = NULL;
+	g_autoptr(GsPluginJob) plugin_job = NULL;
+	guint n_find_section_calls_before;
+	gboolean ret;
+	g_autofree gchar *filename = NULL;
+	g_autoptr(GMappedFile) mapped_file = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GVariant) cache = NULL;
+	g_autoptr(GVariant) entries = NULL;
+	g_autoptr(GVariant) properties = NULL;
+	g_autoptr(GVariant) media = NULL;
+	guint32 version;
+	gint64 cached_at_usecs;
+	gboolean full_details;
+	const gchar *summary;
+	g_autoptr(GError) error = NULL;
+
+	/* no snap, abort */
+	if (!gs_plugin_loader_get_enabled (plugin_loader, "snap")) {
+		g_test_skip ("not enabled");
+		return;
+	}
+
+	/* the store snaps found by the previous test are saved from an idle */
+	filename = gs_utils_get_cache_filename ("snap", "store-snaps.gvariant",
+						GS_UTILS_CACHE_FLAG_WRITEABLE, &error);
+	g_assert_no_error (error);
+	while (!g_file_test (filename, G_FILE_TEST_EXISTS))
+		g_main_context_iteration (NULL, TRUE);
+
+	mapped_file = g_mapped_file_new (filename, FALSE, &error);
+	g_assert_no_error (error);
+	bytes = g_mapped_file_get_bytes (mapped_file);
+	cache = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE ("(ua{s(xba{sv})})"), bytes, FALSE));
+	g_variant_get (cache, "(u@a{s(xba{sv})})", &version, &entries);
+	g_assert_cmpuint (version, ==, 1);
+
+	g_assert_true (g_variant_lookup (entries, "snap", "(xb@a{sv})",
+					 &cached_at_usecs, &full_details, &properties));
+	g_assert_cmpint (cached_at_usecs, <=, g_get_real_time ());
+	g_assert_true (g_variant_lookup (properties, "summary", "&s", &summary));
+	g_assert_cmpstr (summary, ==, "SUMMARY");
+
+	/* nested objects are stored with their type */
+	media = g_variant_lookup_value (properties, "media", G_VARIANT_TYPE ("a(sa{sv})"));
+	g_assert_nonnull (media);
+	g_assert_cmpuint (g_variant_n_children (media), ==, 2);
+
+	/* setting the plugin up again replaces the in-memory cache with the
+	 * one on disk, and the snap is decoded from that without asking the
+	 * store */
+	gs_test_reinitialise_plugin_loader (plugin_loader, allowlist, NULL);
+	n_find_section_calls_before = n_find_section_calls;
+
+	app = gs_app_new ("io.snapcraft.snap");
+	gs_app_set_metadata (app, "snap::name", "snap");
+	gs_app_set_management_plugin (app, gs_plugin_loader_find_plugin (plugin_loader, "snap"));
+	list = gs_app_list_new ();
+	gs_app_list_add (list, app);
+
+	plugin_job = gs_plugin_job_refine_new (list, GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION);
+	ret = gs_plugin_loader_job_action (plugin_loader, plugin_job, NULL, &error);
+	gs_test_flush_main_context ();
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	g_assert_cmpuint (n_find_section_calls, ==, n_find_section_calls_before);
+	g_assert_cmpstr (gs_app_get_summary (app), ==, "SUMMARY");
+	g_assert_cmpstr (gs_app_get_version (app), ==, "VERSION");
+}
+
 int
 main (int argc, char **argv)
 {
 	gboolean ret;
+	g_autofree gchar *tmp_root = NULL;
 	g_autoptr(GError) error = NULL;
 	g_autoptr(GsPluginLoader) plugin_loader = NULL;
 	const gchar * const allowlist[] = {
@@ -375,6 +455,11 @@ main (int argc, char **argv)
 
 	gs_test_init (&argc, &argv);
 
+	/* keep the store snap cache out of the user's cache directory */
+	tmp_root = g_dir_make_tmp ("gnome-software-snap-test-XXXXXX", NULL);
+	g_assert_true (tmp_root != NULL);
+	g_setenv ("GS_SELF_TEST_CACHEDIR", tmp_root, TRUE);
+
 	/* we can only load this once per process */
 	plugin_loader = gs_plugin_loader_new (NULL, NULL);
 	gs_plugin_loader_add_location (plugin_loader, LOCALPLUGINDIR);
@@ -391,5 +476,12 @@ main (int argc, char **argv)
 	g_test_add_data_func ("/gnome-software/plugins/snap/test",
 			      plugin_loader,
 			      (GTestDataFunc) gs_plugins_snap_test_func);
-	return g_test_run ();
+	g_test_add_data_func ("/gnome-software/plugins/snap/cache",
+			      plugin_loader,
+			      (GTestDataFunc) gs_plugins_snap_cache_func);
+	ret = g_test_run ();
+
+	gs_utils_rmtree (tmp_root, NULL);
+
+	return ret;
 }
@@ -13,6 +13,7 @@
 #include <glib/gi18n.h>
 
 #include "gs-screenshot-image.h"
+#include "gs-screenshot-loader.h"
 #include "gs-common.h"
 
 #define SPINNER_TIMEOUT_SECS 2
@@ -33,6 +34,7 @@ struct _GsScreenshotImage
 	SoupSession	*session;
 	SoupMessage	*message;
 	GCancellable	*cancellable;
+	GCancellable	*load_cancellable;
 	gchar		*filename;
 	const gchar	*current_image;
 	guint		 width;
@@ -97,36 +99,47 @@ gs_screenshot_image_set_error (GsScreenshotImage *ssimg, const gchar *message)
 	gs_screenshot_image_stop_spinner (ssimg);
 }
 
+/* Cancel any image which is still being loaded for this widget, as it’s
+ * about to be superseded. */
+static GCancellable *
+gs_screenshot_image_restart_load (GsScreenshotImage *ssimg)
+{
+	if (ssimg->load_cancellable != NULL) {
+		g_cancellable_cancel (ssimg->load_cancellable);
+		g_clear_object (&ssimg->load_cancellable);
+	}
+	ssimg->load_cancellable = g_cancellable_new ();
+	return ssimg->load_cancellable;
+}
+
 static void
-as_screenshot_show_image (GsScreenshotImage *ssimg)
+gs_screenshot_image_get_load_size (GsScreenshotImage *ssimg,
+				   guint *width_out,
+				   guint *height_out)
 {
-	if (as_screenshot_get_media_kind (ssimg->screenshot) == AS_SCREENSHOT_MEDIA_KIND_VIDEO) {
-		gtk_video_set_filename (GTK_VIDEO (ssimg->video), ssimg->filename);
-		ssimg->current_image = "video";
+	/* 0 means 'no need to composite' */
+	if (ssimg->width == G_MAXUINT || ssimg->height == G_MAXUINT) {
+		*width_out = 0;
+		*height_out = 0;
 	} else {
-		g_autoptr(GdkPixbuf) pixbuf = NULL;
-
-		/* no need to composite */
-		if (ssimg->width == G_MAXUINT || ssimg->height == G_MAXUINT) {
-			pixbuf = gdk_pixbuf_new_from_file (ssimg->filename, NULL);
-		} else {
-			/* this is always going to have alpha */
-			pixbuf = gdk_pixbuf_new_from_file_at_scale (ssimg->filename,
-								    (gint) (ssimg->width * ssimg->scale),
-								    (gint) (ssimg->height * ssimg->scale),
-								    FALSE, NULL);
-		}
+		*width_out = ssimg->width * ssimg->scale;
+		*height_out = ssimg->height * ssimg->scale;
+	}
+}
 
-		/* show icon */
-		if (g_strcmp0 (ssimg->current_image, "image1") == 0) {
-			if (pixbuf != NULL)
-				gtk_picture_set_pixbuf (GTK_PICTURE (ssimg->image2), pixbuf);
-			ssimg->current_image = "image2";
-		} else {
-			if (pixbuf != NULL)
-				gtk_picture_set_pixbuf (GTK_PICTURE (ssimg->image1), pixbuf);
-			ssimg->current_image = "image1";
-		}
+static void
+gs_screenshot_image_show_texture (GsScreenshotImage *ssimg,
+				  GdkTexture *texture)
+{
+	/* show icon */
+	if (g_strcmp0 (ssimg->current_image, "image1") == 0) {
+		if (texture != NULL)
+			gtk_picture_set_paintable (GTK_PICTURE (ssimg->image2), GDK_PAINTABLE (texture));
+		ssimg->current_image = "image2";
+	} else {
+		if (texture != NULL)
+			gtk_picture_set_paintable (GTK_PICTURE (ssimg->image1), GDK_PAINTABLE (texture));
+		ssimg->current_image = "image1";
 	}
 
 	gtk_stack_set_visible_child_name (GTK_STACK (ssimg->stack), ssimg->current_image);
@@ -137,109 +150,70 @@ as_screenshot_show_image (GsScreenshotImage *ssimg)
 	gs_screenshot_image_stop_spinner (ssimg);
 }
 
-static GdkPixbuf *
-gs_pixbuf_resample (GdkPixbuf *original,
-		    guint width,
-		    guint height,
-		    gboolean blurred)
+static void
+gs_screenshot_image_loaded_cb (GObject *source_object,
+			       GAsyncResult *result,
+			       gpointer user_data)
 {
-	g_autoptr(GdkPixbuf) pixbuf = NULL;
-	guint tmp_height;
-	guint tmp_width;
-	guint pixbuf_height;
-	guint pixbuf_width;
-	g_autoptr(GdkPixbuf) pixbuf_tmp = NULL;
-
-	/* never set */
-	if (original == NULL)
-		return NULL;
+	g_autoptr(GsScreenshotImage) ssimg = GS_SCREENSHOT_IMAGE (user_data);
+	g_autoptr(GdkTexture) texture = NULL;
+	g_autoptr(GError) error = NULL;
 
-	/* 0 means 'default' */
-	if (width == 0)
-		width = (guint) gdk_pixbuf_get_width (original);
-	if (height == 0)
-		height = (guint) gdk_pixbuf_get_height (original);
-
-	/* don't do anything to an image with the correct size */
-	pixbuf_width = (guint) gdk_pixbuf_get_width (original);
-	pixbuf_height = (guint) gdk_pixbuf_get_height (original);
-	if (width == pixbuf_width && height == pixbuf_height)
-		return g_object_ref (original);
-
-	/* is the aspect ratio of the source perfectly 16:9 */
-	if ((pixbuf_width / 16) * 9 == pixbuf_height) {
-		pixbuf = gdk_pixbuf_scale_simple (original,
-						  (gint) width, (gint) height,
-						  GDK_INTERP_HYPER);
-		if (blurred)
-			gs_utils_pixbuf_blur (pixbuf, 5, 3);
-		return g_steal_pointer (&pixbuf);
-	}
-
-	/* create new 16:9 pixbuf with alpha padding */
-	pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB,
-				 TRUE, 8,
-				 (gint) width,
-				 (gint) height);
-	gdk_pixbuf_fill (pixbuf, 0x00000000);
-	/* check the ratio to see which property needs to be fitted and which needs
-	 * to be reduced */
-	if (pixbuf_width * 9 > pixbuf_height * 16) {
-		tmp_width = width;
-		tmp_height = width * pixbuf_height / pixbuf_width;
-	} else {
-		tmp_width = height * pixbuf_width / pixbuf_height;
-		tmp_height = height;
-	}
-	pixbuf_tmp = gdk_pixbuf_scale_simple (original,
-					      (gint) tmp_width,
-					      (gint) tmp_height,
-					      GDK_INTERP_HYPER);
-	if (blurred)
-		gs_utils_pixbuf_blur (pixbuf_tmp, 5, 3);
-	gdk_pixbuf_copy_area (pixbuf_tmp,
-			      0, 0, /* of src */
-			      (gint) tmp_width,
-			      (gint) tmp_height,
-			      pixbuf,
-			      (gint) (width - tmp_width) / 2,
-			      (gint) (height - tmp_height) / 2);
-	return g_steal_pointer (&pixbuf);
-}
+	texture = gs_screenshot_loader_load_finish (GS_SCREENSHOT_LOADER (source_object), result, &error);
+	if (texture == NULL) {
+		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			return;
+		g_debug ("Failed to load screenshot '%s': %s", ssimg->filename, error->message);
+	}
 
-static gboolean
-gs_pixbuf_save_filename (GdkPixbuf *pixbuf,
-			 const gchar *filename,
-			 guint width,
-			 guint height,
-			 GError **error)
-{
-	g_autoptr(GdkPixbuf) pb = NULL;
-
-	/* resample & save pixbuf */
-	pb = gs_pixbuf_resample (pixbuf, width, height, FALSE);
-	return gdk_pixbuf_save (pb,
-				filename,
-				"png",
-				error,
-				NULL);
+	gs_screenshot_image_show_texture (ssimg, texture);
 }
 
 static void
-gs_screenshot_image_show_blurred (GsScreenshotImage *ssimg,
-				  const gchar *filename_thumb)
+as_screenshot_show_image (GsScreenshotImage *ssimg)
 {
-	g_autoptr(GdkPixbuf) pb_src = NULL;
-	g_autoptr(GdkPixbuf) pb = NULL;
+	GsScreenshotLoader *loader;
+	g_autoptr(GdkTexture) texture = NULL;
+	guint width, height;
+
+	if (as_screenshot_get_media_kind (ssimg->screenshot) == AS_SCREENSHOT_MEDIA_KIND_VIDEO) {
+		gtk_video_set_filename (GTK_VIDEO (ssimg->video), ssimg->filename);
+		ssimg->current_image = "video";
+
+		gtk_stack_set_visible_child_name (GTK_STACK (ssimg->stack), ssimg->current_image);
+
+		gtk_widget_set_visible (GTK_WIDGET (ssimg), TRUE);
+		ssimg->showing_image = TRUE;
+
+		gs_screenshot_image_stop_spinner (ssimg);
+		return;
+	}
 
-	pb_src = gdk_pixbuf_new_from_file (filename_thumb, NULL);
-	if (pb_src == NULL)
+	/* decoding large screenshots takes a while, so only do it on the
+	 * main thread if it has been done before */
+	loader = gs_screenshot_loader_get_default ();
+	gs_screenshot_image_get_load_size (ssimg, &width, &height);
+	texture = gs_screenshot_loader_lookup (loader, ssimg->filename, width, height,
+					       GS_SCREENSHOT_LOADER_FLAGS_NONE);
+	if (texture != NULL) {
+		gs_screenshot_image_restart_load (ssimg);
+		gs_screenshot_image_show_texture (ssimg, texture);
 		return;
-	pb = gs_pixbuf_resample (pb_src,
-				 ssimg->width * ssimg->scale,
-				 ssimg->height * ssimg->scale,
-				 TRUE /* blurred */);
-	if (pb == NULL)
+	}
+
+	gs_screenshot_loader_load_async (loader, ssimg->filename, width, height,
+					 GS_SCREENSHOT_LOADER_FLAGS_NONE,
+					 gs_screenshot_image_restart_load (ssimg),
+					 gs_screenshot_image_loaded_cb,
+					 g_object_ref (ssimg));
+}
+
+static void
+gs_screenshot_image_set_blurred (GsScreenshotImage *ssimg,
+				 GdkTexture *texture)
+{
+	/* the full-size image has already been shown */
+	if (ssimg->showing_image)
 		return;
 
 	if (g_strcmp0 (ssimg->current_image, "video") == 0) {
@@ -248,18 +222,60 @@ gs_screenshot_image_show_blurred (GsScreenshotImage *ssimg,
 	}
 
 	if (g_strcmp0 (ssimg->current_image, "image1") == 0) {
-		gtk_picture_set_pixbuf (GTK_PICTURE (ssimg->image1), pb);
+		gtk_picture_set_paintable (GTK_PICTURE (ssimg->image1), GDK_PAINTABLE (texture));
 	} else {
-		gtk_picture_set_pixbuf (GTK_PICTURE (ssimg->image2), pb);
+		gtk_picture_set_paintable (GTK_PICTURE (ssimg->image2), GDK_PAINTABLE (texture));
 	}
 }
 
-static gboolean
-gs_screenshot_image_save_downloaded_img (GsScreenshotImage *ssimg,
-					 GdkPixbuf *pixbuf,
-					 GError **error)
+static void
+gs_screenshot_image_blurred_loaded_cb (GObject *source_object,
+				       GAsyncResult *result,
+				       gpointer user_data)
+{
+	g_autoptr(GsScreenshotImage) ssimg = GS_SCREENSHOT_IMAGE (user_data);
+	g_autoptr(GdkTexture) texture = NULL;
+
+	texture = gs_screenshot_loader_load_finish (GS_SCREENSHOT_LOADER (source_object), result, NULL);
+	if (texture != NULL)
+		gs_screenshot_image_set_blurred (ssimg, texture);
+}
+
+static void
+gs_screenshot_image_show_blurred (GsScreenshotImage *ssimg,
+				  const gchar *filename_thumb)
+{
+	GsScreenshotLoader *loader = gs_screenshot_loader_get_default ();
+	g_autoptr(GdkTexture) texture = NULL;
+
+	texture = gs_screenshot_loader_lookup (loader, filename_thumb,
+					       ssimg->width * ssimg->scale,
+					       ssimg->height * ssimg->scale,
+					       GS_SCREENSHOT_LOADER_FLAGS_BLURRED);
+	if (texture != NULL) {
+		gs_screenshot_image_set_blurred (ssimg, texture);
+		return;
+	}
+
+	if (ssimg->load_cancellable == NULL)
+		ssimg->load_cancellable = g_cancellable_new ();
+
+	gs_screenshot_loader_load_async (loader, filename_thumb,
+					 ssimg->width * ssimg->scale,
+					 ssimg->height * ssimg->scale,
+					 GS_SCREENSHOT_LOADER_FLAGS_BLURRED,
+					 ssimg->load_cancellable,
+					 gs_screenshot_image_blurred_loaded_cb,
+					 g_object_ref (ssimg));
+}
+
+/* Returns the filename to also save a downloaded screenshot to, at the other
+ * of the thumbnail or normal sizes, if the screenshot only has one image. */
+static gchar *
+gs_screenshot_image_dup_counterpart_filename (GsScreenshotImage *ssimg,
+					      guint *width_out,
+					      guint *height_out)
 {
-	gboolean ret;
 	const GPtrArray *images;
 	g_autoptr(GError) error_local = NULL;
 	g_autofree char *filename = NULL;
@@ -269,20 +285,12 @@ gs_screenshot_image_save_downloaded_img (GsScreenshotImage *ssimg,
 	guint width = ssimg->width;
 	guint height = ssimg->height;
 
-	ret = gs_pixbuf_save_filename (pixbuf, ssimg->filename,
-				      ssimg->width * ssimg->scale,
-				      ssimg->height * ssimg->scale,
-				      error);
-
-	if (!ret)
-		return FALSE;
-
 	if (ssimg->screenshot == NULL)
-		return TRUE;
+		return NULL;
 
 	images = as_screenshot_get_images (ssimg->screenshot);
 	if (images->len > 1)
-		return TRUE;
+		return NULL;
 
 	if (width == AS_IMAGE_THUMBNAIL_WIDTH &&
 	    height == AS_IMAGE_THUMBNAIL_HEIGHT) {
@@ -310,22 +318,38 @@ gs_screenshot_image_save_downloaded_img (GsScreenshotImage *ssimg,
                 g_warning ("Failed to get cache filename for counterpart "
                            "screenshot '%s' in folder '%s': %s", basename,
                            cache_kind, error_local->message);
-                return TRUE;
+                return NULL;
         }
 
-	ret = gs_pixbuf_save_filename (pixbuf, filename,
-					width, height,
-					&error_local);
+	*width_out = width;
+	*height_out = height;
+	return g_steal_pointer (&filename);
+}
 
-	if (!ret) {
-		/* if we cannot save this screenshot, warn about that but do not
-		 * set a user's visible error because this is a complementary
-		 * operation */
-                g_warning ("Failed to save screenshot '%s': %s", filename,
-                           error_local->message);
-        }
+static void
+gs_screenshot_image_saved_cb (GObject *source_object,
+			      GAsyncResult *result,
+			      gpointer user_data)
+{
+	g_autoptr(GsScreenshotImage) ssimg = GS_SCREENSHOT_IMAGE (user_data);
+	g_autoptr(GdkTexture) texture = NULL;
+	g_autoptr(GError) error = NULL;
 
-	return TRUE;
+	texture = gs_screenshot_loader_save_finish (GS_SCREENSHOT_LOADER (source_object), result, &error);
+	if (texture == NULL) {
+		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			return;
+		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA)) {
+			/* TRANSLATORS: possibly image file corrupt or not an image */
+			gs_screenshot_image_set_error (ssimg, _("Failed to load image"));
+		} else {
+			gs_screenshot_image_set_error (ssimg, error->message);
+		}
+		return;
+	}
+
+	/* got image, so show */
+	gs_screenshot_image_show_texture (ssimg, texture);
 }
 
 static void
@@ -340,14 +364,14 @@ gs_screenshot_image_complete_cb (SoupSession *session,
 #endif
 {
 	g_autoptr(GsScreenshotImage) ssimg = GS_SCREENSHOT_IMAGE (user_data);
-	gboolean ret;
 	g_autoptr(GError) error = NULL;
-	g_autoptr(GdkPixbuf) pixbuf = NULL;
-	g_autoptr(GInputStream) stream = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autofree gchar *counterpart_filename = NULL;
+	guint counterpart_width = 0, counterpart_height = 0;
+	guint width, height;
 	guint status_code;
 
 #if SOUP_CHECK_VERSION(3, 0, 0)
-	g_autoptr(GBytes) bytes = NULL;
 	SoupMessage *msg;
 
 	bytes = soup_session_send_and_read_finish (SOUP_SESSION (source_object), result, &error);
@@ -418,47 +442,22 @@ gs_screenshot_image_complete_cb (SoupSession *session,
 		return;
 	}
 
-#if SOUP_CHECK_VERSION(3, 0, 0)
-	stream = g_memory_input_stream_new_from_bytes (bytes);
-#else
-	/* create a buffer with the data */
-	stream = g_memory_input_stream_new_from_data (msg->response_body->data,
-						      msg->response_body->length,
-						      NULL);
-	if (stream == NULL) {
-		gs_screenshot_image_stop_spinner (ssimg);
-		return;
-	}
+#if !SOUP_CHECK_VERSION(3, 0, 0)
+	bytes = g_bytes_new (msg->response_body->data, msg->response_body->length);
 #endif
 
-	/* load the image */
-	pixbuf = gdk_pixbuf_new_from_stream (stream, NULL, NULL);
-	if (pixbuf == NULL) {
-		/* TRANSLATORS: possibly image file corrupt or not an image */
-		gs_screenshot_image_set_error (ssimg, _("Failed to load image"));
-		return;
-	}
-
-	/* is image size destination size unknown or exactly the correct size */
-	if (ssimg->width == G_MAXUINT || ssimg->height == G_MAXUINT ||
-	    (ssimg->width * ssimg->scale == (guint) gdk_pixbuf_get_width (pixbuf) &&
-	     ssimg->height * ssimg->scale == (guint) gdk_pixbuf_get_height (pixbuf))) {
-		ret = gs_pixbuf_save_filename (pixbuf, ssimg->filename,
-					       gdk_pixbuf_get_width (pixbuf),
-					       gdk_pixbuf_get_height (pixbuf),
-					       &error);
-		if (!ret) {
-			gs_screenshot_image_set_error (ssimg, error->message);
-			return;
-		}
-	} else if (!gs_screenshot_image_save_downloaded_img (ssimg, pixbuf,
-							     &error)) {
-		gs_screenshot_image_set_error (ssimg, error->message);
-		return;
-	}
-
-	/* got image, so show */
-	as_screenshot_show_image (ssimg);
+	/* decode, resample and save the image without blocking the UI */
+	gs_screenshot_image_get_load_size (ssimg, &width, &height);
+	if (width != 0 && height != 0)
+		counterpart_filename = gs_screenshot_image_dup_counterpart_filename (ssimg,
+										     &counterpart_width,
+										     &counterpart_height);
+	gs_screenshot_loader_save_async (gs_screenshot_loader_get_default (),
+					 bytes, ssimg->filename, width, height,
+					 counterpart_filename, counterpart_width, counterpart_height,
+					 gs_screenshot_image_restart_load (ssimg),
+					 gs_screenshot_image_saved_cb,
+					 g_object_ref (ssimg));
 }
 
 void
@@ -634,6 +633,7 @@ gs_screenshot_image_load_async (GsScreenshotImage *ssimg,
 	g_autofree gchar *cachefn_thumb = NULL;
 	g_autofree gchar *sizedir = NULL;
 	g_autoptr(GUri) base_uri = NULL;
+	gboolean showing_cached = FALSE;
 
 	g_return_if_fail (GS_IS_SCREENSHOT_IMAGE (ssimg));
 
@@ -641,6 +641,12 @@ gs_screenshot_image_load_async (GsScreenshotImage *ssimg,
 	g_return_if_fail (ssimg->width != 0);
 	g_return_if_fail (ssimg->height != 0);
 
+	/* drop any image still being decoded for the previous screenshot */
+	if (ssimg->load_cancellable != NULL) {
+		g_cancellable_cancel (ssimg->load_cancellable);
+		g_clear_object (&ssimg->load_cancellable);
+	}
+
 	/* Reset the width request, thus the image shrinks when the window width is small */
 	gtk_widget_set_size_request (ssimg->stack, -1, (gint) ssimg->height);
 
@@ -684,6 +690,7 @@ gs_screenshot_image_load_async (GsScreenshotImage *ssimg,
 		/* show the image we have in cache while we're checking for the
 		 * new screenshot (which probably won't have changed) */
 		as_screenshot_show_image (ssimg);
+		showing_cached = TRUE;
 
 		/* verify the cache age against the maximum allowed */
 		age_max = g_settings_get_uint (ssimg->settings,
@@ -696,7 +703,7 @@ gs_screenshot_image_load_async (GsScreenshotImage *ssimg,
 
 	/* if we're not showing a full-size image, we try loading a blurred
 	 * smaller version of it straight away */
-	if (!ssimg->showing_image &&
+	if (!ssimg->showing_image && !showing_cached &&
 	    as_screenshot_get_media_kind (ssimg->screenshot) == AS_SCREENSHOT_MEDIA_KIND_IMAGE &&
 	    ssimg->width > AS_IMAGE_THUMBNAIL_WIDTH &&
 	    ssimg->height > AS_IMAGE_THUMBNAIL_HEIGHT) {
@@ -854,6 +861,11 @@ gs_screenshot_image_dispose (GObject *object)
 		g_clear_object (&ssimg->cancellable);
 	}
 
+	if (ssimg->load_cancellable != NULL) {
+		g_cancellable_cancel (ssimg->load_cancellable);
+		g_clear_object (&ssimg->load_cancellable);
+	}
+
 	if (ssimg->message != NULL) {
 #if !SOUP_CHECK_VERSION(3, 0, 0)
 		soup_session_cancel_message (ssimg->session,
@@ -0,0 +1,963 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2013-2016 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2014-2018 Kalev Lember <klember@redhat.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/**
+ * SECTION:gs-screenshot-loader
+ * @short_description: Decode and cache screenshot images off the main thread
+ *
+ * #GsScreenshotLoader decodes, resamples and saves screenshot images in a
+ * #GsWorkerThread, so that large screenshots don’t block the UI while they
+ * are being loaded.
+ *
+ * The decoded #GdkTextures are kept in an in-memory least-recently-used
+ * cache, bounded by #GsScreenshotLoader:max-size, so that revisiting an app
+ * page or switching between screenshots doesn’t decode the same file again.
+ *
+ * There is one loader per process, returned by
+ * gs_screenshot_loader_get_default(). It lives until the process exits.
+ *
+ * Since: 46
+ */
+
+#include "config.h"
+
+#include "gnome-software-private.h"
+#include "gs-screenshot-loader.h"
+
+/* the number of bytes used per pixel of a decoded texture */
+#define BYTES_PER_PIXEL 4
+
+typedef struct {
+	gchar		*key;  /* (owned) */
+	gchar		*filename;  /* (owned) */
+	GdkTexture	*texture;  /* (owned) */
+	guint64		 size;
+	GList		 link;  /* link in the LRU queue, data points to the entry */
+} CacheEntry;
+
+struct _GsScreenshotLoader
+{
+	GObject			 parent_instance;
+
+	GsWorkerThread		*worker;  /* (owned) */
+	GSettings		*settings;  /* (owned) */
+
+	GMutex			 mutex;
+	GHashTable		*cache;  /* (owned) (element-type utf8 CacheEntry) (mutex mutex) */
+	GQueue			 cache_lru;  /* (element-type CacheEntry) (mutex mutex), most recently used first */
+	guint64			 cache_size;  /* bytes (mutex mutex) */
+	guint			 max_size;  /* bytes (mutex mutex) */
+	GHashTable		*file_generations;  /* (owned) (element-type filename guint) (mutex mutex), bumped each time a file is saved */
+};
+
+G_DEFINE_TYPE (GsScreenshotLoader, gs_screenshot_loader, G_TYPE_OBJECT)
+
+typedef enum {
+	PROP_MAX_SIZE = 1,
+	PROP_SIZE,
+} GsScreenshotLoaderProperty;
+
+static GParamSpec *obj_props[PROP_SIZE + 1] = { NULL, };
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+	g_free (entry->key);
+	g_free (entry->filename);
+	g_object_unref (entry->texture);
+	g_free (entry);
+}
+
+static gchar *
+build_cache_key (const gchar *filename,
+		 guint width,
+		 guint height,
+		 GsScreenshotLoaderFlags flags)
+{
+	return g_strdup_printf ("%s\n%ux%u\n%u", filename, width, height, (guint) flags);
+}
+
+static void
+cache_remove_entry_locked (GsScreenshotLoader *self,
+			   CacheEntry *entry)
+{
+	g_queue_unlink (&self->cache_lru, &entry->link);
+	self->cache_size -= entry->size;
+	g_hash_table_remove (self->cache, entry->key);
+}
+
+static void
+cache_trim_locked (GsScreenshotLoader *self)
+{
+	while (self->cache_size > self->max_size) {
+		GList *link = g_queue_peek_tail_link (&self->cache_lru);
+		if (link == NULL)
+			break;
+		cache_remove_entry_locked (self, link->data);
+	}
+}
+
+static void
+cache_insert_locked (GsScreenshotLoader *self,
+		     const gchar *filename,
+		     guint width,
+		     guint height,
+		     GsScreenshotLoaderFlags flags,
+		     GdkTexture *texture)
+{
+	CacheEntry *entry;
+	g_autofree gchar *key = build_cache_key (filename, width, height, flags);
+	guint64 size = (guint64) gdk_texture_get_width (texture) *
+		       (guint64) gdk_texture_get_height (texture) * BYTES_PER_PIXEL;
+
+	entry = g_hash_table_lookup (self->cache, key);
+	if (entry != NULL)
+		cache_remove_entry_locked (self, entry);
+
+	/* an image which does not fit in the cache at all would only push
+	 * everything else out */
+	if (size > self->max_size)
+		return;
+
+	entry = g_new0 (CacheEntry, 1);
+	entry->key = g_steal_pointer (&key);
+	entry->filename = g_strdup (filename);
+	entry->texture = g_object_ref (texture);
+	entry->size = size;
+	entry->link.data = entry;
+
+	g_hash_table_insert (self->cache, entry->key, entry);
+	g_queue_push_head_link (&self->cache_lru, &entry->link);
+	self->cache_size += size;
+
+	cache_trim_locked (self);
+}
+
+static guint
+file_generation_get_locked (GsScreenshotLoader *self,
+			    const gchar *filename)
+{
+	return GPOINTER_TO_UINT (g_hash_table_lookup (self->file_generations, filename));
+}
+
+/* Loads of @filename which started before this only add their result to the
+ * cache if the generation is unchanged, so they can’t add a texture decoded
+ * from the old file after it has been invalidated. */
+static void
+file_generation_bump_locked (GsScreenshotLoader *self,
+			     const gchar *filename)
+{
+	guint generation;
+
+	if (filename == NULL)
+		return;
+	generation = file_generation_get_locked (self, filename);
+	g_hash_table_insert (self->file_generations, g_strdup (filename), GUINT_TO_POINTER (generation + 1));
+}
+
+static gboolean
+cache_entry_matches_filename_cb (gpointer key,
+				 gpointer value,
+				 gpointer user_data)
+{
+	CacheEntry *entry = value;
+	const gchar *filename = ((gpointer *) user_data)[1];
+	GsScreenshotLoader *self = ((gpointer *) user_data)[0];
+
+	if (g_strcmp0 (entry->filename, filename) != 0)
+		return FALSE;
+
+	/* the hash table frees the entry once it is removed */
+	g_queue_unlink (&self->cache_lru, &entry->link);
+	self->cache_size -= entry->size;
+	return TRUE;
+}
+
+static void
+cache_invalidate_filename_locked (GsScreenshotLoader *self,
+				  const gchar *filename)
+{
+	gpointer data[] = { self, (gpointer) filename };
+
+	if (filename == NULL)
+		return;
+	g_hash_table_foreach_remove (self->cache, cache_entry_matches_filename_cb, data);
+}
+
+static GdkPixbuf *
+gs_pixbuf_resample (GdkPixbuf *original,
+		    guint width,
+		    guint height,
+		    gboolean blurred)
+{
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	guint tmp_height;
+	guint tmp_width;
+	guint pixbuf_height;
+	guint pixbuf_width;
+	g_autoptr(GdkPixbuf) pixbuf_tmp = NULL;
+
+	/* never set */
+	if (original == NULL)
+		return NULL;
+
+	/* 0 means 'default' */
+	if (width == 0)
+		width = (guint) gdk_pixbuf_get_width (original);
+	if (height == 0)
+		height = (guint) gdk_pixbuf_get_height (original);
+
+	/* don't do anything to an image with the correct size */
+	pixbuf_width = (guint) gdk_pixbuf_get_width (original);
+	pixbuf_height = (guint) gdk_pixbuf_get_height (original);
+	if (width == pixbuf_width && height == pixbuf_height)
+		return g_object_ref (original);
+
+	/* is the aspect ratio of the source perfectly 16:9 */
+	if ((pixbuf_width / 16) * 9 == pixbuf_height) {
+		pixbuf = gdk_pixbuf_scale_simple (original,
+						  (gint) width, (gint) height,
+						  GDK_INTERP_HYPER);
+		if (blurred)
+			gs_utils_pixbuf_blur (pixbuf, 5, 3);
+		return g_steal_pointer (&pixbuf);
+	}
+
+	/* create new 16:9 pixbuf with alpha padding */
+	pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB,
+				 TRUE, 8,
+				 (gint) width,
+				 (gint) height);
+	gdk_pixbuf_fill (pixbuf, 0x00000000);
+	/* check the ratio to see which property needs to be fitted and which needs
+	 * to be reduced */
+	if (pixbuf_width * 9 > pixbuf_height * 16) {
+		tmp_width = width;
+		tmp_height = width * pixbuf_height / pixbuf_width;
+	} else {
+		tmp_width = height * pixbuf_width / pixbuf_height;
+		tmp_height = height;
+	}
+	pixbuf_tmp = gdk_pixbuf_scale_simple (original,
+					      (gint) tmp_width,
+					      (gint) tmp_height,
+					      GDK_INTERP_HYPER);
+	if (blurred)
+		gs_utils_pixbuf_blur (pixbuf_tmp, 5, 3);
+	gdk_pixbuf_copy_area (pixbuf_tmp,
+			      0, 0, /* of src */
+			      (gint) tmp_width,
+			      (gint) tmp_height,
+			      pixbuf,
+			      (gint) (width - tmp_width) / 2,
+			      (gint) (height - tmp_height) / 2);
+	return g_steal_pointer (&pixbuf);
+}
+
+/* Saves atomically, as other widgets may be loading the same file from
+ * another thread at the same time. */
+static gboolean
+gs_pixbuf_save_filename (GdkPixbuf *pixbuf,
+			 const gchar *filename,
+			 guint width,
+			 guint height,
+			 GError **error)
+{
+	g_autoptr(GdkPixbuf) pb = NULL;
+	g_autofree gchar *buffer = NULL;
+	gsize buffer_size = 0;
+
+	/* resample & save pixbuf */
+	pb = gs_pixbuf_resample (pixbuf, width, height, FALSE);
+	if (!gdk_pixbuf_save_to_buffer (pb, &buffer, &buffer_size, "png", error, NULL))
+		return FALSE;
+	return g_file_set_contents (filename, buffer, (gssize) buffer_size, error);
+}
+
+static void
+gs_screenshot_loader_get_property (GObject *object,
+				   guint prop_id,
+				   GValue *value,
+				   GParamSpec *pspec)
+{
+	GsScreenshotLoader *self = GS_SCREENSHOT_LOADER (object);
+
+	switch ((GsScreenshotLoaderProperty) prop_id) {
+	case PROP_MAX_SIZE:
+		g_value_set_uint (value, gs_screenshot_loader_get_max_size (self));
+		break;
+	case PROP_SIZE:
+		g_value_set_uint64 (value, gs_screenshot_loader_get_size (self));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+gs_screenshot_loader_set_property (GObject *object,
+				   guint prop_id,
+				   const GValue *value,
+				   GParamSpec *pspec)
+{
+	GsScreenshotLoader *self = GS_SCREENSHOT_LOADER (object);
+
+	switch ((GsScreenshotLoaderProperty) prop_id) {
+	case PROP_MAX_SIZE:
+		gs_screenshot_loader_set_max_size (self, g_value_get_uint (value));
+		break;
+	case PROP_SIZE:
+		/* Read only. */
+		g_assert_not_reached ();
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+gs_screenshot_loader_finalize (GObject *object)
+{
+	GsScreenshotLoader *self = GS_SCREENSHOT_LOADER (object);
+
+	/* gs_screenshot_loader_shutdown_async() should have been called */
+	g_clear_object (&self->worker);
+	g_clear_object (&self->settings);
+	/* the LRU links are embedded in the entries, so this frees them too */
+	g_clear_pointer (&self->cache, g_hash_table_unref);
+	g_clear_pointer (&self->file_generations, g_hash_table_unref);
+	g_mutex_clear (&self->mutex);
+
+	G_OBJECT_CLASS (gs_screenshot_loader_parent_class)->finalize (object);
+}
+
+static void
+gs_screenshot_loader_class_init (GsScreenshotLoaderClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = gs_screenshot_loader_finalize;
+	object_class->get_property = gs_screenshot_loader_get_property;
+	object_class->set_property = gs_screenshot_loader_set_property;
+
+	/**
+	 * GsScreenshotLoader:max-size:
+	 *
+	 * Maximum number of bytes of decoded images to keep in memory.
+	 *
+	 * Least recently used images are dropped from the cache once this
+	 * is exceeded. Set it to zero to disable the cache.
+	 *
+	 * This is bound to the `screenshot-memory-cache-size` GSettings key.
+	 *
+	 * Since: 46
+	 */
+	obj_props[PROP_MAX_SIZE] =
+		g_param_spec_uint ("max-size", NULL, NULL,
+				   0, G_MAXUINT, 128 * 1024 * 1024,
+				   G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * GsScreenshotLoader:size:
+	 *
+	 * Number of bytes of decoded images currently kept in memory.
+	 *
+	 * This is not notified when it changes.
+	 *
+	 * Since: 46
+	 */
+	obj_props[PROP_SIZE] =
+		g_param_spec_uint64 ("size", NULL, NULL,
+				     0, G_MAXUINT64, 0,
+				     G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+	g_object_class_install_properties (object_class, G_N_ELEMENTS (obj_props), obj_props);
+}
+
+static void
+gs_screenshot_loader_init (GsScreenshotLoader *self)
+{
+	g_mutex_init (&self->mutex);
+	self->cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+					     NULL, (GDestroyNotify) cache_entry_free);
+	g_queue_init (&self->cache_lru);
+	self->max_size = 128 * 1024 * 1024;
+	self->file_generations = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	self->worker = gs_worker_thread_new ("gs-screenshot-loader");
+
+	self->settings = g_settings_new ("org.gnome.software");
+	g_settings_bind (self->settings, "screenshot-memory-cache-size",
+			 self, "max-size",
+			 G_SETTINGS_BIND_GET);
+}
+
+/**
+ * gs_screenshot_loader_get_default:
+ *
+ * Get the process-wide screenshot loader, creating it if needed.
+ *
+ * Returns: (transfer none): the default #GsScreenshotLoader
+ * Since: 46
+ */
+GsScreenshotLoader *
+gs_screenshot_loader_get_default (void)
+{
+	static GsScreenshotLoader *loader = NULL;
+
+	if (g_once_init_enter (&loader)) {
+		GsScreenshotLoader *new_loader = g_object_new (GS_TYPE_SCREENSHOT_LOADER, NULL);
+		g_once_init_leave (&loader, new_loader);
+	}
+
+	return loader;
+}
+
+/**
+ * gs_screenshot_loader_get_max_size:
+ * @self: a #GsScreenshotLoader
+ *
+ * Get the value of #GsScreenshotLoader:max-size.
+ *
+ * Returns: maximum size of the in-memory cache, in bytes
+ * Since: 46
+ */
+guint
+gs_screenshot_loader_get_max_size (GsScreenshotLoader *self)
+{
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	g_return_val_if_fail (GS_IS_SCREENSHOT_LOADER (self), 0);
+
+	locker = g_mutex_locker_new (&self->mutex);
+	return self->max_size;
+}
+
+/**
+ * gs_screenshot_loader_set_max_size:
+ * @self: a #GsScreenshotLoader
+ * @max_size: maximum size of the in-memory cache, in bytes
+ *
+ * Set the value of #GsScreenshotLoader:max-size, dropping least recently
+ * used images from the cache if it is now too big.
+ *
+ * Since: 46
+ */
+void
+gs_screenshot_loader_set_max_size (GsScreenshotLoader *self,
+				   guint max_size)
+{
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	g_return_if_fail (GS_IS_SCREENSHOT_LOADER (self));
+
+	locker = g_mutex_locker_new (&self->mutex);
+	if (self->max_size == max_size)
+		return;
+	self->max_size = max_size;
+	cache_trim_locked (self);
+	g_clear_pointer (&locker, g_mutex_locker_free);
+
+	g_object_notify_by_pspec (G_OBJECT (self), obj_props[PROP_MAX_SIZE]);
+}
+
+/**
+ * gs_screenshot_loader_get_size:
+ * @self: a #GsScreenshotLoader
+ *
+ * Get the value of #GsScreenshotLoader:size.
+ *
+ * Returns: current size of the in-memory cache, in bytes
+ * Since: 46
+ */
+guint64
+gs_screenshot_loader_get_size (GsScreenshotLoader *self)
+{
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	g_return_val_if_fail (GS_IS_SCREENSHOT_LOADER (self), 0);
+
+	locker = g_mutex_locker_new (&self->mutex);
+	return self->cache_size;
+}
+
+/**
+ * gs_screenshot_loader_lookup:
+ * @self: a #GsScreenshotLoader
+ * @filename: path of the image file
+ * @width: width of the image to load, in device pixels, or 0 for the
+ *   natural size
+ * @height: height of the image to load, in device pixels, or 0 for the
+ *   natural size
+ * @flags: flags affecting how the image is loaded
+ *
+ * Look up an already decoded image in the in-memory cache, without
+ * touching the disk. This is cheap enough to call from the main thread
+ * before falling back to gs_screenshot_loader_load_async().
+ *
+ * Returns: (transfer full) (nullable): the cached texture, or %NULL if it’s
+ *   not in the cache
+ * Since: 46
+ */
+GdkTexture *
+gs_screenshot_loader_lookup (GsScreenshotLoader *self,
+			     const gchar *filename,
+			     guint width,
+			     guint height,
+			     GsScreenshotLoaderFlags flags)
+{
+	CacheEntry *entry;
+	g_autofree gchar *key = NULL;
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	g_return_val_if_fail (GS_IS_SCREENSHOT_LOADER (self), NULL);
+	g_return_val_if_fail (filename != NULL, NULL);
+
+	key = build_cache_key (filename, width, height, flags);
+	locker = g_mutex_locker_new (&self->mutex);
+	entry = g_hash_table_lookup (self->cache, key);
+	if (entry == NULL)
+		return NULL;
+
+	/* mark as most recently used */
+	g_queue_unlink (&self->cache_lru, &entry->link);
+	g_queue_push_head_link (&self->cache_lru, &entry->link);
+
+	return g_object_ref (entry->texture);
+}
+
+typedef struct {
+	gchar			*filename;  /* (owned) */
+	guint			 width;
+	guint			 height;
+	GsScreenshotLoaderFlags	 flags;
+} LoadData;
+
+static void
+load_data_free (LoadData *data)
+{
+	g_free (data->filename);
+	g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (LoadData, load_data_free)
+
+static void
+load_thread_cb (GTask *task,
+		gpointer source_object,
+		gpointer task_data,
+		GCancellable *cancellable)
+{
+	GsScreenshotLoader *self = GS_SCREENSHOT_LOADER (source_object);
+	LoadData *data = task_data;
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	g_autoptr(GdkTexture) texture = NULL;
+	g_autoptr(GMutexLocker) locker = NULL;
+	g_autoptr(GError) local_error = NULL;
+	guint generation;
+
+	if (g_task_return_error_if_cancelled (task))
+		return;
+
+	locker = g_mutex_locker_new (&self->mutex);
+	generation = file_generation_get_locked (self, data->filename);
+	g_clear_pointer (&locker, g_mutex_locker_free);
+
+	if (data->flags & GS_SCREENSHOT_LOADER_FLAGS_BLURRED) {
+		g_autoptr(GdkPixbuf) pb_src = NULL;
+
+		pb_src = gdk_pixbuf_new_from_file (data->filename, &local_error);
+		if (pb_src != NULL)
+			pixbuf = gs_pixbuf_resample (pb_src, data->width, data->height, TRUE);
+	} else if (data->width == 0 || data->height == 0) {
+		/* no need to composite */
+		pixbuf = gdk_pixbuf_new_from_file (data->filename, &local_error);
+	} else {
+		/* this is always going to have alpha */
+		pixbuf = gdk_pixbuf_new_from_file_at_scale (data->filename,
+							    (gint) data->width,
+							    (gint) data->height,
+							    FALSE, &local_error);
+	}
+
+	if (pixbuf == NULL) {
+		g_task_return_error (task, g_steal_pointer (&local_error));
+		return;
+	}
+
+	texture = gdk_texture_new_for_pixbuf (pixbuf);
+
+	/* don’t cache it if the file was saved again while decoding it */
+	locker = g_mutex_locker_new (&self->mutex);
+	if (file_generation_get_locked (self, data->filename) == generation)
+		cache_insert_locked (self, data->filename, data->width, data->height, data->flags, texture);
+	g_clear_pointer (&locker, g_mutex_locker_free);
+
+	g_task_return_pointer (task, g_steal_pointer (&texture), g_object_unref);
+}
+
+/**
+ * gs_screenshot_loader_load_async:
+ * @self: a #GsScreenshotLoader
+ * @filename: path of the image file
+ * @width: width to scale the image to, in device pixels, or 0 for the
+ *   natural size
+ * @height: height to scale the image to, in device pixels, or 0 for the
+ *   natural size
+ * @flags: flags affecting how the image is loaded
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback to call once the image is loaded
+ * @user_data: data to pass to @callback
+ *
+ * Decode and scale the image at @filename in a worker thread, and add it to
+ * the in-memory cache.
+ *
+ * Blurred placeholders are small and are loaded ahead of other images.
+ *
+ * Since: 46
+ */
+void
+gs_screenshot_loader_load_async (GsScreenshotLoader *self,
+				 const gchar *filename,
+				 guint width,
+				 guint height,
+				 GsScreenshotLoaderFlags flags,
+				 GCancellable *cancellable,
+				 GAsyncReadyCallback callback,
+				 gpointer user_data)
+{
+	g_autoptr(GTask) task = NULL;
+	g_autoptr(LoadData) data = NULL;
+	gint priority;
+
+	g_return_if_fail (GS_IS_SCREENSHOT_LOADER (self));
+	g_return_if_fail (filename != NULL);
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+	priority = (flags & GS_SCREENSHOT_LOADER_FLAGS_BLURRED) ? G_PRIORITY_HIGH : G_PRIORITY_DEFAULT;
+
+	task = g_task_new (self, cancellable, callback, user_data);
+	g_task_set_source_tag (task, gs_screenshot_loader_load_async);
+
+	data = g_new0 (LoadData, 1);
+	data->filename = g_strdup (filename);
+	data->width = width;
+	data->height = height;
+	data->flags = flags;
+	g_task_set_task_data (task, g_steal_pointer (&data), (GDestroyNotify) load_data_free);
+
+	/* decoding different files is independent, so let the helper
+	 * threads pick up some of the work */
+	gs_worker_thread_queue_full (self->worker, priority,
+				     GS_WORKER_THREAD_QUEUE_FLAGS_NONE,
+				     load_thread_cb, g_steal_pointer (&task));
+}
+
+/**
+ * gs_screenshot_loader_load_finish:
+ * @self: a #GsScreenshotLoader
+ * @result: result of the asynchronous operation
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish an asynchronous load operation started with
+ * gs_screenshot_loader_load_async().
+ *
+ * Returns: (transfer full): the decoded texture, or %NULL on error
+ * Since: 46
+ */
+GdkTexture *
+gs_screenshot_loader_load_finish (GsScreenshotLoader *self,
+				  GAsyncResult *result,
+				  GError **error)
+{
+	g_return_val_if_fail (GS_IS_SCREENSHOT_LOADER (self), NULL);
+	g_return_val_if_fail (g_task_is_valid (result, self), NULL);
+	g_return_val_if_fail (g_async_result_is_tagged (result, gs_screenshot_loader_load_async), NULL);
+	g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+typedef struct {
+	GBytes			*bytes;  /* (owned) */
+	gchar			*filename;  /* (owned) */
+	guint			 width;
+	guint			 height;
+	gchar			*counterpart_filename;  /* (owned) (nullable) */
+	guint			 counterpart_width;
+	guint			 counterpart_height;
+} SaveData;
+
+static void
+save_data_free (SaveData *data)
+{
+	g_bytes_unref (data->bytes);
+	g_free (data->filename);
+	g_free (data->counterpart_filename);
+	g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (SaveData, save_data_free)
+
+static void
+save_thread_cb (GTask *task,
+		gpointer source_object,
+		gpointer task_data,
+		GCancellable *cancellable)
+{
+	GsScreenshotLoader *self = GS_SCREENSHOT_LOADER (source_object);
+	SaveData *data = task_data;
+	g_autoptr(GInputStream) stream = NULL;
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	g_autoptr(GdkPixbuf) pixbuf_display = NULL;
+	g_autoptr(GdkTexture) texture = NULL;
+	g_autoptr(GMutexLocker) locker = NULL;
+	g_autoptr(GError) local_error = NULL;
+	guint pixbuf_width, pixbuf_height;
+
+	if (g_task_return_error_if_cancelled (task))
+		return;
+
+	/* load the image */
+	stream = g_memory_input_stream_new_from_bytes (data->bytes);
+	pixbuf = gdk_pixbuf_new_from_stream (stream, cancellable, &local_error);
+	if (pixbuf == NULL) {
+		if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_task_return_error (task, g_steal_pointer (&local_error));
+		else
+			g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+						 "Failed to load image: %s", local_error->message);
+		return;
+	}
+
+	pixbuf_width = (guint) gdk_pixbuf_get_width (pixbuf);
+	pixbuf_height = (guint) gdk_pixbuf_get_height (pixbuf);
+
+	/* is image size destination size unknown or exactly the correct size */
+	if (data->width == 0 || data->height == 0 ||
+	    (data->width == pixbuf_width && data->height == pixbuf_height)) {
+		if (!gs_pixbuf_save_filename (pixbuf, data->filename,
+					      pixbuf_width, pixbuf_height,
+					      &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+			return;
+		}
+		pixbuf_display = g_object_ref (pixbuf);
+	} else {
+		pixbuf_display = gs_pixbuf_resample (pixbuf, data->width, data->height, FALSE);
+		if (!gs_pixbuf_save_filename (pixbuf_display, data->filename,
+					      data->width, data->height,
+					      &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+			return;
+		}
+
+		if (data->counterpart_filename != NULL &&
+		    !gs_pixbuf_save_filename (pixbuf, data->counterpart_filename,
+					      data->counterpart_width,
+					      data->counterpart_height,
+					      &local_error)) {
+			/* if we cannot save this screenshot, warn about that but do not
+			 * set a user's visible error because this is a complementary
+			 * operation */
+			g_warning ("Failed to save screenshot '%s': %s",
+				   data->counterpart_filename, local_error->message);
+			g_clear_error (&local_error);
+		}
+	}
+
+	texture = gdk_texture_new_for_pixbuf (pixbuf_display);
+
+	/* anything decoded from the old files is now stale */
+	locker = g_mutex_locker_new (&self->mutex);
+	file_generation_bump_locked (self, data->filename);
+	file_generation_bump_locked (self, data->counterpart_filename);
+	cache_invalidate_filename_locked (self, data->filename);
+	cache_invalidate_filename_locked (self, data->counterpart_filename);
+	cache_insert_locked (self, data->filename, data->width, data->height,
+			     GS_SCREENSHOT_LOADER_FLAGS_NONE, texture);
+	g_clear_pointer (&locker, g_mutex_locker_free);
+
+	g_task_return_pointer (task, g_steal_pointer (&texture), g_object_unref);
+}
+
+/**
+ * gs_screenshot_loader_save_async:
+ * @self: a #GsScreenshotLoader
+ * @bytes: the downloaded image data
+ * @filename: path to save the image to
+ * @width: width to save the image at, in device pixels, or 0 to save it at
+ *   its natural size
+ * @height: height to save the image at, in device pixels, or 0 to save it at
+ *   its natural size
+ * @counterpart_filename: (nullable): path to also save a differently sized
+ *   copy of the image to, or %NULL to not do that
+ * @counterpart_width: width of the counterpart image, in device pixels
+ * @counterpart_height: height of the counterpart image, in device pixels
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback to call once the image is saved
+ * @user_data: data to pass to @callback
+ *
+ * Decode a downloaded image, resample it and save it to @filename (and
+ * @counterpart_filename), all in a worker thread. The decoded image is added
+ * to the in-memory cache, replacing any stale copies.
+ *
+ * If @bytes can’t be decoded, %G_IO_ERROR_INVALID_DATA is returned. Failing
+ * to save the counterpart image is not an error.
+ *
+ * Saves are serialised with respect to each other, so that two widgets
+ * showing the same screenshot don’t write the same file at the same time.
+ *
+ * Since: 46
+ */
+void
+gs_screenshot_loader_save_async (GsScreenshotLoader *self,
+				 GBytes *bytes,
+				 const gchar *filename,
+				 guint width,
+				 guint height,
+				 const gchar *counterpart_filename,
+				 guint counterpart_width,
+				 guint counterpart_height,
+				 GCancellable *cancellable,
+				 GAsyncReadyCallback callback,
+				 gpointer user_data)
+{
+	g_autoptr(GTask) task = NULL;
+	g_autoptr(SaveData) data = NULL;
+
+	g_return_if_fail (GS_IS_SCREENSHOT_LOADER (self));
+	g_return_if_fail (bytes != NULL);
+	g_return_if_fail (filename != NULL);
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+	task = g_task_new (self, cancellable, callback, user_data);
+	g_task_set_source_tag (task, gs_screenshot_loader_save_async);
+
+	data = g_new0 (SaveData, 1);
+	data->bytes = g_bytes_ref (bytes);
+	data->filename = g_strdup (filename);
+	data->width = width;
+	data->height = height;
+	data->counterpart_filename = g_strdup (counterpart_filename);
+	data->counterpart_width = counterpart_width;
+	data->counterpart_height = counterpart_height;
+	g_task_set_task_data (task, g_steal_pointer (&data), (GDestroyNotify) save_data_free);
+
+	gs_worker_thread_queue_full (self->worker, G_PRIORITY_DEFAULT,
+				     GS_WORKER_THREAD_QUEUE_FLAGS_MUST_SERIALISE,
+				     save_thread_cb, g_steal_pointer (&task));
+}
+
+/**
+ * gs_screenshot_loader_save_finish:
+ * @self: a #GsScreenshotLoader
+ * @result: result of the asynchronous operation
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish an asynchronous save operation started with
+ * gs_screenshot_loader_save_async().
+ *
+ * Returns: (transfer full): the decoded texture at the requested size, or
+ *   %NULL on error
+ * Since: 46
+ */
+GdkTexture *
+gs_screenshot_loader_save_finish (GsScreenshotLoader *self,
+				  GAsyncResult *result,
+				  GError **error)
+{
+	g_return_val_if_fail (GS_IS_SCREENSHOT_LOADER (self), NULL);
+	g_return_val_if_fail (g_task_is_valid (result, self), NULL);
+	g_return_val_if_fail (g_async_result_is_tagged (result, gs_screenshot_loader_save_async), NULL);
+	g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void shutdown_cb (GObject      *source_object,
+                         GAsyncResult *result,
+                         gpointer      user_data);
+
+/**
+ * gs_screenshot_loader_shutdown_async:
+ * @self: a #GsScreenshotLoader
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback for once the asynchronous operation is complete
+ * @user_data: data to pass to @callback
+ *
+ * Shut down the internal worker thread that @self uses to decode images,
+ * once the loads and saves already queued have finished.
+ *
+ * This must be called before the last reference to @self is dropped. The
+ * default loader lives until the process exits, so it doesn’t need shutting
+ * down.
+ *
+ * This is a no-op if called subsequently.
+ *
+ * Since: 46
+ */
+void
+gs_screenshot_loader_shutdown_async (GsScreenshotLoader  *self,
+				     GCancellable        *cancellable,
+				     GAsyncReadyCallback  callback,
+				     gpointer             user_data)
+{
+	g_autoptr(GTask) task = NULL;
+
+	g_return_if_fail (GS_IS_SCREENSHOT_LOADER (self));
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+	task = g_task_new (self, cancellable, callback, user_data);
+	g_task_set_source_tag (task, gs_screenshot_loader_shutdown_async);
+
+	gs_worker_thread_shutdown_async (self->worker, cancellable, shutdown_cb, g_steal_pointer (&task));
+}
+
+static void
+shutdown_cb (GObject      *source_object,
+             GAsyncResult *result,
+             gpointer      user_data)
+{
+	g_autoptr(GTask) task = G_TASK (user_data);
+	GsScreenshotLoader *self = g_task_get_source_object (task);
+	g_autoptr(GError) local_error = NULL;
+
+	if (!gs_worker_thread_shutdown_finish (self->worker, result, &local_error))
+		g_task_return_error (task, g_steal_pointer (&local_error));
+	else
+		g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * gs_screenshot_loader_shutdown_finish:
+ * @self: a #GsScreenshotLoader
+ * @result: result of the asynchronous operation
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish an asynchronous shutdown operation started with
+ * gs_screenshot_loader_shutdown_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 46
+ */
+gboolean
+gs_screenshot_loader_shutdown_finish (GsScreenshotLoader  *self,
+				      GAsyncResult        *result,
+				      GError             **error)
+{
+	g_return_val_if_fail (GS_IS_SCREENSHOT_LOADER (self), FALSE);
+	g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+	g_return_val_if_fail (g_async_result_is_tagged (result, gs_screenshot_loader_shutdown_async), FALSE);
+	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
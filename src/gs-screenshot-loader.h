@@ -0,0 +1,78 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2013-2016 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2014-2018 Kalev Lember <klember@redhat.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+#define GS_TYPE_SCREENSHOT_LOADER (gs_screenshot_loader_get_type ())
+
+G_DECLARE_FINAL_TYPE (GsScreenshotLoader, gs_screenshot_loader, GS, SCREENSHOT_LOADER, GObject)
+
+/**
+ * GsScreenshotLoaderFlags:
+ * @GS_SCREENSHOT_LOADER_FLAGS_NONE: No flags set.
+ * @GS_SCREENSHOT_LOADER_FLAGS_BLURRED: Scale the image up to the requested
+ *   size and blur it, for use as a placeholder while the full image loads.
+ *
+ * Flags for loading a screenshot with gs_screenshot_loader_load_async().
+ */
+typedef enum {
+	GS_SCREENSHOT_LOADER_FLAGS_NONE = 0,
+	GS_SCREENSHOT_LOADER_FLAGS_BLURRED = 1 << 0,
+} GsScreenshotLoaderFlags;
+
+GsScreenshotLoader	*gs_screenshot_loader_get_default	(void);
+
+guint			 gs_screenshot_loader_get_max_size	(GsScreenshotLoader	*self);
+void			 gs_screenshot_loader_set_max_size	(GsScreenshotLoader	*self,
+								 guint			 max_size);
+guint64			 gs_screenshot_loader_get_size		(GsScreenshotLoader	*self);
+
+GdkTexture		*gs_screenshot_loader_lookup		(GsScreenshotLoader	*self,
+								 const gchar		*filename,
+								 guint			 width,
+								 guint			 height,
+								 GsScreenshotLoaderFlags flags);
+void			 gs_screenshot_loader_load_async	(GsScreenshotLoader	*self,
+								 const gchar		*filename,
+								 guint			 width,
+								 guint			 height,
+								 GsScreenshotLoaderFlags flags,
+								 GCancellable		*cancellable,
+								 GAsyncReadyCallback	 callback,
+								 gpointer		 user_data);
+GdkTexture		*gs_screenshot_loader_load_finish	(GsScreenshotLoader	*self,
+								 GAsyncResult		*result,
+								 GError			**error);
+void			 gs_screenshot_loader_save_async	(GsScreenshotLoader	*self,
+								 GBytes			*bytes,
+								 const gchar		*filename,
+								 guint			 width,
+								 guint			 height,
+								 const gchar		*counterpart_filename,
+								 guint			 counterpart_width,
+								 guint			 counterpart_height,
+								 GCancellable		*cancellable,
+								 GAsyncReadyCallback	 callback,
+								 gpointer		 user_data);
+GdkTexture		*gs_screenshot_loader_save_finish	(GsScreenshotLoader	*self,
+								 GAsyncResult		*result,
+								 GError			**error);
+void			 gs_screenshot_loader_shutdown_async	(GsScreenshotLoader	*self,
+								 GCancellable		*cancellable,
+								 GAsyncReadyCallback	 callback,
+								 gpointer		 user_data);
+gboolean		 gs_screenshot_loader_shutdown_finish	(GsScreenshotLoader	*self,
+								 GAsyncResult		*result,
+								 GError			**error);
+
+G_END_DECLS
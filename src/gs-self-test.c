@@ -11,6 +11,7 @@
 #include "gnome-software-private.h"
 
 #include "gs-css.h"
+#include "gs-screenshot-loader.h"
 #include "gs-test.h"
 
 static void
@@ -40,6 +41,220 @@ gs_css_func (void)
 	g_assert_cmpstr (tmp, ==, "color: white;");
 }
 
+static void
+async_result_cb (GObject      *source_object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+	GAsyncResult **result_out = user_data;
+
+	g_assert (*result_out == NULL);
+	*result_out = g_object_ref (result);
+	g_main_context_wakeup (NULL);
+}
+
+/* writes a square PNG, which takes @size × @size × 4 bytes once decoded */
+static gchar *
+write_test_image (const gchar *dir,
+                  const gchar *basename,
+                  gint         size)
+{
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	g_autoptr(GError) error = NULL;
+	gchar *filename = g_build_filename (dir, basename, NULL);
+
+	pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, size, size);
+	gdk_pixbuf_fill (pixbuf, 0xff0000ff);
+	gdk_pixbuf_save (pixbuf, filename, "png", &error, NULL);
+	g_assert_no_error (error);
+
+	return filename;
+}
+
+static GdkTexture *
+load_screenshot (GsScreenshotLoader       *loader,
+                 const gchar              *filename,
+                 guint                     width,
+                 guint                     height,
+                 GsScreenshotLoaderFlags   flags,
+                 GCancellable             *cancellable,
+                 GError                  **error)
+{
+	g_autoptr(GAsyncResult) result = NULL;
+
+	gs_screenshot_loader_load_async (loader, filename, width, height, flags,
+					 cancellable, async_result_cb, &result);
+	while (result == NULL)
+		g_main_context_iteration (NULL, TRUE);
+
+	return gs_screenshot_loader_load_finish (loader, result, error);
+}
+
+/* The worker thread has to be shut down before the loader is freed. */
+static void
+shutdown_loader (GsScreenshotLoader *loader)
+{
+	g_autoptr(GAsyncResult) result = NULL;
+	g_autoptr(GError) error = NULL;
+
+	gs_screenshot_loader_shutdown_async (loader, NULL, async_result_cb, &result);
+	while (result == NULL)
+		g_main_context_iteration (NULL, TRUE);
+
+	gs_screenshot_loader_shutdown_finish (loader, result, &error);
+	g_assert_no_error (error);
+}
+
+static void
+gs_screenshot_loader_cache_func (void)
+{
+	g_autoptr(GsScreenshotLoader) loader = g_object_new (GS_TYPE_SCREENSHOT_LOADER, NULL);
+	g_autoptr(GdkTexture) texture = NULL;
+	g_autofree gchar *tmp_dir = NULL;
+	g_autofree gchar *filename1 = NULL;
+	g_autofree gchar *filename2 = NULL;
+	g_autofree gchar *filename3 = NULL;
+	g_autofree gchar *filename_big = NULL;
+	g_autoptr(GError) error = NULL;
+
+	tmp_dir = g_dir_make_tmp ("gs-self-test-screenshot-loader-XXXXXX", &error);
+	g_assert_no_error (error);
+	filename1 = write_test_image (tmp_dir, "1.png", 10);
+	filename2 = write_test_image (tmp_dir, "2.png", 10);
+	filename3 = write_test_image (tmp_dir, "3.png", 10);
+	filename_big = write_test_image (tmp_dir, "big.png", 20);
+
+	/* two 400 byte images fit */
+	gs_screenshot_loader_set_max_size (loader, 1000);
+	texture = load_screenshot (loader, filename1, 0, 0, GS_SCREENSHOT_LOADER_FLAGS_NONE, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_nonnull (texture);
+	g_clear_object (&texture);
+	texture = load_screenshot (loader, filename2, 0, 0, GS_SCREENSHOT_LOADER_FLAGS_NONE, NULL, &error);
+	g_assert_no_error (error);
+	g_clear_object (&texture);
+	g_assert_cmpuint (gs_screenshot_loader_get_size (loader), ==, 800);
+
+	/* using the first image makes the second the least recently used */
+	texture = gs_screenshot_loader_lookup (loader, filename1, 0, 0, GS_SCREENSHOT_LOADER_FLAGS_NONE);
+	g_assert_nonnull (texture);
+	g_clear_object (&texture);
+	texture = load_screenshot (loader, filename3, 0, 0, GS_SCREENSHOT_LOADER_FLAGS_NONE, NULL, &error);
+	g_assert_no_error (error);
+	g_clear_object (&texture);
+	g_assert_cmpuint (gs_screenshot_loader_get_size (loader), ==, 800);
+	g_assert_null (gs_screenshot_loader_lookup (loader, filename2, 0, 0, GS_SCREENSHOT_LOADER_FLAGS_NONE));
+
+	/* an image bigger than the whole budget doesn’t push the others out */
+	texture = load_screenshot (loader, filename_big, 0, 0, GS_SCREENSHOT_LOADER_FLAGS_NONE, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_nonnull (texture);
+	g_clear_object (&texture);
+	g_assert_null (gs_screenshot_loader_lookup (loader, filename_big, 0, 0, GS_SCREENSHOT_LOADER_FLAGS_NONE));
+	g_assert_cmpuint (gs_screenshot_loader_get_size (loader), ==, 800);
+
+	/* shrinking the budget drops the least recently used image */
+	texture = gs_screenshot_loader_lookup (loader, filename3, 0, 0, GS_SCREENSHOT_LOADER_FLAGS_NONE);
+	g_assert_nonnull (texture);
+	g_clear_object (&texture);
+	gs_screenshot_loader_set_max_size (loader, 500);
+	g_assert_cmpuint (gs_screenshot_loader_get_size (loader), ==, 400);
+	g_assert_null (gs_screenshot_loader_lookup (loader, filename1, 0, 0, GS_SCREENSHOT_LOADER_FLAGS_NONE));
+	texture = gs_screenshot_loader_lookup (loader, filename3, 0, 0, GS_SCREENSHOT_LOADER_FLAGS_NONE);
+	g_assert_nonnull (texture);
+
+	shutdown_loader (loader);
+	gs_utils_rmtree (tmp_dir, NULL);
+}
+
+static void
+gs_screenshot_loader_invalidate_func (void)
+{
+	g_autoptr(GsScreenshotLoader) loader = g_object_new (GS_TYPE_SCREENSHOT_LOADER, NULL);
+	g_autoptr(GdkTexture) texture = NULL;
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GAsyncResult) result = NULL;
+	g_autofree gchar *tmp_dir = NULL;
+	g_autofree gchar *filename = NULL;
+	g_autofree gchar *buffer = NULL;
+	gsize buffer_len = 0;
+	g_autoptr(GError) error = NULL;
+
+	tmp_dir = g_dir_make_tmp ("gs-self-test-screenshot-loader-XXXXXX", &error);
+	g_assert_no_error (error);
+	filename = write_test_image (tmp_dir, "screenshot.png", 10);
+
+	/* cache the image and a blurred placeholder made from it */
+	texture = load_screenshot (loader, filename, 0, 0, GS_SCREENSHOT_LOADER_FLAGS_NONE, NULL, &error);
+	g_assert_no_error (error);
+	g_clear_object (&texture);
+	texture = load_screenshot (loader, filename, 32, 18, GS_SCREENSHOT_LOADER_FLAGS_BLURRED, NULL, &error);
+	g_assert_no_error (error);
+	g_clear_object (&texture);
+	texture = gs_screenshot_loader_lookup (loader, filename, 32, 18, GS_SCREENSHOT_LOADER_FLAGS_BLURRED);
+	g_assert_nonnull (texture);
+	g_clear_object (&texture);
+
+	/* saving a new download of the file drops everything decoded from
+	 * the old one */
+	pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, 20, 20);
+	gdk_pixbuf_fill (pixbuf, 0x00ff00ff);
+	gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &buffer_len, "png", &error, NULL);
+	g_assert_no_error (error);
+	bytes = g_bytes_new_take (g_steal_pointer (&buffer), buffer_len);
+
+	gs_screenshot_loader_save_async (loader, bytes, filename, 0, 0, NULL, 0, 0,
+					 NULL, async_result_cb, &result);
+	while (result == NULL)
+		g_main_context_iteration (NULL, TRUE);
+	texture = gs_screenshot_loader_save_finish (loader, result, &error);
+	g_assert_no_error (error);
+	g_assert_cmpint (gdk_texture_get_width (texture), ==, 20);
+	g_clear_object (&texture);
+
+	g_assert_null (gs_screenshot_loader_lookup (loader, filename, 32, 18, GS_SCREENSHOT_LOADER_FLAGS_BLURRED));
+	texture = gs_screenshot_loader_lookup (loader, filename, 0, 0, GS_SCREENSHOT_LOADER_FLAGS_NONE);
+	g_assert_nonnull (texture);
+	g_assert_cmpint (gdk_texture_get_width (texture), ==, 20);
+	g_clear_object (&texture);
+
+	/* and loading it again reads the new file */
+	texture = load_screenshot (loader, filename, 32, 18, GS_SCREENSHOT_LOADER_FLAGS_BLURRED, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_nonnull (texture);
+	g_assert_cmpuint (gs_screenshot_loader_get_size (loader), ==, 20 * 20 * 4 + 32 * 18 * 4);
+
+	shutdown_loader (loader);
+	gs_utils_rmtree (tmp_dir, NULL);
+}
+
+static void
+gs_screenshot_loader_cancel_func (void)
+{
+	g_autoptr(GsScreenshotLoader) loader = g_object_new (GS_TYPE_SCREENSHOT_LOADER, NULL);
+	g_autoptr(GdkTexture) texture = NULL;
+	g_autoptr(GCancellable) cancellable = g_cancellable_new ();
+	g_autofree gchar *tmp_dir = NULL;
+	g_autofree gchar *filename = NULL;
+	g_autoptr(GError) error = NULL;
+
+	tmp_dir = g_dir_make_tmp ("gs-self-test-screenshot-loader-XXXXXX", &error);
+	g_assert_no_error (error);
+	filename = write_test_image (tmp_dir, "screenshot.png", 10);
+
+	/* a cancelled load fails, and caches nothing */
+	g_cancellable_cancel (cancellable);
+	texture = load_screenshot (loader, filename, 0, 0, GS_SCREENSHOT_LOADER_FLAGS_NONE, cancellable, &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+	g_assert_null (texture);
+	g_assert_null (gs_screenshot_loader_lookup (loader, filename, 0, 0, GS_SCREENSHOT_LOADER_FLAGS_NONE));
+	g_assert_cmpuint (gs_screenshot_loader_get_size (loader), ==, 0);
+
+	shutdown_loader (loader);
+	gs_utils_rmtree (tmp_dir, NULL);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -47,6 +262,9 @@ main (int argc, char **argv)
 
 	/* tests go here */
 	g_test_add_func ("/gnome-software/src/css", gs_css_func);
+	g_test_add_func ("/gnome-software/src/screenshot-loader{cache}", gs_screenshot_loader_cache_func);
+	g_test_add_func ("/gnome-software/src/screenshot-loader{invalidate}", gs_screenshot_loader_invalidate_func);
+	g_test_add_func ("/gnome-software/src/screenshot-loader{cancel}", gs_screenshot_loader_cancel_func);
 
 	return g_test_run ();
 }
@@ -24,6 +24,8 @@
 typedef struct {
 	GsShellSearchProvider *provider;
 	GDBusMethodInvocation *invocation;
+	gchar **terms;
+	gboolean foss_only;
 } PendingSearch;
 
 struct _GsShellSearchProvider {
@@ -35,6 +37,12 @@ struct _GsShellSearchProvider {
 
 	GHashTable *metas_cache;
 	GsAppList *search_results;
+
+	/* the terms and settings @search_results were last returned for, so
+	 * subsearches can narrow them without querying the plugins again */
+	gchar **search_terms;  /* (owned) (nullable) */
+	gboolean search_foss_only;
+	gboolean search_results_truncated;
 };
 
 G_DEFINE_TYPE (GsShellSearchProvider, gs_shell_search_provider, G_TYPE_OBJECT)
@@ -43,6 +51,7 @@ static void
 pending_search_free (PendingSearch *search)
 {
 	g_object_unref (search->invocation);
+	g_strfreev (search->terms);
 	g_slice_free (PendingSearch, search);
 }
 
@@ -59,6 +68,32 @@ search_sort_by_kudo_cb (GsApp *app1, GsApp *app2, gpointer user_data)
 	return 0;
 }
 
+/* Sorts @list and returns it for @invocation, caching the apps in case they
+ * are needed in GetResultMetas or a later subsearch. */
+static void
+return_search_results (GsShellSearchProvider *self,
+		       GDBusMethodInvocation *invocation,
+		       GsAppList             *list)
+{
+	GVariantBuilder builder;
+
+	/* sort by kudos, as there is no ratings data by default */
+	gs_app_list_sort (list, search_sort_by_kudo_cb, NULL);
+
+	/* cache no longer valid */
+	gs_app_list_remove_all (self->search_results);
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("as"));
+	for (guint i = 0; i < gs_app_list_length (list); i++) {
+		GsApp *app = gs_app_list_index (list, i);
+		g_variant_builder_add (&builder, "s", gs_app_get_unique_id (app));
+
+		/* cache this in case we need the app in GetResultMetas */
+		gs_app_list_add (self->search_results, app);
+	}
+	g_dbus_method_invocation_return_value (invocation, g_variant_new ("(as)", &builder));
+}
+
 static void
 search_done_cb (GObject *source,
 		GAsyncResult *res,
@@ -66,33 +101,30 @@ search_done_cb (GObject *source,
 {
 	PendingSearch *search = user_data;
 	GsShellSearchProvider *self = search->provider;
-	guint i;
-	GVariantBuilder builder;
 	g_autoptr(GsAppList) list = NULL;
+	g_autoptr(GError) local_error = NULL;
 
-	/* cache no longer valid */
-	gs_app_list_remove_all (self->search_results);
-
-	list = gs_plugin_loader_job_process_finish (self->plugin_loader, res, NULL);
+	list = gs_plugin_loader_job_process_finish (self->plugin_loader, res, &local_error);
 	if (list == NULL) {
+		/* a cancelled search has been superseded by another one, which
+		 * owns the cached results now */
+		if (!g_error_matches (local_error, GS_PLUGIN_ERROR, GS_PLUGIN_ERROR_CANCELLED) &&
+		    !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_clear_pointer (&self->search_terms, g_strfreev);
 		g_dbus_method_invocation_return_value (search->invocation, g_variant_new ("(as)", NULL));
 		pending_search_free (search);
 		g_application_release (g_application_get_default ());
 		return;	
 	}
 
-	/* sort by kudos, as there is no ratings data by default */
-	gs_app_list_sort (list, search_sort_by_kudo_cb, NULL);
+	/* if the list was cut short, later subsearches cannot be answered
+	 * from it as they might match apps which were dropped */
+	g_strfreev (self->search_terms);
+	self->search_terms = g_steal_pointer (&search->terms);
+	self->search_foss_only = search->foss_only;
+	self->search_results_truncated = (gs_app_list_length (list) >= GS_SHELL_SEARCH_PROVIDER_MAX_RESULTS);
 
-	g_variant_builder_init (&builder, G_VARIANT_TYPE ("as"));
-	for (i = 0; i < gs_app_list_length (list); i++) {
-		GsApp *app = gs_app_list_index (list, i);
-		g_variant_builder_add (&builder, "s", gs_app_get_unique_id (app));
-
-		/* cache this in case we need the app in GetResultMetas */
-		gs_app_list_add (self->search_results, app);
-	}
-	g_dbus_method_invocation_return_value (search->invocation, g_variant_new ("(as)", &builder));
+	return_search_results (self, search->invocation, list);
 
 	pending_search_free (search);
 	g_application_release (g_application_get_default ());
@@ -151,6 +183,7 @@ execute_search (GsShellSearchProvider  *self,
 	g_autoptr(GsPluginJob) plugin_job = NULL;
 	g_autoptr(GsAppQuery) query = NULL;
 	g_autoptr(GSettings) settings = NULL;
+	gboolean foss_only;
 
 	g_cancellable_cancel (self->cancellable);
 	g_clear_object (&self->cancellable);
@@ -158,19 +191,23 @@ execute_search (GsShellSearchProvider  *self,
 	/* don't attempt searches for a single character */
 	if (g_strv_length (terms) == 1 &&
 	    g_utf8_strlen (terms[0], -1) == 1) {
+		g_clear_pointer (&self->search_terms, g_strfreev);
 		g_dbus_method_invocation_return_value (invocation, g_variant_new ("(as)", NULL));
 		return;
 	}
 
+	settings = g_settings_new ("org.gnome.software");
+	foss_only = g_settings_get_boolean (settings, "show-only-free-apps");
+
 	pending_search = g_slice_new (PendingSearch);
 	pending_search->provider = self;
 	pending_search->invocation = g_object_ref (invocation);
+	pending_search->terms = g_strdupv (terms);
+	pending_search->foss_only = foss_only;
 
 	g_application_hold (g_application_get_default ());
 	self->cancellable = g_cancellable_new ();
 
-	settings = g_settings_new ("org.gnome.software");
-
 	query = gs_app_query_new ("keywords", terms,
 				  "refine-flags", GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON |
 						  GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN_HOSTNAME,
@@ -179,7 +216,8 @@ execute_search (GsShellSearchProvider  *self,
 				  "max-results", GS_SHELL_SEARCH_PROVIDER_MAX_RESULTS,
 				  "sort-func", gs_shell_search_provider_sort_cb,
 				  "sort-user-data", self,
-				  "license-type", g_settings_get_boolean (settings, "show-only-free-apps") ? GS_APP_QUERY_LICENSE_FOSS : GS_APP_QUERY_LICENSE_ANY,
+				  "sort-refine-flags", GS_PLUGIN_REFINE_FLAGS_REQUIRE_ID,
+				  "license-type", foss_only ? GS_APP_QUERY_LICENSE_FOSS : GS_APP_QUERY_LICENSE_ANY,
 				  NULL);
 	plugin_job = gs_plugin_job_list_apps_new (query, GS_PLUGIN_LIST_APPS_FLAGS_NONE);
 
@@ -189,6 +227,136 @@ execute_search (GsShellSearchProvider  *self,
 					    pending_search);
 }
 
+/* Whether one of @tokens is a prefix of a token in @text */
+static gboolean
+text_matches_tokens (const gchar         *text,
+		     const gchar * const *tokens)
+{
+	g_auto(GStrv) text_tokens = NULL;
+	g_auto(GStrv) ascii_alternates = NULL;
+
+	if (text == NULL)
+		return FALSE;
+
+	text_tokens = g_str_tokenize_and_fold (text, NULL, &ascii_alternates);
+	for (guint i = 0; tokens[i] != NULL; i++) {
+		for (guint j = 0; text_tokens[j] != NULL; j++) {
+			if (g_str_has_prefix (text_tokens[j], tokens[i]))
+				return TRUE;
+		}
+		for (guint j = 0; ascii_alternates[j] != NULL; j++) {
+			if (g_str_has_prefix (ascii_alternates[j], tokens[i]))
+				return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/* Whether every one of @terms matches one of the properties of @app.
+ *
+ * This is only a conservative approximation of what the plugins do: they
+ * match stemmed terms against every translation and against data such as
+ * keywords and MIME types, none of which is available here. So a %TRUE
+ * result means the app is still a result for @terms, but a %FALSE result
+ * means nothing. */
+static gboolean
+app_matches_terms (GsApp               *app,
+		   const gchar * const *terms)
+{
+	GPtrArray *sources = gs_app_get_sources (app);
+
+	for (guint i = 0; terms[i] != NULL; i++) {
+		g_auto(GStrv) tokens = g_str_tokenize_and_fold (terms[i], NULL, NULL);
+		gboolean matched = FALSE;
+
+		if (text_matches_tokens (gs_app_get_name (app), (const gchar * const *) tokens) ||
+		    text_matches_tokens (gs_app_get_summary (app), (const gchar * const *) tokens) ||
+		    text_matches_tokens (gs_app_get_project_group (app), (const gchar * const *) tokens) ||
+		    text_matches_tokens (gs_app_get_developer_name (app), (const gchar * const *) tokens) ||
+		    text_matches_tokens (gs_app_get_id (app), (const gchar * const *) tokens))
+			matched = TRUE;
+		for (guint j = 0; !matched && j < sources->len; j++) {
+			if (text_matches_tokens (g_ptr_array_index (sources, j), (const gchar * const *) tokens))
+				matched = TRUE;
+		}
+
+		if (!matched)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Whether every result for @terms must also have been a result for
+ * @previous_terms: each previous term is a prefix of the term in the same
+ * position, and any new terms have been appended. */
+static gboolean
+terms_narrow_previous (const gchar * const *previous_terms,
+		       const gchar * const *terms)
+{
+	guint i;
+
+	for (i = 0; previous_terms[i] != NULL; i++) {
+		if (terms[i] == NULL)
+			return FALSE;
+		if (!g_str_has_prefix (terms[i], previous_terms[i]))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Try to answer a subsearch by filtering the cached results of the previous
+ * search, rather than querying all the plugins again. Returns %FALSE if that
+ * cannot be done exactly, in which case @invocation has not been returned. */
+static gboolean
+execute_subsearch (GsShellSearchProvider  *self,
+		   GDBusMethodInvocation  *invocation,
+		   gchar                 **previous_results,
+		   gchar                 **terms)
+{
+	g_autoptr(GsAppList) list = NULL;
+	g_autoptr(GSettings) settings = NULL;
+
+	if (self->search_terms == NULL ||
+	    self->search_results_truncated ||
+	    !terms_narrow_previous ((const gchar * const *) self->search_terms,
+				    (const gchar * const *) terms))
+		return FALSE;
+
+	settings = g_settings_new ("org.gnome.software");
+	if (g_settings_get_boolean (settings, "show-only-free-apps") != self->search_foss_only)
+		return FALSE;
+
+	/* the previous results can only be reused if they all still match;
+	 * an app which fails the local check might still match in the
+	 * plugins, so drop back to a full search rather than risk losing it */
+	list = gs_app_list_new ();
+	for (guint i = 0; previous_results[i] != NULL; i++) {
+		GsApp *app = gs_app_list_lookup (self->search_results, previous_results[i]);
+
+		if (app == NULL ||
+		    !app_matches_terms (app, (const gchar * const *) terms))
+			return FALSE;
+
+		gs_app_list_add (list, app);
+	}
+
+	g_debug ("reusing %u previous results", gs_app_list_length (list));
+
+	/* any in-flight search is now stale */
+	g_cancellable_cancel (self->cancellable);
+	g_clear_object (&self->cancellable);
+
+	g_strfreev (self->search_terms);
+	self->search_terms = g_strdupv (terms);
+
+	return_search_results (self, invocation, list);
+
+	return TRUE;
+}
+
 static gboolean
 handle_get_initial_result_set (GsShellSearchProvider2	*skeleton,
 			       GDBusMethodInvocation	 *invocation,
@@ -212,7 +380,8 @@ handle_get_subsearch_result_set (GsShellSearchProvider2	*skeleton,
 	GsShellSearchProvider *self = user_data;
 
 	g_debug ("****** GetSubSearchResultSet");
-	execute_search (self, invocation, terms);
+	if (!execute_subsearch (self, invocation, previous_results, terms))
+		execute_search (self, invocation, terms);
 	return TRUE;
 }
 
@@ -362,6 +531,7 @@ search_provider_dispose (GObject *obj)
 	}
 
 	g_clear_object (&self->search_results);
+	g_clear_pointer (&self->search_terms, g_strfreev);
 	g_clear_object (&self->plugin_loader);
 	g_clear_object (&self->skeleton);
 